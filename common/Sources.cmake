@@ -1,3 +1,7 @@
 set(SOURCES
     segment.cpp
+    direct_file.cpp
+    metrics.cpp
+    trace.cpp
+    encoder_control.cpp
 )
@@ -0,0 +1,136 @@
+#include "direct_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+using common::direct_file;
+
+namespace {
+
+// O_DIRECT wants buffer, offset and length aligned to the logical block
+// size of the device, 4k covers everything in use today
+const std::size_t alignment = 4096;
+const std::size_t block_size = 1024*1024;
+
+}
+
+direct_file::direct_file()
+    : fd_(-1)
+    , direct_(false)
+    , block_(NULL)
+    , block_fill_(0)
+    , written_(0) {
+
+}
+
+direct_file::~direct_file() {
+    if(fd_ >= 0) {
+        ::close(fd_);
+    }
+    std::free(block_);
+}
+
+bool direct_file::open(const std::string& path, std::size_t expected_size) {
+    if(NULL == block_) {
+        void* block = NULL;
+        if(0 != posix_memalign(&block, alignment, block_size)) {
+            errno = ENOMEM;
+            return false;
+        }
+        block_ = static_cast<std::uint8_t*>(block);
+    }
+
+    fd_ = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC|O_DIRECT, 0644);
+    direct_ = fd_ >= 0;
+    if(fd_ < 0 && errno == EINVAL) {
+        // tmpfs and some fuse filesystems reject O_DIRECT at open
+        fd_ = ::open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    }
+    if(fd_ < 0) {
+        return false;
+    }
+
+    // reserve the extent up front so that the file does not fragment
+    // while it grows, the size is fixed in close()
+    if(0 != expected_size) {
+        fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, expected_size);
+    }
+
+    block_fill_ = 0;
+    written_ = 0;
+    return true;
+}
+
+bool direct_file::write(const std::uint8_t* buf, std::size_t len) {
+    while(len != 0) {
+        std::size_t n = std::min(len, block_size - block_fill_);
+        std::memcpy(block_ + block_fill_, buf, n);
+        block_fill_ += n;
+        buf += n;
+        len -= n;
+        if(block_fill_ == block_size) {
+            if(!write_block(block_size)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool direct_file::close() {
+    bool ok = true;
+    if(block_fill_ != 0) {
+        std::size_t tail = block_fill_;
+        std::size_t len = direct_ ? (tail + alignment - 1) / alignment * alignment : tail;
+        std::memset(block_ + tail, 0, len - tail);
+        ok = write_block(len);
+        written_ -= len - tail; // padding
+    }
+    if(ok && 0 != ftruncate(fd_, written_)) {
+        ok = false;
+    }
+    int err = errno;
+    ::close(fd_);
+    fd_ = -1;
+    errno = err;
+    return ok;
+}
+
+std::size_t direct_file::written() const {
+    return written_;
+}
+
+bool direct_file::direct() const {
+    return direct_;
+}
+
+bool direct_file::write_block(std::size_t len) {
+    const std::uint8_t* buf = block_;
+    std::size_t left = len;
+    while(left != 0) {
+        ssize_t ret = ::write(fd_, buf, left);
+        if(ret < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno == EINVAL && direct_) {
+                // the device wants a larger alignment, continue buffered
+                direct_ = false;
+                fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) & ~O_DIRECT);
+                continue;
+            }
+            return false;
+        }
+        buf += ret;
+        left -= ret;
+    }
+    written_ += len;
+    block_fill_ = 0;
+    return true;
+}
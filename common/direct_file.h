@@ -0,0 +1,41 @@
+#ifndef DIRECT_FILE_H
+#define DIRECT_FILE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace common {
+
+// sequential writer which bypasses the page cache with O_DIRECT. data is
+// staged in an aligned block and written a block at a time, filesystems
+// that refuse O_DIRECT get plain buffered writes instead.
+class direct_file {
+public:
+    direct_file();
+    ~direct_file();
+private:
+    direct_file(const direct_file&) = delete;
+    void operator=(const direct_file&) = delete;
+public:
+    // creates @arg1 and reserves @arg2 bytes for it
+    bool open(const std::string& path, std::size_t expected_size);
+    bool write(const std::uint8_t* buf, std::size_t len);
+    // writes the staged tail and trims the file to what was written
+    bool close();
+public:
+    std::size_t written() const;
+    bool direct() const;
+private:
+    bool write_block(std::size_t len);
+private:
+    int fd_;
+    bool direct_;
+    std::uint8_t* block_;
+    std::size_t block_fill_;
+    std::size_t written_;
+};
+
+}
+
+#endif // DIRECT_FILE_H
@@ -0,0 +1,49 @@
+#include "encoder_control.h"
+
+using common::encoder_target;
+using common::encoder_control;
+
+namespace {
+
+std::uint64_t pack(const encoder_target& target) {
+    return static_cast<std::uint64_t>(target.bitrate_kbit)
+         | static_cast<std::uint64_t>(target.fps_divisor) << 32
+         | static_cast<std::uint64_t>(target.scale_divisor) << 40;
+}
+
+encoder_target unpack(std::uint64_t packed) {
+    encoder_target target;
+    target.bitrate_kbit = static_cast<std::uint32_t>(packed);
+    target.fps_divisor = static_cast<std::uint8_t>(packed >> 32);
+    target.scale_divisor = static_cast<std::uint8_t>(packed >> 40);
+    return target;
+}
+
+}
+
+bool encoder_target::operator==(const encoder_target& other) const {
+    return bitrate_kbit == other.bitrate_kbit &&
+           fps_divisor == other.fps_divisor &&
+           scale_divisor == other.scale_divisor;
+}
+
+bool encoder_target::operator!=(const encoder_target& other) const {
+    return !(*this == other);
+}
+
+encoder_control::encoder_control()
+    : packed_(pack(encoder_target())) {
+
+}
+
+encoder_control::~encoder_control() {
+
+}
+
+void encoder_control::set(const encoder_target& target) {
+    packed_.store(pack(target), std::memory_order_relaxed);
+}
+
+encoder_target encoder_control::get() const {
+    return unpack(packed_.load(std::memory_order_relaxed));
+}
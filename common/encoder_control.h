@@ -0,0 +1,44 @@
+#ifndef ENCODER_CONTROL_H
+#define ENCODER_CONTROL_H
+
+#include <atomic>
+#include <cstdint>
+
+namespace common {
+
+// what the encoder should produce from the next segment on
+class encoder_target {
+public:
+    encoder_target()
+        : bitrate_kbit(0)
+        , fps_divisor(1)
+        , scale_divisor(1) {
+    }
+    bool operator==(const encoder_target& other) const;
+    bool operator!=(const encoder_target& other) const;
+public:
+    std::uint32_t bitrate_kbit;     // 0 leaves the rate to the quantizer range
+    std::uint8_t fps_divisor;       // every n-th frame is encoded
+    std::uint8_t scale_divisor;     // width and height are divided by n
+};
+
+// hands a target from the network side to the encoder thread. the whole
+// target is kept in one word so that the encoder never sees half of an
+// update.
+class encoder_control {
+public:
+    encoder_control();
+    ~encoder_control();
+private:
+    encoder_control(const encoder_control&) = delete;
+    void operator=(const encoder_control&) = delete;
+public:
+    void set(const encoder_target& target);
+    encoder_target get() const;
+private:
+    std::atomic<std::uint64_t> packed_;
+};
+
+}
+
+#endif // ENCODER_CONTROL_H
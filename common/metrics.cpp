@@ -0,0 +1,206 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+using common::counter;
+using common::histogram;
+using common::metrics;
+
+namespace {
+
+// threads take slots round robin the first time they count
+std::size_t thread_slot(std::size_t slot_count) {
+    static std::atomic<std::size_t> next(0);
+    thread_local std::size_t slot = next.fetch_add(1, std::memory_order_relaxed);
+    return slot % slot_count;
+}
+
+void append_number(std::string* out, double value) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.9g", value);
+    out->append(buf);
+}
+
+void append_header(std::string* out, const std::string& name, const std::string& help, const char* type) {
+    out->append("# HELP " + name + " " + help + "\n");
+    out->append("# TYPE " + name + " " + type + "\n");
+}
+
+}
+
+counter::counter() {
+    for(std::size_t i = 0 ; i < slot_count ; i++) {
+        slots_[i].value.store(0, std::memory_order_relaxed);
+    }
+}
+
+counter::~counter() {
+
+}
+
+void counter::add(std::uint64_t n) {
+    slots_[thread_slot(slot_count)].value.fetch_add(n, std::memory_order_relaxed);
+}
+
+std::uint64_t counter::value() const {
+    std::uint64_t sum = 0;
+    for(std::size_t i = 0 ; i < slot_count ; i++) {
+        sum += slots_[i].value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+histogram::histogram()
+    : count_(0)
+    , sum_(0)
+    , top_(0) {
+
+    for(std::size_t i = 0 ; i < bucket_count ; i++) {
+        buckets_[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+histogram::~histogram() {
+
+}
+
+std::size_t histogram::bucket(std::uint64_t value) {
+    const std::uint64_t sub_count = 1 << sub_bits;
+    if(value < sub_count) {
+        return static_cast<std::size_t>(value);
+    }
+    const std::size_t exponent = 63 - __builtin_clzll(value);
+    const std::size_t mantissa = (value >> (exponent - sub_bits)) & (sub_count - 1);
+    return ((exponent - sub_bits + 1) << sub_bits) + mantissa;
+}
+
+std::uint64_t histogram::lower_bound(std::size_t bucket) {
+    const std::size_t sub_count = 1 << sub_bits;
+    if(bucket < sub_count) {
+        return bucket;
+    }
+    const std::size_t exponent = (bucket >> sub_bits) + sub_bits - 1;
+    const std::uint64_t mantissa = bucket & (sub_count - 1);
+    return (sub_count + mantissa) << (exponent - sub_bits);
+}
+
+void histogram::record(std::uint64_t value) {
+    const std::size_t b = bucket(value);
+    buckets_[b].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value, std::memory_order_relaxed);
+    std::size_t top = top_.load(std::memory_order_relaxed);
+    while(b > top && !top_.compare_exchange_weak(top, b, std::memory_order_relaxed));
+}
+
+void histogram::record_since(clock::time_point start) {
+    record(std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count());
+}
+
+std::uint64_t histogram::count(std::size_t bucket) const {
+    return buckets_[bucket].load(std::memory_order_relaxed);
+}
+
+std::uint64_t histogram::count() const {
+    return count_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t histogram::sum() const {
+    return sum_.load(std::memory_order_relaxed);
+}
+
+std::size_t histogram::top() const {
+    return top_.load(std::memory_order_relaxed);
+}
+
+metrics::metrics() {
+
+}
+
+metrics::~metrics() {
+    for(std::map<std::string, entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        delete it->second.c;
+        delete it->second.h;
+    }
+}
+
+counter* metrics::add_counter(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, entry>::iterator it = entries_.find(name);
+    if(it != entries_.end()) {
+        return it->second.c;
+    }
+    entry e = { counter_kind, help, new counter, nullptr, 1.0, nullptr, nullptr };
+    entries_[name] = e;
+    return e.c;
+}
+
+histogram* metrics::add_histogram(const std::string& name, const std::string& help, double scale) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::string, entry>::iterator it = entries_.find(name);
+    if(it != entries_.end()) {
+        return it->second.h;
+    }
+    entry e = { histogram_kind, help, nullptr, new histogram, scale, nullptr, nullptr };
+    entries_[name] = e;
+    return e.h;
+}
+
+void metrics::add_gauge(const std::string& name, const std::string& help, gauge_cb read, void* ctx) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entry e = { gauge_kind, help, nullptr, nullptr, 1.0, read, ctx };
+    entries_[name] = e;
+}
+
+void metrics::remove_gauges(void* ctx) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(std::map<std::string, entry>::iterator it = entries_.begin(); it != entries_.end();) {
+        if(it->second.type == gauge_kind && it->second.ctx == ctx) {
+            entries_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void metrics::write(std::string* out) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for(std::map<std::string, entry>::const_iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        const std::string& name = it->first;
+        const entry& e = it->second;
+        if(e.type == counter_kind) {
+            append_header(out, name, e.help, "counter");
+            out->append(name + " ");
+            append_number(out, static_cast<double>(e.c->value()));
+            out->append("\n");
+        } else if(e.type == gauge_kind) {
+            append_header(out, name, e.help, "gauge");
+            out->append(name + " ");
+            append_number(out, e.read(e.ctx));
+            out->append("\n");
+        } else {
+            // buckets are read one by one while others record, a scrape
+            // may be off by the samples that arrive meanwhile
+            append_header(out, name, e.help, "histogram");
+            const std::size_t top = e.h->top();
+            std::uint64_t cumulative = 0;
+            for(std::size_t b = 0 ; b <= top && b + 1 < histogram::bucket_count ; b++) {
+                cumulative += e.h->count(b);
+                out->append(name + "_bucket{le=\"");
+                append_number(out, static_cast<double>(histogram::lower_bound(b+1) - 1) * e.scale);
+                out->append("\"} ");
+                append_number(out, static_cast<double>(cumulative));
+                out->append("\n");
+            }
+            const std::uint64_t total = std::max(cumulative, e.h->count());
+            out->append(name + "_bucket{le=\"+Inf\"} ");
+            append_number(out, static_cast<double>(total));
+            out->append("\n" + name + "_sum ");
+            append_number(out, static_cast<double>(e.h->sum()) * e.scale);
+            out->append("\n" + name + "_count ");
+            append_number(out, static_cast<double>(total));
+            out->append("\n");
+        }
+    }
+}
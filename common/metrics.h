@@ -0,0 +1,119 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace common {
+
+// monotonic count. each thread adds to a slot of its own on its own
+// cache line, a scrape sums the slots. no lock on either side.
+class counter {
+public:
+    counter();
+    ~counter();
+private:
+    counter(const counter&) = delete;
+    void operator=(const counter&) = delete;
+public:
+    void add(std::uint64_t n = 1);
+    std::uint64_t value() const;
+private:
+    static const std::size_t slot_count = 8;
+    class slot {
+    public:
+        std::atomic<std::uint64_t> value;
+        char pad[64 - sizeof(std::atomic<std::uint64_t>)];
+    };
+    slot slots_[slot_count];
+};
+
+// log-linear buckets like HdrHistogram, four per power of two, so that
+// any quantile read from it is within a quarter of the true value.
+// recording is a few relaxed atomic adds.
+class histogram {
+public:
+    typedef std::chrono::steady_clock clock;
+public:
+    histogram();
+    ~histogram();
+private:
+    histogram(const histogram&) = delete;
+    void operator=(const histogram&) = delete;
+public:
+    void record(std::uint64_t value);
+    // microseconds from @arg1 until now
+    void record_since(clock::time_point start);
+public:
+    static const std::size_t sub_bits = 2;
+    static const std::size_t bucket_count = (64 - sub_bits + 1) << sub_bits;
+    static std::size_t bucket(std::uint64_t value);
+    // the smallest value that falls into bucket @arg1
+    static std::uint64_t lower_bound(std::size_t bucket);
+public:
+    std::uint64_t count(std::size_t bucket) const;
+    std::uint64_t count() const;
+    std::uint64_t sum() const;
+    // highest bucket ever recorded into
+    std::size_t top() const;
+private:
+    std::atomic<std::uint64_t> buckets_[bucket_count];
+    std::atomic<std::uint64_t> count_;
+    std::atomic<std::uint64_t> sum_;
+    std::atomic<std::size_t> top_;
+};
+
+// named counters, histograms and gauges of the whole pipeline, written
+// out in the Prometheus text format. registering and writing take a
+// lock, recording into what was registered does not.
+class metrics {
+public:
+    // read while the metrics are written out, on the writer's thread
+    typedef double (*gauge_cb)(void* ctx);
+public:
+    metrics();
+    ~metrics();
+private:
+    metrics(const metrics&) = delete;
+    void operator=(const metrics&) = delete;
+public:
+    // the same name gives back the same metric, it lives as long as the
+    // registry
+    counter* add_counter(const std::string& name, const std::string& help);
+    // values are written out multiplied by @arg3, e.g. 1e-6 for a
+    // histogram of microseconds in seconds
+    histogram* add_histogram(const std::string& name, const std::string& help, double scale = 1.0);
+    void add_gauge(const std::string& name, const std::string& help, gauge_cb read, void* ctx);
+    // before @arg1 goes away
+    void remove_gauges(void* ctx);
+public:
+    void write(std::string* out) const;
+private:
+    enum kind {
+        counter_kind,
+        histogram_kind,
+        gauge_kind
+    };
+    class entry {
+    public:
+        kind type;
+        std::string help;
+        counter* c;
+        histogram* h;
+        double scale;
+        gauge_cb read;
+        void* ctx;
+    };
+private:
+    mutable std::mutex mutex_;
+    std::map<std::string, entry> entries_;
+};
+
+}
+
+#endif // METRICS_H
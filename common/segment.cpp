@@ -3,7 +3,10 @@
 using common::segment;
 
 segment::segment() 
-    : last_segment_(false) {
+    : last_segment_(false)
+    , duration_ms_(0)
+    , start_ms_(0)
+    , refs_(1) {
 
 }
 
@@ -19,6 +22,22 @@ bool segment::last_segment() const {
     return last_segment_;
 }
 
+void segment::duration_ms(std::uint32_t val) {
+    duration_ms_ = val;
+}
+
+std::uint32_t segment::duration_ms() const {
+    return duration_ms_;
+}
+
+void segment::start_ms(std::int64_t val) {
+    start_ms_ = val;
+}
+
+std::int64_t segment::start_ms() const {
+    return start_ms_;
+}
+
 const std::uint8_t* segment::buffer() const {
     if(0 != buffer_.size()) {
         return &buffer_[0];
@@ -33,4 +52,14 @@ std::size_t segment::size() const {
 
 void segment::insert(const std::uint8_t* buf, std::size_t sz) {
     buffer_.insert(buffer_.end(), &buf[0], &buf[sz]);
+}
+
+void segment::ref() {
+    refs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void segment::unref() {
+    if(1 == refs_.fetch_sub(1, std::memory_order_acq_rel)) {
+        delete this;
+    }
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <cstddef>
 #include <vector>
+#include <atomic>
 
 namespace common {
 
@@ -17,11 +18,25 @@ public:
 public:
     void last_segment(bool);
     bool last_segment() const;
+    // wall clock from the first packet to the cut, 0 if not known
+    void duration_ms(std::uint32_t);
+    std::uint32_t duration_ms() const;
+    // wall clock of the first packet in ms since the epoch, 0 if not known
+    void start_ms(std::int64_t);
+    std::int64_t start_ms() const;
 public:
     void insert(const std::uint8_t* buf, std::size_t sz);
+public:
+    // a segment can be shared by the upload queue and live viewers. it
+    // starts with one reference, the last unref deletes it.
+    void ref();
+    void unref();
 private:
     std::vector<std::uint8_t> buffer_;
     bool last_segment_;
+    std::uint32_t duration_ms_;
+    std::int64_t start_ms_;
+    std::atomic<int> refs_;
 };
 
 }
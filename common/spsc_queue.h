@@ -0,0 +1,61 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+namespace common {
+
+// bounded ring between exactly one producer thread and one consumer
+// thread. neither side takes a lock, push fails while the ring is full.
+template<typename T>
+class spsc_queue {
+public:
+    explicit spsc_queue(std::size_t capacity)
+        : slots_(capacity+1)
+        , head_(0)
+        , tail_(0) {
+    }
+private:
+    spsc_queue(const spsc_queue&) = delete;
+    void operator=(const spsc_queue&) = delete;
+public:
+    // producer side
+    bool push(const T& value) {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        const std::size_t next = (tail + 1) % slots_.size();
+        if(next == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        slots_[tail] = value;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+    // consumer side
+    bool pop(T* value) {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if(head == tail_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *value = slots_[head];
+        head_.store((head + 1) % slots_.size(), std::memory_order_release);
+        return true;
+    }
+    std::size_t capacity() const {
+        return slots_.size() - 1;
+    }
+private:
+    std::vector<T> slots_;
+    // each index is written by one side only, keep them on separate
+    // cache lines. padded rather than aligned, new ignores alignas here.
+    char pad0_[64];
+    std::atomic<std::size_t> head_;
+    char pad1_[64 - sizeof(std::atomic<std::size_t>)];
+    std::atomic<std::size_t> tail_;
+    char pad2_[64 - sizeof(std::atomic<std::size_t>)];
+};
+
+}
+
+#endif // SPSC_QUEUE_H
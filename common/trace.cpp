@@ -0,0 +1,126 @@
+#include "trace.h"
+
+#include <cassert>
+#include <cstdio>
+
+using common::trace;
+
+namespace {
+
+// threads are numbered in the order they first record
+std::uint32_t thread_number() {
+    static std::atomic<std::uint32_t> next(1);
+    thread_local std::uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+    return number;
+}
+
+void append_event(std::string* out, bool first, char phase, const char* name,
+                  std::uint64_t ts, std::uint64_t dur, std::uint64_t id, std::uint32_t tid) {
+    char buf[256];
+    if(phase == 'X') {
+        std::snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u,\"args\":{\"id\":%llu}}",
+                      first ? "" : ",\n", name, static_cast<unsigned long long>(ts), static_cast<unsigned long long>(dur),
+                      tid, static_cast<unsigned long long>(id));
+    } else {
+        std::snprintf(buf, sizeof(buf), "%s{\"name\":\"%s\",\"cat\":\"segment\",\"ph\":\"%c\",\"ts\":%llu,\"pid\":1,\"tid\":%u,\"id\":\"%llu\"}",
+                      first ? "" : ",\n", name, phase, static_cast<unsigned long long>(ts),
+                      tid, static_cast<unsigned long long>(id));
+    }
+    out->append(buf);
+}
+
+}
+
+trace::trace(std::size_t capacity)
+    : ring_(capacity)
+    , head_(0) {
+
+    assert(0 != capacity);
+    for(std::size_t i = 0 ; i < ring_.size() ; i++) {
+        ring_[i].seq.store(0, std::memory_order_relaxed);
+    }
+}
+
+trace::~trace() {
+
+}
+
+std::uint64_t trace::micros(clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(t.time_since_epoch()).count();
+}
+
+std::uint64_t trace::now() {
+    return micros(clock::now());
+}
+
+void trace::complete(const char* name, std::uint64_t begin_us, std::uint64_t end_us, std::uint64_t id) {
+    add('X', name, begin_us, end_us > begin_us ? end_us - begin_us : 0, id);
+}
+
+void trace::begin(const char* name, std::uint64_t id, std::uint64_t ts_us) {
+    add('b', name, ts_us, 0, id);
+}
+
+void trace::end(const char* name, std::uint64_t id, std::uint64_t ts_us) {
+    add('e', name, ts_us, 0, id);
+}
+
+void trace::name_thread(const std::string& name) {
+    std::lock_guard<std::mutex> lock(names_mutex_);
+    thread_names_[thread_number()] = name;
+}
+
+void trace::add(char phase, const char* name, std::uint64_t ts, std::uint64_t dur, std::uint64_t id) {
+    const std::uint64_t n = head_.fetch_add(1, std::memory_order_relaxed);
+    record& r = ring_[n % ring_.size()];
+    // a seqlock per slot. a writer which is a whole ring behind could
+    // still mix its fields into a newer event, with rings this large
+    // that does not happen in practice.
+    r.seq.store(2*n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    r.name.store(name, std::memory_order_relaxed);
+    r.ts.store(ts, std::memory_order_relaxed);
+    r.dur.store(dur, std::memory_order_relaxed);
+    r.id.store(id, std::memory_order_relaxed);
+    r.tid.store(thread_number(), std::memory_order_relaxed);
+    r.phase.store(phase, std::memory_order_relaxed);
+    r.seq.store(2*n + 2, std::memory_order_release);
+}
+
+void trace::write(std::string* out) const {
+    out->append("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> lock(names_mutex_);
+        for(std::map<std::uint32_t, std::string>::const_iterator it = thread_names_.begin(); it != thread_names_.end(); ++it) {
+            char buf[64];
+            std::snprintf(buf, sizeof(buf), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", it->first);
+            out->append(first ? "" : ",\n");
+            out->append(buf);
+            out->append("\"" + it->second + "\"}}");
+            first = false;
+        }
+    }
+
+    const std::uint64_t head = head_.load(std::memory_order_acquire);
+    const std::uint64_t oldest = head > ring_.size() ? head - ring_.size() : 0;
+    for(std::uint64_t n = oldest ; n < head ; n++) {
+        const record& r = ring_[n % ring_.size()];
+        if(r.seq.load(std::memory_order_acquire) != 2*n + 2) {
+            continue; // still written, or already overwritten
+        }
+        const char* name = r.name.load(std::memory_order_relaxed);
+        const std::uint64_t ts = r.ts.load(std::memory_order_relaxed);
+        const std::uint64_t dur = r.dur.load(std::memory_order_relaxed);
+        const std::uint64_t id = r.id.load(std::memory_order_relaxed);
+        const std::uint32_t tid = r.tid.load(std::memory_order_relaxed);
+        const char phase = r.phase.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(r.seq.load(std::memory_order_relaxed) != 2*n + 2) {
+            continue;
+        }
+        append_event(out, first, phase, name, ts, dur, id, tid);
+        first = false;
+    }
+    out->append("\n]}\n");
+}
@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace common {
+
+// the last events of every stage in a ring, written out as Chrome trace
+// JSON which chrome://tracing and Perfetto open. frames show up as spans
+// on the thread that handled them, each segment as a row of its own
+// going through capture, hand-off, backlog and upload.
+//
+// any thread records without a lock or an allocation, the oldest events
+// are overwritten. names are string literals, they are kept as pointers.
+class trace {
+public:
+    typedef std::chrono::steady_clock clock;
+public:
+    explicit trace(std::size_t capacity = 65536);
+    ~trace();
+private:
+    trace(const trace&) = delete;
+    void operator=(const trace&) = delete;
+public:
+    static std::uint64_t micros(clock::time_point t);
+    static std::uint64_t now();
+public:
+    // a span on the calling thread, @arg4 is shown as its id
+    void complete(const char* name, std::uint64_t begin_us, std::uint64_t end_us, std::uint64_t id);
+    // a span of object @arg2, begin and end may come from other threads
+    void begin(const char* name, std::uint64_t id, std::uint64_t ts_us);
+    void end(const char* name, std::uint64_t id, std::uint64_t ts_us);
+    // shown instead of the thread's number
+    void name_thread(const std::string& name);
+public:
+    void write(std::string* out) const;
+private:
+    class record {
+    public:
+        // 2n+1 while event n is written, 2n+2 once it is complete
+        std::atomic<std::uint64_t> seq;
+        std::atomic<const char*> name;
+        std::atomic<std::uint64_t> ts;
+        std::atomic<std::uint64_t> dur;
+        std::atomic<std::uint64_t> id;
+        std::atomic<std::uint32_t> tid;
+        std::atomic<char> phase;
+    };
+    void add(char phase, const char* name, std::uint64_t ts, std::uint64_t dur, std::uint64_t id);
+private:
+    std::vector<record> ring_;
+    std::atomic<std::uint64_t> head_;
+    mutable std::mutex names_mutex_;
+    std::map<std::uint32_t, std::string> thread_names_;
+};
+
+}
+
+#endif // TRACE_H
@@ -36,8 +36,12 @@ log_include_counter _counter_;
 
 } }
 
-// TODO : make thread safe
-#define LOG(level) yavca::common::_logger_->begin_log(level, __FILE__, __PRETTY_FUNCTION__)
+// the level is checked before the time is taken or any argument of the
+// line is evaluated. a line of a level that is compiled out is dead code,
+// one that is switched off at runtime costs a load and a branch.
+#define LOG(level) \
+    !(yavca::common::logging::compiled<level>::value && yavca::common::logging::enabled(level)) \
+        ? (void)0 : yavca::common::_logger_->begin_log(level, __FILE__, __PRETTY_FUNCTION__)
 
 namespace common {
 typedef yavca::common::logging log;
@@ -1,15 +1,60 @@
 #include "logging.h"
 
-yavca::common::logging::logging()
-    : writer_(0) {
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
 
+using yavca::common::logging;
+
+namespace {
+
+// a batch handed to the writer at once
+const std::size_t max_batch = 64 * 1024;
+
+std::size_t round_up_pow2(std::size_t n) {
+    std::size_t p = 1;
+    while(p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+}
+
+logging::logging(std::size_t queue_length)
+    : writer_(0)
+    , ring_(round_up_pow2(queue_length))
+    , mask_(ring_.size() - 1)
+    , tail_(0)
+    , head_(0)
+    , dropped_(0)
+    , truncated_(0)
+    , reported_dropped_(0)
+    , thread_(0)
+    , idle_(false)
+    , stop_(false) {
+
+    for(std::size_t i = 0 ; i < ring_.size() ; i++) {
+        ring_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    batch_.reserve(max_batch + max_line + 1);
 }
 
-yavca::common::logging::~logging() {
+logging::~logging() {
+    if(0 != thread_) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cond_.notify_one();
+        thread_->join();
+        delete thread_;
+    }
     delete writer_;
 }
 
-const char* yavca::common::logging::str_levels[debug+1] = {
+const char* logging::str_levels[debug+1] = {
     "emerg",
     "alert",
     "crit",
@@ -20,4 +65,214 @@ const char* yavca::common::logging::str_levels[debug+1] = {
     "debug"
 };
 
-const yavca::common::logging::end_type yavca::common::logging::end;
+const logging::end_type logging::end;
+
+std::atomic<int> logging::max_level_(info);
+
+void logging::set_level(level l) {
+    max_level_.store(l, std::memory_order_relaxed);
+}
+
+bool logging::parse_level(const char* name, level* l) {
+    for(int i = emerg ; i <= debug ; i++) {
+        if(0 == std::strcmp(name, str_levels[i])) {
+            *l = static_cast<level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void logging::init(writer* w) {
+    assert(0 == writer_);
+    writer_ = w;
+    thread_ = new std::thread(&logging::run, this);
+}
+
+std::uint64_t logging::dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+}
+
+std::uint64_t logging::truncated() const {
+    return truncated_.load(std::memory_order_relaxed);
+}
+
+logging::line& logging::staging() {
+    static thread_local line l;
+    return l;
+}
+
+logging& logging::begin_log(level lvl, const char*, const char* func) {
+    line& l = staging();
+    std::time_t time = std::time(nullptr);
+    std::tm gmtime_tm;
+    gmtime_r(&time, &gmtime_tm);
+    l.len = std::strftime(l.data, max_line, "[ %F %T ] ", &gmtime_tm);
+    l.cut = false;
+    *this << str_levels[lvl] << " [" << func << "] ";
+    return *this;
+}
+
+void logging::append(const char* data, std::size_t len) {
+    line& l = staging();
+    const std::size_t room = max_line - l.len;
+    if(len > room) {
+        len = room;
+        l.cut = true;
+    }
+    std::memcpy(l.data + l.len, data, len);
+    l.len += len;
+}
+
+logging& logging::operator<<(const char* v) {
+    append(v, std::strlen(v));
+    return *this;
+}
+
+logging& logging::operator<<(const std::string& v) {
+    append(v.data(), v.size());
+    return *this;
+}
+
+logging& logging::operator<<(char v) {
+    append(&v, 1);
+    return *this;
+}
+
+logging& logging::operator<<(signed char v) {
+    return *this << static_cast<char>(v);
+}
+
+logging& logging::operator<<(unsigned char v) {
+    return *this << static_cast<char>(v);
+}
+
+logging& logging::operator<<(unsigned short int v) {
+    return *this << static_cast<unsigned long int>(v);
+}
+
+logging& logging::operator<<(signed short int v) {
+    return *this << static_cast<signed long int>(v);
+}
+
+logging& logging::operator<<(unsigned int v) {
+    return *this << static_cast<unsigned long int>(v);
+}
+
+logging& logging::operator<<(signed int v) {
+    return *this << static_cast<signed long int>(v);
+}
+
+logging& logging::operator<<(unsigned long int v) {
+    char buf[24];
+    append(buf, std::snprintf(buf, sizeof(buf), "%lu", v));
+    return *this;
+}
+
+logging& logging::operator<<(signed long int v) {
+    char buf[24];
+    append(buf, std::snprintf(buf, sizeof(buf), "%ld", v));
+    return *this;
+}
+
+logging& logging::operator<<(bool v) {
+    return *this << (v ? "1" : "0");
+}
+
+logging& logging::write(const char* data, std::size_t len) {
+    append(data, len);
+    return *this;
+}
+
+void logging::operator<<(const end_type&) {
+    assert(0 != writer_);
+    line& l = staging();
+    if(l.cut) {
+        truncated_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(!push(l)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // only the first line after the writer went idle wakes it, a wakeup
+    // missed meanwhile costs it one tick
+    if(idle_.exchange(false, std::memory_order_acq_rel)) {
+        cond_.notify_one();
+    }
+}
+
+// bounded multi-producer queue, a producer claims a position with a CAS
+// on tail_ and publishes the slot through its sequence number
+bool logging::push(const line& l) {
+    std::uint64_t pos = tail_.load(std::memory_order_relaxed);
+    slot* s;
+    while(true) {
+        s = &ring_[pos & mask_];
+        const std::uint64_t seq = s->seq.load(std::memory_order_acquire);
+        const std::int64_t diff = static_cast<std::int64_t>(seq - pos);
+        if(diff == 0) {
+            if(tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if(diff < 0) {
+            return false; // full
+        } else {
+            pos = tail_.load(std::memory_order_relaxed);
+        }
+    }
+    std::memcpy(s->data, l.data, l.len);
+    s->len = l.len;
+    s->seq.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool logging::pop(std::string* batch) {
+    slot& s = ring_[head_ & mask_];
+    if(s.seq.load(std::memory_order_acquire) != head_ + 1) {
+        return false;
+    }
+    batch->append(s.data, s.len);
+    batch->push_back('\n');
+    s.seq.store(head_ + ring_.size(), std::memory_order_release);
+    head_++;
+    return true;
+}
+
+void logging::run() {
+    while(true) {
+        drain();
+        bool stop = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop = stop_;
+            if(!stop) {
+                idle_.store(true, std::memory_order_release);
+                cond_.wait_for(lock, std::chrono::milliseconds(100));
+                idle_.store(false, std::memory_order_relaxed);
+            }
+        }
+        if(stop) {
+            // whatever was logged before the logger went away
+            drain();
+            return;
+        }
+    }
+}
+
+void logging::drain() {
+    while(true) {
+        batch_.clear();
+        const std::uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if(dropped != reported_dropped_) {
+            char buf[96];
+            batch_.append(buf, std::snprintf(buf, sizeof(buf), "[ logging ] %llu messages dropped, the writer fell behind\n",
+                                             static_cast<unsigned long long>(dropped - reported_dropped_)));
+            reported_dropped_ = dropped;
+        }
+        while(batch_.size() < max_batch && pop(&batch_));
+        if(batch_.empty()) {
+            return;
+        }
+        writer_->write_lines(batch_.data(), batch_.size());
+    }
+}
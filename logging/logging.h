@@ -1,15 +1,35 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
-#include <sstream>
 #include <cassert>
-#include <iomanip>
-#include <ctime>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "writer.h"
 
+// lines above this level are left out of the build, -DSECCAM_LOG_LEVEL=3
+// keeps err and worse. release builds leave out debug.
+#ifndef SECCAM_LOG_LEVEL
+#ifdef NDEBUG
+#define SECCAM_LOG_LEVEL 6
+#else
+#define SECCAM_LOG_LEVEL 7
+#endif
+#endif
+
 namespace yavca { namespace common {
 
+// a line is put together in a buffer of the logging thread and copied into
+// a bounded ring at end, a writer thread drains the ring and hands the
+// lines to the writer in batches. nothing on the logging side locks,
+// allocates or waits for the output. lines that do not fit are cut, lines
+// that arrive while the ring is full are dropped and counted.
 class logging {
 public:
     enum level {
@@ -25,21 +45,36 @@ public:
 
     static const char* str_levels[debug+1];
 
+    // longest line kept, the rest is cut
+    static const std::size_t max_line = 1024;
+
+    // whether lines of level L are built at all, a constant of the call
+    // site
+    template<level L>
+    class compiled {
+    public:
+        static const bool value = L <= SECCAM_LOG_LEVEL;
+    };
+
+    // lines above @arg1 are skipped from now on, info by default
+    static void set_level(level l);
+    static bool enabled(level l) {
+        return l <= max_level_.load(std::memory_order_relaxed);
+    }
+    // one of str_levels
+    static bool parse_level(const char* name, level* l);
+
 public:
-    logging();
+    explicit logging(std::size_t queue_length = 1024);
     ~logging();
 private:
     logging(const logging&);
     logging& operator=(const logging&);
 public:
 
-    logging& begin_log(level l, const char*, const char* func) {
-        std::time_t time = std::time(nullptr);
-        std::tm gmtime_tm;
-        gmtime_r(&time, &gmtime_tm);
-        ss_ << "[ " << std::put_time(&gmtime_tm, "%F %T") << " ] " << str_levels[l] << " [" << func << "] ";
-        return *this;
-    }
+    // starts a line of the calling thread, a line that thread left
+    // unfinished is thrown away
+    logging& begin_log(level l, const char*, const char* func);
 
     logging& operator<<(const char*);
     logging& operator<<(const std::string&);
@@ -53,6 +88,8 @@ public:
     logging& operator<<(unsigned long int);
     logging& operator<<(signed long int);
     logging& operator<<(bool);
+    // raw bytes that need not be terminated
+    logging& write(const char* data, std::size_t len);
 public:
 
     class end_type {
@@ -66,47 +103,53 @@ public:
 
     static const end_type end;
 
-    void operator<<(const end_type&) {
-        write_message(ss_);
-        ss_.str("");
-    }
+    void operator<<(const end_type&);
 public:
-    void init(writer* w) {
-        assert(0 == writer_);
-        writer_ = w;
-    }
-
+    // starts the writer thread
+    void init(writer* w);
+public:
+    // lines lost because the ring was full, and lines cut at max_line
+    std::uint64_t dropped() const;
+    std::uint64_t truncated() const;
 private:
-    void write_message(const std::ostringstream&);
+    class line {
+    public:
+        char data[max_line];
+        std::size_t len;
+        bool cut;
+    };
+    class slot {
+    public:
+        // the ring position this slot takes next, +1 once it holds it
+        std::atomic<std::uint64_t> seq;
+        std::size_t len;
+        char data[max_line];
+    };
+    static line& staging();
+    void append(const char* data, std::size_t len);
+    bool push(const line& l);
+    bool pop(std::string* batch);
+    // writer thread
+    void run();
+    void drain();
 private:
-    std::ostringstream ss_;
+    static std::atomic<int> max_level_;
     writer* writer_;
+    std::vector<slot> ring_;
+    std::size_t mask_;
+    std::atomic<std::uint64_t> tail_;
+    std::uint64_t head_;
+    std::atomic<std::uint64_t> dropped_;
+    std::atomic<std::uint64_t> truncated_;
+    std::uint64_t reported_dropped_;
+    std::string batch_;
+    std::thread* thread_;
+    std::atomic<bool> idle_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
 };
 
-#define PROXY_SS(type) \
-    inline logging& logging::operator<<(type v) { \
-        assert(0 != writer_); \
-        ss_ << v; \
-        return *this; \
-    }
-
-PROXY_SS(const char*);
-PROXY_SS(const std::string&);
-PROXY_SS(char);
-PROXY_SS(unsigned char);
-PROXY_SS(signed char);
-PROXY_SS(unsigned short int);
-PROXY_SS(signed short int);
-PROXY_SS(unsigned int);
-PROXY_SS(signed int);
-PROXY_SS(unsigned long int);
-PROXY_SS(signed long int);
-PROXY_SS(bool);
-
-inline void logging::write_message(const std::ostringstream &ss) {
-    writer_->write_message(ss.str().c_str());
-}
-
 } }
 
 #endif // LOGGING_H
@@ -1,5 +1,8 @@
 #include "std_err_writer.h"
 
+#include <unistd.h>
+#include <cerrno>
+
 
 yavca::common::std_err_writer::std_err_writer()
 {
@@ -10,3 +13,20 @@ yavca::common::std_err_writer::~std_err_writer()
 {
 
 }
+
+// a whole batch in one system call, stderr is not buffered
+bool yavca::common::std_err_writer::write_lines(const char* data, std::size_t len)
+{
+    while(len != 0) {
+        ssize_t n = ::write(STDERR_FILENO, data, len);
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
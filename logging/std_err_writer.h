@@ -2,7 +2,6 @@
 #define STD_ERR_WRITER_H
 
 #include "writer.h"
-#include <iostream>
 
 namespace yavca { namespace common {
 
@@ -14,10 +13,7 @@ private:
     std_err_writer(const std_err_writer&);
     std_err_writer& operator =(const std_err_writer&);
 public:
-    bool write_message(const char *msg) {
-        std::cerr << msg << std::endl;
-        return true;
-    }
+    bool write_lines(const char* data, std::size_t len);
 };
 
 
@@ -1,6 +1,8 @@
 #ifndef WRITER_H
 #define WRITER_H
 
+#include <cstddef>
+
 namespace yavca { namespace common {
 
 class writer {
@@ -11,7 +13,9 @@ private:
     writer(const writer&);
     writer& operator=(const writer&);
 public:
-    virtual bool write_message(const char* msg) = 0;
+    // one or more lines, each ends with a newline. called from the
+    // logger's writer thread only.
+    virtual bool write_lines(const char* data, std::size_t len) = 0;
 };
 
 } }
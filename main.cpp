@@ -7,9 +7,20 @@
 #include "video/v4l_capture.h"
 #include "video/h264_encoder.h"
 #include "video/segmenter.h"
+#include "video/dvr_recorder.h"
+#include "video/snapshot.h"
 #include "common/segment.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+#include "common/encoder_control.h"
 
 #include "net/http_publisher.h"
+#include "net/dropbox_backend.h"
+#include "net/http_connection.h"
+#include "net/local_backend.h"
+#include "net/upload_shaper.h"
+#include "net/upload_workers.h"
+#include "net/live_server.h"
 
 #include <cassert>
 #include <iostream>
@@ -20,6 +31,12 @@
 #include <functional>
 #include <atomic>
 #include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <limits>
+#include <getopt.h>
 
 extern "C" {
 #include <libavutil/imgutils.h>
@@ -34,15 +51,27 @@ extern "C" {
 #include <event2/event.h>
 #include <event2/dns.h>
 
+// the capture cuts a segment this often, live view sizes its playlist by it
+const int segment_length_sec = 10;
+
 class video_capture {
 public:
-    video_capture(int vc_writer_fd)
+    video_capture(int vc_writer_fd, const common::encoder_control* control, const std::string& probe_cache_dir)
         : capture_(nullptr)
         , encoder_(nullptr)
         , segmenter_(nullptr)
         , thread_(nullptr)
         , stop_(false)
-        , vc_writer_fd_(vc_writer_fd) {
+        , vc_writer_fd_(vc_writer_fd)
+        , control_(control)
+        , probe_cache_dir_(probe_cache_dir)
+        , part_ms_(0)
+        , on_part_ready_(nullptr)
+        , part_ctx_(nullptr)
+        , snapshot_(nullptr)
+        , recorder_(nullptr)
+        , metrics_(nullptr)
+        , trace_(nullptr) {
 
     }
     
@@ -60,11 +89,19 @@ private:
     }
     // called from std::thread video_capture::thread_
     void handle_on_segment_ready(common::segment* segment) {
-        LOG(common::log::info) << "writing segment" << common::log::end;
+        LOG(common::log::debug) << "writing segment" << common::log::end;
+        if(nullptr != recorder_ && !recorder_->record(segment)) {
+            LOG(common::log::err) << "dvr is behind, segment not recorded" << common::log::end;
+        }
         std::uintptr_t seg_ptr = reinterpret_cast<uintptr_t>(segment);
         write(vc_writer_fd_, &seg_ptr, sizeof(std::uintptr_t));
     }
 
+    static void on_part_ready(common::segment* part, bool ends_segment, void* ctx) {
+        video_capture* vid_cap = static_cast<video_capture*>(ctx);
+        vid_cap->on_part_ready_(part, ends_segment, vid_cap->part_ctx_);
+    }
+
     static void on_eof(void* ctx) {
         video_capture* vid_cap = static_cast<video_capture*>(ctx);
         vid_cap->handle_on_eof();
@@ -75,6 +112,33 @@ private:
         // assert(false);
     }
 public:
+    // parts are handed over on the capture thread, before start_capture
+    void set_part_sink(std::uint32_t part_ms, video::segmenter::on_part_ready_cb on_part_ready, void* ctx) {
+        assert(nullptr == thread_);
+        part_ms_ = part_ms;
+        on_part_ready_ = on_part_ready;
+        part_ctx_ = ctx;
+    }
+    // before start_capture
+    void set_snapshot(video::snapshot* snap) {
+        assert(nullptr == thread_);
+        snapshot_ = snap;
+    }
+    // before start_capture
+    void set_recorder(video::dvr_recorder* recorder) {
+        assert(nullptr == thread_);
+        recorder_ = recorder;
+    }
+    // before start_capture
+    void set_metrics(common::metrics* metrics) {
+        assert(nullptr == thread_);
+        metrics_ = metrics;
+    }
+    // before start_capture
+    void set_trace(common::trace* trace) {
+        assert(nullptr == thread_);
+        trace_ = trace;
+    }
     void start_capture() {
         assert(nullptr == thread_);
         thread_ = new std::thread(&video_capture::run, this);
@@ -91,12 +155,30 @@ public:
 private:
     void run() {
         LOG(common::log::info) << "Video subsystem started" << common::log::end;
-        capture_ = new video::v4l_capture;
+        capture_ = new video::v4l_capture(segment_length_sec, probe_cache_dir_);
         encoder_ = new video::h264_encoder;
         segmenter_ = new video::segmenter(&video_capture::on_segment_ready, &video_capture::on_eof, this);
+        if(0 != part_ms_) {
+            segmenter_->enable_parts(part_ms_, &video_capture::on_part_ready);
+        }
 
         capture_->attach_sink(encoder_);
+        if(nullptr != snapshot_) {
+            capture_->attach_snapshot(snapshot_);
+        }
         encoder_->attach_sink(segmenter_);
+        encoder_->set_control(control_);
+        if(nullptr != metrics_) {
+            capture_->set_metrics(metrics_);
+            encoder_->set_metrics(metrics_);
+            segmenter_->set_metrics(metrics_);
+        }
+        if(nullptr != trace_) {
+            trace_->name_thread("capture");
+            capture_->set_trace(trace_);
+            encoder_->set_trace(trace_);
+            segmenter_->set_trace(trace_);
+        }
         
         while(true) {
             if(stop_) {
@@ -119,6 +201,15 @@ private:
     std::thread* thread_;
     std::atomic<bool> stop_;
     int vc_writer_fd_;
+    const common::encoder_control* control_;
+    std::string probe_cache_dir_;
+    std::uint32_t part_ms_;
+    video::segmenter::on_part_ready_cb on_part_ready_;
+    void* part_ctx_;
+    video::snapshot* snapshot_;
+    video::dvr_recorder* recorder_;
+    common::metrics* metrics_;
+    common::trace* trace_;
 };
 
 class ctl_interface {
@@ -147,14 +238,123 @@ private:
     video_capture& capture_;
 };
 
+// what every upload worker needs to make its own dropbox backend
+class upload_config {
+public:
+    std::string base_uri;
+    std::string file_upload_uri;
+    std::uint16_t port;
+    std::string nameserver;
+    std::string bearer;
+    SSL_CTX* ssl_ctx;
+    bool ktls;
+    std::size_t workers;
+    std::uint32_t rate_kbit;
+    std::uint32_t burst_kbyte;
+    std::vector<net::shaper_window> schedule;
+};
+
+// the backend of one upload worker with its share of the rate limit.
+// the shaper runs on the worker's loop and goes away with the backend.
+class worker_backend : public net::storage_backend {
+public:
+    worker_backend(event_base* evbase, evdns_base* evdns, const upload_config& config)
+        : dropbox_(new net::dropbox_backend(config.base_uri, config.file_upload_uri, config.port, config.bearer, evbase, evdns, config.ssl_ctx))
+        , shaper_(nullptr) {
+
+        dropbox_->set_ktls(config.ktls);
+        if(0 != config.rate_kbit || !config.schedule.empty()) {
+            // each worker takes an even share, a worker is as busy as the others
+            std::vector<net::shaper_window> schedule = config.schedule;
+            for(std::size_t i = 0 ; i < schedule.size() ; i++) {
+                schedule[i].rate_kbit = std::max<std::uint32_t>(schedule[i].rate_kbit/config.workers, 0 != schedule[i].rate_kbit ? 1 : 0);
+            }
+            std::uint32_t rate_kbit = std::max<std::uint32_t>(config.rate_kbit/config.workers, 0 != config.rate_kbit ? 1 : 0);
+            std::uint32_t burst_kbyte = std::max<std::uint32_t>(config.burst_kbyte/config.workers, 1);
+            shaper_ = new net::upload_shaper(evbase, rate_kbit, burst_kbyte, schedule);
+            dropbox_->set_upload_rate_limit_group(shaper_->group());
+        }
+    }
+    ~worker_backend() {
+        delete dropbox_;
+        delete shaper_;
+    }
+private:
+    worker_backend(const worker_backend&) = delete;
+    void operator=(const worker_backend&) = delete;
+public:
+    void list(list_cb cb, void* ctx) {
+        dropbox_->list(cb, ctx);
+    }
+    void put(net::upload_session* upload, put_cb cb, void* ctx) {
+        dropbox_->put(upload, cb, ctx);
+    }
+    void put_streaming(net::upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx) {
+        dropbox_->put_streaming(upload, chunk_size, cb, ctx);
+    }
+    void remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx) {
+        dropbox_->remove(paths, cb, ctx);
+    }
+private:
+    net::dropbox_backend* dropbox_;
+    net::upload_shaper* shaper_;
+};
+
+net::storage_backend* make_worker_backend(event_base* evbase, evdns_base* evdns, void* ctx) {
+    const upload_config* config = static_cast<const upload_config*>(ctx);
+    evdns_base_nameserver_ip_add(evdns, config->nameserver.c_str());
+    return new worker_backend(evbase, evdns, *config);
+}
+
+// the stored segments behind the live view's /segments
+class stored_archive {
+public:
+    const net::http_publisher* publisher;
+    const char* location;
+};
+
+void find_stored(std::int64_t from, std::int64_t to, std::vector<net::live_server::archived>* found, void* ctx) {
+    const stored_archive* archive = static_cast<const stored_archive*>(ctx);
+    const std::int64_t max = std::numeric_limits<int>::max();
+    std::vector<api_file> files;
+    archive->publisher->find_stored(static_cast<int>(std::min(std::max<std::int64_t>(from, 0), max)),
+                                    static_cast<int>(std::min(std::max<std::int64_t>(to, 0), max)), &files);
+    for(std::size_t i = 0 ; i < files.size() ; i++) {
+        net::live_server::archived a;
+        a.start = files[i].timestamp;
+        a.end = files[i].end_timestamp;
+        a.location = archive->location;
+        a.path = files[i].path;
+        found->push_back(a);
+    }
+}
+
+void find_recorded(std::int64_t from, std::int64_t to, std::vector<net::live_server::archived>* found, void* ctx) {
+    const video::dvr_recorder* recorder = static_cast<const video::dvr_recorder*>(ctx);
+    std::vector<video::dvr_recorder::entry> entries;
+    recorder->find(from * 1000, to * 1000, &entries);
+    for(std::size_t i = 0 ; i < entries.size() ; i++) {
+        net::live_server::archived a;
+        a.start = entries[i].start_ms / 1000;
+        a.end = (entries[i].end_ms + 999) / 1000;
+        a.location = "local";
+        a.path = recorder->dir() + "/" + entries[i].name;
+        found->push_back(a);
+    }
+}
+
+double read_log_dropped(void*) {
+    return static_cast<double>(yavca::common::_logger_->dropped());
+}
+
 void on_connection_ready(void* ctx) {
-    LOG(common::log::info) << "Starting video subsystem" << common::log::end;
-    ctl_interface* ctl = static_cast<ctl_interface*>(ctx);
-    ctl->start_capture();
+    // capture is already running, the publisher drains what it queued
+    LOG(common::log::info) << "Storage ready" << common::log::end;
 }
 
 void on_connection_error(void* ctx) {
-    // TODO: 
+    // the publisher keeps listing, capture goes on into its queue
+    LOG(common::log::err) << "Storage does not answer, recording is kept until it does" << common::log::end;
 }
 
 void on_last_request_sent(void* ctx) {
@@ -171,6 +371,101 @@ void sigint_function(evutil_socket_t, short, void *ctx) {
 
 int main(int argc,char* argv[]) {
 
+    // segments go to Dropbox unless --local-dir names a directory, the
+    // hosts can be pointed at tools/mock_dropbox for testing
+    std::string local_dir;
+    std::string base_uri = "api.dropboxapi.com";
+    std::string file_upload_uri = "content.dropboxapi.com";
+    std::uint16_t port = 443;
+    std::string nameserver = "8.8.8.8";
+    std::string bearer = "###";
+    std::string cache_file = "dropbox.cache";
+    std::string probe_cache_dir = ".";
+    std::uint32_t upload_rate_kbit = 0;
+    std::uint32_t upload_burst_kbyte = 256;
+    std::vector<net::shaper_window> upload_schedule;
+    bool ktls = false;
+    std::size_t upload_workers = 0;
+    std::uint16_t live_port = 0;
+    std::size_t live_segments = 6;
+    std::uint32_t live_part_ms = 0;
+    std::string dvr_dir;
+    std::uint64_t dvr_quota_mb = 4096;
+    common::log::level log_level = common::log::info;
+    static const option long_options[] = {
+        { "local-dir", required_argument, NULL, 'l' },
+        { "api-host", required_argument, NULL, 'a' },
+        { "content-host", required_argument, NULL, 'c' },
+        { "port", required_argument, NULL, 'p' },
+        { "nameserver", required_argument, NULL, 'n' },
+        { "token", required_argument, NULL, 't' },
+        { "upload-rate", required_argument, NULL, 'r' },
+        { "upload-burst", required_argument, NULL, 'b' },
+        { "upload-schedule", required_argument, NULL, 's' },
+        { "cache-file", required_argument, NULL, 'f' },
+        { "probe-cache-dir", required_argument, NULL, 'P' },
+        { "ktls", no_argument, NULL, 'k' },
+        { "upload-workers", required_argument, NULL, 'w' },
+        { "live-port", required_argument, NULL, 'L' },
+        { "live-segments", required_argument, NULL, 'S' },
+        { "live-part-ms", required_argument, NULL, 'M' },
+        { "dvr-dir", required_argument, NULL, 'D' },
+        { "dvr-quota", required_argument, NULL, 'Q' },
+        { "log-level", required_argument, NULL, 'v' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while((opt = getopt_long(argc, argv, "l:a:c:p:n:t:r:b:s:f:P:kw:L:S:M:D:Q:v:", long_options, NULL)) != -1) {
+        if(opt == 'l') {
+            local_dir = optarg;
+        } else if(opt == 'a') {
+            base_uri = optarg;
+        } else if(opt == 'c') {
+            file_upload_uri = optarg;
+        } else if(opt == 'p') {
+            port = static_cast<std::uint16_t>(std::atoi(optarg));
+        } else if(opt == 'n') {
+            nameserver = optarg;
+        } else if(opt == 't') {
+            bearer = optarg;
+        } else if(opt == 'r') {
+            upload_rate_kbit = std::strtoul(optarg, NULL, 10);
+        } else if(opt == 'b') {
+            upload_burst_kbyte = std::strtoul(optarg, NULL, 10);
+        } else if(opt == 's' && net::upload_shaper::parse_schedule(optarg, &upload_schedule)) {
+            // e.g. 08:00-18:00=2000,18:00-08:00=0
+        } else if(opt == 'f') {
+            cache_file = optarg;
+        } else if(opt == 'P') {
+            probe_cache_dir = optarg;
+        } else if(opt == 'k') {
+            ktls = true;
+        } else if(opt == 'w') {
+            upload_workers = std::strtoul(optarg, NULL, 10);
+        } else if(opt == 'L') {
+            live_port = static_cast<std::uint16_t>(std::atoi(optarg));
+        } else if(opt == 'S') {
+            live_segments = std::strtoul(optarg, NULL, 10);
+        } else if(opt == 'M') {
+            live_part_ms = std::strtoul(optarg, NULL, 10);
+        } else if(opt == 'D') {
+            dvr_dir = optarg;
+        } else if(opt == 'Q') {
+            dvr_quota_mb = std::strtoull(optarg, NULL, 10);
+        } else if(opt == 'v' && common::log::parse_level(optarg, &log_level)) {
+            // emerg, alert, crit, err, warning, notice, info or debug
+            common::log::set_level(log_level);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--local-dir DIR] [--api-host HOST] [--content-host HOST]"
+                      << " [--port PORT] [--nameserver IP] [--token TOKEN]"
+                      << " [--upload-rate KBIT] [--upload-burst KBYTE] [--upload-schedule HH:MM-HH:MM=KBIT,...]"
+                      << " [--cache-file PATH] [--probe-cache-dir DIR] [--ktls] [--upload-workers N]"
+                      << " [--live-port PORT] [--live-segments N] [--live-part-ms MS]"
+                      << " [--dvr-dir DIR] [--dvr-quota MB] [--log-level LEVEL]" << std::endl;
+            return 1;
+        }
+    }
+
     signal(SIGPIPE, SIG_IGN);
 
     avdevice_register_all();
@@ -185,13 +480,10 @@ int main(int argc,char* argv[]) {
 #endif
 
     SSL_CTX* ssl_ctx = SSL_CTX_new(SSLv23_method());
+    net::http_connection::setup_ssl_ctx(ssl_ctx);
     event_base* evbase = event_base_new();
     evdns_base* evdns = evdns_base_new(evbase, EVDNS_BASE_DISABLE_WHEN_INACTIVE);
-    evdns_base_nameserver_ip_add(evdns, "8.8.8.8");
-
-    std::string base_uri = "api.dropboxapi.com";
-    std::string file_upload_uri = "content.dropboxapi.com";
-    std::string bearer = "###";
+    evdns_base_nameserver_ip_add(evdns, nameserver.c_str());
 
     int queue_fds[2];
     if(socketpair(AF_UNIX, SOCK_STREAM, 0, queue_fds) < 0) {
@@ -202,17 +494,113 @@ int main(int argc,char* argv[]) {
     fcntl(queue_fds[1], F_SETFL, fcntl(queue_fds[1], F_GETFL, 0) | O_NONBLOCK);
 
     {
-        video_capture capture(queue_fds[0]);
+        // the publisher steers the encoder through this when the uplink
+        // cannot keep up
+        common::encoder_control encoder_control;
+        // counters of every stage, served on the live view's /metrics
+        common::metrics metrics;
+        metrics.add_gauge("seccam_log_dropped", "Log lines dropped while the log writer was behind.", &read_log_dropped, nullptr);
+        // the newest frame and segment events, on /trace.json
+        common::trace trace;
+        trace.name_thread("main loop");
+        // the live view's stills, encoded only when asked for
+        video::snapshot snapshot;
+        // the local archive keeps recording while the uplink is down,
+        // outlives the capture so that it stores the last segment
+        video::dvr_recorder* recorder = nullptr;
+        if(!dvr_dir.empty()) {
+            recorder = new video::dvr_recorder(dvr_dir, dvr_quota_mb * 1024 * 1024);
+        }
+        video_capture capture(queue_fds[0], &encoder_control, probe_cache_dir);
+        capture.set_recorder(recorder);
+        capture.set_metrics(&metrics);
+        capture.set_trace(&trace);
 
         {
 
             ctl_interface ctl(evbase, capture);
 
-            net::http_publisher publisher(base_uri, file_upload_uri, bearer, evbase, evdns, ssl_ctx, queue_fds[1],
-                                          on_connection_ready, on_connection_error, on_last_request_sent, &ctl
-                                         );
+            net::upload_shaper* shaper = nullptr;
+            net::storage_backend* backend = nullptr;
+            net::upload_workers* workers = nullptr;
+            upload_config config;
+            if(local_dir.empty()) {
+                net::dropbox_backend* dropbox = new net::dropbox_backend(base_uri, file_upload_uri, port, bearer, evbase, evdns, ssl_ctx);
+                if(!cache_file.empty()) {
+                    dropbox->set_cache_file(cache_file);
+                }
+                if(ktls) {
+                    dropbox->set_ktls(true);
+                }
+                if(0 != upload_workers) {
+                    // listing and eviction stay on this loop, segments go
+                    // out on the workers' connections
+                    config.base_uri = base_uri;
+                    config.file_upload_uri = file_upload_uri;
+                    config.port = port;
+                    config.nameserver = nameserver;
+                    config.bearer = bearer;
+                    config.ssl_ctx = ssl_ctx;
+                    config.ktls = ktls;
+                    config.workers = upload_workers;
+                    config.rate_kbit = upload_rate_kbit;
+                    config.burst_kbyte = upload_burst_kbyte;
+                    config.schedule = upload_schedule;
+                    workers = new net::upload_workers(evbase, dropbox, upload_workers, &make_worker_backend, &config);
+                } else if(0 != upload_rate_kbit || !upload_schedule.empty()) {
+                    shaper = new net::upload_shaper(evbase, upload_rate_kbit, upload_burst_kbyte, upload_schedule);
+                    dropbox->set_upload_rate_limit_group(shaper->group());
+                }
+                backend = dropbox;
+            } else {
+                backend = new net::local_backend(local_dir, evbase);
+            }
+
+            net::publisher_options options;
+            if(nullptr != workers) {
+                options.max_uploads = workers->size();
+            }
+            net::http_publisher* publisher = new net::http_publisher(evbase, nullptr != workers ? workers : backend, queue_fds[1], options,
+                                                                     on_connection_ready, on_connection_error, on_last_request_sent, &ctl
+                                                                    );
+            publisher->set_encoder_control(&encoder_control);
+            publisher->set_metrics(&metrics);
+            publisher->set_trace(&trace);
+
+            // viewers on the lan watch the segments that are being uploaded
+            net::live_server* live = nullptr;
+            stored_archive archive;
+            if(0 != live_port) {
+                try {
+                    live = new net::live_server(evbase, "0.0.0.0", live_port, live_segments, segment_length_sec);
+                    if(0 != live_part_ms) {
+                        // low latency, the segmenter feeds parts as it cuts them
+                        live->enable_parts(live_part_ms);
+                        capture.set_part_sink(live_part_ms, &net::live_server::on_part, live);
+                    } else {
+                        publisher->set_segment_listener(&net::live_server::on_segment, live);
+                    }
+                    live->set_snapshot_source(&video::snapshot::on_request, &snapshot);
+                    capture.set_snapshot(&snapshot);
+                    // incidents are looked up by capture time in what is
+                    // uploaded and what the dvr keeps
+                    archive.publisher = publisher;
+                    archive.location = local_dir.empty() ? "cloud" : "local";
+                    live->add_archive_source(&find_stored, &archive);
+                    if(nullptr != recorder) {
+                        live->add_archive_source(&find_recorded, recorder);
+                    }
+                    live->set_metrics(&metrics);
+                    live->set_trace(&trace);
+                } catch(const std::runtime_error& err) {
+                    LOG(common::log::err) << "live view disabled: " << err.what() << common::log::end;
+                }
+            }
+
+            // recording does not wait for the storage to be listed
+            LOG(common::log::info) << "Starting video subsystem" << common::log::end;
+            ctl.start_capture();
 
-            
 
             event *sigevent = evsignal_new(evbase, SIGINT, sigint_function, &ctl);
             event_add(sigevent, NULL);
@@ -220,7 +608,17 @@ int main(int argc,char* argv[]) {
             event_base_dispatch(evbase);
 
             event_free(sigevent);
+
+            // unfinished uploads on the workers complete into the publisher
+            delete workers;
+            delete publisher;
+            delete live;
+            delete backend;
+            delete shaper;
         }
+
+        // capture has been joined, this stores what it queued last
+        delete recorder;
     }
 
     while(true) {
@@ -228,7 +626,7 @@ int main(int argc,char* argv[]) {
         ssize_t rc = read(queue_fds[1], &seg_ptr, sizeof(std::uintptr_t));
         if(rc == sizeof(std::uintptr_t)) {
             common::segment* seg = reinterpret_cast<common::segment*>(seg_ptr);
-            delete seg;
+            seg->unref();
         } else {
             break;
         }
@@ -2,6 +2,21 @@ set(SOURCES
     http_publisher.cpp
     http_connection.cpp
     http_request.cpp
+    request_template.cpp
     http_response.cpp
     timer.cpp
+    retry_policy.cpp
+    dead_letter.cpp
+    storage_backend.cpp
+    dropbox_backend.cpp
+    local_backend.cpp
+    upload_shaper.cpp
+    bitrate_controller.cpp
+    folder_cache.cpp
+    file_index.cpp
+    json_scanner.cpp
+    dropbox_json.cpp
+    live_server.cpp
+    ts_muxer.cpp
+    upload_workers.cpp
 )
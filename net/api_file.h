@@ -10,6 +10,8 @@ public:
     std::string path;
     int size;
     std::string last_modified;
+    int end_timestamp;      // 0 if the name has none
+    int seq;                // of the segments starting in the same second
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "bitrate_controller.h"
+
+#include "logging/log.h"
+
+#include "common/encoder_control.h"
+
+#include <algorithm>
+
+using net::bitrate_controller;
+
+namespace {
+
+const double smoothing = 0.3;
+
+double smooth(double average, double sample) {
+    return 0 == average ? sample : average + smoothing*(sample - average);
+}
+
+}
+
+bitrate_controller::bitrate_controller(common::encoder_control* control,
+                                       std::uint32_t min_kbit,
+                                       std::uint32_t backlog_high_sec
+                                       )
+    : control_(control)
+    , min_kbit_(min_kbit)
+    , backlog_high_sec_(backlog_high_sec)
+    , goodput_kbit_(0)
+    , input_kbit_(0)
+    , free_kbit_(0)
+    , last_segment_ms_(0)
+    , target_kbit_(0)
+    , settle_segments_(0) {
+
+}
+
+bitrate_controller::~bitrate_controller() {
+
+}
+
+void bitrate_controller::on_upload(std::size_t bytes, std::uint64_t elapsed_ms) {
+    // bits per millisecond are kbit/s
+    goodput_kbit_ = smooth(goodput_kbit_, static_cast<double>(bytes)*8/std::max<std::uint64_t>(elapsed_ms, 1));
+}
+
+void bitrate_controller::on_segment(std::size_t bytes, std::size_t backlog_bytes, std::uint64_t now_ms) {
+    const std::uint64_t interval_ms = now_ms - last_segment_ms_;
+    const bool first = 0 == last_segment_ms_;
+    last_segment_ms_ = now_ms;
+    if(first || 0 == interval_ms) {
+        return;
+    }
+    if(settle_segments_ > 0) {
+        // this segment was cut before the encoder picked up the change
+        settle_segments_--;
+        return;
+    }
+    input_kbit_ = smooth(input_kbit_, static_cast<double>(bytes)*8/interval_ms);
+    if(0 == target_kbit_) {
+        free_kbit_ = input_kbit_;
+    }
+    if(0 == goodput_kbit_) {
+        return;
+    }
+
+    const double backlog_sec = static_cast<double>(backlog_bytes)*8/goodput_kbit_/1000;
+    const double current = 0 != target_kbit_ ? target_kbit_ : free_kbit_;
+    if(backlog_sec > backlog_high_sec_ || input_kbit_ > goodput_kbit_*0.9) {
+        // leave headroom to drain what is queued, more so when it is long
+        const double next = goodput_kbit_*(backlog_sec > backlog_high_sec_ ? 0.5 : 0.8);
+        if(next < current*0.9) {
+            publish(static_cast<std::uint32_t>(std::max(next, 1.0)), backlog_sec);
+        }
+    } else if(0 != target_kbit_ && backlog_sec*1000 < interval_ms && input_kbit_ < goodput_kbit_*0.6) {
+        const double next = target_kbit_*1.2;
+        publish(next >= free_kbit_ ? 0 : static_cast<std::uint32_t>(next), backlog_sec);
+    }
+}
+
+void bitrate_controller::publish(std::uint32_t kbit, double backlog_sec) {
+    common::encoder_target target;
+    if(0 != kbit) {
+        target.bitrate_kbit = std::max(kbit, min_kbit_/8);
+        if(kbit < min_kbit_) {
+            target.fps_divisor = 2;
+        }
+        if(kbit < min_kbit_/2) {
+            target.scale_divisor = 2;
+        }
+        if(kbit < min_kbit_/4) {
+            target.fps_divisor = 4;
+        }
+    }
+    control_->set(target);
+    target_kbit_ = kbit;
+    input_kbit_ = 0;
+    settle_segments_ = 1;
+
+    LOG(common::log::info) << "encoder target " << target.bitrate_kbit << " kbit/s"
+                           << " fps/" << static_cast<int>(target.fps_divisor)
+                           << " size/" << static_cast<int>(target.scale_divisor)
+                           << ", goodput " << static_cast<unsigned long>(goodput_kbit_) << " kbit/s"
+                           << " backlog " << static_cast<unsigned long>(backlog_sec) << "s" << common::log::end;
+}
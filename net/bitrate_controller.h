@@ -0,0 +1,50 @@
+#ifndef BITRATE_CONTROLLER_H
+#define BITRATE_CONTROLLER_H
+
+#include <cstdint>
+#include <cstddef>
+
+namespace common {
+    class encoder_control;
+}
+
+namespace net {
+
+// keeps the encoder's output below what the uplink drains. goodput and
+// the encoder's rate are averaged per segment, the target drops when the
+// encoder outruns the uplink or the backlog grows too long and creeps
+// back up once the backlog is gone. below @arg2 of the constructor the
+// frame rate and then the resolution are reduced as well.
+class bitrate_controller {
+public:
+    bitrate_controller(common::encoder_control* control,
+                       std::uint32_t min_kbit,
+                       std::uint32_t backlog_high_sec
+                       );
+    ~bitrate_controller();
+private:
+    bitrate_controller(const bitrate_controller&) = delete;
+    void operator=(const bitrate_controller&) = delete;
+public:
+    // @arg1 bytes were committed after @arg2 ms on the wire
+    void on_upload(std::size_t bytes, std::uint64_t elapsed_ms);
+    // a segment of @arg1 bytes arrived at @arg3 behind @arg2 bytes
+    void on_segment(std::size_t bytes, std::size_t backlog_bytes, std::uint64_t now_ms);
+private:
+    void publish(std::uint32_t kbit, double backlog_sec);
+private:
+    common::encoder_control* control_;
+    std::uint32_t min_kbit_;
+    std::uint32_t backlog_high_sec_;
+    double goodput_kbit_;
+    double input_kbit_;
+    // the encoder's rate while it was last unconstrained
+    double free_kbit_;
+    std::uint64_t last_segment_ms_;
+    std::uint32_t target_kbit_;
+    int settle_segments_;
+};
+
+}
+
+#endif // BITRATE_CONTROLLER_H
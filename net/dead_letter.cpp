@@ -0,0 +1,72 @@
+#include "dead_letter.h"
+
+#include "logging/log.h"
+
+#include "common/segment.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <cerrno>
+#include <cstring>
+
+using net::dead_letter;
+
+dead_letter::dead_letter(const std::string& dir)
+    : dir_(dir)
+    , parked_(0) {
+
+}
+
+dead_letter::~dead_letter() {
+
+}
+
+bool dead_letter::park(const common::segment* seg, const std::string& name) {
+    if(dir_.empty()) {
+        LOG(common::log::err) << "no dead letter directory, dropping " << name << common::log::end;
+        return false;
+    }
+
+    if(0 != mkdir(dir_.c_str(), 0755) && errno != EEXIST) {
+        int err = errno;
+        LOG(common::log::err) << "cannot create " << dir_ << " errno=" << std::strerror(err) << common::log::end;
+        return false;
+    }
+
+    std::string path = dir_ + "/" + name;
+    int fd = open(path.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd < 0) {
+        int err = errno;
+        LOG(common::log::err) << "cannot open " << path << " errno=" << std::strerror(err) << common::log::end;
+        return false;
+    }
+
+    const std::uint8_t* buf = seg->buffer();
+    std::size_t left = seg->size();
+    while(left != 0) {
+        ssize_t ret = write(fd, buf, left);
+        if(ret < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            int err = errno;
+            LOG(common::log::err) << "cannot write " << path << " errno=" << std::strerror(err) << common::log::end;
+            close(fd);
+            unlink(path.c_str());
+            return false;
+        }
+        buf += ret;
+        left -= ret;
+    }
+    close(fd);
+
+    parked_++;
+    LOG(common::log::warning) << "parked " << name << " in " << dir_ << common::log::end;
+    return true;
+}
+
+unsigned long dead_letter::parked() const {
+    return parked_;
+}
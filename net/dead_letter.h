@@ -0,0 +1,31 @@
+#ifndef DEAD_LETTER_H
+#define DEAD_LETTER_H
+
+#include <string>
+
+namespace common {
+    class segment;
+}
+
+namespace net {
+
+// segments that could not be uploaded are written to a local directory
+// instead of being dropped
+class dead_letter {
+public:
+    dead_letter(const std::string& dir);
+    ~dead_letter();
+private:
+    dead_letter(const dead_letter&) = delete;
+    void operator=(const dead_letter&) = delete;
+public:
+    bool park(const common::segment* seg, const std::string& name);
+    unsigned long parked() const;
+private:
+    std::string dir_;
+    unsigned long parked_;
+};
+
+}
+
+#endif // DEAD_LETTER_H
@@ -0,0 +1,847 @@
+#include "dropbox_backend.h"
+
+#include "upload_session.h"
+#include "timer.h"
+#include "folder_cache.h"
+#include "dropbox_json.h"
+#include "request_template.h"
+
+#include "logging/log.h"
+
+#include "common/segment.h"
+
+#include "http_connection.h"
+#include "http_request.h"
+#include "http_response.h"
+
+#include <json/json.h>
+
+#include <event2/buffer.h>
+
+#include <stdexcept>
+#include <sstream>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+
+using net::dropbox_backend;
+
+namespace {
+
+bool parse_json(net::http_response* res, Json::Value* json) {
+    bool ret = false;
+    if(res->size() != 0) {
+        const char* begin = res->body();
+        const char* end = begin+res->size();
+        Json::Reader reader;
+        if(reader.parse(begin, end, *json, false)) {
+            LOG(common::log::debug) << "data parsed" << common::log::end;
+            ret = true;
+        } else {
+            LOG(common::log::err) << "cannot parse data" << common::log::end;
+        }
+    } else {
+        LOG(common::log::err) << "empty data" << common::log::end;
+    }
+    return ret;
+}
+
+// a longer Retry-After is taken as this, it would overflow the delay in ms
+const unsigned long max_retry_after_sec = 3600;
+
+// error bodies are a line of JSON, anything longer is cut
+const std::size_t max_logged_body = 1024;
+
+// gathers the start of the body from the response buffer on the stack,
+// every line of it that is not blank is a line of the log
+void log_body(net::http_response* res) {
+    if(!common::log::enabled(common::log::err)) {
+        return;
+    }
+    evbuffer_iovec vec[4];
+    int n = std::min(res->peek(vec, 4), 4);
+    char body[max_logged_body + 1];
+    std::size_t len = 0;
+    for(int i = 0 ; i < n && len != max_logged_body ; i++) {
+        std::size_t chunk = std::min(vec[i].iov_len, max_logged_body - len);
+        std::memcpy(body + len, vec[i].iov_base, chunk);
+        len += chunk;
+    }
+    body[len] = '\0';
+    char* const body_end = body + len;
+    for(char* line = body; line != body_end; ) {
+        char* eol = static_cast<char*>(std::memchr(line, '\n', body_end - line));
+        char* end = NULL != eol ? eol : body_end;
+        char* next = NULL != eol ? eol + 1 : body_end;
+        if(end != line && '\r' == end[-1]) {
+            end--;
+        }
+        if(end != line) {
+            *end = '\0';
+            LOG(common::log::err) << "response " << line
+                                  << (next == body_end && res->size() > max_logged_body ? "..." : "") << common::log::end;
+        }
+        line = next;
+    }
+}
+
+void make_request_with_body(const std::string& method,
+                            const std::string& path,
+                            const std::string& base_uri,
+                            const std::string& authorization,
+                            const Json::Value& body, 
+                            net::http_connection* http_connection,
+                            net::http_connection::http_request_ready_cb cb, 
+                            void *ctx
+                            ) {
+
+    Json::FastWriter writer;
+    std::string json_str = writer.write(body);
+
+    net::http_request* request = new net::http_request(method, path);
+    request->add_header("Host", base_uri);
+    request->add_header("Authorization", authorization);
+    request->add_header("Content-Type", "application/json");
+    request->data(json_str.c_str(), json_str.size());
+
+    http_connection->make_request(request, cb, ctx);
+
+}
+
+}
+
+dropbox_backend::dropbox_backend(
+    const std::string& base_uri,
+    const std::string& file_upload_uri,
+    std::uint16_t port,
+    const std::string& bearer,
+    event_base* evbase,
+    evdns_base* evdns,
+    SSL_CTX* ssl_ctx
+    )
+    : base_uri_(base_uri)
+    , file_upload_uri_(file_upload_uri)
+    , port_(port)
+    , authorization_("Bearer "+bearer)
+    , folder_("/_seccam_")
+    , evbase_(evbase)
+    , evdns_(evdns)
+    , ssl_ctx_(ssl_ctx)
+    , api_(nullptr)
+    , file_upload_(nullptr)
+    , list_cb_(NULL)
+    , list_ctx_(NULL)
+    , cache_(new folder_cache(""))
+    , remove_cb_(NULL)
+    , remove_ctx_(NULL)
+    , remove_count_(0)
+    , delete_poll_timer_(NULL)
+    , state_(list_idle) {
+
+    static const char* const upload_paths[upload_op_count] = {
+        "/2/files/upload",
+        "/2/files/upload_session/start",
+        "/2/files/upload_session/append_v2",
+        "/2/files/upload_session/finish"
+    };
+    for(int op = 0 ; op < upload_op_count ; op++) {
+        upload_templates_[op] = new request_template("POST", upload_paths[op]);
+        upload_templates_[op]->add_header("Host", file_upload_uri_);
+        upload_templates_[op]->add_header("Authorization", authorization_);
+        upload_templates_[op]->add_header("Content-Type", "application/octet-stream");
+    }
+
+    try {
+        api_ = new http_connection(base_uri_, port_, evbase_, evdns_, ssl_ctx_, &dropbox_backend::on_api_connection_lost, this);
+    } catch (const std::runtime_error& err) {
+        LOG(common::log::err) << "Cannot create http_connection to " << base_uri_ << common::log::end;
+        return;
+    }
+    
+    try {
+        file_upload_ = new http_connection(file_upload_uri_, port_, evbase_, evdns_, ssl_ctx_, &dropbox_backend::on_file_upload_connection_lost, this);
+    } catch (const std::runtime_error& err) {
+        delete api_;
+        LOG(common::log::err) << "Cannot create http_connection to " << file_upload_uri << common::log::end;
+        return;
+    }
+
+}
+
+dropbox_backend::~dropbox_backend() {
+    delete delete_poll_timer_;
+    delete cache_;
+    delete file_upload_;
+    delete api_;
+    for(int op = 0 ; op < upload_op_count ; op++) {
+        delete upload_templates_[op];
+    }
+}
+
+void dropbox_backend::set_upload_rate_limit_group(bufferevent_rate_limit_group* group) {
+    file_upload_->set_rate_limit_group(group);
+}
+
+void dropbox_backend::set_ktls(bool enable) {
+    file_upload_->set_ktls(enable);
+}
+
+void dropbox_backend::on_api_connection_lost(void* ctx) {
+    dropbox_backend* backend = static_cast<dropbox_backend*>(ctx);
+    backend->handle_on_api_connection_lost();
+}
+
+void dropbox_backend::handle_on_api_connection_lost() {
+    // http_connection reconnects by itself before the next request
+    LOG(common::log::info) << " api connection lost " << common::log::end;
+}
+
+void dropbox_backend::on_file_upload_connection_lost(void* ctx) {
+    dropbox_backend* backend = static_cast<dropbox_backend*>(ctx);
+    backend->handle_on_file_upload_connection_lost();
+}
+
+void dropbox_backend::handle_on_file_upload_connection_lost() {
+    // the chunk in flight fails through its own completion callback, the
+    // retry goes out on a fresh connection and resumes the upload session
+    // from the acknowledged offset
+    LOG(common::log::info) << " file upload connection lost " << common::log::end;
+}
+
+void dropbox_backend::set_cache_file(const std::string& path) {
+    delete cache_;
+    cache_ = new folder_cache(path);
+    cache_->load();
+}
+
+void dropbox_backend::list(list_cb cb, void* ctx) {
+    list_cb_ = cb;
+    list_ctx_ = ctx;
+    if(!cache_->cursor().empty()) {
+        list_changes(cache_->cursor());
+    } else {
+        cache_->clear();
+        list_folders();
+    }
+}
+
+void dropbox_backend::end_list(bool ok) {
+    state_ = list_idle;
+    std::vector<api_file> files;
+    if(ok) {
+        cache_->files(&files);
+    }
+    list_cb_(ok, files, list_ctx_);
+}
+
+#define CB_TO_MEMFUN(cb_fun, mem_fun) \
+    void dropbox_backend::cb_fun(http_request* req, http_response* res, void* ctx) { \
+        dropbox_backend* backend = static_cast<dropbox_backend*>(ctx); \
+        return backend->mem_fun(req, res); \
+    }
+
+void dropbox_backend::list_folders() {
+
+    if(state_ != list_idle) {
+        assert(state_ == list_idle);
+    }
+
+    state_ = listing_root_folder;
+
+    Json::Value root;
+    root["path"] = "";
+    root["recursive"] = false;
+    root["include_media_info"] = false;
+    root["include_deleted"] = false;
+    root["include_has_explicit_shared_members"] = false;
+
+    make_request_with_body("POST", "/2/files/list_folder", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_list_folders_complete, this
+                           );
+
+}
+
+
+CB_TO_MEMFUN(on_list_folders_complete, handle_on_list_folders_complete);
+
+void dropbox_backend::handle_on_list_folders_complete(http_request* req, http_response* res) {
+
+    if(state_ != listing_root_folder && state_ != listing_root_folder_continue) {
+        assert(state_ == listing_root_folder || state_ == listing_root_folder_continue);
+    }
+
+    if(!validate_response(res)) {
+        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
+        delete req;
+        delete res;
+        // listing_root_dir_failed
+        end_list(false);
+        return;
+    }
+
+    Json::Value json;
+    bool folder_found = false;
+    bool has_more = false;
+    bool proceeding = false;
+    if(parse_json(res, &json)) {
+        Json::Value& entries = json["entries"];
+        if(entries.isArray()) {
+            for(Json::ArrayIndex i = 0 ; i < entries.size() ; i++) {
+                Json::Value& entry = entries[i];
+                if(!entry.isObject()) {
+                    continue;
+                }
+                Json::Value& tag = entry[".tag"];
+                if(!tag.isString()) {
+                    continue;
+                }
+                if(tag.asString() == "folder") {
+                    Json::Value& path_lower = entry["path_lower"];
+                    if(!path_lower.isString()) {
+                        continue;
+                    }
+                    if(path_lower.asString() == folder_) {
+                        folder_found = true;
+                        break;
+                    }
+                }
+            }
+            if(!folder_found) {
+                Json::Value& has_more_resp = json["has_more"];
+                if(has_more_resp.isBool()) {
+                    has_more = has_more_resp.asBool();
+                    if(has_more) {
+                        Json::Value& cursor_resp = json["cursor"];
+                        if(cursor_resp.isString()) {
+                            std::string cursor = cursor_resp.asString();
+                            list_folders_continue(cursor);
+                            proceeding = true;
+                        } else {
+                            // listing_root_dir_failed
+                            LOG(common::log::err) << "invalid response format cursor missing" << common::log::end;
+                        }
+                    } else {
+                        create_app_folder();
+                        proceeding = true;
+                    }
+                } else {
+                    // listing_root_dir_failed
+                    LOG(common::log::err) << "invalid response format has_more missing" << common::log::end;
+                }
+            } else {
+                // folder found
+                list_app_folder();
+                proceeding = true;
+            }
+        } else {
+            // listing_root_dir_failed
+            LOG(common::log::err) << "invalid response format entries missing" << common::log::end;
+        }
+    } else {
+        // listing_root_dir_failed
+        LOG(common::log::err) << "failed to parse response" << common::log::end;
+    }
+
+    delete req;
+    delete res;
+
+    if(!proceeding) {
+        end_list(false);
+    }
+} 
+
+void dropbox_backend::list_folders_continue(const std::string& cursor) {
+
+    if(state_ != listing_root_folder && state_ != listing_root_folder_continue) {
+        assert(state_ == listing_root_folder || state_ == listing_root_folder_continue);
+    }
+
+    state_ = listing_root_folder_continue;
+
+    Json::Value root;
+    root["cursor"] = cursor;
+
+    make_request_with_body("POST", "/2/files/list_folder/continue", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_list_folders_complete, this
+                           );
+
+}
+
+void dropbox_backend::create_app_folder() {
+
+    if(state_ != listing_root_folder && state_ != listing_root_folder_continue) {
+        assert(state_ == listing_root_folder || state_ == listing_root_folder_continue);
+    }
+
+    state_ = creating_app_folder;
+
+    Json::Value root;
+    root["path"] = folder_;
+    root["autorename"] = false;
+
+    make_request_with_body("POST", "/2/files/create_folder_v2", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_create_folder_complete, this
+                           );
+
+}
+
+CB_TO_MEMFUN(on_create_folder_complete, handle_on_create_folder_complete);
+
+void dropbox_backend::handle_on_create_folder_complete(http_request* req, http_response* res) {
+
+    if(state_ != creating_app_folder) {
+        assert(state_ == creating_app_folder);
+    }
+
+    if(!validate_response(res)) {
+        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
+        delete res;
+        delete req;
+        end_list(false);
+        return;
+    }
+
+    Json::Value json;
+    if(parse_json(res, &json)) {
+        Json::Value& metadata = json["metadata"];
+        if(metadata.isObject()) {
+            Json::Value& path_lower_resp = metadata["path_lower"];
+            if(path_lower_resp.isString()) {
+                std::string path_lower = path_lower_resp.asString();
+                if(path_lower == folder_) {
+                    // listing the empty folder yields the cursor for later runs
+                    list_app_folder();
+                } else {
+                    LOG(common::log::err) << "returned path is " << path_lower << common::log::end;
+                }
+            } else {
+                LOG(common::log::err) << "malformed create folder response" << common::log::end;
+            }
+        } else {
+            LOG(common::log::err) << "create folder failed" << common::log::end;
+        }
+    } else {
+        LOG(common::log::err) << "failed to parse response" << common::log::end;
+    }
+
+    delete req;
+    delete res;
+
+    if(state_ == creating_app_folder) {
+        end_list(false);
+    }
+}
+
+
+void dropbox_backend::list_app_folder() {
+
+    if(state_ != listing_root_folder && state_ != listing_root_folder_continue && state_ != creating_app_folder) {
+        assert(state_ == listing_root_folder ||
+               state_ == listing_root_folder_continue ||
+               state_ == creating_app_folder);
+    }
+
+    state_ = listing_app_folder;
+
+    Json::Value root;
+    root["path"] = folder_;
+    root["recursive"] = false;
+    root["include_media_info"] = false;
+    root["include_deleted"] = false;
+    root["include_has_explicit_shared_members"] = false;
+
+    make_request_with_body("POST", "/2/files/list_folder", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_list_app_folder_complete, this
+                           );
+
+}
+
+CB_TO_MEMFUN(on_list_app_folder_complete, handle_on_list_app_folder_complete);
+
+void dropbox_backend::list_app_folder_continue(const std::string& cursor) {
+
+    if(state_ != listing_app_folder && state_ != listing_app_folder_continue) {
+        assert(state_ == listing_app_folder || state_ == listing_app_folder_continue);
+    }
+
+    state_ = listing_app_folder_continue;
+
+    Json::Value root;
+    root["cursor"] = cursor;
+
+    make_request_with_body("POST", "/2/files/list_folder/continue", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_list_app_folder_complete, this
+                           );
+
+}
+
+void dropbox_backend::list_changes(const std::string& cursor) {
+
+    if(state_ != list_idle && state_ != listing_changes) {
+        assert(state_ == list_idle || state_ == listing_changes);
+    }
+
+    state_ = listing_changes;
+
+    Json::Value root;
+    root["cursor"] = cursor;
+
+    make_request_with_body("POST", "/2/files/list_folder/continue", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_list_app_folder_complete, this
+                           );
+
+}
+
+void dropbox_backend::handle_on_list_app_folder_complete(http_request* req, http_response* res) {
+
+    if(state_ != listing_app_folder && state_ != listing_app_folder_continue && state_ != listing_changes) {
+        assert(state_ == listing_app_folder ||
+               state_ == listing_app_folder_continue ||
+               state_ == listing_changes);
+    }
+
+    if(!validate_response(res)) {
+        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
+        // 409 means the saved cursor is no longer valid, start over
+        bool reset = state_ == listing_changes && res != nullptr && res->response_code() == 409;
+        delete res;
+        delete req;
+        if(reset) {
+            LOG(common::log::info) << "folder cache is stale, listing from scratch" << common::log::end;
+            cache_->clear();
+            state_ = list_idle;
+            list_folders();
+        } else {
+            end_list(false);
+        }
+        return;
+    }
+
+    std::string cursor;
+    bool has_more = false;
+    bool listed = scan_list_page(res->body(), res->size(), folder_, cache_, &cursor, &has_more);
+    if(listed && has_more && state_ == listing_changes) {
+        list_changes(cursor);
+    } else if(listed && has_more) {
+        list_app_folder_continue(cursor);
+    } else if(listed) {
+        cache_->cursor(cursor);
+    }
+
+    delete req;
+    delete res;
+
+    if(!listed) {
+        end_list(false);
+    } else if(!has_more) {
+        LOG(common::log::info) << "app folder listed, " << static_cast<unsigned long>(cache_->size()) << " files" << common::log::end;
+        cache_->save();
+        end_list(true);
+    }
+}
+
+
+void dropbox_backend::put(upload_session* upload, put_cb cb, void* ctx) {
+    // a single request always carries the whole segment
+    upload->offset = 0;
+    send_upload(upload, upload_whole, upload->seg->size(), cb, ctx);
+}
+
+void dropbox_backend::put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx) {
+    const std::size_t remaining = upload->seg->size() - upload->offset;
+    if(upload->session_id.empty()) {
+        upload->offset = 0;
+        send_upload(upload, upload_session_start, std::min(upload->seg->size(), chunk_size), cb, ctx);
+    } else if(remaining <= chunk_size) {
+        send_upload(upload, upload_session_finish, remaining, cb, ctx);
+    } else {
+        send_upload(upload, upload_session_append, chunk_size, cb, ctx);
+    }
+}
+
+class dropbox_backend::upload_handler {
+public:
+    upload_handler(dropbox_backend* backend, upload_session* upload, upload_op op, std::size_t chunk_end,
+                   put_cb cb, void* ctx)
+        : backend_(backend)
+        , upload_(upload)
+        , op_(op)
+        , chunk_end_(chunk_end)
+        , cb_(cb)
+        , ctx_(ctx) {
+
+    }
+    ~upload_handler() {
+
+    }
+private:
+    upload_handler(const upload_handler&) = delete;
+    void operator=(const upload_handler&) = delete;
+public:
+    void execute(net::http_request* req, net::http_response* res) {
+        backend_->handle_on_upload_complete(req, res, upload_, op_, chunk_end_, cb_, ctx_);
+    }
+private:
+    dropbox_backend* backend_;
+    upload_session* upload_;
+    upload_op op_;
+    std::size_t chunk_end_;
+    put_cb cb_;
+    void* ctx_;
+};
+
+void dropbox_backend::send_upload(upload_session* upload, upload_op op, std::size_t chunk_len, put_cb cb, void* ctx) {
+
+    if(op == upload_whole) {
+        write_upload_arg(&upload_arg_, folder_, upload->name);
+    } else if(op == upload_session_start) {
+        write_session_start_arg(&upload_arg_);
+    } else if(op == upload_session_finish) {
+        write_session_finish_arg(&upload_arg_, upload->session_id, upload->offset, folder_, upload->name);
+    } else {
+        write_session_append_arg(&upload_arg_, upload->session_id, upload->offset);
+    }
+
+    net::http_request* request = upload_templates_[op]->make();
+    request->add_header("Dropbox-API-Arg", upload_arg_.c_str());
+
+    if(0 != chunk_len) {
+        request->reference_data(upload->seg->buffer()+upload->offset, chunk_len);
+    }
+
+    LOG(common::log::debug) << "upload " << request->path() << " offset=" << upload->offset << " len=" << chunk_len << common::log::end;
+
+    file_upload_->make_request(request, dropbox_backend::on_upload_complete,
+                               new upload_handler(this, upload, op, upload->offset+chunk_len, cb, ctx));
+
+}
+
+void dropbox_backend::on_upload_complete(http_request* req, http_response* res, void* ctx) {
+    upload_handler* hnd = static_cast<upload_handler*>(ctx);
+    hnd->execute(req, res);
+    delete hnd;
+}
+
+bool dropbox_backend::process_upload_error(http_response* res, upload_session* upload, put_result* result) {
+    // append_v2 reports the offset error at the top level, finish nests it
+    // under lookup_failed. both mean the session is still usable.
+    if(nullptr == res || res->response_code() != 409 || upload->session_id.empty()) {
+        return false;
+    }
+
+    Json::Value json;
+    if(!parse_json(res, &json)) {
+        return false;
+    }
+
+    Json::Value& error = json["error"];
+    if(!error.isObject()) {
+        return false;
+    }
+    const bool nested = error[".tag"].isString() && error[".tag"].asString() == "lookup_failed";
+    Json::Value& lookup_error = nested ? error["lookup_failed"] : error;
+    if(!lookup_error.isObject() || !lookup_error[".tag"].isString()) {
+        return false;
+    }
+
+    std::string tag = lookup_error[".tag"].asString();
+    if(tag == "incorrect_offset") {
+        Json::Value& correct_offset = lookup_error["correct_offset"];
+        if(!correct_offset.isUInt64() || correct_offset.asUInt64() > upload->seg->size()) {
+            LOG(common::log::err) << "invalid correct_offset" << common::log::end;
+            return false;
+        }
+        LOG(common::log::info) << "resuming " << upload->name << " at offset " << static_cast<unsigned long>(correct_offset.asUInt64())
+                               << " instead of " << static_cast<unsigned long>(upload->offset) << common::log::end;
+        upload->offset = correct_offset.asUInt64();
+        return true;
+    } else if(tag == "not_found" || tag == "closed") {
+        LOG(common::log::info) << "upload session for " << upload->name << " is gone, restarting" << common::log::end;
+        upload->session_id.clear();
+        upload->offset = 0;
+        // through the publisher's backoff, a session that keeps coming
+        // back closed is not restarted in a loop
+        result->status = put_result::retry;
+        return true;
+    }
+    return false;
+}
+
+void dropbox_backend::classify_failure(http_response* res, put_result* result) {
+    result->status = put_result::failed;
+    if(nullptr == res || 0 == res->response_code()) {
+        result->status = put_result::retry; // connection failure
+        return;
+    }
+    int code = res->response_code();
+    if(code == 429 || code >= 500) {
+        result->status = put_result::retry;
+        const char* retry_after = res->header("Retry-After");
+        if(NULL != retry_after && std::isdigit(static_cast<unsigned char>(retry_after[0]))) {
+            // delay-seconds only, an HTTP date or garbage is ignored
+            char* end = NULL;
+            unsigned long sec = std::strtoul(retry_after, &end, 10);
+            if('\0' == *end) {
+                result->retry_after_ms = static_cast<std::uint32_t>(std::min(sec, max_retry_after_sec) * 1000);
+            }
+        }
+        // rate limits apply to the whole account
+        result->throttled = code == 429;
+    } else if(code == 408) {
+        result->status = put_result::retry;
+    }
+}
+
+void dropbox_backend::handle_on_upload_complete(http_request* req,
+                                                http_response* res,
+                                                upload_session* upload,
+                                                upload_op op,
+                                                std::size_t chunk_end,
+                                                put_cb cb,
+                                                void* ctx
+                                                ) {
+
+    put_result result;
+    result.status = put_result::progress;
+    result.retry_after_ms = 0;
+    result.throttled = false;
+
+    if(!validate_response(res)) {
+        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
+        // a corrected offset is progress as well, the next chunk goes out
+        // from the new offset. a lost session is retried from the start.
+        if(!process_upload_error(res, upload, &result)) {
+            classify_failure(res, &result);
+        }
+        delete res;
+        delete req;
+        cb(result, ctx);
+        return;
+    }
+
+    if(op == upload_session_append) {
+        // append_v2 answers with an empty (null) body
+        upload->offset = chunk_end;
+    } else if(op == upload_session_start) {
+        if(scan_session_id(res->body(), res->size(), &upload->session_id)) {
+            upload->offset = chunk_end;
+        } else {
+            result.status = put_result::retry;
+        }
+    } else if(scan_file_metadata(res->body(), res->size(), &result.file)) {
+        result.status = put_result::committed;
+    } else {
+        LOG(common::log::err) << "failed to process response" << common::log::end;
+        result.status = put_result::retry;
+    }
+
+    delete req;
+    delete res;
+
+    cb(result, ctx);
+}
+
+void dropbox_backend::remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx) {
+    assert(0 == remove_count_);
+
+    remove_cb_ = cb;
+    remove_ctx_ = ctx;
+    remove_count_ = paths.size();
+
+    Json::Value root;
+    Json::Value& entries = root["entries"];
+    entries = Json::Value(Json::arrayValue);
+    for(std::size_t i = 0 ; i < paths.size() ; i++) {
+        Json::Value entry;
+        entry["path"] = paths[i];
+        entries.append(entry);
+    }
+
+    make_request_with_body("POST", "/2/files/delete_batch", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_delete_batch_complete, this
+                           );
+}
+
+CB_TO_MEMFUN(on_delete_batch_complete, handle_on_delete_batch_complete);
+
+void dropbox_backend::handle_on_delete_batch_complete(http_request* req, http_response* res) {
+
+    assert(0 != remove_count_);
+
+    std::vector<bool> removed;
+    bool finished = true;
+    if(validate_response(res)) {
+        finished = process_delete_batch_response(res, &removed);
+    } else {
+        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
+    }
+
+    delete req;
+    delete res;
+
+    if(finished) {
+        remove_count_ = 0;
+        delete_job_id_.clear();
+        remove_cb_(removed, remove_ctx_);
+    }
+}
+
+bool dropbox_backend::process_delete_batch_response(http_response* res, std::vector<bool>* removed) {
+    // returns false while the batch job is still running on the server
+    std::string tag;
+    std::string job_id;
+    std::vector<bool> entries;
+    if(!scan_delete_batch(res->body(), res->size(), &tag, &job_id, &entries)) {
+        return true;
+    }
+
+    if(tag == "async_job_id" || tag == "in_progress") {
+        if(tag == "async_job_id") {
+            delete_job_id_ = job_id;
+        }
+        delete_poll_timer_ = new net::timer(evbase_, 1000, &dropbox_backend::on_delete_batch_poll, this);
+        return false;
+    } else if(tag != "complete") {
+        LOG(common::log::err) << "delete batch " << tag << common::log::end;
+        return true;
+    }
+
+    // entries are reported in the order of the request
+    if(entries.size() != remove_count_) {
+        LOG(common::log::err) << "invalid response format entries do not match the batch" << common::log::end;
+        return true;
+    }
+    removed->swap(entries);
+    return true;
+}
+
+void dropbox_backend::on_delete_batch_poll(void* ctx) {
+    static_cast<dropbox_backend*>(ctx)->handle_on_delete_batch_poll();
+}
+
+void dropbox_backend::handle_on_delete_batch_poll() {
+    delete_poll_timer_ = NULL; // deletes itself
+
+    Json::Value root;
+    root["async_job_id"] = delete_job_id_;
+
+    make_request_with_body("POST", "/2/files/delete_batch/check", base_uri_, authorization_, root,
+                           api_, &dropbox_backend::on_delete_batch_complete, this
+                           );
+}
+
+bool dropbox_backend::validate_response(http_response* res) {
+    if(res == nullptr) {
+        return false;
+    } else if (res->response_code() != 200) {
+        LOG(common::log::err) << "failed with " << res->response_code() << " " << res->response_phrase() << common::log::end;
+        if(res->size() != 0) {
+            log_body(res);
+        }
+        return false;
+    } else {
+        return true;
+    }
+}
@@ -0,0 +1,148 @@
+#ifndef DROPBOX_BACKEND_H
+#define DROPBOX_BACKEND_H
+
+#include "storage_backend.h"
+
+#include <openssl/ssl.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct event_base;
+struct evdns_base;
+struct bufferevent_rate_limit_group;
+
+namespace Json {
+    class Value;
+}
+
+namespace net {
+
+class http_connection;
+class http_request;
+class http_response;
+class timer;
+class folder_cache;
+class request_template;
+
+// segments live in the /_seccam_ folder of a Dropbox app, metadata goes
+// through the api host and file contents through the content host
+class dropbox_backend : public storage_backend {
+public:
+    dropbox_backend(const std::string& base_uri,
+                    const std::string& file_upload_uri,
+                    std::uint16_t port,
+                    const std::string& bearer,
+                    event_base* evbase,
+                    evdns_base* evdns,
+                    SSL_CTX* ssl_ctx
+                    );
+    ~dropbox_backend();
+public:
+    void list(list_cb cb, void* ctx);
+    void put(upload_session* upload, put_cb cb, void* ctx);
+    void put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx);
+    void remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx);
+public:
+    // shapes the content connection, metadata requests are not limited
+    void set_upload_rate_limit_group(bufferevent_rate_limit_group* group);
+    // kernel TLS on the content connection. segment bytes then go from
+    // their buffer to the socket without being encrypted in userspace
+    void set_ktls(bool enable);
+    // keeps the folder listing in @arg1 so that list() only fetches the
+    // changes made since the previous run
+    void set_cache_file(const std::string& path);
+private:
+    static void on_api_connection_lost(void*);
+    void handle_on_api_connection_lost();
+
+    static void on_file_upload_connection_lost(void*);
+    void handle_on_file_upload_connection_lost();
+private:
+    void list_folders();
+    void list_folders_continue(const std::string& cursor);
+private:
+    void list_app_folder();
+    void list_app_folder_continue(const std::string& cursor);
+    void list_changes(const std::string& cursor);
+
+    void create_app_folder();
+private:
+    void end_list(bool ok);
+private:
+    static void on_list_folders_complete(http_request*, http_response*, void*);
+    void handle_on_list_folders_complete(http_request*, http_response*);
+
+    static void on_create_folder_complete(http_request*, http_response*, void*);
+    void handle_on_create_folder_complete(http_request*, http_response*);
+
+    static void on_list_app_folder_complete(http_request*, http_response*, void*);
+    void handle_on_list_app_folder_complete(http_request*, http_response*);
+private:
+    enum upload_op {
+        upload_whole,
+        upload_session_start,
+        upload_session_append,
+        upload_session_finish,
+        upload_op_count
+    };
+
+    void send_upload(upload_session* upload, upload_op op, std::size_t chunk_len, put_cb cb, void* ctx);
+
+    class upload_handler;
+    static void on_upload_complete(http_request*, http_response*, void*);
+    void handle_on_upload_complete(http_request*, http_response*, upload_session* upload, upload_op op,
+                                   std::size_t chunk_end, put_cb cb, void* ctx);
+private:
+    static void on_delete_batch_complete(http_request*, http_response*, void*);
+    void handle_on_delete_batch_complete(http_request*, http_response*);
+
+    static void on_delete_batch_poll(void* ctx);
+    void handle_on_delete_batch_poll();
+
+    bool process_delete_batch_response(http_response* res, std::vector<bool>* removed);
+private:
+    bool process_upload_error(http_response* res, upload_session* upload, put_result* result);
+    void classify_failure(http_response* res, put_result* result);
+private:
+    bool validate_response(http_response* resp);
+private:
+    std::string base_uri_;
+    std::string file_upload_uri_;
+    std::uint16_t port_;
+    std::string authorization_;
+    std::string folder_;
+    event_base* evbase_;
+    evdns_base* evdns_;
+    SSL_CTX* ssl_ctx_;
+    http_connection* api_;
+    http_connection* file_upload_;
+    list_cb list_cb_;
+    void* list_ctx_;
+    folder_cache* cache_;
+    remove_cb remove_cb_;
+    void* remove_ctx_;
+    std::size_t remove_count_;
+    std::string delete_job_id_;
+    timer* delete_poll_timer_;
+    // one per upload_op, Dropbox-API-Arg is written into upload_arg_
+    request_template* upload_templates_[upload_op_count];
+    std::string upload_arg_;
+private:
+    enum list_state {
+        list_idle,
+        listing_root_folder,
+        listing_root_folder_continue,
+        creating_app_folder,
+        listing_app_folder,
+        listing_app_folder_continue,
+        listing_changes
+    };
+private:
+    list_state state_;
+};
+
+}
+
+#endif // DROPBOX_BACKEND_H
@@ -0,0 +1,359 @@
+#include "dropbox_json.h"
+
+#include "json_scanner.h"
+#include "folder_cache.h"
+
+#include "logging/log.h"
+
+#include <cstdlib>
+
+using net::json_scanner;
+
+namespace {
+
+bool open_object(json_scanner* scanner) {
+    if(scanner->next() != json_scanner::object_begin) {
+        LOG(common::log::err) << "cannot parse data" << common::log::end;
+        return false;
+    }
+    return true;
+}
+
+// the value of the member whose name was just read. anything but a string
+// leaves @arg2 empty
+bool read_string(json_scanner* scanner, std::string* out) {
+    scanner->next();
+    scanner->value(out);
+    return scanner->skip();
+}
+
+bool read_int(json_scanner* scanner, int* out) {
+    *out = scanner->next() == json_scanner::number ? static_cast<int>(scanner->int_value()) : 0;
+    return scanner->skip();
+}
+
+bool skip_value(json_scanner* scanner) {
+    scanner->next();
+    return scanner->skip();
+}
+
+// the members of a listed entry that are in use. the strings keep their
+// buffers from one entry to the next
+bool scan_entry(json_scanner* scanner, std::string* tag, api_file* file) {
+    tag->clear();
+    file->filename.clear();
+    file->path.clear();
+    file->last_modified.clear();
+    file->size = 0;
+    bool ok = true;
+    while(ok && scanner->next() == json_scanner::string) {
+        if(scanner->equals(".tag")) {
+            ok = read_string(scanner, tag);
+        } else if(scanner->equals("name")) {
+            ok = read_string(scanner, &file->filename);
+        } else if(scanner->equals("path_lower")) {
+            ok = read_string(scanner, &file->path);
+        } else if(scanner->equals("client_modified")) {
+            ok = read_string(scanner, &file->last_modified);
+        } else if(scanner->equals("size")) {
+            ok = read_int(scanner, &file->size);
+        } else {
+            ok = skip_value(scanner);
+        }
+    }
+    return ok && scanner->current() == json_scanner::object_end;
+}
+
+void apply_entry(const std::string& tag, api_file* file, const std::string& folder, net::folder_cache* cache) {
+    if(tag.empty()) {
+        LOG(common::log::info) << "skip invalid entry" << common::log::end;
+    } else if(tag == "file") {
+        if(!net::file_index::parse_name(file->filename, file)) {
+            LOG(common::log::err) <<  "invalid file " << file->filename << common::log::end;
+            return;
+        }
+        cache->put(*file);
+    } else if(tag == "deleted") {
+        if(file->path == folder) {
+            cache->clear();
+        } else {
+            cache->remove(file->path);
+        }
+    } else {
+        LOG(common::log::err) << "found unexpected entry " << tag << " ignoring" << common::log::end;
+    }
+}
+
+bool scan_entries(json_scanner* scanner, const std::string& folder, net::folder_cache* cache) {
+    std::string tag;
+    api_file file = api_file();
+    while(scanner->next() != json_scanner::array_end) {
+        if(scanner->current() == json_scanner::object_begin) {
+            if(!scan_entry(scanner, &tag, &file)) {
+                return false;
+            }
+            apply_entry(tag, &file, folder, cache);
+        } else if(scanner->skip()) {
+            LOG(common::log::info) << "skip invalid entry" << common::log::end;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// the contents of a JSON string, without the quotes
+void append_escaped(std::string* out, const std::string& str) {
+    static const char hex[] = "0123456789abcdef";
+    for(std::size_t i = 0 ; i < str.size() ; i++) {
+        const unsigned char c = str[i];
+        if(c == '"' || c == '\\') {
+            out->push_back('\\');
+            out->push_back(c);
+        } else if(c < 0x20) {
+            out->append("\\u00");
+            out->push_back(hex[c >> 4]);
+            out->push_back(hex[c & 0xf]);
+        } else {
+            out->push_back(c);
+        }
+    }
+}
+
+void append_json_string(std::string* out, const std::string& str) {
+    out->push_back('"');
+    append_escaped(out, str);
+    out->push_back('"');
+}
+
+void append_path(std::string* out, const std::string& folder, const std::string& name) {
+    out->append("\"path\":\"");
+    append_escaped(out, folder);
+    out->push_back('/');
+    append_escaped(out, name);
+    out->push_back('"');
+}
+
+void append_number(std::string* out, std::uint64_t value) {
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    do {
+        *--p = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while(value != 0);
+    out->append(p, buf + sizeof(buf));
+}
+
+void append_cursor(std::string* out, const std::string& session_id, std::uint64_t offset) {
+    out->append("\"cursor\":{\"session_id\":");
+    append_json_string(out, session_id);
+    out->append(",\"offset\":");
+    append_number(out, offset);
+    out->push_back('}');
+}
+
+// true if the entry is gone from the server
+bool scan_delete_entry(json_scanner* scanner, std::size_t index) {
+    bool success = false;
+    bool not_found = false;
+    std::string failure_tag;
+    bool ok = true;
+    while(ok && scanner->next() == json_scanner::string) {
+        if(scanner->equals(".tag")) {
+            scanner->next();
+            success = scanner->equals("success");
+            ok = scanner->skip();
+        } else if(scanner->equals("failure") && scanner->next() == json_scanner::object_begin) {
+            // {".tag": "path_lookup", "path_lookup": {".tag": "not_found"}}
+            while(ok && scanner->next() == json_scanner::string) {
+                if(scanner->equals(".tag")) {
+                    ok = read_string(scanner, &failure_tag);
+                } else if(scanner->equals("path_lookup") && scanner->next() == json_scanner::object_begin) {
+                    while(ok && scanner->next() == json_scanner::string) {
+                        if(scanner->equals(".tag")) {
+                            scanner->next();
+                            not_found = scanner->equals("not_found");
+                            ok = scanner->skip();
+                        } else {
+                            ok = skip_value(scanner);
+                        }
+                    }
+                } else {
+                    ok = scanner->is_key() ? skip_value(scanner) : scanner->skip();
+                }
+            }
+        } else {
+            ok = scanner->is_key() ? skip_value(scanner) : scanner->skip();
+        }
+    }
+
+    bool gone = success || (failure_tag == "path_lookup" && not_found);
+    if(!gone) {
+        LOG(common::log::err) << "cannot delete entry " << static_cast<unsigned long>(index) << " " << failure_tag << common::log::end;
+    }
+    return gone;
+}
+
+}
+
+bool net::scan_list_page(const char* body,
+                         std::size_t len,
+                         const std::string& folder,
+                         folder_cache* cache,
+                         std::string* cursor,
+                         bool* has_more) {
+
+    json_scanner scanner(body, body+len);
+    if(!open_object(&scanner)) {
+        return false;
+    }
+
+    bool entries_found = false;
+    bool has_more_found = false;
+    bool ok = true;
+    while(ok && scanner.next() == json_scanner::string) {
+        if(scanner.equals("entries")) {
+            if(scanner.next() == json_scanner::array_begin) {
+                entries_found = true;
+                ok = scan_entries(&scanner, folder, cache);
+            } else {
+                ok = scanner.skip();
+            }
+        } else if(scanner.equals("has_more")) {
+            has_more_found = scanner.next() == json_scanner::boolean;
+            *has_more = scanner.bool_value();
+            ok = scanner.skip();
+        } else if(scanner.equals("cursor")) {
+            ok = read_string(&scanner, cursor);
+        } else {
+            ok = skip_value(&scanner);
+        }
+    }
+
+    if(!ok || scanner.current() != json_scanner::object_end) {
+        LOG(common::log::err) << "failed to parse the response" << common::log::end;
+        return false;
+    } else if(!entries_found) {
+        LOG(common::log::err) << "invalid response format entries missing" << common::log::end;
+        return false;
+    } else if(!has_more_found) {
+        LOG(common::log::err) << "invalid response format has_more missing" << common::log::end;
+        return false;
+    }
+    return true;
+}
+
+bool net::scan_file_metadata(const char* body, std::size_t len, api_file* file) {
+    json_scanner scanner(body, body+len);
+    if(!open_object(&scanner)) {
+        return false;
+    }
+
+    std::string tag;
+    if(!scan_entry(&scanner, &tag, file) || file->filename.empty() || file->path.empty() || file->last_modified.empty()) {
+        LOG(common::log::err) << "invalid response" << common::log::end;
+        return false;
+    }
+    if(!file_index::parse_name(file->filename, file)) {
+        LOG(common::log::err) << "invalid response filename is not a segment name" << common::log::end;
+        return false;
+    }
+    return true;
+}
+
+bool net::scan_session_id(const char* body, std::size_t len, std::string* session_id) {
+    json_scanner scanner(body, body+len);
+    if(!open_object(&scanner)) {
+        return false;
+    }
+
+    session_id->clear();
+    bool ok = true;
+    while(ok && scanner.next() == json_scanner::string) {
+        if(scanner.equals("session_id")) {
+            ok = read_string(&scanner, session_id);
+        } else {
+            ok = skip_value(&scanner);
+        }
+    }
+    if(!ok || scanner.current() != json_scanner::object_end || session_id->empty()) {
+        LOG(common::log::err) << "invalid response format session_id missing" << common::log::end;
+        return false;
+    }
+    return true;
+}
+
+bool net::scan_delete_batch(const char* body,
+                            std::size_t len,
+                            std::string* tag,
+                            std::string* job_id,
+                            std::vector<bool>* removed) {
+
+    json_scanner scanner(body, body+len);
+    if(!open_object(&scanner)) {
+        return false;
+    }
+
+    tag->clear();
+    job_id->clear();
+    bool ok = true;
+    while(ok && scanner.next() == json_scanner::string) {
+        if(scanner.equals(".tag")) {
+            ok = read_string(&scanner, tag);
+        } else if(scanner.equals("async_job_id")) {
+            ok = read_string(&scanner, job_id);
+        } else if(scanner.equals("entries") && scanner.next() == json_scanner::array_begin) {
+            while(ok && scanner.next() != json_scanner::array_end) {
+                if(scanner.current() == json_scanner::object_begin) {
+                    removed->push_back(scan_delete_entry(&scanner, removed->size()));
+                    ok = scanner.current() == json_scanner::object_end;
+                } else {
+                    ok = scanner.skip();
+                }
+            }
+        } else {
+            ok = scanner.is_key() ? skip_value(&scanner) : scanner.skip();
+        }
+    }
+
+    if(!ok || scanner.current() != json_scanner::object_end) {
+        LOG(common::log::err) << "failed to parse response" << common::log::end;
+        return false;
+    } else if(tag->empty()) {
+        LOG(common::log::err) << "invalid response format .tag missing" << common::log::end;
+        return false;
+    }
+    return true;
+}
+
+void net::write_upload_arg(std::string* out, const std::string& folder, const std::string& name) {
+    out->assign("{");
+    append_path(out, folder, name);
+    out->push_back('}');
+}
+
+void net::write_session_start_arg(std::string* out) {
+    out->assign("{\"close\":false}");
+}
+
+void net::write_session_append_arg(std::string* out, const std::string& session_id, std::uint64_t offset) {
+    out->assign("{");
+    append_cursor(out, session_id, offset);
+    out->append(",\"close\":false}");
+}
+
+void net::write_session_finish_arg(std::string* out,
+                                   const std::string& session_id,
+                                   std::uint64_t offset,
+                                   const std::string& folder,
+                                   const std::string& name) {
+    out->assign("{");
+    append_cursor(out, session_id, offset);
+    out->append(",\"commit\":{");
+    append_path(out, folder, name);
+    out->append(",\"mode\":\"add\",\"autorename\":false,\"mute\":true}}");
+}
+
+void net::write_json_string(std::string* out, const std::string& str) {
+    append_json_string(out, str);
+}
@@ -0,0 +1,59 @@
+#ifndef DROPBOX_JSON_H
+#define DROPBOX_JSON_H
+
+#include "api_file.h"
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace net {
+
+class folder_cache;
+
+// readers for the response bodies that arrive with every listed page and
+// every uploaded segment. they pull the few fields in use out of the body
+// with json_scanner, nothing else of the response is kept.
+
+// applies the entries of a list_folder page to @arg4 while reading it.
+// a deleted @arg3 empties the cache.
+bool scan_list_page(const char* body,
+                    std::size_t len,
+                    const std::string& folder,
+                    folder_cache* cache,
+                    std::string* cursor,
+                    bool* has_more);
+
+// metadata of a committed upload
+bool scan_file_metadata(const char* body, std::size_t len, api_file* file);
+
+bool scan_session_id(const char* body, std::size_t len, std::string* session_id);
+
+// @arg3 is the .tag of the batch, @arg4 the async_job_id if there is one.
+// a complete batch adds one flag per entry to @arg5, a path that is
+// already gone counts as removed.
+bool scan_delete_batch(const char* body,
+                       std::size_t len,
+                       std::string* tag,
+                       std::string* job_id,
+                       std::vector<bool>* removed);
+
+// Dropbox-API-Arg of the upload endpoints. each writer replaces the
+// contents of @arg1 and keeps its capacity, so a reused string stops
+// allocating after the first segment.
+void write_upload_arg(std::string* out, const std::string& folder, const std::string& name);
+void write_session_start_arg(std::string* out);
+void write_session_append_arg(std::string* out, const std::string& session_id, std::uint64_t offset);
+void write_session_finish_arg(std::string* out,
+                              const std::string& session_id,
+                              std::uint64_t offset,
+                              const std::string& folder,
+                              const std::string& name);
+
+// appends @arg2 quoted and escaped
+void write_json_string(std::string* out, const std::string& str);
+
+}
+
+#endif // DROPBOX_JSON_H
@@ -0,0 +1,342 @@
+#include "file_index.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+
+using net::file_index;
+
+namespace {
+
+const std::uint32_t snapshot_magic = 0x58494353; // "SCIX"
+// version 1 had a 16-bit prefix and no seq, such a snapshot is not read
+// and the folder is listed again
+const std::uint32_t snapshot_version = 2;
+
+class key_less {
+public:
+    bool operator()(const file_index::entry& e, std::int64_t key) const {
+        return file_index::key(e) < key;
+    }
+};
+
+class timestamp_less {
+public:
+    bool operator()(const file_index::entry& e, int timestamp) const {
+        return e.timestamp < timestamp;
+    }
+    bool operator()(int timestamp, const file_index::entry& e) const {
+        return timestamp < e.timestamp;
+    }
+};
+
+std::uint32_t parse_modified(const std::string& str) {
+    std::tm tm = std::tm();
+    if(6 != std::sscanf(str.c_str(), "%d-%d-%dT%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                        &tm.tm_hour, &tm.tm_min, &tm.tm_sec)) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    std::time_t t = timegm(&tm);
+    return t > 0 ? static_cast<std::uint32_t>(t) : 0;
+}
+
+std::string format_modified(std::uint32_t modified) {
+    if(0 == modified) {
+        return std::string();
+    }
+    std::time_t t = modified;
+    std::tm tm;
+    gmtime_r(&t, &tm);
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+template<typename T>
+void write_pod(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template<typename T>
+bool read_pod(std::istream& in, T* value) {
+    return static_cast<bool>(in.read(reinterpret_cast<char*>(value), sizeof(*value)));
+}
+
+}
+
+file_index::file_index()
+    : bytes_(0) {
+
+}
+
+file_index::~file_index() {
+
+}
+
+std::string file_index::name(int start, int end, int seq) {
+    assert(seq >= 0 && seq <= max_seq && (0 == seq || end > start));
+    if(end <= start) {
+        return std::to_string(start);
+    }
+    if(0 == seq) {
+        return std::to_string(start) + "-" + std::to_string(end);
+    }
+    return std::to_string(start) + "-" + std::to_string(end) + "-" + std::to_string(seq);
+}
+
+bool file_index::parse_name(const std::string& name, api_file* file) {
+    const char* begin = name.c_str();
+    char* end = NULL;
+    long start = std::strtol(begin, &end, 10);
+    if(end == begin || start <= 0 || start > 0x7fffffff) {
+        return false;
+    }
+    file->timestamp = static_cast<int>(start);
+    file->end_timestamp = 0;
+    file->seq = 0;
+    if('\0' == *end) {
+        return true;
+    }
+    if('-' != *end) {
+        return false;
+    }
+    begin = end + 1;
+    long stop = std::strtol(begin, &end, 10);
+    // the duration has to fit the entry
+    if(end == begin || stop <= start || stop - start > 0xffff) {
+        return false;
+    }
+    file->end_timestamp = static_cast<int>(stop);
+    if('\0' == *end) {
+        return true;
+    }
+    if('-' != *end) {
+        return false;
+    }
+    // the first of a second has none, so no 0 here
+    begin = end + 1;
+    long seq = std::strtol(begin, &end, 10);
+    if(end == begin || '\0' != *end || seq <= 0 || seq > max_seq) {
+        return false;
+    }
+    file->seq = static_cast<int>(seq);
+    return true;
+}
+
+std::int64_t file_index::key(int timestamp, int seq) {
+    return static_cast<std::int64_t>(timestamp) << 8 | seq;
+}
+
+std::int64_t file_index::key(const entry& e) {
+    return key(e.timestamp, e.seq);
+}
+
+bool file_index::insert(const api_file& file) {
+    std::string::size_type slash = file.path.rfind('/');
+    const int duration = file.end_timestamp > file.timestamp ? file.end_timestamp - file.timestamp : 0;
+    if(slash == std::string::npos || duration > 0xffff ||
+       file.seq < 0 || file.seq > max_seq || (0 != file.seq && 0 == duration) ||
+       file.path.compare(slash+1, std::string::npos, name(file.timestamp, file.end_timestamp, file.seq)) != 0) {
+        return false;
+    }
+
+    entry e;
+    e.timestamp = file.timestamp;
+    e.size = static_cast<std::uint32_t>(std::max(file.size, 0));
+    e.modified = parse_modified(file.last_modified);
+    e.prefix = intern(file.path.substr(0, slash));
+    e.seq = static_cast<std::uint8_t>(file.seq);
+    e.duration = static_cast<std::uint16_t>(duration);
+
+    // segments mostly arrive in order
+    const std::int64_t k = key(e);
+    if(entries_.empty() || key(entries_.back()) < k) {
+        entries_.push_back(e);
+    } else {
+        std::vector<entry>::iterator it = std::lower_bound(entries_.begin(), entries_.end(), k, key_less());
+        if(it != entries_.end() && key(*it) == k) {
+            return false;
+        }
+        entries_.insert(it, e);
+    }
+    bytes_ += e.size;
+    return true;
+}
+
+bool file_index::erase(std::int64_t key) {
+    std::vector<entry>::iterator it = std::lower_bound(entries_.begin(), entries_.end(), key, key_less());
+    if(it == entries_.end() || file_index::key(*it) != key) {
+        return false;
+    }
+    bytes_ -= it->size;
+    entries_.erase(it);
+    return true;
+}
+
+std::size_t file_index::erase(const std::vector<std::int64_t>& keys) {
+    std::vector<std::int64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+
+    std::vector<entry>::iterator out = entries_.begin();
+    for(std::vector<entry>::iterator it = entries_.begin(); it != entries_.end(); ++it) {
+        if(std::binary_search(sorted.begin(), sorted.end(), key(*it))) {
+            bytes_ -= it->size;
+        } else {
+            *out++ = *it;
+        }
+    }
+    std::size_t erased = entries_.end() - out;
+    entries_.erase(out, entries_.end());
+    return erased;
+}
+
+void file_index::clear() {
+    entries_.clear();
+    prefixes_.clear();
+    bytes_ = 0;
+}
+
+const file_index::entry* file_index::find(std::int64_t key) const {
+    const_iterator it = std::lower_bound(entries_.begin(), entries_.end(), key, key_less());
+    if(it == entries_.end() || file_index::key(*it) != key) {
+        return NULL;
+    }
+    return &*it;
+}
+
+file_index::const_iterator file_index::begin() const {
+    return entries_.begin();
+}
+
+file_index::const_iterator file_index::end() const {
+    return entries_.end();
+}
+
+std::pair<file_index::const_iterator, file_index::const_iterator> file_index::range(int from, int to) const {
+    const_iterator first = std::lower_bound(entries_.begin(), entries_.end(), from, timestamp_less());
+    const_iterator last = std::lower_bound(first, entries_.end(), std::max(from, to), timestamp_less());
+    return std::make_pair(first, last);
+}
+
+int file_index::next_seq(int timestamp) const {
+    const_iterator it = std::lower_bound(entries_.begin(), entries_.end(), key(timestamp, max_seq) + 1, key_less());
+    return it != entries_.begin() && (it - 1)->timestamp == timestamp ? (it - 1)->seq + 1 : 0;
+}
+
+std::pair<file_index::const_iterator, file_index::const_iterator> file_index::overlapping(int from, int to) const {
+    std::pair<const_iterator, const_iterator> r = range(from, to);
+    // segments are cut one after the other, only the one before @arg1
+    // can reach into the range
+    if(r.first != entries_.begin() && from < to) {
+        const_iterator prev = r.first - 1;
+        const bool reaches = 0 != prev->duration ? prev->timestamp + prev->duration > from
+                                                 : r.first == entries_.end() || r.first->timestamp > from;
+        if(reaches) {
+            r.first = prev;
+        }
+    }
+    return r;
+}
+
+std::size_t file_index::size() const {
+    return entries_.size();
+}
+
+std::uint64_t file_index::bytes() const {
+    return bytes_;
+}
+
+std::string file_index::path(const entry& e) const {
+    return prefixes_[e.prefix] + "/" + name(e.timestamp, e.timestamp + e.duration, e.seq);
+}
+
+api_file file_index::file(const entry& e) const {
+    api_file file = {
+        e.timestamp,
+        name(e.timestamp, e.timestamp + e.duration, e.seq),
+        path(e),
+        static_cast<int>(e.size),
+        format_modified(e.modified),
+        0 != e.duration ? e.timestamp + e.duration : 0,
+        e.seq
+    };
+    return file;
+}
+
+std::uint8_t file_index::intern(const std::string& prefix) {
+    for(std::size_t i = 0 ; i < prefixes_.size() ; i++) {
+        if(prefixes_[i] == prefix) {
+            return static_cast<std::uint8_t>(i);
+        }
+    }
+    assert(prefixes_.size() < 0xff);
+    prefixes_.push_back(prefix);
+    return static_cast<std::uint8_t>(prefixes_.size()-1);
+}
+
+bool file_index::write(std::ostream& out) const {
+    // native byte order, the snapshot never leaves the machine
+    write_pod(out, snapshot_magic);
+    write_pod(out, snapshot_version);
+    write_pod(out, static_cast<std::uint32_t>(sizeof(entry)));
+    write_pod(out, static_cast<std::uint32_t>(prefixes_.size()));
+    for(std::size_t i = 0 ; i < prefixes_.size() ; i++) {
+        write_pod(out, static_cast<std::uint32_t>(prefixes_[i].size()));
+        out.write(prefixes_[i].data(), prefixes_[i].size());
+    }
+    write_pod(out, static_cast<std::uint64_t>(entries_.size()));
+    if(!entries_.empty()) {
+        out.write(reinterpret_cast<const char*>(&entries_[0]), entries_.size()*sizeof(entry));
+    }
+    return static_cast<bool>(out);
+}
+
+bool file_index::read(std::istream& in) {
+    clear();
+
+    std::uint32_t magic = 0;
+    std::uint32_t version = 0;
+    std::uint32_t entry_size = 0;
+    std::uint32_t prefix_count = 0;
+    if(!read_pod(in, &magic) || magic != snapshot_magic ||
+       !read_pod(in, &version) || version != snapshot_version ||
+       !read_pod(in, &entry_size) || entry_size != sizeof(entry) ||
+       !read_pod(in, &prefix_count) || prefix_count > 0xff) {
+        return false;
+    }
+    for(std::uint32_t i = 0 ; i < prefix_count ; i++) {
+        std::uint32_t len = 0;
+        if(!read_pod(in, &len) || len > 4096) {
+            clear();
+            return false;
+        }
+        std::string prefix(len, '\0');
+        if(len != 0 && !in.read(&prefix[0], len)) {
+            clear();
+            return false;
+        }
+        prefixes_.push_back(prefix);
+    }
+    std::uint64_t count = 0;
+    if(!read_pod(in, &count) || count > 100000000) {
+        clear();
+        return false;
+    }
+    entries_.resize(count);
+    if(count != 0 && !in.read(reinterpret_cast<char*>(&entries_[0]), count*sizeof(entry))) {
+        clear();
+        return false;
+    }
+    for(std::size_t i = 0 ; i < entries_.size() ; i++) {
+        if(entries_[i].prefix >= prefixes_.size() || (i != 0 && key(entries_[i-1]) >= key(entries_[i]))) {
+            clear();
+            return false;
+        }
+        bytes_ += entries_[i].size;
+    }
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef FILE_INDEX_H
+#define FILE_INDEX_H
+
+#include "api_file.h"
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+namespace net {
+
+// stored segments sorted by timestamp in one flat vector. a segment's
+// path is always <folder>/<start>-<end>, the capture times in seconds,
+// or <folder>/<start> for older ones. segments starting in the same
+// second are told apart by a sequence, <start>-<end>-<seq> from the
+// second one on. the folder is interned and the rest packs into 16 bytes
+// per entry. appending the newest segment and dropping a batch of the
+// oldest are the common cases and both are cheap.
+class file_index {
+public:
+    class entry {
+    public:
+        std::int32_t timestamp;
+        std::uint32_t size;
+        std::uint32_t modified;     // seconds since the epoch, UTC
+        std::uint8_t prefix;
+        std::uint8_t seq;
+        std::uint16_t duration;     // end - timestamp, 0 if not in the name
+    };
+    typedef std::vector<entry>::const_iterator const_iterator;
+public:
+    file_index();
+    ~file_index();
+private:
+    file_index(const file_index&) = delete;
+    void operator=(const file_index&) = delete;
+public:
+    static const int max_seq = 0xff;
+    // <start>-<end>[-<seq>] with end > start, or just <start>
+    static std::string name(int start, int end, int seq);
+    // sets timestamp, end_timestamp and seq of @arg2 from @arg1
+    static bool parse_name(const std::string& name, api_file* file);
+    // what entries are found and erased by, in the order they are kept
+    static std::int64_t key(int timestamp, int seq);
+    static std::int64_t key(const entry& e);
+public:
+    // false if the key is indexed already or the path does not end in
+    // the name
+    bool insert(const api_file& file);
+    bool erase(std::int64_t key);
+    // one pass for the whole batch, @arg1 need not be sorted
+    std::size_t erase(const std::vector<std::int64_t>& keys);
+    void clear();
+public:
+    const entry* find(std::int64_t key) const;
+    // oldest first
+    const_iterator begin() const;
+    const_iterator end() const;
+    // entries with @arg1 <= timestamp < @arg2
+    std::pair<const_iterator, const_iterator> range(int from, int to) const;
+    // one past the newest seq stored for @arg1, 0 if there is none
+    int next_seq(int timestamp) const;
+    // entries whose capture overlaps [@arg1, @arg2), an entry without an
+    // end is taken to last until the next one starts
+    std::pair<const_iterator, const_iterator> overlapping(int from, int to) const;
+    std::size_t size() const;
+    std::uint64_t bytes() const;
+public:
+    std::string path(const entry& e) const;
+    api_file file(const entry& e) const;
+public:
+    // binary snapshot, read() leaves the index empty if it fails
+    bool write(std::ostream& out) const;
+    bool read(std::istream& in);
+private:
+    std::uint8_t intern(const std::string& prefix);
+private:
+    std::vector<entry> entries_;
+    std::vector<std::string> prefixes_;
+    std::uint64_t bytes_;
+};
+
+}
+
+#endif // FILE_INDEX_H
@@ -0,0 +1,126 @@
+#include "folder_cache.h"
+
+#include "logging/log.h"
+
+#include <fstream>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+using net::folder_cache;
+
+namespace {
+
+const char* const magic = "seccam-folder-cache 2";
+
+}
+
+folder_cache::folder_cache(const std::string& path)
+    : path_(path) {
+
+}
+
+folder_cache::~folder_cache() {
+
+}
+
+bool folder_cache::load() {
+    clear();
+    if(path_.empty()) {
+        return false;
+    }
+    std::ifstream in(path_.c_str(), std::ios::binary);
+    if(!in) {
+        LOG(common::log::info) << "no folder cache at " << path_ << common::log::end;
+        return false;
+    }
+
+    // a header line and the cursor, then the binary index snapshot
+    std::string line;
+    if(!std::getline(in, line) || line != magic || !std::getline(in, cursor_) || cursor_.empty() || !index_.read(in)) {
+        LOG(common::log::err) << "ignoring malformed folder cache " << path_ << common::log::end;
+        clear();
+        return false;
+    }
+    LOG(common::log::info) << "folder cache " << path_ << " holds " << static_cast<unsigned long>(index_.size())
+                           << " files" << common::log::end;
+    return true;
+}
+
+bool folder_cache::save() {
+    if(path_.empty() || cursor_.empty()) {
+        return false;
+    }
+    apply_removed();
+    // written aside and renamed so that a crash leaves the previous copy
+    const std::string tmp = path_ + ".tmp";
+    {
+        std::ofstream out(tmp.c_str(), std::ios::binary|std::ios::trunc);
+        out << magic << '\n' << cursor_ << '\n';
+        index_.write(out);
+        out.flush();
+        if(!out) {
+            LOG(common::log::err) << "cannot write " << tmp << common::log::end;
+            std::remove(tmp.c_str());
+            return false;
+        }
+    }
+    if(0 != std::rename(tmp.c_str(), path_.c_str())) {
+        int err = errno;
+        LOG(common::log::err) << "cannot rename " << tmp << " errno=" << std::strerror(err) << common::log::end;
+        std::remove(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+void folder_cache::clear() {
+    cursor_.clear();
+    index_.clear();
+    removed_.clear();
+}
+
+void folder_cache::put(const api_file& file) {
+    const std::int64_t key = file_index::key(file.timestamp, file.seq);
+    removed_.erase(key);
+    const file_index::entry* known = index_.find(key);
+    if(NULL != known && static_cast<int>(known->size) != file.size) {
+        index_.erase(key);
+    }
+    index_.insert(file);
+}
+
+void folder_cache::remove(const std::string& path) {
+    api_file file = api_file();
+    if(file_index::parse_name(path.substr(path.rfind('/') + 1), &file)) {
+        removed_.insert(file_index::key(file.timestamp, file.seq));
+    }
+}
+
+void folder_cache::files(std::vector<api_file>* files) {
+    apply_removed();
+    files->reserve(files->size() + index_.size());
+    for(file_index::const_iterator it = index_.begin(); it != index_.end(); ++it) {
+        files->push_back(index_.file(*it));
+    }
+}
+
+std::size_t folder_cache::size() {
+    apply_removed();
+    return index_.size();
+}
+
+const std::string& folder_cache::cursor() const {
+    return cursor_;
+}
+
+void folder_cache::cursor(const std::string& cursor) {
+    cursor_ = cursor;
+}
+
+void folder_cache::apply_removed() {
+    if(!removed_.empty()) {
+        index_.erase(std::vector<std::int64_t>(removed_.begin(), removed_.end()));
+        removed_.clear();
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef FOLDER_CACHE_H
+#define FOLDER_CACHE_H
+
+#include "api_file.h"
+#include "file_index.h"
+
+#include <string>
+#include <set>
+#include <vector>
+#include <cstdint>
+
+namespace net {
+
+// the files of a listed folder and the list_folder cursor that follows
+// it. saved to a file so that the next start only applies the changes
+// made since. entries are keyed by their name, applying a change twice is
+// harmless.
+class folder_cache {
+public:
+    // an empty @arg1 keeps the cache in memory only
+    explicit folder_cache(const std::string& path);
+    ~folder_cache();
+private:
+    folder_cache(const folder_cache&) = delete;
+    void operator=(const folder_cache&) = delete;
+public:
+    // false leaves the cache empty
+    bool load();
+    bool save();
+    void clear();
+public:
+    void put(const api_file& file);
+    void remove(const std::string& path);
+    void files(std::vector<api_file>* files);
+    std::size_t size();
+public:
+    const std::string& cursor() const;
+    void cursor(const std::string& cursor);
+private:
+    std::string path_;
+    std::string cursor_;
+    file_index index_;
+    // deletions are collected and dropped from the index in one pass
+    std::set<std::int64_t> removed_;
+private:
+    void apply_removed();
+};
+
+}
+
+#endif // FOLDER_CACHE_H
@@ -3,17 +3,57 @@
 #include "http_request.h"
 #include "http_response.h"
 
+#include "logging/log.h"
+
+#include <event2/bufferevent.h>
 #include <event2/bufferevent_ssl.h>
+#include <event2/event.h>
 #include <event2/http.h>
 #include <event2/dns.h>
 
+#include <arpa/inet.h>
+
 #include <cassert>
+#include <chrono>
 #include <iostream>
 
 using net::http_connection;
 
+namespace {
+
+std::uint64_t now_usec() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void enable_ktls(SSL* ssl) {
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_set_options(ssl, SSL_OP_ENABLE_KTLS);
+#else
+    (void)ssl;
+#endif
+}
+
+// true if the kernel encrypts what is written to the connection
+bool ktls_send(const SSL* ssl) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+    return 0 != BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+    (void)ssl;
+    return false;
+#endif
+}
+
+bool is_ip_literal(const std::string& host) {
+    unsigned char buf[sizeof(in6_addr)];
+    return 1 == inet_pton(AF_INET, host.c_str(), buf) || 1 == inet_pton(AF_INET6, host.c_str(), buf);
+}
+
+}
+
 http_connection::http_connection(
     const std::string& base_uri, 
+    std::uint16_t port,
     event_base* evbase, 
     evdns_base* evdns, 
     SSL_CTX* ssl_ctx,
@@ -21,27 +61,137 @@ http_connection::http_connection(
     void* ctx
     )
     : base_uri_(base_uri)
+    , port_(port)
     , evbase_(evbase)
     , evdns_(evdns)
     , ssl_ctx_(ssl_ctx)
     , bev_(NULL)
     , evconnection_(NULL)
     , on_close_cb_(on_close_cb)
-    , ctx_(ctx) {
+    , ctx_(ctx)
+    , reconnect_event_(NULL)
+    , idle_event_(NULL)
+    , session_(NULL)
+    , rate_limit_group_(NULL)
+    , in_flight_(0)
+    , stale_(false)
+    , idle_timeout_sec_(50)
+    , request_timeout_sec_(60)
+    , handshake_pending_(false)
+    , handshake_start_usec_(0)
+    , handshake_count_(0)
+    , resumed_handshake_count_(0)
+    , handshake_usec_total_(0)
+    , ktls_(false)
+    , ktls_handshake_count_(0) {
+
+    reconnect_event_ = evtimer_new(evbase_, &http_connection::on_reconnect, this);
+    assert(NULL != reconnect_event_);
+    idle_event_ = evtimer_new(evbase_, &http_connection::on_idle_timeout, this);
+    assert(NULL != idle_event_);
+
+    connect();
+
+}
+
+void http_connection::setup_ssl_ctx(SSL_CTX* ssl_ctx) {
+    // sessions are kept per connection (not in the internal cache) so that
+    // both hosts sharing the SSL_CTX resume their own session
+    SSL_CTX_set_session_cache_mode(ssl_ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, &http_connection::on_new_session);
+}
+
+http_connection::~http_connection() {
+    LOG(common::log::info) << base_uri_ << " tls handshakes=" << handshake_count_
+                           << " resumed=" << resumed_handshake_count_
+                           << " avg_ms=" << static_cast<unsigned long>(handshake_count_ ? handshake_usec_total_/handshake_count_/1000 : 0)
+                           << " ktls=" << ktls_handshake_count_
+                           << common::log::end;
+    disconnect();
+    for(; pending_requests_.size() != 0; pending_requests_.pop_front())
+        delete pending_requests_.front().req;
+    event_free(idle_event_);
+    event_free(reconnect_event_);
+    if(NULL != session_)
+        SSL_SESSION_free(session_);
+}
+
+void http_connection::connect() {
+    assert(NULL == evconnection_);
 
     SSL* ssl = SSL_new(ssl_ctx_);
     assert(NULL != ssl);
+    SSL_set_app_data(ssl, this);
+    SSL_set_info_callback(ssl, &http_connection::on_ssl_info);
+    if(!is_ip_literal(base_uri_)) {
+        SSL_set_tlsext_host_name(ssl, base_uri_.c_str());
+    }
+    if(ktls_) {
+        enable_ktls(ssl);
+    }
+    if(NULL != session_) {
+        // OpenSSL marks the session of a connection that was not shut down
+        // cleanly as not resumable, so every SSL object gets its own copy
+        SSL_SESSION* resume = SSL_SESSION_dup(session_);
+        SSL_set_session(ssl, resume);
+        SSL_SESSION_free(resume);
+    }
+    handshake_pending_ = false;
+    handshake_start_usec_ = 0;
+
     bev_ = bufferevent_openssl_socket_new(evbase_, -1, ssl, BUFFEREVENT_SSL_CONNECTING, BEV_OPT_CLOSE_ON_FREE|BEV_OPT_DEFER_CALLBACKS);
     assert(NULL != bev_);
     bufferevent_openssl_set_allow_dirty_shutdown(bev_, 1);
-    evconnection_ = evhttp_connection_base_bufferevent_new(evbase_, evdns_, bev_, base_uri.c_str(), 443);
-    evhttp_connection_set_retries(evconnection_, -1);
+    if(NULL != rate_limit_group_) {
+        bufferevent_add_to_rate_limit_group(bev_, rate_limit_group_);
+    }
+    evconnection_ = evhttp_connection_base_bufferevent_new(evbase_, evdns_, bev_, base_uri_.c_str(), port_);
+    // a connect that fails fails the requests waiting for it, so that a
+    // dead peer reaches the caller's retries instead of evhttp retrying
+    // behind them with its own backoff of up to an hour
+    evhttp_connection_set_retries(evconnection_, 0);
+    evhttp_connection_set_timeout(evconnection_, request_timeout_sec_);
     evhttp_connection_set_closecb(evconnection_, &http_connection::on_connection_close, this);
+    stale_ = false;
+}
 
+void http_connection::set_rate_limit_group(bufferevent_rate_limit_group* group) {
+    rate_limit_group_ = group;
+    if(NULL != bev_) {
+        bufferevent_add_to_rate_limit_group(bev_, rate_limit_group_);
+    }
 }
 
-http_connection::~http_connection() {
-    evhttp_connection_free(evconnection_);
+void http_connection::set_ktls(bool enable) {
+    ktls_ = enable;
+    // the current connection has not started its handshake yet unless a
+    // request went out, the option still applies then
+    if(ktls_ && NULL != bev_) {
+        enable_ktls(bufferevent_openssl_get_ssl(bev_));
+    }
+}
+
+void http_connection::disconnect() {
+    if(NULL == evconnection_) {
+        return;
+    }
+    // freeing the connection runs the close callback, which is only
+    // meant for connections the server or the network dropped
+    evhttp_connection_set_closecb(evconnection_, NULL, NULL);
+    if(NULL != rate_limit_group_) {
+        // the bufferevent itself may outlive this call, the group must not
+        // keep it as a member
+        bufferevent_remove_from_rate_limit_group(bev_);
+    }
+    evhttp_connection_free(evconnection_); // frees bev_ and the SSL object
+    evconnection_ = NULL;
+    bev_ = NULL;
+    evtimer_del(idle_event_);
+}
+
+void http_connection::schedule_reconnect() {
+    timeval now = {0, 0};
+    evtimer_add(reconnect_event_, &now);
 }
 
 void http_connection::on_connection_close(evhttp_connection*, void* ctx) {
@@ -50,26 +200,131 @@ void http_connection::on_connection_close(evhttp_connection*, void* ctx) {
 }
 
 void http_connection::handle_on_connection_close() {
+    // the bufferevent still holds the SSL object of the closed session,
+    // it is replaced once the requests in flight have been failed
+    stale_ = true;
+    evtimer_del(idle_event_);
+    if(0 == in_flight_) {
+        schedule_reconnect();
+    }
     on_close_cb_(ctx_);
 }
 
+void http_connection::on_reconnect(int, short, void* ctx) {
+    http_connection* httpcon = static_cast<http_connection*>(ctx);
+    httpcon->handle_on_reconnect();
+}
+
+void http_connection::handle_on_reconnect() {
+    if(0 != in_flight_) {
+        return; // rescheduled when the last request completes
+    }
+    LOG(common::log::info) << "reconnecting to " << base_uri_ << common::log::end;
+    disconnect();
+    connect();
+    for(; pending_requests_.size() != 0; pending_requests_.pop_front()) {
+        const pending_request& pending = pending_requests_.front();
+        issue_request(pending.req, pending.cb, pending.ctx);
+    }
+}
+
+void http_connection::on_idle_timeout(int, short, void* ctx) {
+    http_connection* httpcon = static_cast<http_connection*>(ctx);
+    httpcon->handle_on_idle_timeout();
+}
+
+void http_connection::handle_on_idle_timeout() {
+    // drop the connection before the server's idle timeout does, so that
+    // the next request does not race a half-closed socket. evhttp connects
+    // the replacement only when that request is made, it pays the connect
+    // and a handshake that resumes the TLS session if the server allows.
+    assert(0 == in_flight_);
+    LOG(common::log::info) << "recycling idle connection to " << base_uri_ << common::log::end;
+    disconnect();
+    connect();
+}
+
+void http_connection::on_ssl_info(const SSL* ssl, int where, int) {
+    http_connection* httpcon = static_cast<http_connection*>(SSL_get_app_data(ssl));
+    httpcon->handle_on_ssl_info(ssl, where);
+}
+
+void http_connection::handle_on_ssl_info(const SSL* ssl, int where) {
+    // TLSv1.3 reports post-handshake messages as handshakes as well, only
+    // the first one on each SSL object is counted (start stays set after it)
+    if((where & SSL_CB_HANDSHAKE_START) && 0 == handshake_start_usec_) {
+        handshake_pending_ = true;
+        handshake_start_usec_ = now_usec();
+    } else if((where & SSL_CB_HANDSHAKE_DONE) && handshake_pending_) {
+        std::uint64_t elapsed = now_usec() - handshake_start_usec_;
+        bool resumed = 1 == SSL_session_reused(const_cast<SSL*>(ssl));
+        handshake_pending_ = false;
+        handshake_count_++;
+        handshake_usec_total_ += elapsed;
+        if(resumed) {
+            resumed_handshake_count_++;
+        }
+        bool offloaded = ktls_send(ssl);
+        if(offloaded) {
+            ktls_handshake_count_++;
+        }
+        LOG(common::log::info) << "tls handshake with " << base_uri_ << " took " << static_cast<unsigned long>(elapsed/1000)
+                               << "ms" << (resumed ? " (resumed)" : "")
+                               << (offloaded ? " (kernel tls)" : (ktls_ ? " (kernel tls unavailable)" : "")) << common::log::end;
+    }
+}
+
+int http_connection::on_new_session(SSL* ssl, SSL_SESSION* session) {
+    http_connection* httpcon = static_cast<http_connection*>(SSL_get_app_data(ssl));
+    if(NULL == httpcon) {
+        return 0;
+    }
+    httpcon->handle_on_new_session(session);
+    return 0; // the reference stays with the SSL object
+}
+
+void http_connection::handle_on_new_session(SSL_SESSION* session) {
+    if(NULL != session_)
+        SSL_SESSION_free(session_);
+    session_ = SSL_SESSION_dup(session);
+}
+
+std::uint32_t http_connection::handshake_count() const {
+    return handshake_count_;
+}
+
+std::uint32_t http_connection::resumed_handshake_count() const {
+    return resumed_handshake_count_;
+}
+
+std::uint64_t http_connection::handshake_usec_total() const {
+    return handshake_usec_total_;
+}
+
+std::uint32_t http_connection::ktls_handshake_count() const {
+    return ktls_handshake_count_;
+}
+
 class handler {
 public:
-    handler(net::http_request* request, http_connection::http_request_ready_cb cb, void* ctx);
+    handler(http_connection* connection, net::http_request* request, http_connection::http_request_ready_cb cb, void* ctx);
     virtual ~handler();
 public:
     void execute(net::http_response*);
+    http_connection* connection() const { return connection_; }
 private:
     handler(const handler&) = delete;
     void operator=(const handler&) = delete;
 private:
+    http_connection* connection_;
     net::http_request* request_;
     http_connection::http_request_ready_cb cb_;
     void* ctx_;
 };
 
-handler::handler(net::http_request* request, http_connection::http_request_ready_cb cb, void* ctx)
-    : request_(request)
+handler::handler(http_connection* connection, net::http_request* request, http_connection::http_request_ready_cb cb, void* ctx)
+    : connection_(connection)
+    , request_(request)
     , cb_(cb)
     , ctx_(ctx) {
 }
@@ -88,6 +343,8 @@ void handler::execute(net::http_response* res) {
 
 void http_connection::on_evhttp_request_done(evhttp_request *evreq, void *ctx) {
     handler* hnd = static_cast<handler*>(ctx);
+    http_connection* connection = hnd->connection();
+    connection->in_flight_--;
     if(NULL == evreq) {
         hnd->execute(0);
     } else {
@@ -96,6 +353,19 @@ void http_connection::on_evhttp_request_done(evhttp_request *evreq, void *ctx) {
         hnd->execute(resp);
     }
     delete hnd;
+    connection->on_request_done();
+}
+
+void http_connection::on_request_done() {
+    if(0 != in_flight_) {
+        return;
+    }
+    if(stale_) {
+        schedule_reconnect();
+    } else {
+        timeval idle = {idle_timeout_sec_, 0};
+        evtimer_add(idle_event_, &idle);
+    }
 }
 
 namespace {
@@ -111,6 +381,18 @@ evhttp_cmd_type str_to_evmethod(const std::string& str_method) {
 }
 
 void http_connection::make_request(http_request* req, http_request_ready_cb cb, void* ctx) {
-    req->callback(&http_connection::on_evhttp_request_done, new handler(req,cb,ctx));
+    if(stale_) {
+        pending_request pending = { req, cb, ctx };
+        pending_requests_.push_back(pending);
+        schedule_reconnect();
+        return;
+    }
+    issue_request(req, cb, ctx);
+}
+
+void http_connection::issue_request(http_request* req, http_request_ready_cb cb, void* ctx) {
+    evtimer_del(idle_event_);
+    in_flight_++;
+    req->callback(&http_connection::on_evhttp_request_done, new handler(this,req,cb,ctx));
     evhttp_make_request(evconnection_, req->request(), str_to_evmethod(req->method()), req->path().c_str());
-}
\ No newline at end of file
+}
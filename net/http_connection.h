@@ -4,12 +4,16 @@
 #include <openssl/ssl.h>
 
 #include <string>
+#include <list>
+#include <cstdint>
 
 struct event_base;
 struct evdns_base;
 struct bufferevent;
 struct evhttp_connection;
 struct evhttp_request;
+struct event;
+struct bufferevent_rate_limit_group;
 
 namespace net {
 
@@ -21,37 +25,96 @@ public:
     typedef void (*connection_error_cb)(void*);
     typedef void (*http_request_ready_cb)(http_request*, http_response*, void*);
 public:
-    http_connection(const std::string& base_uri, 
-                    event_base* evbase, 
-                    evdns_base* evdns, 
+    http_connection(const std::string& base_uri,
+                    std::uint16_t port,
+                    event_base* evbase,
+                    evdns_base* evdns,
                     SSL_CTX* ssl_ctx,
                     connection_error_cb on_close_cb,
                     void* ctx
                     );
     ~http_connection();
+public:
+    // once on the SSL_CTX, where it is created and before any connection
+    // or thread uses it. sessions are kept per connection, not in the
+    // context's cache.
+    static void setup_ssl_ctx(SSL_CTX* ssl_ctx);
 public:
     // transfers ownership of @arg1
     void make_request(http_request* req, http_request_ready_cb cb, void* ctx);
+public:
+    // every connection made from now on draws from @arg1
+    void set_rate_limit_group(bufferevent_rate_limit_group* group);
+    // asks OpenSSL to hand record encryption to the kernel (kTLS). it
+    // only happens where the kernel has the tls module and supports the
+    // negotiated cipher, other connections stay in userspace
+    void set_ktls(bool enable);
+public:
+    std::uint32_t handshake_count() const;
+    std::uint32_t resumed_handshake_count() const;
+    std::uint64_t handshake_usec_total() const;
+    std::uint32_t ktls_handshake_count() const;
 private:
     http_connection(const http_connection&) = delete;
     void operator=(const http_connection&) = delete;
+private:
+    void connect();
+    void disconnect();
+    void schedule_reconnect();
+    void issue_request(http_request* req, http_request_ready_cb cb, void* ctx);
+    void on_request_done();
 private:
     static void on_connection_close(evhttp_connection*, void* ctx);
     void handle_on_connection_close();
 
     static void on_evhttp_request_done(evhttp_request *, void *);
 
+    static void on_reconnect(int, short, void* ctx);
+    void handle_on_reconnect();
+
+    static void on_idle_timeout(int, short, void* ctx);
+    void handle_on_idle_timeout();
+
+    static void on_ssl_info(const SSL* ssl, int where, int ret);
+    void handle_on_ssl_info(const SSL* ssl, int where);
+
+    static int on_new_session(SSL* ssl, SSL_SESSION* session);
+    void handle_on_new_session(SSL_SESSION* session);
+private:
+    class pending_request {
+    public:
+        http_request* req;
+        http_request_ready_cb cb;
+        void* ctx;
+    };
 private:
     const std::string& base_uri_;
+    std::uint16_t port_;
     event_base* evbase_;
-    evdns_base* evdns_; 
+    evdns_base* evdns_;
+    SSL_CTX* ssl_ctx_;
     bufferevent* bev_;
     evhttp_connection* evconnection_;
-    SSL_CTX* ssl_ctx_;
     connection_error_cb on_close_cb_;
     void* ctx_;
+    event* reconnect_event_;
+    event* idle_event_;
+    SSL_SESSION* session_;
+    bufferevent_rate_limit_group* rate_limit_group_;
+    std::list<pending_request> pending_requests_;
+    int in_flight_;
+    bool stale_;
+    int idle_timeout_sec_;
+    int request_timeout_sec_;
+    bool handshake_pending_;
+    std::uint64_t handshake_start_usec_;
+    std::uint32_t handshake_count_;
+    std::uint32_t resumed_handshake_count_;
+    std::uint64_t handshake_usec_total_;
+    bool ktls_;
+    std::uint32_t ktls_handshake_count_;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,93 +1,170 @@
 #include "http_publisher.h"
 
 #include "timer.h"
+#include "retry_policy.h"
+#include "dead_letter.h"
+#include "bitrate_controller.h"
 
 #include "logging/log.h"
 
 #include "common/segment.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 
-#include "http_connection.h"
-#include "http_request.h"
-#include "http_response.h"
-
-#include <json/json.h>
 #include <event2/event.h>
 
 #include <unistd.h>
 
-#include <stdexcept>
 #include <iostream>
-#include <sstream>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
 
 using net::http_publisher;
 
+namespace {
+
+std::uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// goodput is handed to the bitrate controller at most this often
+const std::uint64_t goodput_window_ms = 2000;
+
+}
+
 http_publisher::http_publisher(
-    const std::string& base_uri,
-    const std::string& file_upload_uri,
-    const std::string& bearer,
     event_base* evbase,
-    evdns_base* evdns,
-    SSL_CTX* ssl_ctx,
+    storage_backend* backend,
     int read_segment_fd,
+    const publisher_options& options,
     connection_event_cb on_connection_ready, 
     connection_event_cb on_connection_error, 
     connection_event_cb on_last_request_sent,
     void* ctx
     )
-    : base_uri_(base_uri)
-    , file_upload_uri_(file_upload_uri)
-    , bearer_(bearer)
-    , evbase_(evbase)
-    , evdns_(evdns)
-    , ssl_ctx_(ssl_ctx)
+    : evbase_(evbase)
+    , backend_(backend)
     , read_segment_fd_(read_segment_fd)
     , read_segments_event_(NULL)
     , on_connection_ready_(on_connection_ready)
     , on_connection_error_(on_connection_error)
     , on_last_request_sent_(on_last_request_sent)
     , ctx_(ctx)
-    , api_(nullptr)
-    , file_upload_(nullptr)
-    , files_size_(0)
+    , list_timer_(NULL)
+    , list_retries_(0)
     , last_segment_(false)
-    , state_(initializing)
-    , initial_retry_sec_(2)
-    , max_retry_count_(5) {
-
-
-    try {
-        api_ = new http_connection(base_uri_, evbase_, evdns_, ssl_ctx_, &http_publisher::on_api_connection_lost, this);
-    } catch (const std::runtime_error& err) {
-        LOG(common::log::err) << "Cannot create http_connection to " << base_uri_ << common::log::end;
-        return;
-    }
-    
-    try {
-        file_upload_ = new http_connection(file_upload_uri_, evbase_, evdns_, ssl_ctx_, &http_publisher::on_file_upload_connection_lost, this);
-    } catch (const std::runtime_error& err) {
-        delete api_;
-        LOG(common::log::err) << "Cannot create http_connection to " << file_upload_uri << common::log::end;
-        return;
-    }
+    , options_(options)
+    , retry_policy_(new retry_policy(options.retry_initial_ms, options.retry_max_ms, options.retry_max_attempts))
+    , dead_letter_(new dead_letter(options.dead_letter_dir))
+    , throttled_until_ms_(0)
+    , throttle_timer_(NULL)
+    , pending_upload_bytes_(0)
+    , uploads_in_flight_(0)
+    , goodput_since_ms_(0)
+    , goodput_bytes_(0)
+    , evicting_bytes_(0)
+    , last_name_ts_(0)
+    , last_name_seq_(0)
+    , live_(NULL)
+    , bitrate_controller_(NULL)
+    , on_segment_(NULL)
+    , on_segment_ctx_(NULL)
+    , metrics_(NULL)
+    , uploaded_bytes_(NULL)
+    , uploads_committed_(NULL)
+    , upload_retries_(NULL)
+    , uploads_parked_(NULL)
+    , upload_time_(NULL)
+    , trace_(NULL)
+    , state_(initializing) {
 
     read_segments_event_ = event_new(evbase_, read_segment_fd_, EV_READ|EV_PERSIST, &http_publisher::on_segments, this);
     assert(NULL != read_segments_event_);
     event_add(read_segments_event_, NULL);
 
-    list_folders();
+    state_ = enumerating;
+    backend_->list(&http_publisher::on_list_complete, this);
 
 }
 
 http_publisher::~http_publisher() {
 
-    for(; segment_list_.size() != 0; segment_list_.pop_front())
-        delete segment_list_.front();
+    if(NULL != metrics_) {
+        metrics_->remove_gauges(this);
+    }
 
+    if(NULL != live_) {
+        finish_upload(live_);
+    }
+    for(; backlog_.size() != 0; backlog_.pop_front())
+        finish_upload(backlog_.front());
+
+    park_waiting_retries();
+
+    delete list_timer_;
+    delete throttle_timer_;
     event_free(read_segments_event_);
-    delete file_upload_;
-    delete api_;
+    delete bitrate_controller_;
+    delete dead_letter_;
+    delete retry_policy_;
+}
+
+void http_publisher::set_encoder_control(common::encoder_control* control) {
+    assert(NULL == bitrate_controller_);
+    bitrate_controller_ = new bitrate_controller(control, options_.encoder_min_kbit, options_.backlog_high_sec);
+}
+
+void http_publisher::set_segment_listener(segment_cb on_segment, void* ctx) {
+    on_segment_ = on_segment;
+    on_segment_ctx_ = ctx;
+}
+
+void http_publisher::set_metrics(common::metrics* metrics) {
+    metrics_ = metrics;
+    uploaded_bytes_ = metrics->add_counter("seccam_upload_bytes_total", "Bytes of the segments committed to the storage.");
+    uploads_committed_ = metrics->add_counter("seccam_uploads_committed_total", "Segments committed to the storage.");
+    upload_retries_ = metrics->add_counter("seccam_upload_retries_total", "Upload retries scheduled.");
+    uploads_parked_ = metrics->add_counter("seccam_uploads_parked_total", "Segments given up on and kept in the dead letter directory.");
+    upload_time_ = metrics->add_histogram("seccam_upload_seconds", "Time from the first byte of a segment sent until it is committed.", 1e-6);
+    metrics->add_gauge("seccam_upload_queue_segments", "Segments waiting for an upload slot or a retry.", &http_publisher::read_queued, this);
+    metrics->add_gauge("seccam_uploads_in_flight", "Uploads in progress.", &http_publisher::read_in_flight, this);
+    metrics->add_gauge("seccam_upload_pending_bytes", "Bytes of the segments not committed yet.", &http_publisher::read_pending_bytes, this);
+    metrics->add_gauge("seccam_http_state", "Publisher state, 0 initializing 1 enumerating 2 idle 3 popping_segment 4 sending_segment 5 terminating_video.",
+                       &http_publisher::read_state, this);
+}
+
+void http_publisher::set_trace(common::trace* trace) {
+    trace_ = trace;
+}
+
+double http_publisher::read_queued(void* ctx) {
+    const http_publisher* publisher = static_cast<const http_publisher*>(ctx);
+    return publisher->backlog_.size() + (NULL != publisher->live_ ? 1 : 0) +
+           publisher->retry_ready_.size() + publisher->waiting_retries_.size();
+}
+
+double http_publisher::read_in_flight(void* ctx) {
+    return static_cast<const http_publisher*>(ctx)->uploads_in_flight_;
+}
+
+double http_publisher::read_pending_bytes(void* ctx) {
+    return static_cast<const http_publisher*>(ctx)->pending_upload_bytes_;
+}
+
+double http_publisher::read_state(void* ctx) {
+    return static_cast<const http_publisher*>(ctx)->state_;
+}
+
+void http_publisher::find_stored(int from, int to, std::vector<api_file>* files) const {
+    std::pair<file_index::const_iterator, file_index::const_iterator> r = index_.overlapping(from, to);
+    for(file_index::const_iterator it = r.first; it != r.second; ++it) {
+        files->push_back(index_.file(*it));
+    }
 }
 
 void http_publisher::on_segments(int, short what, void *ctx) {
@@ -96,21 +173,21 @@ void http_publisher::on_segments(int, short what, void *ctx) {
 }
 
 void http_publisher::handle_on_segments() {
-    if(state_ != idle && state_ != popping_segment && state_ != sending_segment) {
-        assert(state_ == idle ||
-               state_ == popping_segment ||
-               state_ == sending_segment);
+    // capture starts with the process, segments that arrive before the
+    // backend is listed wait in the queue
+    if(state_ == terminating_video) {
+        assert(state_ != terminating_video);
         return;
     }
-    LOG(common::log::info) << "reading segment" << common::log::end;
+    LOG(common::log::debug) << "reading segment" << common::log::end;
     bool segments_added = false;
     while(true) {
         std::uintptr_t seg_ptr;
         ssize_t ret = read(read_segment_fd_, &seg_ptr, sizeof(seg_ptr));
         if(ret == sizeof(seg_ptr)) {
-            LOG(common::log::info) << "adding segment" << common::log::end;
+            LOG(common::log::debug) << "adding segment" << common::log::end;
             common::segment* seg = reinterpret_cast<common::segment*>(seg_ptr);
-            segment_list_.push_back(seg);
+            queue_segment(seg);
             segments_added = true;
         } else {
             if(ret == 0) {
@@ -137,312 +214,275 @@ void http_publisher::handle_on_segments() {
             }
         }
     }
-    if(segments_added && state_ == idle) {
+    if(segments_added && state_ == initializing && live_->seg->last_segment()) {
+        // shutdown does not wait for a storage that has not answered a
+        // listing, a listing in flight is waited for
+        park_queued();
+        return;
+    }
+    if(segments_added) {
+        evict_files();
+    }
+    if(segments_added && upload_slot_free()) {
         pop_segment();
     }
 }
 
-void http_publisher::on_api_connection_lost(void* ctx) {
-    http_publisher* httppub = static_cast<http_publisher*>(ctx);
-    httppub->handle_on_api_connection_lost();
-}
-
-void http_publisher::handle_on_api_connection_lost() {
-    LOG(common::log::info) << " refresh api connection " << common::log::end;
-    // delete api_;
-    // api_ = new http_connection(base_uri_, evbase_, evdns_, ssl_ctx_, &http_publisher::on_api_connection_lost, this);
-}
-
-void http_publisher::on_file_upload_connection_lost(void* ctx) {
-    http_publisher* httppub = static_cast<http_publisher*>(ctx);
-    httppub->handle_on_file_upload_connection_lost();
-}
-
-void http_publisher::handle_on_file_upload_connection_lost() {
-    LOG(common::log::info) << " refresh file upload connection " << common::log::end;
-    // delete file_upload_;
-    // file_upload_ = new http_connection(file_upload_uri_, evbase_, evdns_, ssl_ctx_, &http_publisher::on_file_upload_connection_lost, this);
+void http_publisher::on_list_complete(bool ok, const std::vector<api_file>& files, void* ctx) {
+    static_cast<http_publisher*>(ctx)->handle_on_list_complete(ok, files);
 }
 
+void http_publisher::handle_on_list_complete(bool ok, const std::vector<api_file>& files) {
+    if(state_ != enumerating) {
+        assert(state_ == enumerating);
+    }
 
-namespace {
-
-bool parse_json(const std::vector<uint8_t>& buf, Json::Value* res) {
-    bool ret = false;
-    if(buf.size() != 0) {
-        const char* begin = reinterpret_cast<const char*>(&buf[0]);
-        const char* end = begin+buf.size();
-        Json::Reader reader;
-        if(reader.parse(begin, end, *res, false)) {
-            LOG(common::log::info) << "data parsed" << common::log::end;
-            ret = true;
-        } else {
-            LOG(common::log::err) << "cannot parse data" << common::log::end;
+    if(!ok) {
+        state_ = initializing;
+        if(NULL != live_ && live_->seg->last_segment()) {
+            LOG(common::log::err) << "cannot enumerate stored segments" << common::log::end;
+            park_queued();
+            return;
         }
-    } else {
-        LOG(common::log::err) << "empty data" << common::log::end;
+        // recording goes on meanwhile, the retries share the uploads'
+        // budget and end up probing at the longest delay
+        std::uint32_t timeout = retry_policy_->delay_ms(list_retries_, 0);
+        list_retries_++;
+        LOG(common::log::err) << "cannot enumerate stored segments, retry " << list_retries_
+                              << " in " << timeout << "ms" << common::log::end;
+        list_timer_ = new net::timer(evbase_, timeout, &http_publisher::on_list_retry_expired, this);
+        if(list_retries_ == options_.retry_max_attempts) {
+            // once, the listing is still retried
+            on_connection_error_(ctx_);
+        }
+        return;
     }
-    return ret;
-}
-
-void make_request_with_body(const std::string& method,
-                            const std::string& path,
-                            const std::string& base_uri,
-                            const std::string& bearer,
-                            const Json::Value& body, 
-                            net::http_connection* http_connection,
-                            net::http_connection::http_request_ready_cb cb, 
-                            void *ctx
-                            ) {
-
-    Json::FastWriter writer;
-    std::string json_str = writer.write(body);
-
-    net::http_request* request = new net::http_request(method, path);
-    request->add_header("Host", base_uri);
-    request->add_header("Authorization", "Bearer "+bearer);
-    request->add_header("Content-Type", "application/json");
-    request->data(json_str.c_str(), json_str.size());
 
-    http_connection->make_request(request, cb, ctx);
+    for(std::size_t i = 0 ; i < files.size() ; i++) {
+        add_file(files[i]);
+    }
+    rename_queued();
 
+    LOG(common::log::info) << "connection ready, " << static_cast<unsigned long>(index_.size())
+                           << " files " << static_cast<unsigned long>(index_.bytes()) << " bytes stored, "
+                           << static_cast<unsigned long>(backlog_.size() + (NULL != live_ ? 1 : 0))
+                           << " segments queued" << common::log::end;
+    state_ = idle;
+    evict_files();
+    on_connection_ready_(ctx_);
+    if(state_ == idle) {
+        pop_segment();
+    }
 }
 
+void http_publisher::on_list_retry_expired(void* ctx) {
+    static_cast<http_publisher*>(ctx)->handle_on_list_retry_expired();
 }
 
-void http_publisher::list_folders() {
+void http_publisher::handle_on_list_retry_expired() {
+    list_timer_ = NULL; // deletes itself
+    state_ = enumerating;
+    backend_->list(&http_publisher::on_list_complete, this);
+}
 
-    if(state_ != initializing) {
-        assert(state_ == initializing);
+void http_publisher::rename_queued() {
+    // segments queued during the listing were named without knowing what
+    // is stored. one that would collide keeps its capture times and takes
+    // the next free seq of its second, which also moves the ones queued
+    // after it in that second.
+    std::vector<upload_session*> queued(backlog_.begin(), backlog_.end());
+    if(NULL != live_) {
+        queued.push_back(live_);
+    }
+    api_file prev = api_file();
+    for(std::size_t i = 0 ; i < queued.size() ; i++) {
+        api_file name = api_file();
+        file_index::parse_name(queued[i]->name, &name);
+        int seq = index_.next_seq(name.timestamp);
+        if(name.timestamp == prev.timestamp) {
+            seq = std::max(seq, prev.seq + 1);
+        }
+        if(name.seq < seq) {
+            name.seq = seq;
+            std::string renamed = file_index::name(name.timestamp, std::max(name.end_timestamp, name.timestamp + 1), seq);
+            LOG(common::log::info) << "renaming queued segment " << queued[i]->name << " to " << renamed << common::log::end;
+            queued[i]->name = renamed;
+        }
+        if(name.timestamp > last_name_ts_ || (name.timestamp == last_name_ts_ && name.seq > last_name_seq_)) {
+            last_name_ts_ = name.timestamp;
+            last_name_seq_ = name.seq;
+        }
+        prev = name;
     }
-
-    state_ = listing_root_folder;
-
-    Json::Value root;
-    root["path"] = "";
-    root["recursive"] = false;
-    root["include_media_info"] = false;
-    root["include_deleted"] = false;
-    root["include_has_explicit_shared_members"] = false;
-
-    make_request_with_body("POST", "/2/files/list_folder", base_uri_, bearer_, root,
-                           api_, &http_publisher::on_list_folders_complete, this
-                           );
-
 }
 
-#define CB_TO_MEMFUN(cb_fun, mem_fun) \
-    void http_publisher::cb_fun(http_request* req, http_response* res, void* ctx) { \
-        http_publisher* http_pub = static_cast<http_publisher*>(ctx); \
-        return http_pub->mem_fun(req, res); \
+int http_publisher::name_seq(std::time_t ts) const {
+    int seq = index_.next_seq(static_cast<int>(ts));
+    if(ts == last_name_ts_) {
+        seq = std::max(seq, last_name_seq_ + 1);
     }
+    // a segment is at least a frame, 255 of them do not start in a second
+    assert(seq <= file_index::max_seq);
+    return seq;
+}
 
-CB_TO_MEMFUN(on_list_folders_complete, handle_on_list_folders_complete);
-
-void http_publisher::handle_on_list_folders_complete(http_request* req, http_response* res) {
-
-    if(state_ != listing_root_folder) {
-        assert(state_ == listing_root_folder);
+void http_publisher::add_file(const api_file& file) {
+    if(!index_.insert(file)) {
+        LOG(common::log::err) << "not indexing " << file.path << common::log::end;
     }
+}
 
-    if(!validate_response(res)) {
-        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
-        delete req;
-        delete res;
-        // listing_root_dir_failed
+void http_publisher::pop_segment() {
+    if(state_ != idle && state_ != sending_segment) {
+        assert(state_ == idle || state_ == sending_segment);
         return;
     }
 
-    const std::vector<uint8_t>& data = res->data();
-    Json::Value json;
-    bool folder_found = false;
-    bool has_more = false;
-    if(parse_json(data, &json)) {
-        Json::Value& entries = json["entries"];
-        if(entries.isArray()) {
-            for(int i = 0 ; i < entries.size() ; i++) {
-                Json::Value& entry = entries[i];
-                if(!entry.isObject()) {
-                    continue;
-                }
-                Json::Value& tag = entry[".tag"];
-                if(!tag.isString()) {
-                    continue;
-                }
-                if(tag.asString() == "folder") {
-                    Json::Value& path_lower = entry["path_lower"];
-                    if(!path_lower.isString()) {
-                        continue;
-                    }
-                    if(path_lower.asString() == "/_seccam_") {
-                        folder_found = true;
-                        break;
-                    }
-                }
+    while(uploads_in_flight_ < options_.max_uploads) {
+        state_ = popping_segment;
+
+        std::uint64_t now = now_ms();
+        if(now < throttled_until_ms_) {
+            LOG(common::log::info) << "throttled for " << static_cast<unsigned long>(throttled_until_ms_ - now) << "ms" << common::log::end;
+            state_ = uploads_in_flight_ != 0 ? sending_segment : idle;
+            if(NULL == throttle_timer_) {
+                throttle_timer_ = new net::timer(evbase_, throttled_until_ms_ - now, &http_publisher::on_throttle_expired, this);
             }
-            if(!folder_found) {
-                Json::Value& has_more_resp = json["has_more"];
-                if(has_more_resp.isBool()) {
-                    has_more = has_more_resp.asBool();
-                    if(has_more) {
-                        Json::Value& cursor_resp = json["cursor"];
-                        if(cursor_resp.isString()) {
-                            std::string cursor = cursor_resp.asString();
-                            list_folders_continue(cursor);
-                        } else {
-                            // listing_root_dir_failed
-                            LOG(common::log::err) << "invalid response format cursor missing" << common::log::end;
-                        }
-                    } else {
-                        create_app_folder();
-                    }
-                } else {
-                    // listing_root_dir_failed
-                    LOG(common::log::err) << "invalid response format has_more missing" << common::log::end;
-                }
+            return;
+        }
+
+        // the newest segment goes first so that what happens now is online
+        // as soon as possible, retries and the backlog get the rest of the
+        // upload budget
+        if(NULL != live_) {
+            upload_session* upload = live_;
+            live_ = NULL;
+            take_upload_slot();
+            send_segment(upload);
+        } else if(retry_ready_.size() > 0) {
+            upload_session* upload = retry_ready_.front();
+            retry_ready_.pop_front();
+            take_upload_slot();
+            state_ = sending_segment;
+            send_upload(upload);
+        } else if(backlog_.size() > 0) {
+            upload_session* upload = backlog_.front();
+            backlog_.pop_front();
+            take_upload_slot();
+            send_segment(upload);
+        } else if(uploads_in_flight_ != 0) {
+            // the last one to complete pops again
+            state_ = sending_segment;
+            return;
+        } else {
+            if (last_segment_) {
+                // don't hold the shutdown for a link that may not come back,
+                // whatever still waits for a retry is kept locally
+                park_waiting_retries();
+                LOG(common::log::info) << "no more segments" << common::log::end;
+                state_ = terminating_video;
+                on_last_request_sent_(ctx_);
             } else {
-                // folder found
-                list_app_folder();
+                LOG(common::log::info) << "segments list is empty - going idle" << common::log::end;
+                state_ = idle;
             }
-        } else {
-            // listing_root_dir_failed
-            LOG(common::log::err) << "invalid response format entries missing" << common::log::end;
+            return;
         }
-    } else {
-        // listing_root_dir_failed
-        LOG(common::log::err) << "failed to parse response" << common::log::end;
     }
-
-    delete req;
-    delete res;
-} 
-
-void http_publisher::list_folders_continue(const std::string& cursor) {
-    throw std::runtime_error("method /list_folder/continue not implemented");
 }
 
-void http_publisher::create_app_folder() {
+bool http_publisher::upload_slot_free() const {
+    return (state_ == idle || state_ == sending_segment) && uploads_in_flight_ < options_.max_uploads;
+}
 
-    if(state_ != listing_root_folder) {
-        assert(state_ == listing_root_folder);
+void http_publisher::take_upload_slot() {
+    if(0 == uploads_in_flight_) {
+        // goodput is measured over the time something is on the wire
+        goodput_since_ms_ = now_ms();
+        goodput_bytes_ = 0;
     }
-
-    state_ = creating_app_folder;
-
-    Json::Value root;
-    root["path"] = "/_seccam_";
-    root["autorename"] = false;
-
-    make_request_with_body("POST", "/2/files/create_folder_v2", base_uri_, bearer_, root,
-                           api_, &http_publisher::on_create_folder_complete, this
-                           );
-
+    uploads_in_flight_++;
 }
 
-CB_TO_MEMFUN(on_create_folder_complete, handle_on_create_folder_complete);
+void http_publisher::release_upload_slot() {
+    uploads_in_flight_--;
+    if(0 == uploads_in_flight_) {
+        report_goodput(true);
+    }
+}
 
-void http_publisher::handle_on_create_folder_complete(http_request* req, http_response* res) {
+void http_publisher::count_delivered(std::size_t bytes) {
+    goodput_bytes_ += bytes;
+    report_goodput(false);
+}
 
-    if(state_ != creating_app_folder) {
-        assert(state_ == creating_app_folder);
+void http_publisher::report_goodput(bool idle) {
+    // parallel uploads share the uplink, what they deliver together over
+    // wall time is what it carries. a single upload's rate times the
+    // uploads in flight overstates it whenever they overlap only partly.
+    if(NULL == bitrate_controller_ || 0 == goodput_bytes_) {
+        return;
     }
-
-    if(!validate_response(res)) {
-        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
-        delete res;
-        delete req;
+    const std::uint64_t now = now_ms();
+    if(!idle && now - goodput_since_ms_ < goodput_window_ms) {
         return;
     }
+    bitrate_controller_->on_upload(goodput_bytes_, std::max<std::uint64_t>(now - goodput_since_ms_, 1));
+    goodput_since_ms_ = now;
+    goodput_bytes_ = 0;
+}
 
-    const std::vector<uint8_t>& data = res->data();
+void http_publisher::queue_segment(common::segment* seg) {
 
-    Json::Value json;
-    if(parse_json(data, &json)) {
-        Json::Value& metadata = json["metadata"];
-        if(metadata.isObject()) {
-            Json::Value& path_lower_resp = metadata["path_lower"];
-            if(path_lower_resp.isString()) {
-                std::string path_lower = path_lower_resp.asString();
-                if(path_lower == "/_seccam_") {
-                    on_enumerate_files_complete();
-                } else {
-                    LOG(common::log::err) << "returned path is " << path_lower << common::log::end;
-                }
-            } else {
-                LOG(common::log::err) << "malformed create folder response" << common::log::end;
-            }
-        } else {
-            LOG(common::log::err) << "create folder failed" << common::log::end;
-        }
-    } else {
-        LOG(common::log::err) << "failed to parse response" << common::log::end;
+    // named by capture time in seconds, <start>-<end>. segments starting
+    // in the same second are told apart by a seq, <start>-<end>-<seq>.
+    const std::int64_t start_ms = 0 != seg->start_ms() ? seg->start_ms() : std::time(NULL) * 1000LL;
+    const std::time_t ts = start_ms / 1000;
+    const std::time_t end = std::max<std::time_t>((start_ms + seg->duration_ms() + 999) / 1000, ts + 1);
+    const int seq = name_seq(ts);
+    if(ts >= last_name_ts_) {
+        last_name_ts_ = ts;
+        last_name_seq_ = seq;
     }
 
-    delete req;
-    delete res;
-}
+    upload_session* upload = new upload_session;
+    upload->seg = seg;
+    upload->name = file_index::name(ts, end, seq);
+    upload->offset = 0;
+    upload->furthest_offset = 0;
+    upload->retry_count = 0;
+    upload->start_ms = 0;
 
-void http_publisher::on_enumerate_files_complete() {
-    LOG(common::log::info) << "connection ready" << common::log::end;
-    if(state_ != listing_app_folder && state_ != listing_app_folder_continue && state_ != creating_app_folder) {
-        assert(state_ == listing_app_folder ||
-               state_ == listing_app_folder_continue ||
-               state_ == creating_app_folder);
+    if(NULL != bitrate_controller_) {
+        bitrate_controller_->on_segment(seg->size(), pending_upload_bytes_, now_ms());
     }
-    state_ = idle;
-    on_connection_ready_(ctx_);
-}
+    pending_upload_bytes_ += seg->size();
 
-void http_publisher::pop_segment() {
-    if(state_ != idle && state_ != sending_segment && state_ != sending_segment_retry) {
-        assert(state_ == idle || state_ == sending_segment || state_ == sending_segment_retry);
-        return;
+    if(NULL != on_segment_) {
+        on_segment_(seg, on_segment_ctx_);
     }
 
-    state_ = popping_segment;
-
-    if(segment_list_.size() > 0) {
-        common::segment* seg = segment_list_.front();
-        LOG(common::log::info) << "sending segment size=" << seg->size() << common::log::end;
-        segment_list_.pop_front();
-        send_segment(seg);
-    } else {
-        if (last_segment_) {
-            LOG(common::log::info) << "no more segments" << common::log::end;
-            state_ = terminating_video;
-            on_last_request_sent_(ctx_);
-        } else {
-            LOG(common::log::info) << "segments list is empty - going idle" << common::log::end;
-            state_ = idle;
-        }
+    if(NULL != trace_) {
+        const std::uint64_t now = common::trace::now();
+        trace_->end("handoff", seg->start_ms(), now);
+        trace_->begin("backlog", seg->start_ms(), now);
     }
-}
-
-class http_publisher::on_segment_sent_handler {
-public:
-    on_segment_sent_handler(http_publisher* publisher, Json::Value* root, common::segment* seg)
-        : publisher_(publisher)
-        , root_(root)
-        , seg_(seg) {
 
+    if(NULL != live_) {
+        backlog_.push_back(live_);
     }
-    ~on_segment_sent_handler() {
+    live_ = upload;
 
+    if(state_ == initializing || state_ == enumerating) {
+        // nothing goes out before the listing, the oldest are kept
+        // locally instead of in memory
+        for(; backlog_.size() + 1 > options_.unlisted_queue_max && backlog_.size() != 0; backlog_.pop_front())
+            park_upload(backlog_.front());
     }
-private:
-    on_segment_sent_handler(const on_segment_sent_handler&) = delete;
-    void operator=(const on_segment_sent_handler&);
-public:
-    void execute(net::http_request* req, net::http_response* res) {
-        publisher_->handle_on_send_segment_complete(req, res, root_, seg_);
-    }
-private:
-    http_publisher* publisher_;
-    Json::Value* root_;
-    common::segment* seg_;
-};
 
-void http_publisher::send_segment(common::segment* seg) {
+}
+
+void http_publisher::send_segment(upload_session* upload) {
 
     if(state_ != popping_segment) {
         assert(state_ == popping_segment);
@@ -450,207 +490,137 @@ void http_publisher::send_segment(common::segment* seg) {
 
     state_ = sending_segment;
 
-    long new_size = files_size_ + seg->size();
-    last_segment_ = seg->last_segment();
-
-    if(new_size >= (1024*1024*1024)*2l) {
-        // TODO: delete most recent file and then resend
-    } 
-
-    std::time_t ts = std::time(NULL);
-    std::ostringstream name_str;
-    name_str << ts;
-
-    Json::Value* root_ptr = new Json::Value;
-    Json::Value& root = *root_ptr;
-    root["path"] = "/_seccam_/"+name_str.str();
-    Json::FastWriter writer;
-    std::string json_str = writer.write(root);
-    json_str = json_str.substr(0, json_str.size()-1); // erase '\n'
+    // the last segment can overtake the backlog, the flag has to stick
+    last_segment_ = last_segment_ || upload->seg->last_segment();
 
-    net::http_request* request = new net::http_request("POST", "/2/files/upload");
-    request->add_header("Host", file_upload_uri_);
-    request->add_header("Authorization", "Bearer "+bearer_);
-    request->add_header("Dropbox-API-Arg", json_str);
-    request->add_header("Content-Type", "application/octet-stream");
+    LOG(common::log::info) << "sending segment " << upload->name << " size=" << upload->seg->size()
+                           << " backlog=" << static_cast<unsigned long>(backlog_.size()) << common::log::end;
 
-    request->reference_data(seg->buffer(), seg->size());
-
-    file_upload_->make_request(request, http_publisher::on_send_segment_complete,
-                               new on_segment_sent_handler(this, root_ptr, seg));
+    upload->start_ms = now_ms();
+    if(NULL != trace_) {
+        const std::uint64_t now = common::trace::now();
+        trace_->end("backlog", upload->seg->start_ms(), now);
+        trace_->begin("upload", upload->seg->start_ms(), now);
+    }
+    send_upload(upload);
 
 }
 
-void http_publisher::on_send_segment_complete(http_request* req, http_response* res, void* ctx) {
-    on_segment_sent_handler* hnd = static_cast<on_segment_sent_handler*>(ctx);
-    hnd->execute(req, res);
-    delete hnd;
-}
+class http_publisher::put_handler {
+public:
+    put_handler(http_publisher* publisher, upload_session* upload)
+        : publisher_(publisher)
+        , upload_(upload) {
 
-bool http_publisher::process_upload_response(Json::Value& json) {
-    bool response_ok = false;
-    Json::Value& name = json["name"];
-    Json::Value& last_modified = json["client_modified"];
-    Json::Value& path_lower = json["path_lower"];
-    Json::Value& size = json["size"];
-    if(name.isString() && last_modified.isString() && path_lower.isString() && size.isNumeric()) {
-        std::string timestamp_str = name.asString();
-        int timestamp = std::atoi(timestamp_str.c_str());
-        if(timestamp > 0) {
-            api_file file = {
-                timestamp,
-                timestamp_str,
-                path_lower.asString(),
-                size.asInt(),
-                last_modified.asString()
-            };
-            files_size_ += file.size;
-            bool inserted = files_by_timestamp_.insert(std::make_pair(timestamp, file)).second;
-            assert(true == inserted);
-            response_ok = true;
-        } else {
-            LOG(common::log::err) << "invalid response filename is not a number" << common::log::end;
-        }
-    } else {
-        LOG(common::log::err) << "invalid response" << common::log::end;
     }
-    return response_ok;
-}
+    ~put_handler() {
 
-void http_publisher::handle_on_send_segment_complete(http_request* req,
-                                                     http_response* res,
-                                                     Json::Value* json_arg,
-                                                     common::segment* seg
-                                                     ) {
+    }
+private:
+    put_handler(const put_handler&) = delete;
+    void operator=(const put_handler&) = delete;
+public:
+    void execute(const put_result& result) {
+        publisher_->handle_on_put_complete(result, upload_);
+    }
+private:
+    http_publisher* publisher_;
+    upload_session* upload_;
+};
 
-    LOG(common::log::info) << "segment sent" << common::log::end;
+void http_publisher::send_upload(upload_session* upload) {
 
     if(state_ != sending_segment) {
         assert(state_ == sending_segment);
     }
 
-    if(!validate_response(res)) {
-        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
-        delete res;
-        delete req;
-        start_retry_timer(json_arg, seg, 0);
-        return;
-    }
-
-    const std::vector<uint8_t>& data = res->data();
-    
-    bool send_new_segment = false;
-    Json::Value json;
-    if(parse_json(data, &json)) {
-        if(process_upload_response(json)) {
-            send_new_segment = true;
-        } else {
-            LOG(common::log::err) << "failed to process response" << common::log::end;
-        }
+    // segments which fit in a single chunk are not worth a session,
+    // everything else is streamed so that a retry only transfers what
+    // the backend has not acknowledged yet
+    if(upload->seg->size() <= options_.upload_chunk_size) {
+        backend_->put(upload, &http_publisher::on_put_complete, new put_handler(this, upload));
     } else {
-        LOG(common::log::err) << "failed to parse response" << common::log::end;
+        backend_->put_streaming(upload, options_.upload_chunk_size, &http_publisher::on_put_complete, new put_handler(this, upload));
     }
 
-    delete req;
-    delete res;
-    delete json_arg;
-    delete seg;
-
-    if(send_new_segment) {
-        LOG(common::log::info) << "pop new segment" << common::log::end;
-        pop_segment();
-    }
 }
 
-void http_publisher::list_app_folder() {
-
-    if(state_ != listing_root_folder) {
-        assert(state_ == listing_root_folder);
-    }
-
-    state_ = listing_app_folder;
-
-    Json::Value root;
-    root["path"] = "/_seccam_";
-    root["recursive"] = false;
-    root["include_media_info"] = false;
-    root["include_deleted"] = false;
-    root["include_has_explicit_shared_members"] = false;
-
-    make_request_with_body("POST", "/2/files/list_folder", base_uri_, bearer_, root,
-                           api_, &http_publisher::on_list_app_folder_complete, this
-                           );
-
-}
-
-CB_TO_MEMFUN(on_list_app_folder_complete, handle_on_list_app_folder_complete);
-
-void http_publisher::list_app_folder_continue(const std::string& cursor) {
-
-    if(state_ != listing_app_folder) {
-        assert(state_ == listing_app_folder);
-    }
-
-    state_ = listing_app_folder_continue;
-
-    Json::Value root;
-    root["cursor"] = cursor;
-
-    make_request_with_body("POST", "/2/files/list_folder/continue", base_uri_, bearer_, root,
-                           api_, &http_publisher::on_list_app_folder_complete, this
-                           );
-
+void http_publisher::on_put_complete(const put_result& result, void* ctx) {
+    put_handler* hnd = static_cast<put_handler*>(ctx);
+    hnd->execute(result);
+    delete hnd;
 }
 
-void http_publisher::handle_on_list_app_folder_complete(http_request* req, http_response* res) {
+void http_publisher::handle_on_put_complete(const put_result& result, upload_session* upload) {
 
-    if(state_ != listing_app_folder && state_ != listing_app_folder_continue) {
-        assert(state_ == listing_app_folder || state_ == listing_app_folder_continue);
-    }
-
-    if(!validate_response(res)) {
-        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
-        delete res;
-        delete req;
-        return;
+    if(state_ != sending_segment) {
+        assert(state_ == sending_segment);
     }
 
-    const std::vector<uint8_t>& data = res->data();
-    Json::Value json;
-    if(parse_json(data, &json)) {
-        Json::Value& entries  = json["entries"];
-        if(entries.isArray()) {
-            append_to_files(entries);
-            Json::Value& has_more_resp = json["has_more"];
-            if(has_more_resp.isBool()) {
-                bool has_more = has_more_resp.asBool();
-                if(has_more) {
-                    Json::Value& cursor = json["cursor"];
-                    list_app_folder_continue(cursor.asString());
-                } else {
-                    on_enumerate_files_complete();
-                }
-            } else {
-                LOG(common::log::err) << "invalid response format has_more missing" << common::log::end;
+    if(result.status == put_result::progress) {
+        retry_policy_->on_success();
+        // a restarted session repeats chunks it sent before, only new
+        // ground ends the retries
+        if(upload->offset > upload->furthest_offset) {
+            count_delivered(upload->offset - upload->furthest_offset);
+            upload->furthest_offset = upload->offset;
+            upload->retry_count = 0;
+        }
+        send_upload(upload);
+    } else if(result.status == put_result::committed) {
+        retry_policy_->on_success();
+        std::uint64_t elapsed_ms = std::max<std::uint64_t>(now_ms() - upload->start_ms, 1);
+        LOG(common::log::info) << "segment " << upload->name << " sent, " << static_cast<unsigned long>(upload->seg->size())
+                               << " bytes in " << static_cast<unsigned long>(elapsed_ms) << "ms, "
+                               << static_cast<unsigned long>(upload->seg->size()/elapsed_ms) << " kB/s" << common::log::end;
+        if(NULL != metrics_) {
+            uploaded_bytes_->add(upload->seg->size());
+            uploads_committed_->add();
+            upload_time_->record(elapsed_ms * 1000);
+        }
+        if(NULL != trace_) {
+            // retries included, they are part of what the segment waited
+            trace_->end("upload", upload->seg->start_ms(), common::trace::now());
+        }
+        count_delivered(upload->seg->size() - std::min(upload->furthest_offset, upload->seg->size()));
+        release_upload_slot();
+        add_file(result.file);
+        finish_upload(upload);
+        evict_files();
+        LOG(common::log::debug) << "pop new segment" << common::log::end;
+        pop_segment();
+    } else if(result.status == put_result::cancelled) {
+        // the backend is being torn down, the segment is kept locally and
+        // nothing else goes out
+        release_upload_slot();
+        park_upload(upload);
+    } else {
+        release_upload_slot();
+        // the upload waits on its own, the next segment can go out meanwhile
+        if(result.status == put_result::retry) {
+            if(result.throttled) {
+                // rate limits apply to the whole account, hold back every upload
+                throttled_until_ms_ = std::max(throttled_until_ms_, now_ms() + std::max<std::uint32_t>(result.retry_after_ms, options_.retry_initial_ms));
             }
+            schedule_retry(upload, result.retry_after_ms);
         } else {
-            LOG(common::log::err) << "invalid response format entries missing" << common::log::end;
+            park_upload(upload);
         }
-    } else {
-        LOG(common::log::err) << "failed to parse the response" << common::log::end;
+        pop_segment();
     }
+}
 
-    delete req;
-    delete res;
+void http_publisher::finish_upload(upload_session* upload) {
+    pending_upload_bytes_ -= upload->seg->size();
+    upload->seg->unref();
+    delete upload;
 }
 
 class http_publisher::retry_timer_handler {
 public:
-    retry_timer_handler(http_publisher* publisher, Json::Value* json_arg, common::segment* seg, int retry_cnt)
+    retry_timer_handler(http_publisher* publisher, upload_session* upload)
         : publisher_(publisher)
-        , json_arg_(json_arg)
-        , seg_(seg)
-        , retry_cnt_(retry_cnt) {
+        , upload_(upload) {
 
     }
     ~retry_timer_handler() {
@@ -660,30 +630,36 @@ private:
     void operator=(const retry_timer_handler&);
 public:
     void execute() {
-        publisher_->handle_on_retry_expired(retry_cnt_, json_arg_, seg_);
+        publisher_->handle_on_retry_expired(upload_);
     }
 private:
     http_publisher* publisher_;
-    Json::Value* json_arg_;
-    common::segment* seg_;
-    int retry_cnt_;
+    upload_session* upload_;
 };
 
-void http_publisher::start_retry_timer(Json::Value* json_arg, common::segment* seg, int retry_count) {
+void http_publisher::schedule_retry(upload_session* upload, std::uint32_t retry_after_ms) {
 
-    if(state_ != sending_segment && state_ != sending_segment_retry) {
-        assert(state_ == sending_segment ||
-               state_ == sending_segment_retry
-               );
+    if(retry_policy_->exhausted(upload->retry_count)) {
+        LOG(common::log::err) << "giving up on " << upload->name << " after " << upload->retry_count << " retries" << common::log::end;
+        park_upload(upload);
+        return;
+    }
+
+    std::uint32_t timeout = retry_policy_->delay_ms(upload->retry_count, retry_after_ms);
+    upload->retry_count++;
+    if(NULL != metrics_) {
+        upload_retries_->add();
     }
 
-    state_ = sending_segment_retry_timer;
+    LOG(common::log::info) << "retry " << upload->retry_count << " of " << upload->name
+                           << " in " << timeout << "ms" << common::log::end;
 
-    std::uint32_t timeout = initial_retry_sec_ + retry_count*initial_retry_sec_;
-    net::timer* timer = new net::timer(evbase_, timeout,
-                                       &http_publisher::on_retry_timer_expired,
-                                       new retry_timer_handler(this, json_arg, seg, retry_count)
-                                       ); // deleted after on_retry_timer_expired
+    retry_timer_handler* hnd = new retry_timer_handler(this, upload);
+    net::timer* retry_timer = new net::timer(evbase_, timeout,
+                                             &http_publisher::on_retry_timer_expired,
+                                             hnd
+                                             ); // deleted after on_retry_timer_expired
+    waiting_retries_[upload] = std::make_pair(retry_timer, hnd);
 
 }
 
@@ -693,181 +669,135 @@ void http_publisher::on_retry_timer_expired(void* ctx) {
     delete hnd;
 }
 
-class http_publisher::on_send_segment_retry_complete_handler {
-public:
+void http_publisher::handle_on_retry_expired(upload_session* upload) {
 
-    on_send_segment_retry_complete_handler(int retry_cnt,
-                                           http_publisher* publisher,
-                                           Json::Value* json_arg,
-                                           common::segment* seg
-                                           )
-        : retry_cnt_(retry_cnt)
-        , publisher_(publisher)
-        , json_arg_(json_arg)
-        , seg_(seg) {
+    waiting_retries_.erase(upload);
+    retry_ready_.push_back(upload);
 
-    }
-
-    ~on_send_segment_retry_complete_handler() { }
+    LOG(common::log::info) << "retry " << upload->retry_count << " of " << upload->name
+                           << " ready at offset " << static_cast<unsigned long>(upload->offset) << common::log::end;
 
-private:
-    on_send_segment_retry_complete_handler(const on_send_segment_retry_complete_handler&) = delete;
-    void operator=(const on_send_segment_retry_complete_handler&) = delete;
-public:
-    void execute(http_request* req, http_response* res) {
-        publisher_->handle_on_send_segment_retry_complete(req, res, retry_cnt_, json_arg_, seg_);
+    if(upload_slot_free()) {
+        pop_segment();
     }
 
-private:
-    int retry_cnt_;
-    http_publisher* publisher_;
-    Json::Value* json_arg_;
-    common::segment* seg_;
-};
+}
 
-void http_publisher::handle_on_retry_expired(int retry_cnt, Json::Value* json_arg, common::segment* seg) {
+void http_publisher::on_throttle_expired(void* ctx) {
+    static_cast<http_publisher*>(ctx)->handle_on_throttle_expired();
+}
 
-    if(state_ != sending_segment_retry_timer) {
-        assert(sending_segment_retry_timer == state_);
+void http_publisher::handle_on_throttle_expired() {
+    throttle_timer_ = NULL; // deletes itself
+    if(upload_slot_free()) {
+        pop_segment();
     }
+}
 
-    state_ = sending_segment_retry;
-
-    Json::FastWriter writer;
-    std::string json_str = writer.write(*json_arg);
-    json_str = json_str.substr(0, json_str.size()-1); // erase '\n'
-
-    net::http_request* request = new net::http_request("POST", "/2/files/upload");
-    request->add_header("Host", file_upload_uri_);
-    request->add_header("Authorization", "Bearer "+bearer_);
-    request->add_header("Dropbox-API-Arg", json_str);
-    request->add_header("Content-Type", "application/octet-stream");
-
-    request->reference_data(seg->buffer(), seg->size());
-
-    file_upload_->make_request(request, http_publisher::on_send_segment_retry_complete,
-                               new on_send_segment_retry_complete_handler(retry_cnt, this, json_arg, seg));
+void http_publisher::park_upload(upload_session* upload) {
+    if(NULL != metrics_) {
+        uploads_parked_->add();
+    }
+    dead_letter_->park(upload->seg, upload->name);
+    finish_upload(upload);
+}
 
+void http_publisher::park_waiting_retries() {
+    for(; waiting_retries_.size() != 0; waiting_retries_.erase(waiting_retries_.begin())) {
+        std::map<upload_session*, std::pair<timer*, retry_timer_handler*> >::iterator it = waiting_retries_.begin();
+        delete it->second.first;
+        delete it->second.second;
+        park_upload(it->first);
+    }
+    for(; retry_ready_.size() != 0; retry_ready_.pop_front())
+        park_upload(retry_ready_.front());
 }
 
-void http_publisher::on_send_segment_retry_complete(http_request* req, http_response* res, void* ctx) {
-    on_send_segment_retry_complete_handler* hnd = static_cast<on_send_segment_retry_complete_handler*>(ctx);
-    hnd->execute(req, res);
-    delete hnd;
+void http_publisher::park_queued() {
+    LOG(common::log::warning) << "storage not listed, keeping " << static_cast<unsigned long>(backlog_.size() + (NULL != live_ ? 1 : 0))
+                              << " queued segments locally" << common::log::end;
+    delete list_timer_;
+    list_timer_ = NULL;
+    for(; backlog_.size() != 0; backlog_.pop_front())
+        park_upload(backlog_.front());
+    if(NULL != live_) {
+        park_upload(live_);
+        live_ = NULL;
+    }
+    state_ = terminating_video;
+    on_last_request_sent_(ctx_);
 }
 
-void http_publisher::handle_on_send_segment_retry_complete(http_request* req,
-                                                           http_response* res,
-                                                           int retry_cnt,
-                                                           Json::Value* json_arg,
-                                                           common::segment* seg
-                                                           ) {
+void http_publisher::evict_files() {
 
-    if(state_ != sending_segment_retry) {
-        assert(sending_segment_retry == state_);
+    if(!evicting_.empty()) {
+        return; // one batch at a time, the next one is planned when it completes
     }
-
-    if(!validate_response(res)) {
-        LOG(common::log::err) << "failed " << req->method() << " request to " << req->path() << common::log::end;
-        delete res;
-        delete req;
-
-        if(retry_cnt < max_retry_count_) {
-            start_retry_timer(json_arg, seg, retry_cnt+1);
-        } else {
-            delete json_arg;
-            delete seg;
-            // TODO: terminate
-            assert(NULL == "Retry expired");
+    if(state_ != idle && state_ != popping_segment && state_ != sending_segment) {
+        return; // index incomplete or shutting down
+    }
+
+    // queued segments count as used space so that room is made before
+    // the uploads need it, not after they fail
+    const long projected = static_cast<long>(index_.bytes()) + pending_upload_bytes_;
+    const long high = static_cast<long>(options_.quota_bytes/100*options_.quota_high_percent);
+    const long low = static_cast<long>(options_.quota_bytes/100*options_.quota_low_percent);
+    const bool over_quota = projected > high;
+    const std::time_t oldest_allowed = options_.max_age_sec != 0 ? std::time(NULL) - options_.max_age_sec : 0;
+
+    std::vector<std::string> paths;
+    long remaining = projected;
+    for(file_index::const_iterator it = index_.begin();
+        it != index_.end() && evicting_.size() < options_.delete_batch_max; ++it) {
+        bool too_old = it->timestamp < oldest_allowed;
+        if(!too_old && !(over_quota && remaining > low)) {
+            break;
         }
-        return;
+        paths.push_back(index_.path(*it));
+        evicting_.push_back(file_index::key(*it));
+        evicting_bytes_ += it->size;
+        remaining -= it->size;
     }
 
-    const std::vector<std::uint8_t>& data = res->data();
-
-    bool send_new_segment = false;
-    Json::Value json;
-    if(parse_json(data, &json)) {
-        if(process_upload_response(json)) {
-            send_new_segment = true;
-        } else {
-            LOG(common::log::err) << "failed to process response" << common::log::end;
-        }
-    } else {
-        LOG(common::log::err) << "failed to parse response" << common::log::end;
+    if(evicting_.empty()) {
+        return;
     }
 
-    delete res;
-    delete req;
-    delete json_arg;
-    delete seg;
-
-    if(send_new_segment) {
-        pop_segment();
-    } else {
-        // TODO: terminate
-        assert(false);
-    }
+    LOG(common::log::info) << "evicting " << static_cast<unsigned long>(evicting_.size()) << " files, "
+                           << evicting_bytes_ << " bytes, projected usage " << projected << common::log::end;
 
+    backend_->remove(paths, &http_publisher::on_remove_complete, this);
 }
 
-bool http_publisher::validate_response(http_response* res) {
-    if(res == nullptr) {
-        return false;
-    } else if (res->response_code() != 200) {
-        LOG(common::log::err) << "failed with" << res->response_code() << " " << res->response_phrase() << common::log::end;
-        const std::vector<std::uint8_t>& buf = res->data();
-        if(buf.size() != 0) {
-            const char* begin = reinterpret_cast<const char*>(&buf[0]);
-            const char* end = begin+buf.size();
-            std::string data(begin, end);
-            LOG(common::log::err) << "response " << data << common::log::end;
-        }
-        return false;
-    } else {
-        return true;
-    }
+void http_publisher::on_remove_complete(const std::vector<bool>& removed, void* ctx) {
+    static_cast<http_publisher*>(ctx)->handle_on_remove_complete(removed);
 }
 
-void http_publisher::append_to_files(Json::Value& entries) {
-    for(int i = 0 ; i < entries.size() ; i++) {
-        Json::Value& entry = entries[i];
-        if(!entry.isObject()) {
-            LOG(common::log::info) << "skip invalid entry" << common::log::end;
-            continue;
-        }
-        Json::Value& tag_resp = entry[".tag"];
-        if(!tag_resp.isString()) {
-            LOG(common::log::info) << "skip invalid entry" << common::log::end;
-            continue;
-        }
-        std::string tag = tag_resp.asString();
-        if(tag == "file") {
-
-            std::string filename = entry["name"].asString();
-            int timestamp = std::atoi(filename.c_str());
-            if(0 == timestamp) {
-                LOG(common::log::err) <<  "invalid file " << filename << common::log::end;
-                continue;
-            }
-
-            api_file file = {
-                timestamp,
-                filename,
-                entry["path_lower"].asString(),
-                entry["size"].asInt(),
-                entry["client_modified"].asString()
-            };
+void http_publisher::handle_on_remove_complete(const std::vector<bool>& removed) {
 
-            files_size_ += file.size;
+    assert(!evicting_.empty());
 
-            bool inserted = files_by_timestamp_.insert(std::make_pair(timestamp, file)).second;
-            assert(true == inserted);
-
-        } else {
-            LOG(common::log::err) << "found unexpected entry " << tag << " ignoring" << common::log::end;
+    // an empty result means the request failed, it is planned again
+    // with the next upload
+    bool any_removed = false;
+    if(removed.size() == evicting_.size()) {
+        std::vector<std::int64_t> keys;
+        for(std::size_t i = 0 ; i < removed.size() ; i++) {
+            if(removed[i]) {
+                keys.push_back(evicting_[i]);
+            }
         }
+        any_removed = index_.erase(keys) != 0;
+        LOG(common::log::info) << "evicted, usage now " << static_cast<unsigned long>(index_.bytes()) << common::log::end;
     }
-}
 
+    end_eviction();
+    if(any_removed) {
+        evict_files();
+    }
+}
 
+void http_publisher::end_eviction() {
+    evicting_.clear();
+    evicting_bytes_ = 0;
+}
@@ -2,141 +2,176 @@
 #define HTTP_PUBLISHER_H
 
 #include "api_file.h"
-
-#include <openssl/ssl.h>
+#include "upload_session.h"
+#include "publisher_options.h"
+#include "storage_backend.h"
+#include "file_index.h"
 
 #include <string>
 #include <map>
 #include <list>
+#include <vector>
+#include <cstdint>
+#include <ctime>
 
 struct event_base;
-struct evdns_base;
 struct event;
 
-
-namespace Json {
-    class Value;
-}
-
 namespace common {
     class segment;
+    class encoder_control;
+    class metrics;
+    class counter;
+    class histogram;
+    class trace;
 }
 
 namespace net {
 
-class http_connection;
-class http_request;
-class http_response;
+class retry_policy;
+class dead_letter;
+class timer;
+class bitrate_controller;
 
 class http_publisher {
 private:
     typedef void (*connection_event_cb)(void*);
+    typedef void (*segment_cb)(common::segment*, void*);
 public:
-    http_publisher( const std::string& base_uri,
-                    const std::string& file_upload_uri,
-                    const std::string& bearer,
-                    event_base* evbase,
-                    evdns_base* evdns,
-                    SSL_CTX* ssl_ctx,
+    http_publisher( event_base* evbase,
+                    storage_backend* backend,
                     int read_segment_fd,
+                    const publisher_options& options,
                     connection_event_cb on_connection_ready,
                     connection_event_cb on_connection_error,
                     connection_event_cb on_last_request_sent,
                     void* ctx
                     );
     ~http_publisher();
+public:
+    // lets the publisher throttle the encoder when the uplink falls behind
+    void set_encoder_control(common::encoder_control* control);
+    // sees every segment as it is queued, a listener that keeps it
+    // takes a reference
+    void set_segment_listener(segment_cb on_segment, void* ctx);
+    // upload counters and latency, queue depths and the state. the
+    // gauges read the publisher, they go away with it.
+    void set_metrics(common::metrics* metrics);
+    // continues the trace of each segment through backlog and upload
+    void set_trace(common::trace* trace);
+public:
+    // stored segments whose capture overlaps [@arg1, @arg2) in seconds
+    // since the epoch, answered from the index without a listing
+    void find_stored(int from, int to, std::vector<api_file>* files) const;
 private:
     static void on_segments(int, short what, void *ctx);
     void handle_on_segments();
+private:
+    static double read_queued(void* ctx);
+    static double read_in_flight(void* ctx);
+    static double read_pending_bytes(void* ctx);
+    static double read_state(void* ctx);
 private:
     http_publisher(const http_publisher&) = delete;
     void operator=(const http_publisher&) = delete;
 private:
-    static void on_api_connection_lost(void*);
-    void handle_on_api_connection_lost();
+    static void on_list_complete(bool ok, const std::vector<api_file>& files, void* ctx);
+    void handle_on_list_complete(bool ok, const std::vector<api_file>& files);
 
-    static void on_file_upload_connection_lost(void*);
-    void handle_on_file_upload_connection_lost();
+    static void on_list_retry_expired(void* ctx);
+    void handle_on_list_retry_expired();
 private:
-    void list_folders();
-    void list_folders_continue(const std::string& cursor);
-private:
-    void list_app_folder();
-    void list_app_folder_continue(const std::string& cursor);
-
-    void create_app_folder();
-private:
-    void send_segment(common::segment* seg);
+    void queue_segment(common::segment* seg);
+    void send_segment(upload_session* upload);
+    void send_upload(upload_session* upload);
 private:
     void pop_segment();
-private:
-    void on_enumerate_files_complete();
-private:
-    bool process_upload_response(Json::Value& resp);
-private:
-    static void on_list_folders_complete(http_request*, http_response*, void*);
-    void handle_on_list_folders_complete(http_request*, http_response*);
-
-    static void on_create_folder_complete(http_request*, http_response*, void*);
-    void handle_on_create_folder_complete(http_request*, http_response*);
-
-    static void on_list_app_folder_complete(http_request*, http_response*, void*);
-    void handle_on_list_app_folder_complete(http_request*, http_response*);
-
-    class on_segment_sent_handler;
-    static void on_send_segment_complete(http_request*, http_response*, void*);
-    void handle_on_send_segment_complete(http_request*, http_response*, Json::Value* json_arg, common::segment* seg);
+    bool upload_slot_free() const;
+    void take_upload_slot();
+    void release_upload_slot();
+    // bytes the backend acknowledged for the first time
+    void count_delivered(std::size_t bytes);
+    void report_goodput(bool idle);
+private:
+    void add_file(const api_file& file);
+    void rename_queued();
+    // the seq of a segment starting at @arg1, past what is stored or
+    // was named before under the same second
+    int name_seq(std::time_t ts) const;
+private:
+    class put_handler;
+    static void on_put_complete(const put_result& result, void* ctx);
+    void handle_on_put_complete(const put_result& result, upload_session* upload);
 
     class retry_timer_handler;
     static void on_retry_timer_expired(void* ctx);
-    void handle_on_retry_expired(int retry_cnt, Json::Value* json_arg, common::segment* seg);
+    void handle_on_retry_expired(upload_session* upload);
 
-    class on_send_segment_retry_complete_handler;
-    static void on_send_segment_retry_complete(http_request* req, http_response* res, void* ctx);
-    void handle_on_send_segment_retry_complete(http_request* req, http_response* res, int retry_cnt, Json::Value* json_arg, common::segment* seg);
+    static void on_throttle_expired(void* ctx);
+    void handle_on_throttle_expired();
 
+    static void on_remove_complete(const std::vector<bool>& removed, void* ctx);
+    void handle_on_remove_complete(const std::vector<bool>& removed);
 private:
-    void start_retry_timer(Json::Value* json_arg, common::segment* seg, int retry_count);
-private:
-    bool validate_response(http_response* resp);
+    void evict_files();
+    void end_eviction();
 private:
-    void append_to_files(Json::Value& entries);
+    void schedule_retry(upload_session* upload, std::uint32_t retry_after_ms);
+    void park_upload(upload_session* upload);
+    void park_waiting_retries();
+    // shutdown before the storage was listed
+    void park_queued();
+    void finish_upload(upload_session* upload);
 private:
-    std::string base_uri_;
-    std::string file_upload_uri_;
-    std::string bearer_;
     event_base* evbase_;
-    evdns_base* evdns_;
-    SSL_CTX* ssl_ctx_;
+    storage_backend* backend_;
     int read_segment_fd_;
     event* read_segments_event_;
-    std::list<common::segment*> segment_list_;
     connection_event_cb on_connection_ready_;
     connection_event_cb on_connection_error_;
     connection_event_cb on_last_request_sent_;
     void* ctx_;
-    http_connection* api_;
-    http_connection* file_upload_;
-    std::map<int, api_file> files_by_timestamp_;
-    long files_size_;
+    timer* list_timer_; // NULL unless a listing waits for a retry
+    int list_retries_;
+    file_index index_;
     bool last_segment_;
-    int initial_retry_sec_;
-    int max_retry_count_;
+    publisher_options options_;
+    retry_policy* retry_policy_;
+    dead_letter* dead_letter_;
+    std::list<upload_session*> retry_ready_;
+    std::map<upload_session*, std::pair<timer*, retry_timer_handler*> > waiting_retries_;
+    std::uint64_t throttled_until_ms_;
+    timer* throttle_timer_; // NULL unless pending
+    long pending_upload_bytes_;
+    std::size_t uploads_in_flight_;
+    // what all uploads delivered together since goodput_since_ms_
+    std::uint64_t goodput_since_ms_;
+    std::size_t goodput_bytes_;
+    std::vector<std::int64_t> evicting_;
+    long evicting_bytes_;
+    // the newest name handed out
+    std::time_t last_name_ts_;
+    int last_name_seq_;
+    // the segment that arrived last and everything it overtook
+    upload_session* live_;
+    std::list<upload_session*> backlog_;
+    bitrate_controller* bitrate_controller_;
+    segment_cb on_segment_;
+    void* on_segment_ctx_;
+    common::metrics* metrics_;
+    common::counter* uploaded_bytes_;
+    common::counter* uploads_committed_;
+    common::counter* upload_retries_;
+    common::counter* uploads_parked_;
+    common::histogram* upload_time_;
+    common::trace* trace_;
 private:
     enum http_state {
         initializing,
-        listing_root_folder,
-        listing_root_folder_continue,
-        creating_app_folder,
-        listing_app_folder,
-        listing_app_folder_continue,
-        generic_http_error,
-        starting_video_thread,
+        enumerating,
         idle,
         popping_segment,
         sending_segment,
-        sending_segment_retry_timer,
-        sending_segment_retry,
         terminating_video
     };
 private:
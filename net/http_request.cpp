@@ -1,4 +1,5 @@
 #include "http_request.h"
+#include "request_template.h"
 
 #include <event2/http.h>
 #include <event2/buffer.h>
@@ -8,6 +9,16 @@ using net::http_request;
 http_request::http_request(const std::string& method, const std::string& path)
     : method_(method)
     , path_(path)
+    , template_(NULL)
+    , data_size_(0)
+    , http_request_(evhttp_request_new(&http_request::on_evhttp_request_done, this))
+    , evhttp_request_done_cb_(NULL)
+    , ctx_(NULL) {
+
+}
+
+http_request::http_request(const request_template* tmpl)
+    : template_(tmpl)
     , data_size_(0)
     , http_request_(evhttp_request_new(&http_request::on_evhttp_request_done, this))
     , evhttp_request_done_cb_(NULL)
@@ -25,6 +36,11 @@ void http_request::add_header(const std::string& field, const std::string& value
     evhttp_add_header(headers, field.c_str(), value.c_str());
 }
 
+void http_request::add_header(const char* field, const char* value) {
+    evkeyvalq* headers = evhttp_request_get_output_headers(http_request_);
+    evhttp_add_header(headers, field, value);
+}
+
 void http_request::data(const char* buf, std::size_t sz) {
     evbuffer *evbuf = evhttp_request_get_output_buffer(http_request_);
     evbuffer_add(evbuf, buf, sz);
@@ -37,11 +53,11 @@ void http_request::reference_data(const void* buf, std::size_t sz) {
 }
 
 const std::string& http_request::method() const {
-    return method_;
+    return NULL == template_ ? method_ : template_->method();
 }
 
 const std::string& http_request::path() const {
-    return path_;
+    return NULL == template_ ? path_ : template_->path();
 }
 
 void http_request::callback(evhttp_request_done_cb cb, void* ctx) {
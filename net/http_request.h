@@ -9,6 +9,8 @@ struct evhttp_request;
 
 namespace net {
 
+class request_template;
+
 class http_request {
 private:
     typedef void (*evhttp_request_done_cb)(evhttp_request *, void *);
@@ -20,11 +22,15 @@ private:
     void operator=(const http_request&) = delete;
 public:
     void add_header(const std::string& field, const std::string& value);
+    void add_header(const char* field, const char* value);
     void data(const char* buf, std::size_t sz);
     void reference_data(const void*, std::size_t);
 public:
     const std::string& method() const;
     const std::string& path() const;
+private:
+    friend class request_template;
+    explicit http_request(const request_template* tmpl);
 private:
     friend class http_connection;
     void callback(evhttp_request_done_cb, void*);
@@ -37,6 +43,7 @@ private:
 private:
     std::string method_;
     std::string path_;
+    const request_template* template_;
     std::uint32_t data_size_;
     evhttp_request* http_request_;
     evhttp_request_done_cb evhttp_request_done_cb_;
@@ -3,13 +3,10 @@
 #include <event2/http.h>
 #include <event2/buffer.h>
 
-#include <cassert>
-
 using net::http_response;
 
 http_response::http_response(evhttp_request* evreq) 
-    : evreq_(evreq)
-    , buffer_read_(false) {
+    : evreq_(evreq) {
     
 }
 
@@ -21,17 +18,29 @@ int http_response::response_code() const {
 }
 
 const char* http_response::response_phrase() const {
-    return evhttp_request_get_response_code_line(evreq_);
+    // none without a response, e.g. when the connect failed
+    const char* phrase = evhttp_request_get_response_code_line(evreq_);
+    return NULL != phrase ? phrase : "";
+}
+
+const char* http_response::header(const char* field) const {
+    evkeyvalq* headers = evhttp_request_get_input_headers(evreq_);
+    return evhttp_find_header(headers, field);
+}
+
+std::size_t http_response::size() const {
+    return evbuffer_get_length(evhttp_request_get_input_buffer(evreq_));
 }
 
-const std::vector<uint8_t>& http_response::data() {
-    if(!buffer_read_) {
-        evbuffer* buf = evhttp_request_get_input_buffer(evreq_);
-        std::size_t sz = evbuffer_get_length(buf);
-        buffer_.resize(sz);
-        int drained = evbuffer_copyout(buf, &buffer_[0], sz);
-        assert(sz == drained);
-        buffer_read_ = true;
+const char* http_response::body() {
+    evbuffer* buf = evhttp_request_get_input_buffer(evreq_);
+    if(0 == evbuffer_get_length(buf)) {
+        return NULL;
     }
-    return buffer_;
-}
\ No newline at end of file
+    // no copy when the first chain holds everything
+    return reinterpret_cast<const char*>(evbuffer_pullup(buf, -1));
+}
+
+int http_response::peek(evbuffer_iovec* vec, int n) const {
+    return evbuffer_peek(evhttp_request_get_input_buffer(evreq_), -1, NULL, vec, n);
+}
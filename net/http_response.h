@@ -3,11 +3,14 @@
 
 struct evhttp_request;
 
-#include <cstdint>
-#include <vector>
+#include <event2/buffer.h>
+
+#include <cstddef>
 
 namespace net {
 
+// the body is never copied out, it is read in place from libevent's
+// input buffer for as long as the response lives
 class http_response {
 public:
     http_response(evhttp_request* evreq);
@@ -15,17 +18,23 @@ public:
 public:
     int response_code() const;
     const char* response_phrase() const;
+    const char* header(const char* field) const;
 public:
-    const std::vector<uint8_t>& data();
+    std::size_t size() const;
+    // the whole body in one piece, NULL if it is empty. a body that
+    // arrived in one chunk is returned as is, otherwise libevent joins
+    // the chunks in its own buffer
+    const char* body();
+    // fills @arg1 with up to @arg2 pieces of the body without moving
+    // anything, returns how many pieces there are
+    int peek(evbuffer_iovec* vec, int n) const;
 private:
     http_response(const http_response&) = delete;
     void operator=(const http_response&) = delete;
 private:
     evhttp_request* evreq_;
-    bool buffer_read_;
-    std::vector<uint8_t> buffer_;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,269 @@
+#include "json_scanner.h"
+
+#include <cstring>
+
+using net::json_scanner;
+
+namespace {
+
+bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+int hex_value(char c) {
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool read_hex4(const char* p, const char* end, unsigned* code) {
+    if(end - p < 4) {
+        return false;
+    }
+    *code = 0;
+    for(int i = 0 ; i < 4 ; i++) {
+        int v = hex_value(p[i]);
+        if(v < 0) {
+            return false;
+        }
+        *code = (*code << 4) | v;
+    }
+    return true;
+}
+
+void append_utf8(std::string* out, unsigned code) {
+    if(code < 0x80) {
+        out->push_back(static_cast<char>(code));
+    } else if(code < 0x800) {
+        out->push_back(static_cast<char>(0xc0 | (code >> 6)));
+        out->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else if(code < 0x10000) {
+        out->push_back(static_cast<char>(0xe0 | (code >> 12)));
+        out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+        out->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    } else {
+        out->push_back(static_cast<char>(0xf0 | (code >> 18)));
+        out->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+        out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+        out->push_back(static_cast<char>(0x80 | (code & 0x3f)));
+    }
+}
+
+}
+
+json_scanner::json_scanner(const char* begin, const char* end)
+    : pos_(begin)
+    , end_(end)
+    , token_begin_(begin)
+    , token_end_(begin)
+    , token_(null)
+    , key_(false)
+    , expect_key_(false)
+    , escaped_(false) {
+
+}
+
+json_scanner::~json_scanner() {
+
+}
+
+json_scanner::token json_scanner::fail() {
+    token_ = error;
+    return token_;
+}
+
+json_scanner::token json_scanner::next() {
+    if(token_ == error || token_ == end) {
+        return token_;
+    }
+    key_ = false;
+
+    while(pos_ != end_ && is_space(*pos_)) pos_++;
+    // separators only decide whether a member name comes next
+    if(pos_ != end_ && (*pos_ == ',' || *pos_ == ':')) {
+        if(nesting_.empty()) {
+            return fail();
+        }
+        expect_key_ = *pos_ == ',' && nesting_.back() == '{';
+        pos_++;
+        while(pos_ != end_ && is_space(*pos_)) pos_++;
+    }
+    if(pos_ == end_) {
+        if(!nesting_.empty()) {
+            return fail();
+        }
+        token_ = end;
+        return token_;
+    }
+
+    token_begin_ = pos_;
+    const char c = *pos_++;
+    switch(c) {
+    case '{':
+        nesting_.push_back('{');
+        expect_key_ = true;
+        token_ = object_begin;
+        break;
+    case '[':
+        nesting_.push_back('[');
+        expect_key_ = false;
+        token_ = array_begin;
+        break;
+    case '}':
+    case ']':
+        if(nesting_.empty() || nesting_.back() != (c == '}' ? '{' : '[')) {
+            return fail();
+        }
+        nesting_.pop_back();
+        expect_key_ = false;
+        token_ = c == '}' ? object_end : array_end;
+        break;
+    case '"':
+        escaped_ = false;
+        token_begin_ = pos_;
+        while(pos_ != end_ && *pos_ != '"') {
+            if(*pos_ == '\\') {
+                escaped_ = true;
+                if(++pos_ == end_) {
+                    return fail();
+                }
+            }
+            pos_++;
+        }
+        if(pos_ == end_) {
+            return fail();
+        }
+        token_end_ = pos_++;
+        key_ = expect_key_ && !nesting_.empty() && nesting_.back() == '{';
+        expect_key_ = false;
+        token_ = string;
+        return token_;
+    case 't':
+    case 'f':
+    case 'n': {
+        const char* literal = c == 't' ? "true" : (c == 'f' ? "false" : "null");
+        std::size_t len = std::strlen(literal);
+        if(static_cast<std::size_t>(end_ - token_begin_) < len || 0 != std::memcmp(token_begin_, literal, len)) {
+            return fail();
+        }
+        pos_ = token_begin_ + len;
+        token_ = c == 'n' ? null : boolean;
+        break;
+    }
+    default:
+        if(c != '-' && (c < '0' || c > '9')) {
+            return fail();
+        }
+        while(pos_ != end_ && ((*pos_ >= '0' && *pos_ <= '9') || *pos_ == '.' || *pos_ == 'e' || *pos_ == 'E' || *pos_ == '+' || *pos_ == '-')) {
+            pos_++;
+        }
+        token_ = number;
+        break;
+    }
+    token_end_ = pos_;
+    return token_;
+}
+
+json_scanner::token json_scanner::current() const {
+    return token_;
+}
+
+bool json_scanner::is_key() const {
+    return key_;
+}
+
+std::size_t json_scanner::depth() const {
+    // a container's own braces count at the level of its parent
+    if(token_ == object_begin || token_ == array_begin) {
+        return nesting_.size() - 1;
+    }
+    return nesting_.size();
+}
+
+bool json_scanner::skip() {
+    if(token_ != object_begin && token_ != array_begin) {
+        return token_ != error;
+    }
+    const std::size_t level = nesting_.size();
+    while(nesting_.size() >= level) {
+        if(next() == error || token_ == end) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool json_scanner::equals(const char* literal) const {
+    if(token_ != string) {
+        return false;
+    }
+    const std::size_t len = std::strlen(literal);
+    if(!escaped_) {
+        return static_cast<std::size_t>(token_end_ - token_begin_) == len && 0 == std::memcmp(token_begin_, literal, len);
+    }
+    std::string unescaped;
+    value(&unescaped);
+    return unescaped == literal;
+}
+
+void json_scanner::value(std::string* out) const {
+    out->clear();
+    if(token_ != string) {
+        return;
+    }
+    if(!escaped_) {
+        out->assign(token_begin_, token_end_);
+        return;
+    }
+    for(const char* p = token_begin_ ; p < token_end_ ; p++) {
+        if(*p != '\\') {
+            out->push_back(*p);
+            continue;
+        }
+        p++;
+        switch(*p) {
+        case 'b': out->push_back('\b'); break;
+        case 'f': out->push_back('\f'); break;
+        case 'n': out->push_back('\n'); break;
+        case 'r': out->push_back('\r'); break;
+        case 't': out->push_back('\t'); break;
+        case 'u': {
+            unsigned code = 0;
+            if(!read_hex4(p+1, token_end_, &code)) {
+                return;
+            }
+            p += 4;
+            unsigned low = 0;
+            if(code >= 0xd800 && code < 0xdc00 && token_end_ - p > 6 && p[1] == '\\' && p[2] == 'u' &&
+               read_hex4(p+3, token_end_, &low) && low >= 0xdc00 && low < 0xe000) {
+                code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+                p += 6;
+            }
+            append_utf8(out, code);
+            break;
+        }
+        default: out->push_back(*p); break;
+        }
+    }
+}
+
+std::int64_t json_scanner::int_value() const {
+    if(token_ != number) {
+        return 0;
+    }
+    const char* p = token_begin_;
+    bool negative = p != token_end_ && *p == '-';
+    if(negative) {
+        p++;
+    }
+    std::int64_t value = 0;
+    for(; p != token_end_ && *p >= '0' && *p <= '9' ; p++) {
+        value = value*10 + (*p - '0');
+    }
+    return negative ? -value : value;
+}
+
+bool json_scanner::bool_value() const {
+    return token_ == boolean && *token_begin_ == 't';
+}
@@ -0,0 +1,66 @@
+#ifndef JSON_SCANNER_H
+#define JSON_SCANNER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace net {
+
+// pull parser over a complete JSON document. tokens point into the
+// buffer, nothing is allocated unless a string is asked for. it trusts
+// the server to send well formed JSON and only checks nesting and
+// literals.
+class json_scanner {
+public:
+    enum token {
+        object_begin,
+        object_end,
+        array_begin,
+        array_end,
+        string,
+        number,
+        boolean,
+        null,
+        end,
+        error
+    };
+public:
+    json_scanner(const char* begin, const char* end);
+    ~json_scanner();
+private:
+    json_scanner(const json_scanner&) = delete;
+    void operator=(const json_scanner&) = delete;
+public:
+    token next();
+    token current() const;
+    // the current string is a member name
+    bool is_key() const;
+    // nesting of the current token, the top level object's members are 1
+    std::size_t depth() const;
+    // skips over the value that starts with the current token
+    bool skip();
+public:
+    // compares the current string without unescaping it
+    bool equals(const char* literal) const;
+    void value(std::string* out) const;
+    std::int64_t int_value() const;
+    bool bool_value() const;
+private:
+    token fail();
+private:
+    const char* pos_;
+    const char* end_;
+    const char* token_begin_;
+    const char* token_end_;
+    token token_;
+    bool key_;
+    bool expect_key_;
+    bool escaped_;
+    std::vector<char> nesting_;
+};
+
+}
+
+#endif // JSON_SCANNER_H
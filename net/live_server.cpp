@@ -0,0 +1,696 @@
+#include "live_server.h"
+
+#include "dropbox_json.h"
+#include "ts_muxer.h"
+
+#include "logging/log.h"
+
+#include "common/segment.h"
+#include "common/spsc_queue.h"
+#include "common/metrics.h"
+#include "common/trace.h"
+
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+#include <event2/keyvalq_struct.h>
+
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cassert>
+
+using net::live_server;
+
+namespace {
+
+const char* const playlist_path = "/live.m3u8";
+const char* const snapshot_path = "/snapshot.jpg";
+const char* const archive_path = "/segments";
+const char* const metrics_path = "/metrics";
+const char* const trace_path = "/trace.json";
+const char* const segment_prefix = "/live/";
+const char* const segment_suffix = ".ts";
+const char* const segment_type = "video/mp2t";
+
+// parts waiting for the main loop, about a minute of them
+const std::size_t parts_capacity = 256;
+
+// the segments whose parts are listed, the one being written included
+const std::size_t part_segments = 3;
+
+std::uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string seconds(std::uint32_t ms) {
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%u.%03u", ms / 1000, ms % 1000);
+    return buf;
+}
+
+bool archived_before(const live_server::archived& lhs, const live_server::archived& rhs) {
+    return lhs.start < rhs.start;
+}
+
+std::string segment_uri(std::uint64_t seq) {
+    std::ostringstream uri;
+    uri << segment_prefix << seq << segment_suffix;
+    return uri.str();
+}
+
+std::string part_uri(std::uint64_t seq, std::size_t part) {
+    std::ostringstream uri;
+    uri << segment_prefix << seq << "." << part << segment_suffix;
+    return uri.str();
+}
+
+}
+
+live_server::live_server(
+    event_base* evbase,
+    const std::string& address,
+    std::uint16_t port,
+    std::size_t segments_kept,
+    int segment_length_sec
+    )
+    : evbase_(evbase)
+    , http_(NULL)
+    , port_(0)
+    , segments_kept_(std::max<std::size_t>(segments_kept, 1))
+    , segment_length_ms_(static_cast<std::uint32_t>(segment_length_sec)*1000)
+    , next_seq_(0)
+    , ended_(false)
+    , muxer_(new ts_muxer)
+    , requests_(0)
+    , part_ms_(0)
+    , parts_(NULL)
+    , parts_fd_(-1)
+    , parts_event_(NULL)
+    , tick_event_(NULL)
+    , snapshot_(NULL)
+    , snapshot_ctx_(NULL)
+    , metrics_(NULL)
+    , trace_(NULL) {
+
+    http_ = evhttp_new(evbase_);
+    evhttp_set_gencb(http_, &live_server::on_request, this);
+    evhttp_set_allowed_methods(http_, EVHTTP_REQ_GET|EVHTTP_REQ_HEAD);
+
+    evhttp_bound_socket* handle = evhttp_bind_socket_with_handle(http_, address.c_str(), port);
+    if(NULL == handle) {
+        evhttp_free(http_);
+        delete muxer_;
+        throw std::runtime_error("cannot listen on "+address);
+    }
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(evhttp_bound_socket_get_fd(handle), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    port_ = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port
+                                             : reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+
+    write_playlist();
+
+    LOG(common::log::info) << "live view on " << address << ":" << port_ << playlist_path << common::log::end;
+}
+
+live_server::~live_server() {
+    if(NULL != tick_event_) {
+        event_free(tick_event_);
+    }
+    if(NULL != parts_event_) {
+        event_free(parts_event_);
+    }
+    // held requests go with their connections, replies still in flight
+    // hold their own references
+    evhttp_free(http_);
+    held_.clear();
+    if(NULL != parts_) {
+        posted_part posted;
+        while(parts_->pop(&posted)) {
+            posted.part->unref();
+        }
+        delete parts_;
+        close(parts_fd_);
+    }
+    for(; segments_.size() != 0; segments_.pop_front())
+        release(&segments_.front());
+    delete muxer_;
+}
+
+void live_server::set_snapshot_source(snapshot_cb snapshot, void* ctx) {
+    snapshot_ = snapshot;
+    snapshot_ctx_ = ctx;
+}
+
+void live_server::add_archive_source(archive_cb find, void* ctx) {
+    archives_.push_back(std::make_pair(find, ctx));
+}
+
+void live_server::set_metrics(const common::metrics* metrics) {
+    metrics_ = metrics;
+}
+
+void live_server::set_trace(const common::trace* trace) {
+    trace_ = trace;
+}
+
+std::uint16_t live_server::port() const {
+    return port_;
+}
+
+std::uint64_t live_server::requests() const {
+    return requests_;
+}
+
+void live_server::on_segment(common::segment* seg, void* ctx) {
+    static_cast<live_server*>(ctx)->add_segment(seg);
+}
+
+void live_server::add_segment(common::segment* seg) {
+    assert(0 == part_ms_);
+    live_segment live;
+    live.seq = next_seq_++;
+    bool independent;
+    live.seg = muxer_->write(seg, &independent);
+    live.duration_ms = 0 != seg->duration_ms() ? seg->duration_ms() : segment_length_ms_;
+    live.complete = true;
+    segments_.push_back(live);
+    ended_ = seg->last_segment();
+    trim();
+    write_playlist();
+}
+
+void live_server::enable_parts(std::uint32_t part_ms) {
+    assert(0 != part_ms && NULL == parts_);
+    part_ms_ = part_ms;
+    parts_ = new common::spsc_queue<posted_part>(parts_capacity);
+    parts_fd_ = eventfd(0, EFD_NONBLOCK);
+    if(parts_fd_ < 0) {
+        throw std::runtime_error("cannot create live view parts queue");
+    }
+    parts_event_ = event_new(evbase_, parts_fd_, EV_READ|EV_PERSIST, &live_server::on_parts, this);
+    event_add(parts_event_, NULL);
+
+    tick_event_ = event_new(evbase_, -1, EV_PERSIST, &live_server::on_tick, this);
+    timeval tv = { static_cast<time_t>(part_ms_/1000), static_cast<suseconds_t>(part_ms_%1000*1000) };
+    event_add(tick_event_, &tv);
+
+    write_playlist();
+}
+
+void live_server::on_part(common::segment* part, bool ends_segment, void* ctx) {
+    static_cast<live_server*>(ctx)->post_part(part, ends_segment);
+}
+
+void live_server::post_part(common::segment* part, bool ends_segment) {
+    // capture thread
+    posted_part posted = { part, ends_segment };
+    if(!parts_->push(posted)) {
+        LOG(common::log::err) << "live view behind, dropping a part" << common::log::end;
+        part->unref();
+        return;
+    }
+    std::uint64_t one = 1;
+    if(write(parts_fd_, &one, sizeof(one)) != sizeof(one)) {
+        assert(false);
+    }
+}
+
+void live_server::on_parts(int, short, void* ctx) {
+    static_cast<live_server*>(ctx)->handle_on_parts();
+}
+
+void live_server::handle_on_parts() {
+    std::uint64_t count;
+    if(read(parts_fd_, &count, sizeof(count)) < 0) {
+        // EAGAIN, woken for parts that were already taken
+    }
+    posted_part posted;
+    bool added = false;
+    while(parts_->pop(&posted)) {
+        add_part(posted.part, posted.ends_segment);
+        added = true;
+    }
+    if(added) {
+        write_playlist();
+        answer_held();
+    }
+}
+
+void live_server::add_part(common::segment* part, bool ends_segment) {
+    if(segments_.empty() || segments_.back().complete) {
+        live_segment live;
+        live.seq = next_seq_++;
+        live.seg = NULL;
+        live.duration_ms = 0;
+        live.complete = false;
+        segments_.push_back(live);
+    }
+    live_segment& live = segments_.back();
+    live.complete = ends_segment;
+    ended_ = ended_ || part->last_segment();
+    if(0 != part->size()) {
+        bool independent;
+        common::segment* packed = muxer_->write(part, &independent);
+        if(0 != packed->size()) {
+            live.parts.push_back(packed);
+            live.independent.push_back(independent);
+            live.duration_ms += part->duration_ms();
+        } else {
+            packed->unref();
+        }
+    }
+    part->unref();
+    trim();
+}
+
+void live_server::release(live_segment* live) {
+    if(NULL != live->seg) {
+        live->seg->unref();
+    }
+    for(std::size_t i = 0 ; i < live->parts.size() ; i++) {
+        live->parts[i]->unref();
+    }
+    live->parts.clear();
+    live->independent.clear();
+}
+
+void live_server::trim() {
+    // the segment being written does not count
+    const std::size_t kept = segments_kept_ + (!segments_.empty() && !segments_.back().complete ? 1 : 0);
+    for(; segments_.size() > kept; segments_.pop_front())
+        release(&segments_.front());
+}
+
+live_server::live_segment* live_server::find_segment(std::uint64_t seq) {
+    if(segments_.empty() || seq < segments_.front().seq || seq > segments_.back().seq) {
+        return NULL;
+    }
+    return &segments_[seq - segments_.front().seq];
+}
+
+std::uint64_t live_server::writing_seq() const {
+    return segments_.empty() || segments_.back().complete ? next_seq_ : segments_.back().seq;
+}
+
+bool live_server::playlist_has(std::uint64_t seq, std::size_t part) {
+    if(ended_ || (!segments_.empty() && seq < segments_.front().seq)) {
+        return true;
+    }
+    live_segment* live = find_segment(seq);
+    if(NULL == live) {
+        return false;
+    }
+    return live->complete || (part != std::string::npos && part < live->parts.size());
+}
+
+void live_server::write_playlist() {
+    std::uint32_t target_ms = segment_length_ms_;
+    std::uint32_t part_target_ms = part_ms_;
+    for(std::size_t i = 0 ; i < segments_.size() ; i++) {
+        target_ms = std::max(target_ms, segments_[i].duration_ms);
+        for(std::size_t j = 0 ; j < segments_[i].parts.size() ; j++) {
+            part_target_ms = std::max(part_target_ms, segments_[i].parts[j]->duration_ms());
+        }
+    }
+
+    std::ostringstream out;
+    out << "#EXTM3U\n"
+        << "#EXT-X-VERSION:" << (0 != part_ms_ ? 6 : 3) << "\n"
+        << "#EXT-X-TARGETDURATION:" << (target_ms + 999) / 1000 << "\n";
+    if(0 != part_ms_) {
+        out << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" << seconds(part_target_ms*3) << "\n"
+            << "#EXT-X-PART-INF:PART-TARGET=" << seconds(part_target_ms) << "\n";
+    }
+    out << "#EXT-X-MEDIA-SEQUENCE:" << (segments_.empty() ? next_seq_ : segments_.front().seq) << "\n";
+    for(std::size_t i = 0 ; i < segments_.size() ; i++) {
+        const live_segment& live = segments_[i];
+        if(i + part_segments >= segments_.size()) {
+            // a segment starts with its codec headers and a key frame, the
+            // encoder puts more of them inside, where a player can join
+            // without waiting for the next segment
+            for(std::size_t j = 0 ; j < live.parts.size() ; j++) {
+                out << "#EXT-X-PART:DURATION=" << seconds(live.parts[j]->duration_ms())
+                    << ",URI=\"" << part_uri(live.seq, j) << "\"" << (live.independent[j] ? ",INDEPENDENT=YES" : "") << "\n";
+            }
+        }
+        if(live.complete) {
+            out << "#EXTINF:" << seconds(live.duration_ms) << ",\n"
+                << segment_uri(live.seq) << "\n";
+        }
+    }
+    if(ended_) {
+        out << "#EXT-X-ENDLIST\n";
+    } else if(0 != part_ms_) {
+        const std::uint64_t seq = writing_seq();
+        live_segment* live = find_segment(seq);
+        out << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" << part_uri(seq, NULL != live ? live->parts.size() : 0) << "\"\n";
+    }
+    playlist_ = out.str();
+}
+
+void live_server::on_request(evhttp_request* req, void* ctx) {
+    static_cast<live_server*>(ctx)->handle_on_request(req);
+}
+
+void live_server::handle_on_request(evhttp_request* req) {
+    requests_++;
+
+    // held requests must not outlive their connection
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req), &live_server::on_connection_close, this);
+
+    const char* path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+    if(NULL == path) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+        return;
+    }
+    if(0 == std::strcmp(path, playlist_path)) {
+        request_playlist(req);
+        return;
+    }
+    if(0 == std::strcmp(path, snapshot_path) && NULL != snapshot_) {
+        send_snapshot(req);
+        return;
+    }
+    if(0 == std::strcmp(path, archive_path) && !archives_.empty()) {
+        send_archived(req);
+        return;
+    }
+    if(0 == std::strcmp(path, metrics_path) && NULL != metrics_) {
+        send_metrics(req);
+        return;
+    }
+    if(0 == std::strcmp(path, trace_path) && NULL != trace_) {
+        send_trace(req);
+        return;
+    }
+
+    // /live/<seq>.ts or /live/<seq>.<part>.ts
+    const std::size_t prefix_len = std::strlen(segment_prefix);
+    if(0 == std::strncmp(path, segment_prefix, prefix_len)) {
+        char* end = NULL;
+        unsigned long long seq = std::strtoull(path + prefix_len, &end, 10);
+        if(end != path + prefix_len && 0 == std::strcmp(end, segment_suffix)) {
+            request_segment(req, seq);
+            return;
+        }
+        if(end != path + prefix_len && '.' == *end && 0 != part_ms_) {
+            const char* part_begin = end + 1;
+            unsigned long part = std::strtoul(part_begin, &end, 10);
+            if(end != part_begin && 0 == std::strcmp(end, segment_suffix)) {
+                request_part(req, seq, part);
+                return;
+            }
+        }
+    }
+    evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+}
+
+void live_server::request_playlist(evhttp_request* req) {
+    // blocking reload, _HLS_msn=<seq>[&_HLS_part=<part>] answers once
+    // the playlist has that part
+    const char* query = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+    evkeyvalq params;
+    if(0 == part_ms_ || NULL == query || 0 != evhttp_parse_query_str(query, &params)) {
+        send_playlist(req);
+        return;
+    }
+    const char* msn = evhttp_find_header(&params, "_HLS_msn");
+    const char* part = evhttp_find_header(&params, "_HLS_part");
+    if(NULL == msn) {
+        evhttp_clear_headers(&params);
+        send_playlist(req);
+        return;
+    }
+    const std::uint64_t seq = std::strtoull(msn, NULL, 10);
+    const std::size_t part_index = NULL != part ? std::strtoul(part, NULL, 10) : std::string::npos;
+    evhttp_clear_headers(&params);
+
+    if(seq > writing_seq() + 2) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+    } else if(playlist_has(seq, part_index)) {
+        send_playlist(req);
+    } else {
+        hold(req, held_playlist, seq, part_index, now_ms() + 3*std::max(segment_length_ms_, part_ms_));
+    }
+}
+
+void live_server::send_playlist(evhttp_request* req) {
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", "application/vnd.apple.mpegurl");
+    evhttp_add_header(headers, "Cache-Control", "no-cache");
+    evbuffer* body = evbuffer_new();
+    evbuffer_add(body, playlist_.data(), playlist_.size());
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::send_snapshot(evhttp_request* req) {
+    // encoded at most once per frame, everyone in between gets a copy
+    // of the same image
+    const std::uint8_t* data = NULL;
+    std::size_t size = 0;
+    if(!snapshot_(&data, &size, snapshot_ctx_)) {
+        evhttp_send_error(req, HTTP_SERVUNAVAIL, NULL);
+        return;
+    }
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", "image/jpeg");
+    evhttp_add_header(headers, "Cache-Control", "no-cache");
+    evbuffer* body = evbuffer_new();
+    evbuffer_add(body, data, size);
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::send_archived(evhttp_request* req) {
+    const char* query = evhttp_uri_get_query(evhttp_request_get_evhttp_uri(req));
+    evkeyvalq params;
+    if(NULL == query || 0 != evhttp_parse_query_str(query, &params)) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+        return;
+    }
+    const char* from_str = evhttp_find_header(&params, "from");
+    const char* to_str = evhttp_find_header(&params, "to");
+    char* end = NULL;
+    const std::int64_t from = NULL != from_str ? std::strtoll(from_str, &end, 10) : 0;
+    const bool from_ok = NULL != from_str && end != from_str && '\0' == *end;
+    const std::int64_t to = NULL != to_str ? std::strtoll(to_str, &end, 10) : 0;
+    const bool to_ok = NULL != to_str && end != to_str && '\0' == *end;
+    evhttp_clear_headers(&params);
+    if(!from_ok || !to_ok || from > to) {
+        evhttp_send_error(req, HTTP_BADREQUEST, NULL);
+        return;
+    }
+
+    std::vector<archived> found;
+    for(std::size_t i = 0 ; i < archives_.size() ; i++) {
+        archives_[i].first(from, to, &found, archives_[i].second);
+    }
+    std::stable_sort(found.begin(), found.end(), &archived_before);
+
+    std::string out = "{\"segments\":[";
+    for(std::size_t i = 0 ; i < found.size() ; i++) {
+        out.append(0 != i ? ",{" : "{");
+        out.append("\"start\":" + std::to_string(found[i].start));
+        out.append(",\"end\":" + std::to_string(found[i].end));
+        out.append(",\"location\":");
+        write_json_string(&out, found[i].location);
+        out.append(",\"path\":");
+        write_json_string(&out, found[i].path);
+        out.append("}");
+    }
+    out.append("]}");
+
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", "application/json");
+    evhttp_add_header(headers, "Cache-Control", "no-cache");
+    evbuffer* body = evbuffer_new();
+    evbuffer_add(body, out.data(), out.size());
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::send_metrics(evhttp_request* req) {
+    std::string out;
+    metrics_->write(&out);
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", "text/plain; version=0.0.4");
+    evhttp_add_header(headers, "Cache-Control", "no-cache");
+    evbuffer* body = evbuffer_new();
+    evbuffer_add(body, out.data(), out.size());
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::send_trace(evhttp_request* req) {
+    std::string out;
+    trace_->write(&out);
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", "application/json");
+    evhttp_add_header(headers, "Content-Disposition", "attachment; filename=\"seccam-trace.json\"");
+    evhttp_add_header(headers, "Cache-Control", "no-cache");
+    evbuffer* body = evbuffer_new();
+    evbuffer_add(body, out.data(), out.size());
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::request_segment(evhttp_request* req, std::uint64_t seq) {
+    live_segment* live = find_segment(seq);
+    if(NULL == live) {
+        evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+        return;
+    }
+
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", segment_type);
+
+    if(!live->complete) {
+        // what is there now, the rest as it is cut
+        evhttp_add_header(headers, "Cache-Control", "no-cache");
+        evhttp_send_reply_start(req, HTTP_OK, "OK");
+        hold(req, held_segment, seq, 0, 0);
+        stream_parts(&held_[evhttp_request_get_connection(req)]);
+        return;
+    }
+
+    evhttp_add_header(headers, "Cache-Control", "max-age=3600");
+    evbuffer* body = evbuffer_new();
+    if(NULL != live->seg) {
+        add_reference(body, live->seg);
+    }
+    for(std::size_t i = 0 ; i < live->parts.size() ; i++) {
+        add_reference(body, live->parts[i]);
+    }
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::request_part(evhttp_request* req, std::uint64_t seq, std::size_t part) {
+    live_segment* live = find_segment(seq);
+    if(NULL != live && part < live->parts.size()) {
+        send_part(req, live->parts[part]);
+    } else if(!ended_ && seq == writing_seq() && part == (NULL != live ? live->parts.size() : 0)) {
+        // the preload hint, asked for before it is cut
+        hold(req, held_part, seq, part, now_ms() + 3*part_ms_);
+    } else {
+        evhttp_send_error(req, HTTP_NOTFOUND, NULL);
+    }
+}
+
+void live_server::send_part(evhttp_request* req, common::segment* part) {
+    evkeyvalq* headers = evhttp_request_get_output_headers(req);
+    evhttp_add_header(headers, "Content-Type", segment_type);
+    evhttp_add_header(headers, "Cache-Control", "max-age=3600");
+    evbuffer* body = evbuffer_new();
+    add_reference(body, part);
+    evhttp_send_reply(req, HTTP_OK, "OK", body);
+    evbuffer_free(body);
+}
+
+void live_server::add_reference(evbuffer* body, common::segment* seg) {
+    // the reply points into the segment, the reference is dropped once
+    // the connection has written it out
+    if(0 != seg->size()) {
+        seg->ref();
+        evbuffer_add_reference(body, seg->buffer(), seg->size(), &live_server::on_segment_sent, seg);
+    }
+}
+
+void live_server::on_segment_sent(const void*, std::size_t, void* ctx) {
+    static_cast<common::segment*>(ctx)->unref();
+}
+
+void live_server::hold(evhttp_request* req, held_kind kind, std::uint64_t seq, std::size_t part, std::uint64_t deadline_ms) {
+    held_request held = { kind, req, seq, part, deadline_ms };
+    held_[evhttp_request_get_connection(req)] = held;
+}
+
+void live_server::on_connection_close(evhttp_connection* conn, void* ctx) {
+    static_cast<live_server*>(ctx)->handle_on_connection_close(conn);
+}
+
+void live_server::handle_on_connection_close(evhttp_connection* conn) {
+    // libevent frees the request of the connection
+    held_.erase(conn);
+}
+
+void live_server::answer_held() {
+    for(std::map<evhttp_connection*, held_request>::iterator it = held_.begin(); it != held_.end(); ) {
+        if(answer_held(&it->second, false)) {
+            held_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
+bool live_server::answer_held(held_request* held, bool expired) {
+    switch(held->kind) {
+        case held_playlist:
+            if(expired || playlist_has(held->seq, held->part)) {
+                send_playlist(held->req);
+                return true;
+            }
+            return false;
+        case held_part: {
+            live_segment* live = find_segment(held->seq);
+            if(NULL != live && held->part < live->parts.size()) {
+                send_part(held->req, live->parts[held->part]);
+                return true;
+            }
+            if(expired || ended_ || held->seq < writing_seq() || (NULL != live && live->complete)) {
+                evhttp_send_error(held->req, HTTP_NOTFOUND, NULL);
+                return true;
+            }
+            return false;
+        }
+        case held_segment:
+            return stream_parts(held);
+    }
+    return true;
+}
+
+bool live_server::stream_parts(held_request* held) {
+    live_segment* live = find_segment(held->seq);
+    if(NULL != live && held->part < live->parts.size()) {
+        evbuffer* chunk = evbuffer_new();
+        for(; held->part < live->parts.size(); held->part++)
+            add_reference(chunk, live->parts[held->part]);
+        evhttp_send_reply_chunk(held->req, chunk);
+        evbuffer_free(chunk);
+    }
+    if(NULL == live || live->complete) {
+        evhttp_send_reply_end(held->req);
+        return true;
+    }
+    return false;
+}
+
+void live_server::on_tick(int, short, void* ctx) {
+    static_cast<live_server*>(ctx)->handle_on_tick();
+}
+
+void live_server::handle_on_tick() {
+    // reloads waiting longer than the player would are answered anyway
+    const std::uint64_t now = now_ms();
+    for(std::map<evhttp_connection*, held_request>::iterator it = held_.begin(); it != held_.end(); ) {
+        if(0 != it->second.deadline_ms && now >= it->second.deadline_ms && answer_held(&it->second, true)) {
+            held_.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,184 @@
+#ifndef LIVE_SERVER_H
+#define LIVE_SERVER_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <map>
+#include <utility>
+#include <cstdint>
+#include <cstddef>
+
+struct event_base;
+struct event;
+struct evhttp;
+struct evhttp_request;
+struct evhttp_connection;
+struct evbuffer;
+
+namespace common {
+    class segment;
+    class metrics;
+    class trace;
+    template<typename T> class spsc_queue;
+}
+
+namespace net {
+
+class ts_muxer;
+
+// serves the newest segments to viewers on the local network as an HLS
+// playlist, /live.m3u8, and one url per segment. the segments are packed
+// into MPEG-TS once as they arrive, what is uploaded and recorded stays
+// H.264, and each reply holds a reference to the packed copy instead of
+// copying it again. /segments answers where the recorded segments of a
+// time range are kept, /metrics how the pipeline is doing and
+// /trace.json where its time went.
+//
+// with parts enabled the segments are built from the parts the
+// segmenter cuts while it writes (LL-HLS). the playlist lists the parts
+// of the newest segments, a reload asking for a part that does not
+// exist yet is held until it does, and the segment being written is
+// streamed with chunked transfer as its parts arrive.
+class live_server {
+public:
+    // the newest still as a JPEG, @arg1 and @arg2 are valid until the
+    // next call. false if there is none.
+    typedef bool (*snapshot_cb)(const std::uint8_t** data, std::size_t* size, void* ctx);
+    // a recorded segment whose capture overlaps the asked range
+    class archived {
+    public:
+        std::int64_t start;         // seconds since the epoch
+        std::int64_t end;           // 0 if not known
+        std::string location;       // "local" or "cloud"
+        std::string path;
+    };
+    // adds what overlaps [@arg1, @arg2) to @arg3, without going to disk
+    // or the network
+    typedef void (*archive_cb)(std::int64_t from, std::int64_t to, std::vector<archived>* found, void* ctx);
+public:
+    // throws std::runtime_error if it cannot listen
+    live_server(event_base* evbase,
+                const std::string& address,
+                std::uint16_t port,
+                std::size_t segments_kept,
+                int segment_length_sec
+                );
+    ~live_server();
+private:
+    live_server(const live_server&) = delete;
+    void operator=(const live_server&) = delete;
+public:
+    // for http_publisher::set_segment_listener
+    static void on_segment(common::segment* seg, void* ctx);
+    void add_segment(common::segment* seg);
+public:
+    // before the first part is posted
+    void enable_parts(std::uint32_t part_ms);
+    // for video::segmenter::enable_parts, called on the capture thread.
+    // the server takes over @arg1.
+    static void on_part(common::segment* part, bool ends_segment, void* ctx);
+    void post_part(common::segment* part, bool ends_segment);
+public:
+    // serves /snapshot.jpg
+    void set_snapshot_source(snapshot_cb snapshot, void* ctx);
+    // serves /segments?from=<t0>&to=<t1> as JSON, from every source added
+    void add_archive_source(archive_cb find, void* ctx);
+    // serves /metrics in the Prometheus text format
+    void set_metrics(const common::metrics* metrics);
+    // serves /trace.json, the trace ring as Chrome trace JSON
+    void set_trace(const common::trace* trace);
+public:
+    std::uint16_t port() const;
+    std::uint64_t requests() const;
+private:
+    class posted_part {
+    public:
+        common::segment* part;
+        bool ends_segment;
+    };
+    class live_segment {
+    public:
+        std::uint64_t seq;
+        common::segment* seg;               // NULL when built from parts
+        std::vector<common::segment*> parts;
+        std::vector<bool> independent;     // of each part, it has a key frame
+        std::uint32_t duration_ms;
+        bool complete;
+    };
+    enum held_kind {
+        held_playlist,
+        held_part,
+        held_segment
+    };
+    class held_request {
+    public:
+        held_kind kind;
+        evhttp_request* req;
+        std::uint64_t seq;
+        std::size_t part;                   // next one to send for held_segment
+        std::uint64_t deadline_ms;          // 0 waits for the segment to end
+    };
+private:
+    static void on_request(evhttp_request* req, void* ctx);
+    void handle_on_request(evhttp_request* req);
+    void send_playlist(evhttp_request* req);
+    void send_snapshot(evhttp_request* req);
+    void send_archived(evhttp_request* req);
+    void send_metrics(evhttp_request* req);
+    void send_trace(evhttp_request* req);
+    void request_playlist(evhttp_request* req);
+    void request_segment(evhttp_request* req, std::uint64_t seq);
+    void request_part(evhttp_request* req, std::uint64_t seq, std::size_t part);
+    void send_part(evhttp_request* req, common::segment* part);
+    void add_reference(evbuffer* body, common::segment* seg);
+    static void on_segment_sent(const void* data, std::size_t len, void* ctx);
+
+    static void on_connection_close(evhttp_connection* conn, void* ctx);
+    void handle_on_connection_close(evhttp_connection* conn);
+    void hold(evhttp_request* req, held_kind kind, std::uint64_t seq, std::size_t part, std::uint64_t deadline_ms);
+    bool answer_held(held_request* held, bool expired);
+    void answer_held();
+    bool stream_parts(held_request* held);
+
+    static void on_parts(int, short, void* ctx);
+    void handle_on_parts();
+    void add_part(common::segment* part, bool ends_segment);
+
+    static void on_tick(int, short, void* ctx);
+    void handle_on_tick();
+private:
+    live_segment* find_segment(std::uint64_t seq);
+    std::uint64_t writing_seq() const;
+    bool playlist_has(std::uint64_t seq, std::size_t part);
+    void release(live_segment* live);
+    void trim();
+    void write_playlist();
+private:
+    event_base* evbase_;
+    evhttp* http_;
+    std::uint16_t port_;
+    std::size_t segments_kept_;
+    std::uint32_t segment_length_ms_;
+    std::deque<live_segment> segments_;
+    std::uint64_t next_seq_;
+    bool ended_;
+    std::string playlist_;
+    ts_muxer* muxer_;
+    std::uint64_t requests_;
+    std::uint32_t part_ms_;
+    common::spsc_queue<posted_part>* parts_;
+    int parts_fd_;
+    event* parts_event_;
+    event* tick_event_;
+    std::map<evhttp_connection*, held_request> held_;
+    snapshot_cb snapshot_;
+    void* snapshot_ctx_;
+    std::vector<std::pair<archive_cb, void*> > archives_;
+    const common::metrics* metrics_;
+    const common::trace* trace_;
+};
+
+}
+
+#endif // LIVE_SERVER_H
@@ -0,0 +1,350 @@
+#include "local_backend.h"
+
+#include "upload_session.h"
+#include "file_index.h"
+
+#include "logging/log.h"
+
+#include "common/segment.h"
+#include "common/direct_file.h"
+
+#include <event2/event.h>
+
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+
+using net::local_backend;
+
+class local_backend::job {
+public:
+    enum job_type {
+        list_job,
+        put_job,
+        put_streaming_job,
+        remove_job
+    };
+public:
+    job_type type;
+    upload_session* upload;
+    std::size_t chunk_size;
+    std::vector<std::string> paths;
+    list_cb on_list;
+    put_cb on_put;
+    remove_cb on_remove;
+    void* ctx;
+    // filled in by the worker thread
+    bool ok;
+    std::vector<api_file> files;
+    put_result result;
+    std::vector<bool> removed;
+};
+
+local_backend::local_backend(const std::string& dir, event_base* evbase)
+    : dir_(dir)
+    , evbase_(evbase)
+    , completion_event_(NULL)
+    , thread_(nullptr)
+    , stop_(false) {
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, completion_fds_) < 0) {
+        assert(NULL == "cannot create socket pair");
+    }
+    fcntl(completion_fds_[0], F_SETFL, fcntl(completion_fds_[0], F_GETFL, 0) | O_NONBLOCK);
+
+    completion_event_ = event_new(evbase_, completion_fds_[0], EV_READ|EV_PERSIST, &local_backend::on_completions, this);
+    assert(NULL != completion_event_);
+    event_add(completion_event_, NULL);
+
+    thread_ = new std::thread(&local_backend::run, this);
+}
+
+local_backend::~local_backend() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thread_->join();
+    delete thread_;
+
+    // nobody waits for these anymore
+    for(; jobs_.size() != 0; jobs_.pop_front())
+        delete jobs_.front();
+    while(true) {
+        std::uintptr_t job_ptr;
+        if(read(completion_fds_[0], &job_ptr, sizeof(job_ptr)) != sizeof(job_ptr)) {
+            break;
+        }
+        delete reinterpret_cast<job*>(job_ptr);
+    }
+    for(std::map<std::string, common::direct_file*>::iterator it = open_parts_.begin(); it != open_parts_.end(); ++it)
+        delete it->second; // the part file is removed by the next list()
+
+    event_free(completion_event_);
+    close(completion_fds_[0]);
+    close(completion_fds_[1]);
+}
+
+void local_backend::list(list_cb cb, void* ctx) {
+    job* j = new job;
+    j->type = job::list_job;
+    j->upload = nullptr;
+    j->on_list = cb;
+    j->ctx = ctx;
+    submit(j);
+}
+
+void local_backend::put(upload_session* upload, put_cb cb, void* ctx) {
+    job* j = new job;
+    j->type = job::put_job;
+    j->upload = upload;
+    j->chunk_size = upload->seg->size();
+    j->on_put = cb;
+    j->ctx = ctx;
+    submit(j);
+}
+
+void local_backend::put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx) {
+    job* j = new job;
+    j->type = job::put_streaming_job;
+    j->upload = upload;
+    j->chunk_size = chunk_size;
+    j->on_put = cb;
+    j->ctx = ctx;
+    submit(j);
+}
+
+void local_backend::remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx) {
+    job* j = new job;
+    j->type = job::remove_job;
+    j->upload = nullptr;
+    j->paths = paths;
+    j->on_remove = cb;
+    j->ctx = ctx;
+    submit(j);
+}
+
+void local_backend::submit(job* j) {
+    j->ok = false;
+    j->result.status = put_result::failed;
+    j->result.retry_after_ms = 0;
+    j->result.throttled = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(j);
+    }
+    cond_.notify_one();
+}
+
+void local_backend::on_completions(int, short what, void* ctx) {
+    assert(EV_READ == what);
+    static_cast<local_backend*>(ctx)->handle_on_completions();
+}
+
+void local_backend::handle_on_completions() {
+    while(true) {
+        std::uintptr_t job_ptr;
+        ssize_t ret = read(completion_fds_[0], &job_ptr, sizeof(job_ptr));
+        if(ret != sizeof(job_ptr)) {
+            if(ret < 0 && errno == EINTR) {
+                continue;
+            }
+            assert(ret < 0 && (errno == EWOULDBLOCK || errno == EAGAIN));
+            break;
+        }
+        job* j = reinterpret_cast<job*>(job_ptr);
+        if(j->type == job::list_job) {
+            j->on_list(j->ok, j->files, j->ctx);
+        } else if(j->type == job::remove_job) {
+            j->on_remove(j->removed, j->ctx);
+        } else {
+            j->on_put(j->result, j->ctx);
+        }
+        delete j;
+    }
+}
+
+void local_backend::run() {
+    while(true) {
+        job* j = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cond_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+            if(stop_) {
+                return;
+            }
+            j = jobs_.front();
+            jobs_.pop_front();
+        }
+
+        // the publisher does not touch an upload while a call for it is
+        // outstanding, so the worker updates it in place
+        if(j->type == job::list_job) {
+            execute_list(j);
+        } else if(j->type == job::remove_job) {
+            execute_remove(j);
+        } else {
+            execute_put(j);
+        }
+
+        std::uintptr_t job_ptr = reinterpret_cast<std::uintptr_t>(j);
+        while(write(completion_fds_[1], &job_ptr, sizeof(job_ptr)) < 0 && errno == EINTR);
+    }
+}
+
+void local_backend::execute_list(job* j) {
+    if(0 != mkdir(dir_.c_str(), 0755) && errno != EEXIST) {
+        int err = errno;
+        LOG(common::log::err) << "cannot create " << dir_ << " errno=" << std::strerror(err) << common::log::end;
+        return;
+    }
+
+    DIR* dir = opendir(dir_.c_str());
+    if(NULL == dir) {
+        int err = errno;
+        LOG(common::log::err) << "cannot open " << dir_ << " errno=" << std::strerror(err) << common::log::end;
+        return;
+    }
+
+    for(dirent* entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if(name == "." || name == "..") {
+            continue;
+        }
+        if(name[0] == '.' && name.size() > 5 && name.compare(name.size()-5, 5, ".part") == 0) {
+            // left behind by an upload which never finished
+            LOG(common::log::info) << "removing stale " << name << common::log::end;
+            unlink((dir_ + "/" + name).c_str());
+            continue;
+        }
+        api_file file;
+        if(!file_index::parse_name(name, &file)) {
+            LOG(common::log::err) << "found unexpected entry " << name << " ignoring" << common::log::end;
+            continue;
+        }
+        if(stat_file(name, &file)) {
+            j->files.push_back(file);
+        }
+    }
+    closedir(dir);
+
+    j->ok = true;
+}
+
+void local_backend::execute_put(job* j) {
+    upload_session* upload = j->upload;
+    put_result* result = &j->result;
+    const std::size_t seg_size = upload->seg->size();
+
+    common::direct_file* file = nullptr;
+    if(upload->session_id.empty()) {
+        upload->session_id = "." + upload->name + ".part";
+        upload->offset = 0;
+        file = new common::direct_file;
+        if(!file->open(dir_ + "/" + upload->session_id, seg_size)) {
+            int err = errno;
+            LOG(common::log::err) << "cannot open " << upload->session_id << " errno=" << std::strerror(err) << common::log::end;
+            delete file;
+            upload->session_id.clear();
+            return;
+        }
+        open_parts_[upload->session_id] = file;
+    } else {
+        std::map<std::string, common::direct_file*>::iterator it = open_parts_.find(upload->session_id);
+        if(it == open_parts_.end()) {
+            assert(false);
+            upload->session_id.clear();
+            upload->offset = 0;
+            return;
+        }
+        file = it->second;
+    }
+
+    std::size_t len = std::min(seg_size - upload->offset, j->chunk_size);
+    if(!file->write(upload->seg->buffer() + upload->offset, len)) {
+        int err = errno;
+        LOG(common::log::err) << "cannot write " << upload->session_id << " errno=" << std::strerror(err) << common::log::end;
+        // ENOSPC and friends clear up later, EIO or EROFS do not
+        result->status = err == ENOSPC || err == EDQUOT ? put_result::retry : put_result::failed;
+        drop_part(upload);
+        return;
+    }
+    upload->offset += len;
+
+    if(upload->offset < seg_size) {
+        result->status = put_result::progress;
+    } else if(commit_part(file, upload, result)) {
+        result->status = put_result::committed;
+    }
+}
+
+bool local_backend::commit_part(common::direct_file* file, upload_session* upload, put_result* result) {
+    const std::string part = dir_ + "/" + upload->session_id;
+    if(!file->close() || 0 != rename(part.c_str(), (dir_ + "/" + upload->name).c_str())) {
+        int err = errno;
+        LOG(common::log::err) << "cannot commit " << upload->name << " errno=" << std::strerror(err) << common::log::end;
+        drop_part(upload);
+        return false;
+    }
+    LOG(common::log::info) << "stored " << upload->name << (file->direct() ? " (direct)" : "") << common::log::end;
+
+    delete file;
+    open_parts_.erase(upload->session_id);
+    upload->session_id.clear();
+
+    return stat_file(upload->name, &result->file);
+}
+
+void local_backend::drop_part(upload_session* upload) {
+    std::map<std::string, common::direct_file*>::iterator it = open_parts_.find(upload->session_id);
+    if(it != open_parts_.end()) {
+        delete it->second;
+        open_parts_.erase(it);
+    }
+    unlink((dir_ + "/" + upload->session_id).c_str());
+    upload->session_id.clear();
+    upload->offset = 0;
+}
+
+void local_backend::execute_remove(job* j) {
+    for(std::size_t i = 0 ; i < j->paths.size() ; i++) {
+        bool gone = 0 == unlink(j->paths[i].c_str()) || errno == ENOENT;
+        if(!gone) {
+            int err = errno;
+            LOG(common::log::err) << "cannot delete " << j->paths[i] << " errno=" << std::strerror(err) << common::log::end;
+        }
+        j->removed.push_back(gone);
+    }
+}
+
+bool local_backend::stat_file(const std::string& name, api_file* file) {
+    const std::string path = dir_ + "/" + name;
+    struct stat st;
+    if(0 != stat(path.c_str(), &st)) {
+        int err = errno;
+        LOG(common::log::err) << "cannot stat " << path << " errno=" << std::strerror(err) << common::log::end;
+        return false;
+    }
+
+    std::tm tm;
+    char modified[32];
+    gmtime_r(&st.st_mtime, &tm);
+    std::strftime(modified, sizeof(modified), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    file_index::parse_name(name, file);
+    file->filename = name;
+    file->path = path;
+    file->size = static_cast<int>(st.st_size);
+    file->last_modified = modified;
+    return true;
+}
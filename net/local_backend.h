@@ -0,0 +1,66 @@
+#ifndef LOCAL_BACKEND_H
+#define LOCAL_BACKEND_H
+
+#include "storage_backend.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct event_base;
+struct event;
+
+namespace common {
+    class direct_file;
+}
+
+namespace net {
+
+// stores segments in a local directory, e.g. an NFS or USB mount. file
+// io runs on a worker thread, completions are handed back to the event
+// loop through a socket pair like the segments coming from capture.
+class local_backend : public storage_backend {
+public:
+    local_backend(const std::string& dir, event_base* evbase);
+    ~local_backend();
+public:
+    void list(list_cb cb, void* ctx);
+    void put(upload_session* upload, put_cb cb, void* ctx);
+    void put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx);
+    void remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx);
+private:
+    class job;
+    void submit(job* j);
+private:
+    static void on_completions(int, short what, void* ctx);
+    void handle_on_completions();
+private:
+    // worker thread
+    void run();
+    void execute_list(job* j);
+    void execute_put(job* j);
+    void execute_remove(job* j);
+    bool commit_part(common::direct_file* file, upload_session* upload, put_result* result);
+    void drop_part(upload_session* upload);
+    bool stat_file(const std::string& name, api_file* file);
+private:
+    std::string dir_;
+    event_base* evbase_;
+    int completion_fds_[2];
+    event* completion_event_;
+    std::thread* thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::list<job*> jobs_;
+    bool stop_;
+    // partial files of streaming uploads by session_id, worker thread only
+    std::map<std::string, common::direct_file*> open_parts_;
+};
+
+}
+
+#endif // LOCAL_BACKEND_H
@@ -0,0 +1,56 @@
+#ifndef PUBLISHER_OPTIONS_H
+#define PUBLISHER_OPTIONS_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace net {
+
+class publisher_options {
+public:
+    publisher_options()
+        : retry_initial_ms(2000)
+        , retry_max_ms(120000)
+        , retry_max_attempts(8)
+        , upload_chunk_size(1024*1024)
+        , max_uploads(1)
+        , dead_letter_dir("dead_letter")
+        , unlisted_queue_max(30)
+        , quota_bytes(2ull*1024*1024*1024)
+        , quota_high_percent(90)
+        , quota_low_percent(80)
+        , max_age_sec(0)
+        , delete_batch_max(200)
+        , encoder_min_kbit(200)
+        , backlog_high_sec(60) {
+    }
+public:
+    std::uint32_t retry_initial_ms;
+    std::uint32_t retry_max_ms;
+    int retry_max_attempts;
+    std::size_t upload_chunk_size;
+    // segments uploaded at the same time, more than one only pays off
+    // when the backend spreads them over several connections
+    std::size_t max_uploads;
+    std::string dead_letter_dir;
+    // segments held in memory until the storage is listed, older ones
+    // go to the dead letter directory
+    std::size_t unlisted_queue_max;
+    // eviction starts above the high watermark and deletes the oldest
+    // segments until the low watermark is reached. max_age_sec of 0
+    // keeps segments regardless of age.
+    std::uint64_t quota_bytes;
+    int quota_high_percent;
+    int quota_low_percent;
+    std::uint32_t max_age_sec;
+    std::size_t delete_batch_max;
+    // with an encoder control attached the bitrate follows the uplink,
+    // below encoder_min_kbit frame rate and resolution are given up too
+    std::uint32_t encoder_min_kbit;
+    std::uint32_t backlog_high_sec;
+};
+
+}
+
+#endif // PUBLISHER_OPTIONS_H
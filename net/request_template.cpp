@@ -0,0 +1,35 @@
+#include "request_template.h"
+
+#include "http_request.h"
+
+using net::request_template;
+
+request_template::request_template(const std::string& method, const std::string& path)
+    : method_(method)
+    , path_(path) {
+
+}
+
+request_template::~request_template() {
+
+}
+
+void request_template::add_header(const std::string& field, const std::string& value) {
+    headers_.push_back(std::make_pair(field, value));
+}
+
+net::http_request* request_template::make() const {
+    http_request* request = new http_request(this);
+    for(std::size_t i = 0 ; i < headers_.size() ; i++) {
+        request->add_header(headers_[i].first.c_str(), headers_[i].second.c_str());
+    }
+    return request;
+}
+
+const std::string& request_template::method() const {
+    return method_;
+}
+
+const std::string& request_template::path() const {
+    return path_;
+}
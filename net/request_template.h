@@ -0,0 +1,37 @@
+#ifndef REQUEST_TEMPLATE_H
+#define REQUEST_TEMPLATE_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace net {
+
+class http_request;
+
+// method, path and the headers that every request to one endpoint
+// carries, built once. requests made from a template refer to its method
+// and path, the template has to outlive them.
+class request_template {
+public:
+    request_template(const std::string& method, const std::string& path);
+    ~request_template();
+private:
+    request_template(const request_template&) = delete;
+    void operator=(const request_template&) = delete;
+public:
+    void add_header(const std::string& field, const std::string& value);
+    // a new request with the template's headers set
+    http_request* make() const;
+public:
+    const std::string& method() const;
+    const std::string& path() const;
+private:
+    std::string method_;
+    std::string path_;
+    std::vector<std::pair<std::string, std::string> > headers_;
+};
+
+}
+
+#endif // REQUEST_TEMPLATE_H
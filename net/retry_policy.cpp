@@ -0,0 +1,44 @@
+#include "retry_policy.h"
+
+#include <algorithm>
+
+using net::retry_policy;
+
+retry_policy::retry_policy(std::uint32_t initial_delay_ms,
+                           std::uint32_t max_delay_ms,
+                           int max_attempts
+                           )
+    : initial_delay_ms_(initial_delay_ms)
+    , max_delay_ms_(max_delay_ms)
+    , max_attempts_(max_attempts)
+    , tokens_(10)
+    , max_tokens_(10)
+    , token_ratio_(0.1)
+    , rng_(std::random_device()()) {
+
+}
+
+retry_policy::~retry_policy() {
+
+}
+
+bool retry_policy::exhausted(int attempt) const {
+    return attempt >= max_attempts_;
+}
+
+std::uint32_t retry_policy::delay_ms(int attempt, std::uint32_t retry_after_ms) {
+    std::uint32_t delay = max_delay_ms_;
+    if(tokens_ >= 1) {
+        tokens_ -= 1;
+        std::uint64_t backoff = static_cast<std::uint64_t>(initial_delay_ms_) << std::min(attempt, 20);
+        delay = static_cast<std::uint32_t>(std::min<std::uint64_t>(backoff, max_delay_ms_));
+    }
+    // "equal jitter": keep half of the backoff, randomize the other half
+    std::uint32_t half = delay/2;
+    delay = half + static_cast<std::uint32_t>(rng_() % (delay - half + 1));
+    return std::max(delay, retry_after_ms);
+}
+
+void retry_policy::on_success() {
+    tokens_ = std::min(max_tokens_, tokens_ + token_ratio_);
+}
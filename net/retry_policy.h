@@ -0,0 +1,39 @@
+#ifndef RETRY_POLICY_H
+#define RETRY_POLICY_H
+
+#include <cstdint>
+#include <random>
+
+namespace net {
+
+// exponential backoff with jitter. retries draw from a token budget that
+// successful requests refill, once it is empty every retry waits the
+// maximum delay so a dead link is probed instead of hammered.
+class retry_policy {
+public:
+    retry_policy(std::uint32_t initial_delay_ms,
+                 std::uint32_t max_delay_ms,
+                 int max_attempts
+                 );
+    ~retry_policy();
+private:
+    retry_policy(const retry_policy&) = delete;
+    void operator=(const retry_policy&) = delete;
+public:
+    bool exhausted(int attempt) const;
+    // @arg2 is the server's Retry-After, the delay is never shorter
+    std::uint32_t delay_ms(int attempt, std::uint32_t retry_after_ms);
+    void on_success();
+private:
+    std::uint32_t initial_delay_ms_;
+    std::uint32_t max_delay_ms_;
+    int max_attempts_;
+    double tokens_;
+    double max_tokens_;
+    double token_ratio_;
+    std::minstd_rand rng_;
+};
+
+}
+
+#endif // RETRY_POLICY_H
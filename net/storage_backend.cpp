@@ -0,0 +1,5 @@
+#include "storage_backend.h"
+
+net::storage_backend::storage_backend() { }
+
+net::storage_backend::~storage_backend() { }
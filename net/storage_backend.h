@@ -0,0 +1,58 @@
+#ifndef STORAGE_BACKEND_H
+#define STORAGE_BACKEND_H
+
+#include "api_file.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace net {
+
+class upload_session;
+
+class put_result {
+public:
+    enum status_type {
+        progress,   // chunk stored, upload->offset advanced
+        committed,  // segment stored as @file
+        retry,      // transient failure, try again after retry_after_ms
+        failed,     // permanent failure
+        cancelled   // the backend went away before it finished
+    };
+public:
+    status_type status;
+    std::uint32_t retry_after_ms;
+    bool throttled; // the whole backend asks for a pause
+    api_file file;
+};
+
+// where the publisher stores segments. every call completes through its
+// callback on the event loop thread, never from within the call itself.
+class storage_backend {
+public:
+    typedef void (*list_cb)(bool ok, const std::vector<api_file>& files, void* ctx);
+    typedef void (*put_cb)(const put_result& result, void* ctx);
+    typedef void (*remove_cb)(const std::vector<bool>& removed, void* ctx);
+public:
+    storage_backend();
+    virtual ~storage_backend();
+private:
+    storage_backend(const storage_backend&) = delete;
+    void operator=(const storage_backend&) = delete;
+public:
+    // prepares the target and enumerates the segments stored in it
+    virtual void list(list_cb cb, void* ctx) = 0;
+    // stores the whole segment at once, a retry starts over
+    virtual void put(upload_session* upload, put_cb cb, void* ctx) = 0;
+    // stores up to @arg2 bytes from upload->offset, the last chunk commits
+    virtual void put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx) = 0;
+    // @arg2 reports every path in request order, it is empty if the
+    // request failed as a whole
+    virtual void remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx) = 0;
+};
+
+}
+
+#endif // STORAGE_BACKEND_H
@@ -7,7 +7,7 @@
 using net::timer;
 
 timer::timer(event_base* const ev_base,
-             std::uint32_t timeout_sec,
+             std::uint32_t timeout_ms,
              net::timer::on_expire on_expire_cb,
              void *arg)
     : timer_(NULL)
@@ -17,8 +17,8 @@ timer::timer(event_base* const ev_base,
     timer_ = evtimer_new(ev_base, &timer::on_ev_expire, this);
 
     timeval timeout;
-    timeout.tv_sec = timeout_sec;
-    timeout.tv_usec = 0;
+    timeout.tv_sec = timeout_ms/1000;
+    timeout.tv_usec = (timeout_ms%1000)*1000;
     evtimer_add(timer_, &timeout);
 
 }
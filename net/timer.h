@@ -13,7 +13,7 @@ public:
     typedef void (*on_expire)(void*);
 public:
     timer(event_base* const ev_base,
-          std::uint32_t timeout_sec,
+          std::uint32_t timeout_ms,
           on_expire on_expire_cb,
           void* arg
           );
@@ -0,0 +1,272 @@
+#include "ts_muxer.h"
+
+#include "common/segment.h"
+
+#include <algorithm>
+#include <cstring>
+
+using net::ts_muxer;
+
+namespace {
+
+const std::size_t packet_size = 188;
+const std::size_t payload_size = packet_size - 4;
+
+const std::uint16_t pat_pid = 0x0000;
+const std::uint16_t pmt_pid = 0x1000;
+const std::uint16_t video_pid = 0x0100;
+
+const std::uint8_t stream_type_h264 = 0x1b;
+const std::uint8_t stream_id_video = 0xe0;
+
+// 90 kHz, 33 bits
+const std::uint64_t ts_mask = (static_cast<std::uint64_t>(1) << 33) - 1;
+
+// H.222.0 wants each access unit to start with a delimiter
+const std::uint8_t aud[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0xf0 };
+
+enum nal_type {
+    nal_slice = 1,
+    nal_idr = 5,
+    nal_sei = 6,
+    nal_sps = 7,
+    nal_pps = 8,
+    nal_aud = 9
+};
+
+// CRC-32/MPEG-2 of the PSI sections
+std::uint32_t crc32(const std::uint8_t* data, std::size_t size) {
+    std::uint32_t crc = 0xffffffff;
+    for(std::size_t i = 0 ; i < size ; i++) {
+        crc ^= static_cast<std::uint32_t>(data[i]) << 24;
+        for(int bit = 0 ; bit < 8 ; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// where the next start code begins, a zero before 00 00 01 included
+const std::uint8_t* find_start_code(const std::uint8_t* p, const std::uint8_t* end) {
+    for(; end - p >= 3; p++) {
+        if(0 == p[0] && 0 == p[1] && 1 == p[2]) {
+            return p;
+        }
+    }
+    return end;
+}
+
+std::size_t nal_begin(const std::uint8_t* data, const std::uint8_t* start_code) {
+    return static_cast<std::size_t>((start_code != data && 0 == start_code[-1] ? start_code - 1 : start_code) - data);
+}
+
+std::size_t put_section(std::uint8_t* buf, std::uint8_t table_id, const std::uint8_t* body, std::size_t body_size) {
+    // table id, section length, id 1, version 0, current, one section
+    const std::size_t length = 5 + body_size + 4;
+    buf[0] = table_id;
+    buf[1] = 0xb0 | static_cast<std::uint8_t>(length >> 8);
+    buf[2] = static_cast<std::uint8_t>(length);
+    buf[3] = 0x00;
+    buf[4] = 0x01;
+    buf[5] = 0xc1;
+    buf[6] = 0x00;
+    buf[7] = 0x00;
+    std::memcpy(buf + 8, body, body_size);
+    const std::uint32_t crc = crc32(buf, 8 + body_size);
+    buf[8 + body_size] = static_cast<std::uint8_t>(crc >> 24);
+    buf[9 + body_size] = static_cast<std::uint8_t>(crc >> 16);
+    buf[10 + body_size] = static_cast<std::uint8_t>(crc >> 8);
+    buf[11 + body_size] = static_cast<std::uint8_t>(crc);
+    return 12 + body_size;
+}
+
+}
+
+ts_muxer::ts_muxer()
+    : pat_cc_(0)
+    , pmt_cc_(0)
+    , video_cc_(0) {
+
+}
+
+ts_muxer::~ts_muxer() {
+
+}
+
+common::segment* ts_muxer::write(const common::segment* in, bool* independent) {
+    const std::uint8_t* data = in->buffer();
+    std::size_t size = in->size();
+    if(!pending_.empty()) {
+        pending_.insert(pending_.end(), data, data + size);
+        data = &pending_[0];
+        size = pending_.size();
+    }
+    split(data, size);
+
+    common::segment* out = new common::segment;
+    out->start_ms(in->start_ms());
+    out->duration_ms(in->duration_ms());
+    out->last_segment(in->last_segment());
+
+    *independent = false;
+    std::vector<std::uint8_t> ts;
+    if(!units_.empty()) {
+        ts.reserve((size / payload_size + 2 * units_.size() + 4) * packet_size);
+        put_tables(&ts);
+        const std::uint64_t start = static_cast<std::uint64_t>(in->start_ms()) * 90;
+        const std::uint64_t step = std::max<std::uint64_t>(static_cast<std::uint64_t>(in->duration_ms()) * 90 / units_.size(), 1);
+        for(std::size_t i = 0 ; i < units_.size() ; i++) {
+            put_pes(&ts, data, units_[i], (start + i * step) & ts_mask);
+            *independent = *independent || units_[i].key;
+        }
+    }
+
+    // a frame never spans two writes, only the headers before it can
+    const std::size_t used = units_.empty() ? 0 : units_.back().end;
+    std::vector<std::uint8_t> rest(data + used, data + size);
+    pending_.swap(rest);
+
+    if(!ts.empty()) {
+        out->insert(&ts[0], ts.size());
+    }
+    return out;
+}
+
+void ts_muxer::split(const std::uint8_t* data, std::size_t size) {
+    // a new access unit starts with a delimiter, SEI or parameter set
+    // after a slice, or with a slice whose first_mb_in_slice is 0
+    units_.clear();
+    const std::uint8_t* const end = data + size;
+    const std::uint8_t* nal = find_start_code(data, end);
+    access_unit au = { nal_begin(data, nal), 0, false, 0, 0 };
+    bool has_slice = false;
+    while(nal != end) {
+        const std::uint8_t* header = nal + 3;
+        const std::uint8_t* next = find_start_code(header, end);
+        const std::size_t begin = nal_begin(data, nal);
+        if(header != end) {
+            const int type = header[0] & 0x1f;
+            const bool slice = nal_slice == type || nal_idr == type;
+            const bool first_slice = slice && header + 1 != end && (header[1] & 0x80);
+            const bool starts_unit = nal_aud == type || nal_sei == type || nal_sps == type || nal_pps == type || first_slice;
+            if(has_slice && starts_unit) {
+                au.end = begin;
+                units_.push_back(au);
+                au.begin = begin;
+                au.key = false;
+                au.headers_begin = 0;
+                au.headers_end = 0;
+                has_slice = false;
+            }
+            if(begin == au.begin && nal_aud == type) {
+                // put back in front of the parameter sets
+                au.begin = nal_begin(data, next);
+            }
+            if(nal_sps == type || nal_pps == type) {
+                if(au.headers_begin == au.headers_end) {
+                    au.headers_begin = begin;
+                }
+                au.headers_end = nal_begin(data, next);
+            }
+            has_slice = has_slice || slice;
+            au.key = au.key || nal_idr == type;
+        }
+        nal = next;
+    }
+    if(has_slice) {
+        au.end = size;
+        units_.push_back(au);
+    }
+}
+
+void ts_muxer::put_tables(std::vector<std::uint8_t>* out) {
+    std::uint8_t payload[payload_size];
+
+    // program 1 in pmt_pid
+    const std::uint8_t pat[] = {
+        0x00, 0x01,
+        static_cast<std::uint8_t>(0xe0 | (pmt_pid >> 8)), static_cast<std::uint8_t>(pmt_pid)
+    };
+    std::memset(payload, 0xff, sizeof(payload));
+    payload[0] = 0; // pointer field
+    put_section(payload + 1, 0x00, pat, sizeof(pat));
+    put_packet(out, pat_pid, &pat_cc_, true, payload, sizeof(payload), NULL, false);
+
+    // the video stream, which also carries the clock
+    const std::uint8_t pmt[] = {
+        static_cast<std::uint8_t>(0xe0 | (video_pid >> 8)), static_cast<std::uint8_t>(video_pid),
+        0xf0, 0x00,
+        stream_type_h264,
+        static_cast<std::uint8_t>(0xe0 | (video_pid >> 8)), static_cast<std::uint8_t>(video_pid),
+        0xf0, 0x00
+    };
+    std::memset(payload, 0xff, sizeof(payload));
+    payload[0] = 0;
+    put_section(payload + 1, 0x02, pmt, sizeof(pmt));
+    put_packet(out, pmt_pid, &pmt_cc_, true, payload, sizeof(payload), NULL, false);
+}
+
+void ts_muxer::put_pes(std::vector<std::uint8_t>* out, const std::uint8_t* data, const access_unit& au, std::uint64_t pts) {
+    // unbounded length, data aligned, a PTS and no DTS as there are no
+    // B-frames in baseline
+    const std::uint8_t header[] = {
+        0x00, 0x00, 0x01, stream_id_video,
+        0x00, 0x00,
+        0x84, 0x80, 0x05,
+        static_cast<std::uint8_t>(0x21 | ((pts >> 29) & 0x0e)),
+        static_cast<std::uint8_t>(pts >> 22),
+        static_cast<std::uint8_t>(0x01 | ((pts >> 14) & 0xfe)),
+        static_cast<std::uint8_t>(pts >> 7),
+        static_cast<std::uint8_t>(0x01 | ((pts << 1) & 0xfe))
+    };
+    pes_.assign(header, header + sizeof(header));
+    pes_.insert(pes_.end(), aud, aud + sizeof(aud));
+    if(au.headers_begin != au.headers_end) {
+        headers_.assign(data + au.headers_begin, data + au.headers_end);
+    } else if(au.key) {
+        pes_.insert(pes_.end(), headers_.begin(), headers_.end());
+    }
+    pes_.insert(pes_.end(), data + au.begin, data + au.end);
+
+    // the clock goes with the first packet of each frame
+    std::size_t pos = 0;
+    while(pos < pes_.size()) {
+        const bool start = 0 == pos;
+        const std::size_t room = payload_size - (start ? 8 : 0);
+        const std::size_t len = std::min(room, pes_.size() - pos);
+        put_packet(out, video_pid, &video_cc_, start, &pes_[pos], len, start ? &pts : NULL, start && au.key);
+        pos += len;
+    }
+}
+
+void ts_muxer::put_packet(std::vector<std::uint8_t>* out, std::uint16_t pid, std::uint8_t* cc, bool start,
+                          const std::uint8_t* payload, std::size_t len, const std::uint64_t* pcr, bool random_access) {
+    // an adaptation field for the clock and flags, or to stuff a payload
+    // that does not fill the packet
+    const bool adaptation = NULL != pcr || random_access || len < payload_size;
+    std::uint8_t* p = &*out->insert(out->end(), packet_size, 0xff);
+    p[0] = 0x47;
+    p[1] = (start ? 0x40 : 0x00) | static_cast<std::uint8_t>(pid >> 8);
+    p[2] = static_cast<std::uint8_t>(pid);
+    p[3] = (adaptation ? 0x30 : 0x10) | *cc;
+    *cc = (*cc + 1) & 0x0f;
+    p += 4;
+    if(adaptation) {
+        const std::size_t length = payload_size - 1 - len;
+        p[0] = static_cast<std::uint8_t>(length);
+        if(0 != length) {
+            p[1] = (random_access ? 0x40 : 0x00) | (NULL != pcr ? 0x10 : 0x00);
+            if(NULL != pcr) {
+                const std::uint64_t base = *pcr;
+                p[2] = static_cast<std::uint8_t>(base >> 25);
+                p[3] = static_cast<std::uint8_t>(base >> 17);
+                p[4] = static_cast<std::uint8_t>(base >> 9);
+                p[5] = static_cast<std::uint8_t>(base >> 1);
+                p[6] = static_cast<std::uint8_t>(((base & 1) << 7) | 0x7e);
+                p[7] = 0x00;
+            }
+        }
+        p += 1 + length;
+    }
+    std::memcpy(p, payload, len);
+}
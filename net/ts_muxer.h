@@ -0,0 +1,62 @@
+#ifndef TS_MUXER_H
+#define TS_MUXER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace common {
+    class segment;
+}
+
+namespace net {
+
+// packs the H.264 Annex B the encoder writes into MPEG-TS for players
+// that cannot take an elementary stream. what is written is one piece of
+// the stream after the other, the continuity counters carry over so that
+// the pieces can be served on their own or one after the other.
+//
+// the segments carry no frame times, the frames of a piece are spread
+// evenly over its duration from its start_ms. the encoder writes its
+// parameter sets only where a segment starts, they are repeated before
+// every other key frame so that a player can start there.
+class ts_muxer {
+public:
+    ts_muxer();
+    ~ts_muxer();
+private:
+    ts_muxer(const ts_muxer&) = delete;
+    void operator=(const ts_muxer&) = delete;
+public:
+    // a new segment with one reference, starting with a PAT and a PMT.
+    // codec headers at the end of @arg1 wait for the frame they belong
+    // to, the segment is empty if there is nothing else. @arg2 tells
+    // whether it has a key frame, a player can start there.
+    common::segment* write(const common::segment* in, bool* independent);
+private:
+    class access_unit {
+    public:
+        std::size_t begin;
+        std::size_t end;
+        bool key;
+        std::size_t headers_begin;      // its parameter sets, if any
+        std::size_t headers_end;
+    };
+    void split(const std::uint8_t* data, std::size_t size);
+    void put_tables(std::vector<std::uint8_t>* out);
+    void put_pes(std::vector<std::uint8_t>* out, const std::uint8_t* data, const access_unit& au, std::uint64_t pts);
+    void put_packet(std::vector<std::uint8_t>* out, std::uint16_t pid, std::uint8_t* cc, bool start,
+                    const std::uint8_t* payload, std::size_t len, const std::uint64_t* pcr, bool random_access);
+private:
+    std::vector<access_unit> units_;
+    std::vector<std::uint8_t> pending_;
+    std::vector<std::uint8_t> headers_;     // the last SPS and PPS
+    std::vector<std::uint8_t> pes_;
+    std::uint8_t pat_cc_;
+    std::uint8_t pmt_cc_;
+    std::uint8_t video_cc_;
+};
+
+}
+
+#endif // TS_MUXER_H
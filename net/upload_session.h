@@ -0,0 +1,30 @@
+#ifndef UPLOAD_SESSION_H
+#define UPLOAD_SESSION_H
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+namespace common {
+    class segment;
+}
+
+namespace net {
+
+// progress of a single segment upload. offset is the number of bytes
+// the backend has acknowledged, a retry resumes from there. session_id
+// is whatever the backend needs to find the partial upload again.
+class upload_session {
+public:
+    common::segment* seg;
+    std::string name;
+    std::string session_id;
+    std::size_t offset;
+    std::size_t furthest_offset; // retries count up until offset passes it
+    int retry_count;
+    std::uint64_t start_ms;
+};
+
+}
+
+#endif
@@ -0,0 +1,151 @@
+#include "upload_shaper.h"
+
+#include "logging/log.h"
+
+#include <event2/event.h>
+#include <event2/bufferevent.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+using net::upload_shaper;
+
+namespace {
+
+bool parse_time_of_day(const std::string& str, int* minutes) {
+    int hours = 0;
+    int mins = 0;
+    char tail = 0;
+    if(2 != std::sscanf(str.c_str(), "%d:%d%c", &hours, &mins, &tail) || hours < 0 || hours > 24 || mins < 0 || mins > 59) {
+        return false;
+    }
+    *minutes = hours*60 + mins;
+    return *minutes <= 24*60;
+}
+
+}
+
+upload_shaper::upload_shaper(event_base* evbase,
+                             std::uint32_t rate_kbit,
+                             std::uint32_t burst_kbyte,
+                             const std::vector<shaper_window>& schedule
+                             )
+    : evbase_(evbase)
+    , default_rate_kbit_(rate_kbit)
+    , burst_kbyte_(burst_kbyte)
+    , schedule_(schedule)
+    , group_(NULL)
+    , tick_event_(NULL)
+    , rate_kbit_(0) {
+
+    ev_token_bucket_cfg* cfg = ev_token_bucket_cfg_new(EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, NULL);
+    group_ = bufferevent_rate_limit_group_new(evbase_, cfg);
+    ev_token_bucket_cfg_free(cfg); // the group keeps a copy
+    assert(NULL != group_);
+
+    tick_event_ = evtimer_new(evbase_, &upload_shaper::on_tick, this);
+    assert(NULL != tick_event_);
+
+    apply();
+}
+
+upload_shaper::~upload_shaper() {
+    event_free(tick_event_);
+    bufferevent_rate_limit_group_free(group_);
+}
+
+bool upload_shaper::parse_schedule(const std::string& spec, std::vector<shaper_window>* schedule) {
+    std::string::size_type begin = 0;
+    while(begin < spec.size()) {
+        std::string::size_type end = spec.find(',', begin);
+        if(end == std::string::npos) {
+            end = spec.size();
+        }
+        const std::string item = spec.substr(begin, end-begin);
+        std::string::size_type dash = item.find('-');
+        std::string::size_type equals = item.find('=');
+        if(dash == std::string::npos || equals == std::string::npos || equals < dash) {
+            return false;
+        }
+        shaper_window window;
+        if(!parse_time_of_day(item.substr(0, dash), &window.start_min) ||
+           !parse_time_of_day(item.substr(dash+1, equals-dash-1), &window.end_min)) {
+            return false;
+        }
+        window.rate_kbit = std::strtoul(item.c_str()+equals+1, NULL, 10);
+        schedule->push_back(window);
+        begin = end+1;
+    }
+    return true;
+}
+
+bufferevent_rate_limit_group* upload_shaper::group() const {
+    return group_;
+}
+
+std::uint32_t upload_shaper::rate_kbit() const {
+    return rate_kbit_;
+}
+
+std::uint32_t upload_shaper::scheduled_rate_kbit() const {
+    std::time_t now = std::time(NULL);
+    std::tm local;
+    localtime_r(&now, &local);
+    const int minute = local.tm_hour*60 + local.tm_min;
+
+    // the first matching window wins
+    for(std::size_t i = 0 ; i < schedule_.size() ; i++) {
+        const shaper_window& window = schedule_[i];
+        bool inside = window.start_min <= window.end_min
+                    ? minute >= window.start_min && minute < window.end_min
+                    : minute >= window.start_min || minute < window.end_min;
+        if(inside) {
+            return window.rate_kbit;
+        }
+    }
+    return default_rate_kbit_;
+}
+
+void upload_shaper::apply() {
+    std::uint32_t rate = scheduled_rate_kbit();
+    if(rate != rate_kbit_) {
+        ev_token_bucket_cfg* cfg = NULL;
+        if(0 == rate) {
+            cfg = ev_token_bucket_cfg_new(EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, NULL);
+        } else {
+            // only the write side is shaped, responses are small
+            // libevent's default one second tick: shorter ticks stall the
+            // openssl bufferevents of a group once a record no longer fits
+            const std::size_t per_sec = static_cast<std::size_t>(rate)*125;
+            const std::size_t burst = std::max<std::size_t>(static_cast<std::size_t>(burst_kbyte_)*1024, per_sec);
+            cfg = ev_token_bucket_cfg_new(EV_RATE_LIMIT_MAX, EV_RATE_LIMIT_MAX, per_sec, burst, NULL);
+        }
+        assert(NULL != cfg);
+        bufferevent_rate_limit_group_set_cfg(group_, cfg);
+        ev_token_bucket_cfg_free(cfg);
+
+        if(0 == rate) {
+            LOG(common::log::info) << "upload rate unlimited" << common::log::end;
+        } else {
+            LOG(common::log::info) << "upload rate limited to " << rate << " kbit/s" << common::log::end;
+        }
+        rate_kbit_ = rate;
+    }
+
+    if(!schedule_.empty()) {
+        // windows start on the minute
+        timeval next = { 60 - std::time(NULL) % 60, 0 };
+        evtimer_add(tick_event_, &next);
+    }
+}
+
+void upload_shaper::on_tick(int, short, void* ctx) {
+    static_cast<upload_shaper*>(ctx)->handle_on_tick();
+}
+
+void upload_shaper::handle_on_tick() {
+    apply();
+}
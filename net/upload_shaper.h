@@ -0,0 +1,60 @@
+#ifndef UPLOAD_SHAPER_H
+#define UPLOAD_SHAPER_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+struct event_base;
+struct event;
+struct bufferevent_rate_limit_group;
+
+namespace net {
+
+// [start_min, end_min) in local time, may wrap around midnight
+class shaper_window {
+public:
+    int start_min;
+    int end_min;
+    std::uint32_t rate_kbit;
+};
+
+// token bucket shared by every upload connection. the rate follows a
+// time-of-day schedule, outside of it the default rate applies and 0
+// means unlimited. the burst lets a short request through at full speed.
+class upload_shaper {
+public:
+    upload_shaper(event_base* evbase,
+                  std::uint32_t rate_kbit,
+                  std::uint32_t burst_kbyte,
+                  const std::vector<shaper_window>& schedule
+                  );
+    ~upload_shaper();
+private:
+    upload_shaper(const upload_shaper&) = delete;
+    void operator=(const upload_shaper&) = delete;
+public:
+    // "08:00-18:00=2000,22:00-06:00=0", rates in kbit/s
+    static bool parse_schedule(const std::string& spec, std::vector<shaper_window>* schedule);
+public:
+    bufferevent_rate_limit_group* group() const;
+    std::uint32_t rate_kbit() const;
+private:
+    std::uint32_t scheduled_rate_kbit() const;
+    void apply();
+private:
+    static void on_tick(int, short, void* ctx);
+    void handle_on_tick();
+private:
+    event_base* evbase_;
+    std::uint32_t default_rate_kbit_;
+    std::uint32_t burst_kbyte_;
+    std::vector<shaper_window> schedule_;
+    bufferevent_rate_limit_group* group_;
+    event* tick_event_;
+    std::uint32_t rate_kbit_;
+};
+
+}
+
+#endif // UPLOAD_SHAPER_H
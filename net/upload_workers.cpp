@@ -0,0 +1,302 @@
+#include "upload_workers.h"
+
+#include "logging/log.h"
+
+#include "common/spsc_queue.h"
+
+#include <event2/event.h>
+#include <event2/dns.h>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <thread>
+#include <set>
+#include <stdexcept>
+#include <cassert>
+#include <cstdint>
+
+using net::upload_workers;
+
+namespace {
+
+// more uploads than this in flight on one worker is a bug in the caller,
+// a publisher has a handful at most
+const std::size_t queue_capacity = 1024;
+
+void wake(int fd) {
+    std::uint64_t one = 1;
+    if(write(fd, &one, sizeof(one)) != sizeof(one)) {
+        assert(false);
+    }
+}
+
+void drain(int fd) {
+    std::uint64_t count;
+    if(read(fd, &count, sizeof(count)) < 0) {
+        // EAGAIN, woken for jobs that were already taken
+    }
+}
+
+}
+
+class upload_workers::job {
+public:
+    upload_session* upload;     // NULL stops the worker
+    std::size_t chunk_size;     // 0 for a whole put
+    put_cb cb;
+    void* ctx;
+    put_result result;
+};
+
+// submit, in_flight and the results run on the owner's thread, the rest
+// on the worker's thread once it has started
+class upload_workers::worker {
+public:
+    worker(event_base* owner_evbase, backend_factory factory, void* ctx)
+        : evbase_(event_base_new())
+        , evdns_(NULL)
+        , backend_(NULL)
+        , jobs_(queue_capacity)
+        , results_(queue_capacity)
+        , jobs_fd_(eventfd(0, EFD_NONBLOCK))
+        , results_fd_(eventfd(0, EFD_NONBLOCK))
+        , jobs_event_(NULL)
+        , results_event_(NULL)
+        , in_flight_(0)
+        , thread_(nullptr) {
+
+        if(NULL == evbase_ || jobs_fd_ < 0 || results_fd_ < 0) {
+            throw std::runtime_error("cannot create upload worker");
+        }
+        evdns_ = evdns_base_new(evbase_, EVDNS_BASE_DISABLE_WHEN_INACTIVE);
+        backend_ = factory(evbase_, evdns_, ctx);
+
+        jobs_event_ = event_new(evbase_, jobs_fd_, EV_READ|EV_PERSIST, &worker::on_jobs, this);
+        event_add(jobs_event_, NULL);
+        results_event_ = event_new(owner_evbase, results_fd_, EV_READ|EV_PERSIST, &worker::on_results, this);
+        event_add(results_event_, NULL);
+
+        thread_ = new std::thread(&event_base_dispatch, evbase_);
+    }
+    ~worker() {
+        assert(NULL == thread_);
+        event_free(results_event_);
+        event_free(jobs_event_);
+        if(NULL != evdns_) {
+            evdns_base_free(evdns_, 0);
+        }
+        event_base_free(evbase_);
+        close(jobs_fd_);
+        close(results_fd_);
+    }
+private:
+    worker(const worker&) = delete;
+    void operator=(const worker&) = delete;
+public:
+    void submit(job* j) {
+        if(!jobs_.push(j)) {
+            assert(NULL == "upload worker queue full");
+        }
+        if(NULL != j->upload) {
+            in_flight_++;
+        }
+        wake(jobs_fd_);
+    }
+    std::size_t in_flight() const {
+        return in_flight_;
+    }
+    // joins the thread and frees the backend, the puts it dropped are
+    // left in started_
+    void stop() {
+        job* stop = new job();
+        stop->upload = NULL;
+        submit(stop);
+        thread_->join();
+        delete thread_;
+        thread_ = NULL;
+        delete backend_;
+        backend_ = NULL;
+    }
+    // after stop, on the owner's thread. results that arrived are handed
+    // out as they are, everything else as cancelled.
+    void finish_all() {
+        handle_on_results();
+        job* j = NULL;
+        while(jobs_.pop(&j)) {
+            cancel(j);
+        }
+        for(std::set<put_context*>::iterator it = started_.begin(); it != started_.end(); ++it) {
+            cancel((*it)->j);
+            delete *it;
+        }
+        started_.clear();
+    }
+private:
+    static void on_jobs(int, short, void* ctx) {
+        static_cast<worker*>(ctx)->handle_on_jobs();
+    }
+    void handle_on_jobs() {
+        drain(jobs_fd_);
+        job* j = NULL;
+        while(jobs_.pop(&j)) {
+            if(NULL == j->upload) {
+                delete j;
+                event_base_loopbreak(evbase_);
+                return;
+            }
+            put_context* put_ctx = new put_context(this, j);
+            started_.insert(put_ctx);
+            if(0 == j->chunk_size) {
+                backend_->put(j->upload, &worker::on_put_complete, put_ctx);
+            } else {
+                backend_->put_streaming(j->upload, j->chunk_size, &worker::on_put_complete, put_ctx);
+            }
+        }
+    }
+
+    class put_context {
+    public:
+        put_context(worker* w, job* j)
+            : w(w)
+            , j(j) {
+        }
+        worker* w;
+        job* j;
+    };
+    static void on_put_complete(const put_result& result, void* ctx) {
+        put_context* put_ctx = static_cast<put_context*>(ctx);
+        put_ctx->w->started_.erase(put_ctx);
+        put_ctx->w->handle_on_put_complete(result, put_ctx->j);
+        delete put_ctx;
+    }
+    void handle_on_put_complete(const put_result& result, job* j) {
+        j->result = result;
+        if(!results_.push(j)) {
+            assert(NULL == "upload worker result queue full");
+        }
+        wake(results_fd_);
+    }
+private:
+    // on the owner's loop
+    static void on_results(int, short, void* ctx) {
+        static_cast<worker*>(ctx)->handle_on_results();
+    }
+    void handle_on_results() {
+        drain(results_fd_);
+        job* j = NULL;
+        while(results_.pop(&j)) {
+            in_flight_--;
+            finish(j);
+        }
+    }
+    void cancel(job* j) {
+        in_flight_--;
+        j->result.status = put_result::cancelled;
+        finish(j);
+    }
+private:
+    event_base* evbase_;
+    evdns_base* evdns_;
+    storage_backend* backend_;
+    common::spsc_queue<job*> jobs_;
+    common::spsc_queue<job*> results_;
+    int jobs_fd_;
+    int results_fd_;
+    event* jobs_event_;
+    event* results_event_;
+    std::size_t in_flight_;
+    std::thread* thread_;
+    // handed to the backend and not completed yet, worker's thread
+    std::set<put_context*> started_;
+};
+
+upload_workers::upload_workers(
+    event_base* evbase,
+    storage_backend* control,
+    std::size_t count,
+    backend_factory factory,
+    void* ctx
+    )
+    : control_(control)
+    , stopping_(false) {
+
+    assert(0 != count);
+    for(std::size_t i = 0 ; i < count ; i++) {
+        workers_.push_back(new worker(evbase, factory, ctx));
+    }
+    LOG(common::log::info) << "uploading on " << static_cast<unsigned long>(count) << " worker threads" << common::log::end;
+
+}
+
+upload_workers::~upload_workers() {
+    // every thread is stopped before any callback runs, a callback may
+    // put again and that must not reach a running worker
+    stopping_ = true;
+    for(std::size_t i = 0 ; i < workers_.size() ; i++) {
+        workers_[i]->stop();
+    }
+    for(std::size_t i = 0 ; i < workers_.size() ; i++) {
+        workers_[i]->finish_all();
+    }
+    for(; cancelled_.size() != 0; cancelled_.pop_front()) {
+        job* j = cancelled_.front();
+        j->result.status = put_result::cancelled;
+        finish(j);
+    }
+    for(std::size_t i = 0 ; i < workers_.size() ; i++) {
+        delete workers_[i];
+    }
+}
+
+void upload_workers::list(list_cb cb, void* ctx) {
+    control_->list(cb, ctx);
+}
+
+void upload_workers::put(upload_session* upload, put_cb cb, void* ctx) {
+    job* j = new job();
+    j->upload = upload;
+    j->chunk_size = 0;
+    j->cb = cb;
+    j->ctx = ctx;
+    dispatch(j);
+}
+
+void upload_workers::put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx) {
+    assert(0 != chunk_size);
+    job* j = new job();
+    j->upload = upload;
+    j->chunk_size = chunk_size;
+    j->cb = cb;
+    j->ctx = ctx;
+    dispatch(j);
+}
+
+void upload_workers::remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx) {
+    control_->remove(paths, cb, ctx);
+}
+
+std::size_t upload_workers::size() const {
+    return workers_.size();
+}
+
+void upload_workers::finish(job* j) {
+    j->cb(j->result, j->ctx);
+    delete j;
+}
+
+void upload_workers::dispatch(job* j) {
+    if(stopping_) {
+        cancelled_.push_back(j);
+        return;
+    }
+    // the least busy worker, a chunk need not go where the previous one
+    // of its upload went since the session lives in upload_session
+    worker* target = workers_[0];
+    for(std::size_t i = 1 ; i < workers_.size() ; i++) {
+        if(workers_[i]->in_flight() < target->in_flight()) {
+            target = workers_[i];
+        }
+    }
+    target->submit(j);
+}
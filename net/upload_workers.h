@@ -0,0 +1,59 @@
+#ifndef UPLOAD_WORKERS_H
+#define UPLOAD_WORKERS_H
+
+#include "storage_backend.h"
+
+#include <vector>
+#include <deque>
+#include <cstddef>
+
+struct event_base;
+struct evdns_base;
+
+namespace net {
+
+// runs puts on worker threads, each with its own event loop and its own
+// backend, so connections and their TLS work are spread over the cores.
+// list and remove stay with the control backend on the caller's loop.
+// uploads are handed to a worker and results handed back through
+// lock-free queues, callbacks still arrive on the caller's loop.
+class upload_workers : public storage_backend {
+public:
+    // makes the backend of one worker. it is called on the caller's
+    // thread before that worker starts, @arg1 and @arg2 belong to the
+    // worker and @arg2 has no nameservers yet. the backend is deleted
+    // after the worker has stopped, before @arg1 is freed.
+    typedef storage_backend* (*backend_factory)(event_base* evbase, evdns_base* evdns, void* ctx);
+public:
+    upload_workers(event_base* evbase,
+                   storage_backend* control,
+                   std::size_t count,
+                   backend_factory factory,
+                   void* ctx
+                   );
+    // puts that have not completed are finished with put_result::cancelled
+    // on the caller's thread, so the owner of their callbacks must still
+    // be alive. puts made from those callbacks are cancelled as well.
+    ~upload_workers();
+public:
+    void list(list_cb cb, void* ctx);
+    void put(upload_session* upload, put_cb cb, void* ctx);
+    void put_streaming(upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx);
+    void remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx);
+public:
+    std::size_t size() const;
+private:
+    class job;
+    class worker;
+    void dispatch(job* j);
+    static void finish(job* j);
+private:
+    storage_backend* control_;
+    std::vector<worker*> workers_;
+    bool stopping_;
+    std::deque<job*> cancelled_;
+};
+
+}
+
+#endif // UPLOAD_WORKERS_H
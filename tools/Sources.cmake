@@ -0,0 +1,17 @@
+set(MOCK_DROPBOX_SOURCES
+    mock_dropbox.cpp
+    mock_dropbox_main.cpp
+)
+
+set(PUBLISHER_BENCH_SOURCES
+    mock_dropbox.cpp
+    publisher_bench.cpp
+)
+
+set(JSON_BENCH_SOURCES
+    json_bench.cpp
+)
+
+set(REQUEST_BENCH_SOURCES
+    request_bench.cpp
+)
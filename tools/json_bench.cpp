@@ -0,0 +1,151 @@
+#include "net/dropbox_json.h"
+#include "net/folder_cache.h"
+
+#include <json/json.h>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include <getopt.h>
+
+namespace {
+
+const char* folder = "/_seccam_/video0";
+
+std::uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// a list_folder page shaped like the ones Dropbox sends, with the
+// metadata members the backend never reads
+std::vector<std::uint8_t> make_page(int entries) {
+    std::ostringstream out;
+    out << "{\"entries\": [";
+    for(int i = 0 ; i < entries ; i++) {
+        int timestamp = 1500000000 + i*10;
+        out << (i == 0 ? "" : ", ")
+            << "{\".tag\": \"file\", \"name\": \"" << timestamp << "\""
+            << ", \"id\": \"id:a4ayc_80_OEAAAAAAAAA" << i << "\""
+            << ", \"client_modified\": \"2017-07-14T02:40:00Z\""
+            << ", \"server_modified\": \"2017-07-14T02:40:03Z\""
+            << ", \"rev\": \"a1c10ce0dd78" << i << "\""
+            << ", \"size\": " << 2000000 + i
+            << ", \"path_lower\": \"" << folder << "/" << timestamp << "\""
+            << ", \"path_display\": \"" << folder << "/" << timestamp << "\""
+            << ", \"sharing_info\": {\"read_only\": false, \"parent_shared_folder_id\": \"84528192421\"}"
+            << ", \"is_downloadable\": true"
+            << ", \"content_hash\": \"e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855\"}";
+    }
+    out << "], \"cursor\": \"ZtkX9_EHj3x7PMkVuFIhwKYXEpwpLwyxp9vMKomUhllil9q7eWiAu\", \"has_more\": false}";
+    std::string str = out.str();
+    return std::vector<std::uint8_t>(str.begin(), str.end());
+}
+
+// what the backend did before the scanner: a full DOM, then a walk
+bool jsoncpp_page(const std::vector<std::uint8_t>& body, net::folder_cache* cache) {
+    const char* begin = reinterpret_cast<const char*>(&body[0]);
+    Json::Value json;
+    Json::Reader reader;
+    if(!reader.parse(begin, begin+body.size(), json, false)) {
+        return false;
+    }
+    Json::Value& entries = json["entries"];
+    for(Json::ArrayIndex i = 0 ; i < entries.size() ; i++) {
+        Json::Value& entry = entries[i];
+        if(entry[".tag"].asString() != "file") {
+            continue;
+        }
+        api_file file = api_file();
+        file.filename = entry["name"].asString();
+        file.path = entry["path_lower"].asString();
+        file.size = entry["size"].asInt();
+        file.last_modified = entry["client_modified"].asString();
+        if(!net::file_index::parse_name(file.filename, &file)) {
+            continue;
+        }
+        cache->put(file);
+    }
+    return json["has_more"].isBool() && json["cursor"].isString();
+}
+
+bool scanner_page(const std::vector<std::uint8_t>& body, net::folder_cache* cache) {
+    std::string cursor;
+    bool has_more = false;
+    return net::scan_list_page(reinterpret_cast<const char*>(&body[0]), body.size(), folder, cache, &cursor, &has_more);
+}
+
+void run(const char* name, bool (*parse)(const std::vector<std::uint8_t>&, net::folder_cache*),
+         const std::vector<std::uint8_t>& body, int iterations) {
+
+    net::folder_cache cache("");
+    std::uint64_t start = now_us();
+    bool ok = true;
+    for(int i = 0 ; i < iterations && ok ; i++) {
+        cache.clear();
+        ok = parse(body, &cache);
+    }
+    double sec = (now_us() - start) / 1e6;
+    double mb = static_cast<double>(body.size()) * iterations / 1e6;
+
+    std::cout << std::left << std::setw(10) << name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(10) << mb / sec << " MB/s"
+              << std::setw(12) << cache.size() * iterations / sec << " entries/s"
+              << std::setw(10) << sec * 1e6 / iterations << " us/page"
+              << (ok ? "" : "  FAILED") << std::endl;
+}
+
+void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--entries N] [--iterations N] [--file PATH]" << std::endl;
+}
+
+}
+
+// parses list_folder pages with jsoncpp and with the scanner the
+// backend uses and compares the throughput. --file takes a recorded
+// response instead of the synthesized page.
+int main(int argc, char* argv[]) {
+
+    int entries = 2000;
+    int iterations = 200;
+    std::string file;
+
+    static const option long_options[] = {
+        { "entries", required_argument, NULL, 'n' },
+        { "iterations", required_argument, NULL, 'i' },
+        { "file", required_argument, NULL, 'f' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while((opt = getopt_long(argc, argv, "n:i:f:", long_options, NULL)) != -1) {
+        switch(opt) {
+            case 'n': entries = std::atoi(optarg); break;
+            case 'i': iterations = std::max(1, std::atoi(optarg)); break;
+            case 'f': file = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    std::vector<std::uint8_t> body;
+    if(file.empty()) {
+        body = make_page(entries);
+    } else {
+        std::ifstream in(file.c_str(), std::ios::binary);
+        body.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    if(body.empty()) {
+        std::cerr << "nothing to parse" << std::endl;
+        return 1;
+    }
+
+    std::cout << static_cast<unsigned long>(body.size()) << " bytes per page" << std::endl;
+    run("jsoncpp", jsoncpp_page, body, iterations);
+    run("scanner", scanner_page, body, iterations);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#!/bin/sh
+# plays what the live view serves with ffprobe: the playlist through the
+# HLS demuxer, each segment on its own and each part after the parts
+# since the last independent one. exits non-zero on the first that does
+# not decode.
+#
+#   tools/live_check.sh http://camera:8080
+#
+# needs curl and ffprobe from ffmpeg.
+
+set -e
+
+verbosity=error
+base=${1:?usage: $0 http://host:port}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+frames() {
+    ffprobe -v "$verbosity" -count_frames -select_streams v:0 \
+            -show_entries stream=codec_name,nb_read_frames -of csv=p=0 "$@"
+}
+
+fetch() {
+    # the body to $2, fails unless it is served as MPEG-TS
+    type=$(curl -sf -o "$2" -w '%{content_type}' "$base$1")
+    if [ "$type" != "video/mp2t" ]; then
+        echo "$1: served as $type" >&2
+        exit 1
+    fi
+}
+
+check() {
+    # codec and frame count of the last argument, named $1 in the output.
+    # short parts are too few packets to probe, players are told the
+    # format by the playlist as well
+    name=$1
+    shift
+    out=$(frames "$@")
+    case "$out" in
+        h264,[1-9]*) echo "$name: $out" ;;
+        *) echo "$name: does not play: $out" >&2; exit 1 ;;
+    esac
+}
+
+curl -sf -o "$work/live.m3u8" "$base/live.m3u8"
+check /live.m3u8 "$base/live.m3u8"
+
+for uri in $(grep '^/live/' "$work/live.m3u8"); do
+    fetch "$uri" "$work/segment.ts"
+    check "$uri" -f mpegts "$work/segment.ts"
+done
+
+grep '^#EXT-X-PART:' "$work/live.m3u8" | while read -r part; do
+    uri=$(echo "$part" | sed 's/.*URI="\([^"]*\)".*/\1/')
+    seq=$(basename "$uri" | cut -d. -f1)
+    fetch "$uri" "$work/part.ts"
+    # a player may join at an independent part. inside a segment it can
+    # start with frames before its key frame, which do not decode.
+    case "$part" in
+        *INDEPENDENT=YES*)
+            cp "$work/part.ts" "$work/parts.$seq.ts"
+            case "$uri" in
+                *.0.ts) verbosity=error ;;
+                *) verbosity=fatal ;;
+            esac
+            ;;
+        *) cat "$work/part.ts" >> "$work/parts.$seq.ts" ;;
+    esac
+    check "$uri" -f mpegts "$work/parts.$seq.ts"
+done
@@ -0,0 +1,698 @@
+#include "mock_dropbox.h"
+
+#include "logging/log.h"
+
+#include <json/json.h>
+
+#include <event2/event.h>
+#include <event2/http.h>
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
+#include <event2/keyvalq_struct.h>
+
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <openssl/ec.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <stdexcept>
+#include <sstream>
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <ctime>
+
+using tools::mock_dropbox;
+
+namespace {
+
+const char* const seccam_folder = "/_seccam_";
+
+std::string to_lower(std::string str) {
+    std::transform(str.begin(), str.end(), str.begin(), ::tolower);
+    return str;
+}
+
+std::string parent_of(const std::string& path) {
+    std::string::size_type slash = path.rfind('/');
+    return slash == std::string::npos || slash == 0 ? std::string() : path.substr(0, slash);
+}
+
+std::string iso_time(std::time_t ts) {
+    std::tm tm;
+    char buf[32];
+    gmtime_r(&ts, &tm);
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%SZ", &tm);
+    return buf;
+}
+
+const char* reason_phrase(int code) {
+    switch(code) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 409: return "Conflict";
+        case 429: return "Too Many Requests";
+        default: return "Internal Server Error";
+    }
+}
+
+bool parse_json(const char* begin, const char* end, Json::Value* res) {
+    Json::Reader reader;
+    return begin != end && reader.parse(begin, end, *res, false);
+}
+
+// a throwaway P-256 key and certificate, clients do not verify it
+bool use_self_signed_certificate(SSL_CTX* ssl_ctx) {
+    EVP_PKEY* pkey = NULL;
+    EVP_PKEY_CTX* pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+    if(NULL == pctx ||
+       EVP_PKEY_keygen_init(pctx) <= 0 ||
+       EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) <= 0 ||
+       EVP_PKEY_keygen(pctx, &pkey) <= 0) {
+        EVP_PKEY_CTX_free(pctx);
+        return false;
+    }
+    EVP_PKEY_CTX_free(pctx);
+
+    X509* cert = X509_new();
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), -3600);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 30L*24*3600);
+    X509_NAME* name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char*>("mock-dropbox"), -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509_set_pubkey(cert, pkey);
+
+    bool ok = X509_sign(cert, pkey, EVP_sha256()) > 0 &&
+              SSL_CTX_use_certificate(ssl_ctx, cert) == 1 &&
+              SSL_CTX_use_PrivateKey(ssl_ctx, pkey) == 1;
+
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return ok;
+}
+
+}
+
+class mock_dropbox::delayed_reply {
+public:
+    mock_dropbox* owner;
+    evhttp_request* req;
+    evhttp_connection* conn;
+    int code;
+    evbuffer* body;
+    std::string retry_after;
+    event* timer;
+};
+
+mock_dropbox::mock_dropbox(event_base* evbase, const mock_dropbox_options& options)
+    : options_(options)
+    , evbase_(evbase)
+    , ssl_ctx_(NULL)
+    , http_(NULL)
+    , rate_limit_(NULL)
+    , port_(0)
+    , random_(options.seed)
+    , seq_(0)
+    , next_id_(0)
+    , uploads_(0)
+    , bytes_received_(0)
+    , requests_(0)
+    , drop_reply_(false) {
+
+    ssl_ctx_ = SSL_CTX_new(SSLv23_server_method());
+    if(NULL == ssl_ctx_ || !use_self_signed_certificate(ssl_ctx_)) {
+        SSL_CTX_free(ssl_ctx_);
+        throw std::runtime_error("cannot set up TLS");
+    }
+    static const unsigned char session_context[] = "mock_dropbox";
+    SSL_CTX_set_session_id_context(ssl_ctx_, session_context, sizeof(session_context)-1);
+
+    http_ = evhttp_new(evbase_);
+    evhttp_set_bevcb(http_, &mock_dropbox::on_new_connection, this);
+    evhttp_set_gencb(http_, &mock_dropbox::on_request, this);
+    evhttp_set_allowed_methods(http_, EVHTTP_REQ_POST);
+
+    evhttp_bound_socket* handle = evhttp_bind_socket_with_handle(http_, options_.address.c_str(), options_.port);
+    if(NULL == handle) {
+        evhttp_free(http_);
+        SSL_CTX_free(ssl_ctx_);
+        throw std::runtime_error("cannot listen on "+options_.address);
+    }
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    getsockname(evhttp_bound_socket_get_fd(handle), reinterpret_cast<sockaddr*>(&addr), &addr_len);
+    port_ = ntohs(addr.ss_family == AF_INET6 ? reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port
+                                             : reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+
+    if(0 != options_.bandwidth_kbit) {
+        std::size_t rate = options_.bandwidth_kbit*125;
+        rate_limit_ = ev_token_bucket_cfg_new(rate, rate, rate, rate, NULL);
+    }
+
+    if(0 != options_.preload_files) {
+        folders_.insert(seccam_folder);
+        std::time_t first = std::time(NULL) - options_.preload_files*60;
+        for(int i = 0 ; i < options_.preload_files ; i++) {
+            std::ostringstream name;
+            name << first + i*60;
+            mock_file file = {
+                std::string(seccam_folder) + "/" + name.str(),
+                name.str(),
+                options_.preload_size,
+                iso_time(first + i*60),
+                ++next_id_
+            };
+            files_[file.path] = file;
+        }
+    }
+
+    LOG(common::log::info) << "mock dropbox listening on " << options_.address << ":" << port_ << common::log::end;
+}
+
+mock_dropbox::~mock_dropbox() {
+    for(std::multimap<evhttp_connection*, delayed_reply*>::iterator it = delayed_.begin(); it != delayed_.end(); ++it) {
+        event_free(it->second->timer);
+        evbuffer_free(it->second->body);
+        delete it->second;
+    }
+    delayed_.clear();
+    for(std::map<std::string, Json::Value*>::iterator it = delete_jobs_.begin(); it != delete_jobs_.end(); ++it)
+        delete it->second;
+
+    evhttp_free(http_);
+    if(NULL != rate_limit_)
+        ev_token_bucket_cfg_free(rate_limit_);
+    SSL_CTX_free(ssl_ctx_);
+}
+
+std::uint16_t mock_dropbox::port() const {
+    return port_;
+}
+
+std::uint64_t mock_dropbox::uploads() const {
+    return uploads_;
+}
+
+std::uint64_t mock_dropbox::bytes_received() const {
+    return bytes_received_;
+}
+
+std::uint64_t mock_dropbox::requests() const {
+    return requests_;
+}
+
+bufferevent* mock_dropbox::on_new_connection(event_base*, void* ctx) {
+    return static_cast<mock_dropbox*>(ctx)->handle_on_new_connection();
+}
+
+bufferevent* mock_dropbox::handle_on_new_connection() {
+    SSL* ssl = SSL_new(ssl_ctx_);
+    bufferevent* bev = bufferevent_openssl_socket_new(evbase_, -1, ssl, BUFFEREVENT_SSL_ACCEPTING, BEV_OPT_CLOSE_ON_FREE);
+    if(NULL != rate_limit_) {
+        bufferevent_set_rate_limit(bev, rate_limit_);
+    }
+    return bev;
+}
+
+void mock_dropbox::on_request(evhttp_request* req, void* ctx) {
+    static_cast<mock_dropbox*>(ctx)->handle_on_request(req);
+}
+
+void mock_dropbox::handle_on_request(evhttp_request* req) {
+    requests_++;
+
+    // delayed answers must not outlive their connection
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req), &mock_dropbox::on_connection_close, this);
+
+    if(inject_failure(req)) {
+        return;
+    }
+
+    evkeyvalq* headers = evhttp_request_get_input_headers(req);
+    if(NULL == evhttp_find_header(headers, "Authorization")) {
+        Json::Value error;
+        error[".tag"] = "invalid_access_token";
+        reply_error(req, 401, "invalid_access_token/", error);
+        drop_reply_ = false;
+        return;
+    }
+
+    const std::string path = evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req));
+    evbuffer* input = evhttp_request_get_input_buffer(req);
+    const std::size_t len = evbuffer_get_length(input);
+
+    // content endpoints carry their arguments in a header, the rest in the body
+    Json::Value arg;
+    bool arg_ok = false;
+    if(path == "/2/files/upload" || path.compare(0, 24, "/2/files/upload_session/") == 0) {
+        bytes_received_ += len;
+        const char* api_arg = evhttp_find_header(headers, "Dropbox-API-Arg");
+        if(NULL != api_arg) {
+            std::string api_arg_str = api_arg;
+            arg_ok = parse_json(api_arg_str.data(), api_arg_str.data()+api_arg_str.size(), &arg);
+        }
+    } else {
+        const char* body = reinterpret_cast<const char*>(evbuffer_pullup(input, -1));
+        arg_ok = parse_json(body, body+len, &arg);
+    }
+
+    if(!arg_ok) {
+        reply_raw(req, 400, "Error in call to API function: could not decode input as JSON", NULL);
+    } else if(path == "/2/files/list_folder") {
+        list_folder(req, arg);
+    } else if(path == "/2/files/list_folder/continue") {
+        list_folder_continue(req, arg);
+    } else if(path == "/2/files/create_folder_v2") {
+        create_folder(req, arg);
+    } else if(path == "/2/files/upload") {
+        upload(req, arg, len);
+    } else if(path == "/2/files/upload_session/start") {
+        upload_session_start(req, len);
+    } else if(path == "/2/files/upload_session/append_v2") {
+        upload_session_append(req, arg, len);
+    } else if(path == "/2/files/upload_session/finish") {
+        upload_session_finish(req, arg, len);
+    } else if(path == "/2/files/delete_batch") {
+        delete_batch(req, arg);
+    } else if(path == "/2/files/delete_batch/check") {
+        delete_batch_check(req, arg);
+    } else {
+        reply_raw(req, 404, "Unknown API function: " + path, NULL);
+    }
+    drop_reply_ = false;
+}
+
+bool mock_dropbox::inject_failure(evhttp_request* req) {
+    int roll = static_cast<int>(random_() % 100);
+    if(roll < options_.drop_percent) {
+        // half of the dropped requests are carried out, only their answer is lost
+        drop_reply_ = true;
+        if(random_() % 2 == 0) {
+            reply_raw(req, 500, std::string(), NULL);
+            drop_reply_ = false;
+            return true;
+        }
+        return false;
+    }
+    roll -= options_.drop_percent;
+    if(roll < options_.throttle_percent) {
+        Json::Value root;
+        root["error_summary"] = "too_many_requests/";
+        root["error"]["reason"][".tag"] = "too_many_requests";
+        root["error"]["retry_after"] = 1;
+        Json::FastWriter writer;
+        reply_raw(req, 429, writer.write(root), "1");
+        return true;
+    }
+    roll -= options_.throttle_percent;
+    if(roll < options_.error_percent) {
+        reply_raw(req, 500, std::string(), NULL);
+        return true;
+    }
+    return false;
+}
+
+void mock_dropbox::list_folder(evhttp_request* req, const Json::Value& arg) {
+    const std::string path = to_lower(arg["path"].asString());
+    if(!path.empty() && folders_.count(path) == 0) {
+        Json::Value error;
+        error[".tag"] = "path";
+        error["path"][".tag"] = "not_found";
+        reply_error(req, 409, "path/not_found/", error);
+        return;
+    }
+    list_page(req, path, 0);
+}
+
+void mock_dropbox::list_folder_continue(evhttp_request* req, const Json::Value& arg) {
+    // L|path|offset continues a listing, D|path|seq reports changes after seq
+    const std::string cursor = arg["cursor"].asString();
+    std::string::size_type first = cursor.find('|');
+    std::string::size_type last = cursor.rfind('|');
+    if(cursor.size() < 3 || first != 1 || last == first || (cursor[0] != 'L' && cursor[0] != 'D')) {
+        Json::Value error;
+        error[".tag"] = "reset";
+        reply_error(req, 409, "reset/", error);
+        return;
+    }
+    const std::string path = cursor.substr(first+1, last-first-1);
+    const std::uint64_t value = std::strtoull(cursor.c_str()+last+1, NULL, 10);
+    if(cursor[0] == 'L') {
+        list_page(req, path, value);
+    } else {
+        list_changes(req, path, value);
+    }
+}
+
+void mock_dropbox::list_page(evhttp_request* req, const std::string& path, std::size_t offset) {
+    Json::Value root;
+    Json::Value& entries = root["entries"];
+    entries = Json::Value(Json::arrayValue);
+
+    std::size_t index = 0;
+    for(std::set<std::string>::const_iterator it = folders_.begin(); it != folders_.end(); ++it) {
+        if(parent_of(*it) != path) {
+            continue;
+        }
+        if(index >= offset && entries.size() < options_.page_size) {
+            entries.append(folder_metadata(*it));
+        }
+        index++;
+    }
+    const std::string prefix = path + "/";
+    for(std::map<std::string, mock_file>::const_iterator it = files_.lower_bound(prefix);
+        it != files_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+        if(parent_of(it->first) != path) {
+            continue;
+        }
+        if(index >= offset && entries.size() < options_.page_size) {
+            entries.append(file_metadata(it->second));
+        }
+        index++;
+    }
+
+    std::size_t next = offset + entries.size();
+    std::ostringstream cursor;
+    if(next < index) {
+        cursor << "L|" << path << "|" << next;
+    } else {
+        cursor << "D|" << path << "|" << seq_;
+    }
+    root["cursor"] = cursor.str();
+    root["has_more"] = next < index;
+    reply(req, 200, root);
+}
+
+void mock_dropbox::list_changes(evhttp_request* req, const std::string& path, std::uint64_t seq) {
+    Json::Value root;
+    Json::Value& entries = root["entries"];
+    entries = Json::Value(Json::arrayValue);
+
+    std::size_t i = 0;
+    while(i < changes_.size() && changes_[i].seq <= seq) {
+        i++;
+    }
+    std::uint64_t last_seq = seq;
+    for(; i < changes_.size() && entries.size() < options_.page_size; i++) {
+        const change& chg = changes_[i];
+        last_seq = chg.seq;
+        if(parent_of(chg.path) != path) {
+            continue;
+        }
+        std::map<std::string, mock_file>::const_iterator file = files_.find(chg.path);
+        if(chg.deleted) {
+            Json::Value entry;
+            entry[".tag"] = "deleted";
+            entry["name"] = chg.path.substr(chg.path.rfind('/')+1);
+            entry["path_lower"] = chg.path;
+            entry["path_display"] = chg.path;
+            entries.append(entry);
+        } else if(file != files_.end()) {
+            entries.append(file_metadata(file->second));
+        } else if(folders_.count(chg.path) != 0) {
+            entries.append(folder_metadata(chg.path));
+        }
+    }
+
+    std::ostringstream cursor;
+    cursor << "D|" << path << "|" << last_seq;
+    root["cursor"] = cursor.str();
+    root["has_more"] = i < changes_.size();
+    reply(req, 200, root);
+}
+
+void mock_dropbox::create_folder(evhttp_request* req, const Json::Value& arg) {
+    const std::string path = to_lower(arg["path"].asString());
+    if(folders_.count(path) != 0) {
+        Json::Value error;
+        error[".tag"] = "path";
+        error["path"][".tag"] = "conflict";
+        error["path"]["conflict"][".tag"] = "folder";
+        reply_error(req, 409, "path/conflict/folder/", error);
+        return;
+    }
+    folders_.insert(path);
+    record_change(path, false);
+
+    Json::Value root;
+    root["metadata"] = folder_metadata(path);
+    root["metadata"].removeMember(".tag");
+    reply(req, 200, root);
+}
+
+void mock_dropbox::upload(evhttp_request* req, const Json::Value& arg, std::size_t len) {
+    commit_file(req, arg["path"].asString(), len);
+}
+
+void mock_dropbox::upload_session_start(evhttp_request* req, std::size_t len) {
+    std::ostringstream id;
+    id << "mock-session-" << ++next_id_;
+    sessions_[id.str()] = len;
+
+    Json::Value root;
+    root["session_id"] = id.str();
+    reply(req, 200, root);
+}
+
+void mock_dropbox::upload_session_append(evhttp_request* req, const Json::Value& arg, std::size_t len) {
+    std::size_t* received = NULL;
+    if(!session_lookup(req, arg["cursor"], &received, false)) {
+        return;
+    }
+    *received += len;
+    reply_raw(req, 200, "null", NULL);
+}
+
+void mock_dropbox::upload_session_finish(evhttp_request* req, const Json::Value& arg, std::size_t len) {
+    std::size_t* received = NULL;
+    if(!session_lookup(req, arg["cursor"], &received, true)) {
+        return;
+    }
+    std::size_t size = *received + len;
+    sessions_.erase(arg["cursor"]["session_id"].asString());
+    commit_file(req, arg["commit"]["path"].asString(), size);
+}
+
+bool mock_dropbox::session_lookup(evhttp_request* req, const Json::Value& cursor, std::size_t** received, bool nested) {
+    // finish reports lookup errors nested under lookup_failed, append_v2 does not
+    Json::Value error;
+    std::string summary;
+    std::map<std::string, std::size_t>::iterator it = sessions_.find(cursor["session_id"].asString());
+    if(it == sessions_.end()) {
+        error[".tag"] = "not_found";
+        summary = "not_found/";
+    } else if(cursor["offset"].asUInt64() != it->second) {
+        error[".tag"] = "incorrect_offset";
+        error["correct_offset"] = Json::UInt64(it->second);
+        summary = "incorrect_offset/";
+    } else {
+        *received = &it->second;
+        return true;
+    }
+
+    if(nested) {
+        Json::Value lookup_failed;
+        lookup_failed[".tag"] = "lookup_failed";
+        lookup_failed["lookup_failed"] = error;
+        reply_error(req, 409, "lookup_failed/"+summary, lookup_failed);
+    } else {
+        reply_error(req, 409, summary, error);
+    }
+    return false;
+}
+
+bool mock_dropbox::commit_file(evhttp_request* req, const std::string& path, std::size_t size) {
+    const std::string path_lower = to_lower(path);
+    std::map<std::string, mock_file>::iterator it = files_.find(path_lower);
+    if(it != files_.end()) {
+        // like Dropbox, re-uploading the same content is not a conflict.
+        // contents are not kept, the size has to do.
+        if(it->second.size == size) {
+            reply(req, 200, file_metadata(it->second));
+            return true;
+        }
+        Json::Value error;
+        error[".tag"] = "path";
+        error["path"]["reason"][".tag"] = "conflict";
+        error["path"]["reason"]["conflict"][".tag"] = "file";
+        reply_error(req, 409, "path/conflict/file/", error);
+        return false;
+    }
+
+    mock_file file = {
+        path_lower,
+        path_lower.substr(path_lower.rfind('/')+1),
+        size,
+        iso_time(std::time(NULL)),
+        ++next_id_
+    };
+    files_[path_lower] = file;
+    record_change(path_lower, false);
+    uploads_++;
+
+    reply(req, 200, file_metadata(file));
+    return true;
+}
+
+void mock_dropbox::delete_batch(evhttp_request* req, const Json::Value& arg) {
+    // deletes happen right away, the result is handed out by the first check
+    Json::Value* result = new Json::Value;
+    (*result)[".tag"] = "complete";
+    Json::Value& entries = (*result)["entries"];
+    entries = Json::Value(Json::arrayValue);
+
+    const Json::Value& paths = arg["entries"];
+    for(Json::ArrayIndex i = 0 ; i < paths.size() ; i++) {
+        const std::string path = to_lower(paths[i]["path"].asString());
+        Json::Value entry;
+        std::map<std::string, mock_file>::iterator it = files_.find(path);
+        if(it != files_.end()) {
+            entry[".tag"] = "success";
+            entry["metadata"] = file_metadata(it->second);
+            files_.erase(it);
+            record_change(path, true);
+        } else {
+            entry[".tag"] = "failure";
+            entry["failure"][".tag"] = "path_lookup";
+            entry["failure"]["path_lookup"][".tag"] = "not_found";
+        }
+        entries.append(entry);
+    }
+
+    std::ostringstream id;
+    id << "mock-job-" << ++next_id_;
+    delete_jobs_[id.str()] = result;
+
+    Json::Value root;
+    root[".tag"] = "async_job_id";
+    root["async_job_id"] = id.str();
+    reply(req, 200, root);
+}
+
+void mock_dropbox::delete_batch_check(evhttp_request* req, const Json::Value& arg) {
+    std::map<std::string, Json::Value*>::iterator it = delete_jobs_.find(arg["async_job_id"].asString());
+    if(it == delete_jobs_.end()) {
+        Json::Value error;
+        error[".tag"] = "invalid_async_job_id";
+        reply_error(req, 409, "invalid_async_job_id/", error);
+        return;
+    }
+    reply(req, 200, *it->second);
+    delete it->second;
+    delete_jobs_.erase(it);
+}
+
+Json::Value mock_dropbox::file_metadata(const mock_file& file) const {
+    std::ostringstream rev;
+    rev << std::hex << 0x5000000000ull + file.rev;
+
+    Json::Value entry;
+    entry[".tag"] = "file";
+    entry["name"] = file.name;
+    entry["path_lower"] = file.path;
+    entry["path_display"] = file.path;
+    entry["id"] = "id:" + rev.str();
+    entry["client_modified"] = file.client_modified;
+    entry["server_modified"] = file.client_modified;
+    entry["rev"] = rev.str();
+    entry["size"] = Json::UInt64(file.size);
+    return entry;
+}
+
+Json::Value mock_dropbox::folder_metadata(const std::string& path) const {
+    Json::Value entry;
+    entry[".tag"] = "folder";
+    entry["name"] = path.substr(path.rfind('/')+1);
+    entry["path_lower"] = path;
+    entry["path_display"] = path;
+    entry["id"] = "id:folder" + path;
+    return entry;
+}
+
+void mock_dropbox::record_change(const std::string& path, bool deleted) {
+    change chg = { ++seq_, path, deleted };
+    changes_.push_back(chg);
+}
+
+void mock_dropbox::reply(evhttp_request* req, int code, const Json::Value& body) {
+    Json::FastWriter writer;
+    reply_raw(req, code, writer.write(body), NULL);
+}
+
+void mock_dropbox::reply_error(evhttp_request* req, int code, const std::string& summary, const Json::Value& error) {
+    Json::Value root;
+    root["error_summary"] = summary;
+    root["error"] = error;
+    reply(req, code, root);
+}
+
+void mock_dropbox::reply_raw(evhttp_request* req, int code, const std::string& body, const char* retry_after) {
+    evhttp_connection* conn = evhttp_request_get_connection(req);
+    if(drop_reply_) {
+        // the request was carried out but the client never hears about it
+        shutdown(bufferevent_getfd(evhttp_connection_get_bufferevent(conn)), SHUT_RDWR);
+        return;
+    }
+
+    delayed_reply* delayed = new delayed_reply;
+    delayed->owner = this;
+    delayed->req = req;
+    delayed->conn = conn;
+    delayed->code = code;
+    delayed->body = evbuffer_new();
+    evbuffer_add(delayed->body, body.data(), body.size());
+    delayed->retry_after = NULL != retry_after ? retry_after : "";
+    delayed->timer = evtimer_new(evbase_, &mock_dropbox::on_reply_timer, delayed);
+    delayed_.insert(std::make_pair(conn, delayed));
+
+    timeval tv = { static_cast<time_t>(options_.latency_ms/1000), static_cast<suseconds_t>(options_.latency_ms%1000*1000) };
+    evtimer_add(delayed->timer, &tv);
+}
+
+void mock_dropbox::on_reply_timer(int, short, void* ctx) {
+    delayed_reply* delayed = static_cast<delayed_reply*>(ctx);
+    mock_dropbox* owner = delayed->owner;
+
+    std::pair<std::multimap<evhttp_connection*, delayed_reply*>::iterator,
+              std::multimap<evhttp_connection*, delayed_reply*>::iterator> range = owner->delayed_.equal_range(delayed->conn);
+    for(; range.first != range.second; ++range.first) {
+        if(range.first->second == delayed) {
+            owner->delayed_.erase(range.first);
+            break;
+        }
+    }
+
+    evkeyvalq* headers = evhttp_request_get_output_headers(delayed->req);
+    evhttp_add_header(headers, "Content-Type", "application/json");
+    if(!delayed->retry_after.empty()) {
+        evhttp_add_header(headers, "Retry-After", delayed->retry_after.c_str());
+    }
+    evhttp_send_reply(delayed->req, delayed->code, reason_phrase(delayed->code), delayed->body);
+
+    event_free(delayed->timer);
+    evbuffer_free(delayed->body);
+    delete delayed;
+}
+
+void mock_dropbox::on_connection_close(evhttp_connection* conn, void* ctx) {
+    static_cast<mock_dropbox*>(ctx)->handle_on_connection_close(conn);
+}
+
+void mock_dropbox::handle_on_connection_close(evhttp_connection* conn) {
+    // libevent frees the requests of the connection, their answers are void
+    std::pair<std::multimap<evhttp_connection*, delayed_reply*>::iterator,
+              std::multimap<evhttp_connection*, delayed_reply*>::iterator> range = delayed_.equal_range(conn);
+    for(std::multimap<evhttp_connection*, delayed_reply*>::iterator it = range.first; it != range.second; ++it) {
+        event_free(it->second->timer);
+        evbuffer_free(it->second->body);
+        delete it->second;
+    }
+    delayed_.erase(range.first, range.second);
+}
@@ -0,0 +1,146 @@
+#ifndef MOCK_DROPBOX_H
+#define MOCK_DROPBOX_H
+
+#include <openssl/ssl.h>
+
+#include <string>
+#include <set>
+#include <map>
+#include <vector>
+#include <random>
+#include <cstdint>
+#include <cstddef>
+
+struct event_base;
+struct evhttp;
+struct evhttp_request;
+struct evhttp_connection;
+struct evbuffer;
+struct bufferevent;
+struct ev_token_bucket_cfg;
+
+namespace Json {
+    class Value;
+}
+
+namespace tools {
+
+class mock_dropbox_options {
+public:
+    mock_dropbox_options()
+        : address("127.0.0.1")
+        , port(8443)
+        , latency_ms(0)
+        , bandwidth_kbit(0)
+        , error_percent(0)
+        , throttle_percent(0)
+        , drop_percent(0)
+        , page_size(100)
+        , preload_files(0)
+        , preload_size(1000000)
+        , seed(1) {
+    }
+public:
+    std::string address;
+    std::uint16_t port;             // 0 picks a free port
+    std::uint32_t latency_ms;       // added to every answer
+    std::uint32_t bandwidth_kbit;   // per connection and direction, 0 is unlimited
+    int error_percent;              // answered with 500
+    int throttle_percent;           // answered with 429 and Retry-After
+    int drop_percent;               // connection closed without an answer
+    std::size_t page_size;          // list_folder entries per page
+    int preload_files;              // segments in /_seccam_ at start
+    std::size_t preload_size;
+    unsigned seed;
+};
+
+// in-memory stand-in for the parts of the Dropbox v2 api the publisher
+// uses, served over TLS with a throwaway self-signed certificate. file
+// contents are counted, not kept.
+class mock_dropbox {
+public:
+    // throws std::runtime_error if it cannot listen
+    mock_dropbox(event_base* evbase, const mock_dropbox_options& options);
+    ~mock_dropbox();
+private:
+    mock_dropbox(const mock_dropbox&) = delete;
+    void operator=(const mock_dropbox&) = delete;
+public:
+    std::uint16_t port() const;
+    std::uint64_t uploads() const;
+    std::uint64_t bytes_received() const;
+    std::uint64_t requests() const;
+private:
+    static bufferevent* on_new_connection(event_base* evbase, void* ctx);
+    bufferevent* handle_on_new_connection();
+
+    static void on_request(evhttp_request* req, void* ctx);
+    void handle_on_request(evhttp_request* req);
+
+    static void on_connection_close(evhttp_connection* conn, void* ctx);
+    void handle_on_connection_close(evhttp_connection* conn);
+
+    class delayed_reply;
+    static void on_reply_timer(int, short, void* ctx);
+private:
+    void list_folder(evhttp_request* req, const Json::Value& arg);
+    void list_folder_continue(evhttp_request* req, const Json::Value& arg);
+    void create_folder(evhttp_request* req, const Json::Value& arg);
+    void upload(evhttp_request* req, const Json::Value& arg, std::size_t len);
+    void upload_session_start(evhttp_request* req, std::size_t len);
+    void upload_session_append(evhttp_request* req, const Json::Value& arg, std::size_t len);
+    void upload_session_finish(evhttp_request* req, const Json::Value& arg, std::size_t len);
+    void delete_batch(evhttp_request* req, const Json::Value& arg);
+    void delete_batch_check(evhttp_request* req, const Json::Value& arg);
+private:
+    class mock_file {
+    public:
+        std::string path;
+        std::string name;
+        std::size_t size;
+        std::string client_modified;
+        std::uint64_t rev;
+    };
+    class change {
+    public:
+        std::uint64_t seq;
+        std::string path;
+        bool deleted;
+    };
+    bool session_lookup(evhttp_request* req, const Json::Value& cursor, std::size_t** received, bool nested);
+    bool commit_file(evhttp_request* req, const std::string& path, std::size_t size);
+    void list_page(evhttp_request* req, const std::string& path, std::size_t offset);
+    void list_changes(evhttp_request* req, const std::string& path, std::uint64_t seq);
+    Json::Value file_metadata(const mock_file& file) const;
+    Json::Value folder_metadata(const std::string& path) const;
+    void record_change(const std::string& path, bool deleted);
+private:
+    void reply(evhttp_request* req, int code, const Json::Value& body);
+    void reply_raw(evhttp_request* req, int code, const std::string& body, const char* retry_after);
+    void reply_error(evhttp_request* req, int code, const std::string& summary, const Json::Value& error);
+    bool inject_failure(evhttp_request* req);
+private:
+    mock_dropbox_options options_;
+    event_base* evbase_;
+    SSL_CTX* ssl_ctx_;
+    evhttp* http_;
+    ev_token_bucket_cfg* rate_limit_;
+    std::uint16_t port_;
+    std::mt19937 random_;
+    std::set<std::string> folders_;
+    std::map<std::string, mock_file> files_;
+    std::vector<change> changes_;
+    std::uint64_t seq_;
+    std::map<std::string, std::size_t> sessions_;
+    std::map<std::string, Json::Value*> delete_jobs_;
+    std::uint64_t next_id_;
+    std::multimap<evhttp_connection*, delayed_reply*> delayed_;
+    std::uint64_t uploads_;
+    std::uint64_t bytes_received_;
+    std::uint64_t requests_;
+    bool drop_reply_;
+};
+
+}
+
+#endif // MOCK_DROPBOX_H
@@ -0,0 +1,86 @@
+#include "mock_dropbox.h"
+
+#include "logging/log.h"
+
+#include <event2/event.h>
+
+#include <iostream>
+#include <stdexcept>
+#include <csignal>
+#include <cstdlib>
+#include <getopt.h>
+
+namespace {
+
+void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--address IP] [--port PORT] [--latency-ms MS] [--bandwidth-kbit KBIT]"
+              << " [--error-percent N] [--throttle-percent N] [--drop-percent N] [--page-size N]"
+              << " [--preload N] [--preload-size BYTES] [--seed N]" << std::endl;
+}
+
+void on_sigint(evutil_socket_t, short, void* ctx) {
+    event_base_loopexit(static_cast<event_base*>(ctx), NULL);
+}
+
+}
+
+// standalone mock of the Dropbox api, point seccam at it with
+// --api-host 127.0.0.1 --content-host 127.0.0.1 --port 8443
+int main(int argc, char* argv[]) {
+
+    signal(SIGPIPE, SIG_IGN);
+
+    tools::mock_dropbox_options options;
+    static const option long_options[] = {
+        { "address", required_argument, NULL, 'a' },
+        { "port", required_argument, NULL, 'p' },
+        { "latency-ms", required_argument, NULL, 'l' },
+        { "bandwidth-kbit", required_argument, NULL, 'b' },
+        { "error-percent", required_argument, NULL, 'e' },
+        { "throttle-percent", required_argument, NULL, 't' },
+        { "drop-percent", required_argument, NULL, 'd' },
+        { "page-size", required_argument, NULL, 'g' },
+        { "preload", required_argument, NULL, 'n' },
+        { "preload-size", required_argument, NULL, 's' },
+        { "seed", required_argument, NULL, 'r' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while((opt = getopt_long(argc, argv, "a:p:l:b:e:t:d:g:n:s:r:", long_options, NULL)) != -1) {
+        switch(opt) {
+            case 'a': options.address = optarg; break;
+            case 'p': options.port = static_cast<std::uint16_t>(std::atoi(optarg)); break;
+            case 'l': options.latency_ms = std::strtoul(optarg, NULL, 10); break;
+            case 'b': options.bandwidth_kbit = std::strtoul(optarg, NULL, 10); break;
+            case 'e': options.error_percent = std::atoi(optarg); break;
+            case 't': options.throttle_percent = std::atoi(optarg); break;
+            case 'd': options.drop_percent = std::atoi(optarg); break;
+            case 'g': options.page_size = std::strtoul(optarg, NULL, 10); break;
+            case 'n': options.preload_files = std::atoi(optarg); break;
+            case 's': options.preload_size = std::strtoul(optarg, NULL, 10); break;
+            case 'r': options.seed = std::strtoul(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+
+    event_base* evbase = event_base_new();
+    int rc = 0;
+    try {
+        tools::mock_dropbox server(evbase, options);
+
+        event* sigevent = evsignal_new(evbase, SIGINT, on_sigint, evbase);
+        event_add(sigevent, NULL);
+
+        event_base_dispatch(evbase);
+
+        event_free(sigevent);
+        std::cout << "requests " << server.requests() << " uploads " << server.uploads()
+                  << " bytes " << server.bytes_received() << std::endl;
+    } catch(const std::runtime_error& err) {
+        LOG(common::log::err) << err.what() << common::log::end;
+        rc = 1;
+    }
+    event_base_free(evbase);
+
+    return rc;
+}
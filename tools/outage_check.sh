@@ -0,0 +1,53 @@
+#!/bin/sh
+# stops the mock storage while publisher_bench uploads to it. with the
+# storage back after a while, checks that the dropped connections are
+# noticed, that the requests failing meanwhile reach the publisher's
+# retries and that uploads go on. with the storage gone for good, checks
+# that the retries run out and every segment left ends up in the dead
+# letter directory. exits non-zero on the first check that fails.
+#
+#   tools/outage_check.sh build/tools/publisher_bench
+
+set -e
+
+bench=${1:?usage: $0 path/to/publisher_bench}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+run() {
+    rm -rf "$work/dead_letter"
+    timeout 120 "$bench" --segments 20 --segment-size 200000 --queue-depth 2 \
+            --outage-after 5 --dead-letter-dir "$work/dead_letter" "$@" > "$work/report" 2> "$work/log"
+}
+
+fail() {
+    echo "$1" >&2
+    cat "$work/report" >&2
+    exit 1
+}
+
+expect() {
+    # $1 in the bench's log or report $2, described by $3
+    grep -q "$1" "$work/$2" || fail "$3: not seen"
+}
+
+run --outage-ms 3000
+expect 'stopping the mock' log "outage"
+expect 'connection lost' log "dropped connection"
+expect 'reconnecting to' log "reconnect"
+# a refused connect fails its request instead of being retried by evhttp
+expect 'failed with 0' log "connect failure reported"
+expect 'retry 1 of' log "retry scheduled"
+expect 'starting the mock again' log "storage back"
+# segments that still wait for a retry when the last one is committed
+# are given up, the rest goes out after the outage
+awk '/starting the mock again/ { back = 1 } back && / sent, / { ok = 1 } END { exit !ok }' "$work/log" ||
+    fail "uploads after the outage: not seen"
+echo "outage: ok"
+
+run --retry-ms 50 --retry-max-ms 200 --retry-attempts 3
+expect 'giving up on' log "retries exhausted"
+expect '^segments 20 committed 5 failed 15 parked 15$' report "the segments after the outage parked"
+parked=$(ls "$work/dead_letter" | wc -l)
+[ "$parked" -eq 15 ] || fail "$parked segments in the dead letter directory"
+echo "storage gone: ok"
@@ -0,0 +1,514 @@
+#include "mock_dropbox.h"
+
+#include "logging/log.h"
+
+#include "common/segment.h"
+#include "common/metrics.h"
+
+#include "net/http_publisher.h"
+#include "net/dropbox_backend.h"
+#include "net/http_connection.h"
+#include "net/local_backend.h"
+#include "net/upload_shaper.h"
+#include "net/upload_workers.h"
+
+#include <event2/event.h>
+#include <event2/dns.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+#include <algorithm>
+#include <cassert>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <getopt.h>
+
+namespace {
+
+std::uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// sits between the publisher and the real backend and reports every
+// segment that reached a final state. the publisher's count of parked
+// segments tells which results it gave up on.
+class timing_backend : public net::storage_backend {
+public:
+    typedef void (*segment_done_cb)(const common::segment* seg, bool committed, void* ctx);
+public:
+    timing_backend(net::storage_backend* backend, const common::counter* parked, segment_done_cb on_done, void* ctx)
+        : backend_(backend)
+        , parked_(parked)
+        , on_done_(on_done)
+        , ctx_(ctx) {
+    }
+    ~timing_backend() {
+    }
+public:
+    void list(list_cb cb, void* ctx) {
+        backend_->list(cb, ctx);
+    }
+    void put(net::upload_session* upload, put_cb cb, void* ctx) {
+        backend_->put(upload, &timing_backend::on_put_complete, new put_context(this, upload, cb, ctx));
+    }
+    void put_streaming(net::upload_session* upload, std::size_t chunk_size, put_cb cb, void* ctx) {
+        backend_->put_streaming(upload, chunk_size, &timing_backend::on_put_complete, new put_context(this, upload, cb, ctx));
+    }
+    void remove(const std::vector<std::string>& paths, remove_cb cb, void* ctx) {
+        backend_->remove(paths, cb, ctx);
+    }
+private:
+    class put_context {
+    public:
+        put_context(timing_backend* owner, net::upload_session* upload, put_cb cb, void* ctx)
+            : owner(owner)
+            , upload(upload)
+            , cb(cb)
+            , ctx(ctx) {
+        }
+        timing_backend* owner;
+        net::upload_session* upload;
+        put_cb cb;
+        void* ctx;
+    };
+    static void on_put_complete(const net::put_result& result, void* ctx) {
+        put_context* put_ctx = static_cast<put_context*>(ctx);
+        timing_backend* owner = put_ctx->owner;
+        // the segment is gone once the publisher has seen the result, a
+        // parked one is only reported by its address
+        const common::segment* seg = put_ctx->upload->seg;
+        if(result.status == net::put_result::committed) {
+            owner->on_done_(seg, true, owner->ctx_);
+            put_ctx->cb(result, put_ctx->ctx);
+        } else {
+            const std::uint64_t parked = owner->parked_->value();
+            put_ctx->cb(result, put_ctx->ctx);
+            if(owner->parked_->value() != parked) {
+                owner->on_done_(seg, false, owner->ctx_);
+            }
+        }
+        delete put_ctx;
+    }
+private:
+    net::storage_backend* backend_;
+    const common::counter* parked_;
+    segment_done_cb on_done_;
+    void* ctx_;
+};
+
+// the mock runs on its own loop and thread so that its TLS work does not
+// count against the publisher
+class mock_thread {
+public:
+    mock_thread(const tools::mock_dropbox_options& options)
+        : options_(options)
+        , evbase_(event_base_new())
+        , server_(nullptr)
+        , stop_event_(NULL)
+        , thread_(nullptr) {
+        if(socketpair(AF_UNIX, SOCK_STREAM, 0, stop_fds_) < 0) {
+            assert(NULL == "cannot create socket pair");
+        }
+        stop_event_ = event_new(evbase_, stop_fds_[0], EV_READ, &mock_thread::on_stop, evbase_);
+        start();
+    }
+    ~mock_thread() {
+        stop();
+        event_free(stop_event_);
+        event_base_free(evbase_);
+        close(stop_fds_[0]);
+        close(stop_fds_[1]);
+    }
+private:
+    mock_thread(const mock_thread&) = delete;
+    void operator=(const mock_thread&) = delete;
+public:
+    // a stopped mock has dropped its connections and refuses new ones,
+    // it starts again on the same port and with nothing stored
+    void start() {
+        assert(nullptr == thread_);
+        server_ = new tools::mock_dropbox(evbase_, options_);
+        options_.port = server_->port();
+        event_add(stop_event_, NULL);
+        thread_ = new std::thread(&event_base_dispatch, evbase_);
+    }
+    void stop() {
+        if(nullptr == thread_) {
+            return;
+        }
+        char stop = 0;
+        if(write(stop_fds_[1], &stop, 1) != 1) {
+            assert(false);
+        }
+        thread_->join();
+        delete thread_;
+        thread_ = nullptr;
+        delete server_;
+        server_ = nullptr;
+    }
+    bool running() const {
+        return nullptr != thread_;
+    }
+    std::uint16_t port() const {
+        return options_.port;
+    }
+private:
+    static void on_stop(int fd, short, void* ctx) {
+        char stop;
+        if(read(fd, &stop, 1) != 1) {
+            assert(false);
+        }
+        event_base_loopexit(static_cast<event_base*>(ctx), NULL);
+    }
+private:
+    tools::mock_dropbox_options options_;
+    event_base* evbase_;
+    tools::mock_dropbox* server_;
+    event* stop_event_;
+    int stop_fds_[2];
+    std::thread* thread_;
+};
+
+// keeps queue_depth segments in the publisher until all are pushed,
+// the way the capture thread would if the uplink were the bottleneck
+class bench {
+public:
+    bench(event_base* evbase, int write_segment_fd, int segments, std::size_t segment_size, int queue_depth)
+        : evbase_(evbase)
+        , write_segment_fd_(write_segment_fd)
+        , segments_(segments)
+        , segment_size_(segment_size)
+        , queue_depth_(queue_depth)
+        , pushed_(0)
+        , committed_(0)
+        , failed_(0)
+        , bytes_(0)
+        , created_ms_(now_ms())
+        , start_ms_(0)
+        , end_ms_(0)
+        , mock_(nullptr)
+        , outage_after_(0)
+        , outage_ms_(0) {
+    }
+public:
+    // the publisher listed the storage, nothing was pushed otherwise
+    bool ready() const {
+        return 0 != start_ms_;
+    }
+    // stops @arg1 once @arg2 segments are committed, for @arg3 ms or for
+    // good if 0
+    void set_outage(mock_thread* mock, int after, std::uint32_t ms) {
+        mock_ = mock;
+        outage_after_ = after;
+        outage_ms_ = ms;
+    }
+public:
+    static void on_ready(void* ctx) {
+        bench* b = static_cast<bench*>(ctx);
+        b->start_ms_ = now_ms();
+        b->push();
+    }
+    static void on_error(void* ctx) {
+        LOG(common::log::err) << "storage does not answer the listing" << common::log::end;
+        event_base_loopexit(static_cast<bench*>(ctx)->evbase_, NULL);
+    }
+    static void on_last_request_sent(void* ctx) {
+        bench* b = static_cast<bench*>(ctx);
+        b->end_ms_ = now_ms();
+        event_base_loopexit(b->evbase_, NULL);
+    }
+    static void on_segment_done(const common::segment* seg, bool committed, void* ctx) {
+        static_cast<bench*>(ctx)->handle_on_segment_done(seg, committed);
+    }
+    static void on_outage_end(int, short, void* ctx) {
+        bench* b = static_cast<bench*>(ctx);
+        LOG(common::log::warning) << "starting the mock again" << common::log::end;
+        b->mock_->start();
+    }
+public:
+    // @arg2 segments were given up on and parked
+    void report(std::ostream& out, std::uint64_t parked) const {
+        if(!ready()) {
+            out << "startup n/a" << std::endl;
+            return;
+        }
+        double elapsed = std::max<std::uint64_t>(end_ms_ - start_ms_, 1) / 1000.0;
+        std::vector<std::uint64_t> latencies(latencies_);
+        std::sort(latencies.begin(), latencies.end());
+        out << std::fixed << std::setprecision(2)
+            << "startup " << start_ms_ - created_ms_ << " ms\n"
+            << "segments " << segments_ << " committed " << committed_ << " failed " << segments_ - committed_
+            << " parked " << parked << "\n"
+            << "elapsed " << elapsed << " s, " << committed_ / elapsed << " uploads/s, "
+            << bytes_ / elapsed / 1000000 << " MB/s\n"
+            << "commit latency ms p50 " << percentile(latencies, 50)
+            << " p90 " << percentile(latencies, 90)
+            << " p99 " << percentile(latencies, 99)
+            << " max " << (latencies.empty() ? 0 : latencies.back()) << std::endl;
+    }
+private:
+    static std::uint64_t percentile(const std::vector<std::uint64_t>& sorted, int p) {
+        if(sorted.empty()) {
+            return 0;
+        }
+        std::size_t index = (sorted.size() * p + 99) / 100;
+        return sorted[std::min(sorted.size(), std::max<std::size_t>(index, 1)) - 1];
+    }
+    void push() {
+        while(pushed_ < segments_ && pushed_ - committed_ - failed_ < queue_depth_) {
+            common::segment* seg = new common::segment;
+            std::vector<std::uint8_t> data(segment_size_, static_cast<std::uint8_t>(pushed_));
+            seg->insert(&data[0], data.size());
+            seg->last_segment(++pushed_ == segments_);
+            pushed_at_[seg] = now_ms();
+
+            std::uintptr_t seg_ptr = reinterpret_cast<std::uintptr_t>(seg);
+            if(write(write_segment_fd_, &seg_ptr, sizeof(seg_ptr)) != sizeof(seg_ptr)) {
+                assert(false);
+            }
+        }
+    }
+    void handle_on_segment_done(const common::segment* seg, bool committed) {
+        std::map<const common::segment*, std::uint64_t>::iterator it = pushed_at_.find(seg);
+        assert(it != pushed_at_.end());
+        if(committed) {
+            committed_++;
+            bytes_ += seg->size();
+            latencies_.push_back(now_ms() - it->second);
+            if(committed_ == outage_after_ && nullptr != mock_ && mock_->running()) {
+                start_outage();
+            }
+        } else {
+            failed_++;
+        }
+        pushed_at_.erase(it);
+        push();
+    }
+    void start_outage() {
+        LOG(common::log::warning) << "stopping the mock after " << committed_ << " segments" << common::log::end;
+        mock_->stop();
+        if(0 != outage_ms_) {
+            timeval timeout = { static_cast<time_t>(outage_ms_ / 1000), static_cast<suseconds_t>(outage_ms_ % 1000 * 1000) };
+            event_base_once(evbase_, -1, EV_TIMEOUT, &bench::on_outage_end, this, &timeout);
+        }
+    }
+private:
+    event_base* evbase_;
+    int write_segment_fd_;
+    int segments_;
+    std::size_t segment_size_;
+    int queue_depth_;
+    int pushed_;
+    int committed_;
+    int failed_;
+    std::uint64_t bytes_;
+    std::uint64_t created_ms_;
+    std::uint64_t start_ms_;
+    std::uint64_t end_ms_;
+    std::map<const common::segment*, std::uint64_t> pushed_at_;
+    std::vector<std::uint64_t> latencies_;
+    mock_thread* mock_;
+    int outage_after_;
+    std::uint32_t outage_ms_;
+};
+
+// what an upload worker needs to reach the mock
+class worker_config {
+public:
+    std::string host;
+    std::uint16_t port;
+    SSL_CTX* ssl_ctx;
+    bool ktls;
+};
+
+net::storage_backend* make_worker_backend(event_base* evbase, evdns_base* evdns, void* ctx) {
+    const worker_config* config = static_cast<const worker_config*>(ctx);
+    net::dropbox_backend* dropbox = new net::dropbox_backend(config->host, config->host, config->port, "bench", evbase, evdns, config->ssl_ctx);
+    dropbox->set_ktls(config->ktls);
+    return dropbox;
+}
+
+void usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [--segments N] [--segment-size BYTES] [--chunk-size BYTES] [--queue-depth N]"
+              << " [--local-dir DIR] [--latency-ms MS] [--bandwidth-kbit KBIT] [--error-percent N]"
+              << " [--throttle-percent N] [--drop-percent N] [--preload N] [--upload-rate KBIT]"
+              << " [--cache-file PATH] [--ktls] [--workers N] [--outage-after N] [--outage-ms MS]"
+              << " [--retry-ms MS] [--retry-max-ms MS] [--retry-attempts N] [--dead-letter-dir DIR]" << std::endl;
+}
+
+}
+
+// drives http_publisher against the mock (or a local directory) and
+// reports uploads/s, MB/s and the commit latency distribution
+int main(int argc, char* argv[]) {
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int segments = 100;
+    std::size_t segment_size = 2000000;
+    int queue_depth = 4;
+    std::string local_dir;
+    std::uint32_t upload_rate_kbit = 0;
+    std::string cache_file;
+    bool ktls = false;
+    std::size_t workers = 0;
+    int outage_after = 0;
+    std::uint32_t outage_ms = 0;
+    net::publisher_options options;
+    options.dead_letter_dir = ""; // failures are counted, not kept, unless --dead-letter-dir
+    tools::mock_dropbox_options mock_options;
+    mock_options.port = 0;
+
+    static const option long_options[] = {
+        { "segments", required_argument, NULL, 'n' },
+        { "segment-size", required_argument, NULL, 's' },
+        { "chunk-size", required_argument, NULL, 'c' },
+        { "queue-depth", required_argument, NULL, 'q' },
+        { "local-dir", required_argument, NULL, 'L' },
+        { "latency-ms", required_argument, NULL, 'l' },
+        { "bandwidth-kbit", required_argument, NULL, 'b' },
+        { "error-percent", required_argument, NULL, 'e' },
+        { "throttle-percent", required_argument, NULL, 't' },
+        { "drop-percent", required_argument, NULL, 'd' },
+        { "preload", required_argument, NULL, 'p' },
+        { "upload-rate", required_argument, NULL, 'r' },
+        { "cache-file", required_argument, NULL, 'f' },
+        { "ktls", no_argument, NULL, 'k' },
+        { "workers", required_argument, NULL, 'w' },
+        { "outage-after", required_argument, NULL, 'o' },
+        { "outage-ms", required_argument, NULL, 'O' },
+        { "retry-ms", required_argument, NULL, 'i' },
+        { "retry-max-ms", required_argument, NULL, 'm' },
+        { "retry-attempts", required_argument, NULL, 'a' },
+        { "dead-letter-dir", required_argument, NULL, 'D' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while((opt = getopt_long(argc, argv, "n:s:c:q:L:l:b:e:t:d:p:r:f:kw:o:O:i:m:a:D:", long_options, NULL)) != -1) {
+        switch(opt) {
+            case 'n': segments = std::atoi(optarg); break;
+            case 's': segment_size = std::strtoul(optarg, NULL, 10); break;
+            case 'c': options.upload_chunk_size = std::strtoul(optarg, NULL, 10); break;
+            case 'q': queue_depth = std::max(1, std::atoi(optarg)); break;
+            case 'L': local_dir = optarg; break;
+            case 'l': mock_options.latency_ms = std::strtoul(optarg, NULL, 10); break;
+            case 'b': mock_options.bandwidth_kbit = std::strtoul(optarg, NULL, 10); break;
+            case 'e': mock_options.error_percent = std::atoi(optarg); break;
+            case 't': mock_options.throttle_percent = std::atoi(optarg); break;
+            case 'd': mock_options.drop_percent = std::atoi(optarg); break;
+            case 'p': mock_options.preload_files = std::atoi(optarg); break;
+            case 'r': upload_rate_kbit = std::strtoul(optarg, NULL, 10); break;
+            case 'f': cache_file = optarg; break;
+            case 'k': ktls = true; break;
+            case 'w': workers = std::strtoul(optarg, NULL, 10); break;
+            case 'o': outage_after = std::atoi(optarg); break;
+            case 'O': outage_ms = std::strtoul(optarg, NULL, 10); break;
+            case 'i': options.retry_initial_ms = std::strtoul(optarg, NULL, 10); break;
+            case 'm': options.retry_max_ms = std::strtoul(optarg, NULL, 10); break;
+            case 'a': options.retry_max_attempts = std::atoi(optarg); break;
+            case 'D': options.dead_letter_dir = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    // the shaper belongs to one loop, workers would each need their own
+    if(segments <= 0 || segment_size == 0 || (0 != workers && (0 != upload_rate_kbit || !local_dir.empty()))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    SSL_CTX* ssl_ctx = SSL_CTX_new(SSLv23_method());
+    net::http_connection::setup_ssl_ctx(ssl_ctx);
+    event_base* evbase = event_base_new();
+    evdns_base* evdns = evdns_base_new(evbase, 0);
+
+    int queue_fds[2];
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, queue_fds) < 0) {
+        assert(NULL == "cannot create socket pair");
+    }
+    fcntl(queue_fds[0], F_SETFL, fcntl(queue_fds[0], F_GETFL, 0) | O_NONBLOCK);
+    fcntl(queue_fds[1], F_SETFL, fcntl(queue_fds[1], F_GETFL, 0) | O_NONBLOCK);
+
+    int rc = 0;
+    try {
+        mock_thread* mock = nullptr;
+        net::upload_shaper* shaper = nullptr;
+        net::storage_backend* backend = nullptr;
+        net::upload_workers* upload = nullptr;
+        worker_config config;
+        const std::string host = "127.0.0.1";
+        if(local_dir.empty()) {
+            mock = new mock_thread(mock_options);
+            net::dropbox_backend* dropbox = new net::dropbox_backend(host, host, mock->port(), "bench", evbase, evdns, ssl_ctx);
+            if(0 != upload_rate_kbit) {
+                shaper = new net::upload_shaper(evbase, upload_rate_kbit, 256, std::vector<net::shaper_window>());
+                dropbox->set_upload_rate_limit_group(shaper->group());
+            }
+            if(!cache_file.empty()) {
+                dropbox->set_cache_file(cache_file);
+            }
+            if(ktls) {
+                dropbox->set_ktls(true);
+            }
+            if(0 != workers) {
+                config.host = host;
+                config.port = mock->port();
+                config.ssl_ctx = ssl_ctx;
+                config.ktls = ktls;
+                upload = new net::upload_workers(evbase, dropbox, workers, &make_worker_backend, &config);
+                options.max_uploads = workers;
+            }
+            backend = dropbox;
+        } else {
+            backend = new net::local_backend(local_dir, evbase);
+        }
+
+        {
+            bench b(evbase, queue_fds[0], segments, segment_size, queue_depth);
+            if(nullptr != mock && 0 != outage_after) {
+                b.set_outage(mock, outage_after, outage_ms);
+            }
+            // the publisher counts what it parks into the same counter
+            common::metrics metrics;
+            const common::counter* parked = metrics.add_counter("seccam_uploads_parked_total", "Segments given up on and kept in the dead letter directory.");
+            timing_backend timing(nullptr != upload ? upload : backend, parked, &bench::on_segment_done, &b);
+            net::http_publisher publisher(evbase, &timing, queue_fds[1], options,
+                                          &bench::on_ready, &bench::on_error, &bench::on_last_request_sent, &b);
+            publisher.set_metrics(&metrics);
+
+            event_base_dispatch(evbase);
+
+            b.report(std::cout, parked->value());
+            if(!b.ready()) {
+                rc = 1;
+            }
+            // unfinished uploads complete into the publisher
+            delete upload;
+        }
+
+        delete backend;
+        delete shaper;
+        delete mock;
+    } catch(const std::runtime_error& err) {
+        LOG(common::log::err) << err.what() << common::log::end;
+        rc = 1;
+    }
+
+    close(queue_fds[0]);
+    close(queue_fds[1]);
+
+    evdns_base_free(evdns, 0);
+    event_base_free(evbase);
+    SSL_CTX_free(ssl_ctx);
+
+    return rc;
+}
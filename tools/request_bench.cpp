@@ -0,0 +1,156 @@
+#include "net/http_request.h"
+#include "net/request_template.h"
+#include "net/dropbox_json.h"
+
+#include <json/json.h>
+
+#include <event2/event.h>
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <getopt.h>
+
+namespace {
+
+// allocations made by this program and, through the hooks below, by
+// libevent. the bench is single threaded.
+unsigned long allocations = 0;
+
+void* counting_malloc(std::size_t sz) {
+    allocations++;
+    return std::malloc(sz);
+}
+
+void* counting_realloc(void* ptr, std::size_t sz) {
+    allocations++;
+    return std::realloc(ptr, sz);
+}
+
+std::uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const std::string host = "content.dropboxapi.com";
+const std::string bearer = "sl.B0zXy5f1MmE2QzU3OTItNGQ3Ni00OGYwLWI0MzctNzQ1YjQ5YzU0ZDE3";
+const std::string session_id = "AAAAAAAAAZvF3mcAAAAAAKrIPw";
+
+// how send_upload built an append_v2 request before the templates
+net::http_request* make_request(std::uint64_t offset) {
+    Json::Value arg;
+    Json::Value cursor;
+    cursor["session_id"] = session_id;
+    cursor["offset"] = Json::UInt64(offset);
+    arg["cursor"] = cursor;
+    arg["close"] = false;
+
+    Json::FastWriter writer;
+    std::string json_str = writer.write(arg);
+    json_str = json_str.substr(0, json_str.size()-1);
+
+    net::http_request* request = new net::http_request("POST", "/2/files/upload_session/append_v2");
+    request->add_header("Host", host);
+    request->add_header("Authorization", "Bearer "+bearer);
+    request->add_header("Dropbox-API-Arg", json_str);
+    request->add_header("Content-Type", "application/octet-stream");
+    return request;
+}
+
+net::request_template* append_template = NULL;
+std::string upload_arg;
+
+net::http_request* make_from_template(std::uint64_t offset) {
+    net::write_session_append_arg(&upload_arg, session_id, offset);
+    net::http_request* request = append_template->make();
+    request->add_header("Dropbox-API-Arg", upload_arg.c_str());
+    return request;
+}
+
+void run(const char* label, net::http_request* (*make)(std::uint64_t), int iterations) {
+    // one round to size the reused buffers
+    delete make(0);
+
+    unsigned long before = allocations;
+    std::uint64_t start = now_ns();
+    for(int i = 0 ; i < iterations ; i++) {
+        delete make(static_cast<std::uint64_t>(i) * 4194304);
+    }
+    std::uint64_t elapsed = now_ns() - start;
+
+    std::cout << std::left << std::setw(10) << label << std::right << std::fixed << std::setprecision(0)
+              << std::setw(8) << static_cast<double>(elapsed) / iterations << " ns/request"
+              << std::setprecision(1)
+              << std::setw(8) << static_cast<double>(allocations - before) / iterations << " allocations/request"
+              << std::endl;
+}
+
+}
+
+// every form of new and delete is replaced so that they pair up. they
+// stay out of line, inlined into a caller gcc pairs the malloc() and
+// free() inside them with the operators and warns of a mismatch.
+__attribute__((noinline)) void* operator new(std::size_t sz) {
+    void* ptr = counting_malloc(sz);
+    if(NULL == ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+__attribute__((noinline)) void* operator new[](std::size_t sz) {
+    return operator new(sz);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+__attribute__((noinline)) void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+// builds upload_session/append_v2 requests the way send_upload used to
+// and from a request template, and reports time and allocations per
+// request including those made inside libevent
+int main(int argc, char* argv[]) {
+
+    int iterations = 200000;
+
+    static const option long_options[] = {
+        { "iterations", required_argument, NULL, 'i' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while((opt = getopt_long(argc, argv, "i:", long_options, NULL)) != -1) {
+        switch(opt) {
+            case 'i': iterations = std::max(1, std::atoi(optarg)); break;
+            default: std::cerr << "usage: " << argv[0] << " [--iterations N]" << std::endl; return 1;
+        }
+    }
+
+    event_set_mem_functions(counting_malloc, counting_realloc, std::free);
+
+    append_template = new net::request_template("POST", "/2/files/upload_session/append_v2");
+    append_template->add_header("Host", host);
+    append_template->add_header("Authorization", "Bearer "+bearer);
+    append_template->add_header("Content-Type", "application/octet-stream");
+
+    run("jsoncpp", make_request, iterations);
+    run("template", make_from_template, iterations);
+
+    delete append_template;
+    return 0;
+}
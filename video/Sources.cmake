@@ -2,5 +2,7 @@ set(SOURCES
     v4l_capture.cpp
     h264_encoder.cpp
     segmenter.cpp
+    snapshot.cpp
+    dvr_recorder.cpp
     # segment.cpp
 )
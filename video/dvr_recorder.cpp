@@ -0,0 +1,246 @@
+#include "dvr_recorder.h"
+
+#include "logging/log.h"
+
+#include "common/segment.h"
+#include "common/direct_file.h"
+
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+using video::dvr_recorder;
+
+namespace {
+
+const char* const suffix = ".h264";
+const std::size_t suffix_len = 5;
+
+std::int64_t wall_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// <start_ms>-<end_ms>.h264
+bool parse_name(const std::string& name, dvr_recorder::entry* e) {
+    if(name.size() <= suffix_len || name.compare(name.size()-suffix_len, suffix_len, suffix) != 0) {
+        return false;
+    }
+    const char* p = name.c_str();
+    char* end = NULL;
+    e->start_ms = std::strtoll(p, &end, 10);
+    if(end == p || *end != '-') {
+        return false;
+    }
+    p = end + 1;
+    e->end_ms = std::strtoll(p, &end, 10);
+    if(end == p || end != name.c_str() + name.size() - suffix_len || e->end_ms < e->start_ms) {
+        return false;
+    }
+    e->name = name;
+    return true;
+}
+
+bool entry_older(const dvr_recorder::entry& lhs, const dvr_recorder::entry& rhs) {
+    return lhs.start_ms < rhs.start_ms;
+}
+
+bool starts_before(const dvr_recorder::entry& e, std::int64_t ms) {
+    return e.start_ms < ms;
+}
+
+}
+
+dvr_recorder::dvr_recorder(const std::string& dir, std::uint64_t quota_bytes, std::size_t queue_length)
+    : dir_(dir)
+    , quota_bytes_(quota_bytes)
+    , queue_(queue_length)
+    , thread_(nullptr)
+    , stop_(false)
+    , recorded_(0)
+    , dropped_(0)
+    , used_bytes_(0)
+    , expected_size_(0) {
+
+    thread_ = new std::thread(&dvr_recorder::run, this);
+}
+
+dvr_recorder::~dvr_recorder() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cond_.notify_one();
+    thread_->join();
+    delete thread_;
+}
+
+bool dvr_recorder::record(common::segment* seg) {
+    pending p;
+    p.seg = seg;
+    p.end_ms = 0 != seg->start_ms() ? seg->start_ms() + seg->duration_ms() : wall_ms();
+    seg->ref();
+    if(!queue_.push(p)) {
+        seg->unref();
+        dropped_++;
+        return false;
+    }
+    // not under the lock, a missed wakeup costs the writer one tick
+    cond_.notify_one();
+    return true;
+}
+
+void dvr_recorder::find(std::int64_t from_ms, std::int64_t to_ms, std::vector<entry>* found) const {
+    if(from_ms >= to_ms) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    std::deque<entry>::const_iterator first = std::lower_bound(index_.begin(), index_.end(), from_ms, &starts_before);
+    const std::deque<entry>::const_iterator last = std::lower_bound(first, index_.end(), to_ms, &starts_before);
+    // segments follow each other, only the one before can reach in
+    if(first != index_.begin() && (first - 1)->end_ms > from_ms) {
+        --first;
+    }
+    found->insert(found->end(), first, last);
+}
+
+const std::string& dvr_recorder::dir() const {
+    return dir_;
+}
+
+std::uint64_t dvr_recorder::recorded() const {
+    return recorded_;
+}
+
+std::uint64_t dvr_recorder::dropped() const {
+    return dropped_;
+}
+
+void dvr_recorder::run() {
+    load_index();
+    while(true) {
+        drain();
+        bool stop = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stop = stop_;
+            if(!stop) {
+                cond_.wait_for(lock, std::chrono::milliseconds(100));
+            }
+        }
+        if(stop) {
+            // whatever capture queued before it stopped
+            drain();
+            return;
+        }
+    }
+}
+
+void dvr_recorder::drain() {
+    pending p;
+    while(queue_.pop(&p)) {
+        store(p);
+        p.seg->unref();
+    }
+}
+
+void dvr_recorder::load_index() {
+    if(0 != mkdir(dir_.c_str(), 0755) && errno != EEXIST) {
+        int err = errno;
+        LOG(common::log::err) << "cannot create " << dir_ << " errno=" << std::strerror(err) << common::log::end;
+        return;
+    }
+
+    DIR* dir = opendir(dir_.c_str());
+    if(NULL == dir) {
+        int err = errno;
+        LOG(common::log::err) << "cannot open " << dir_ << " errno=" << std::strerror(err) << common::log::end;
+        return;
+    }
+
+    std::vector<entry> loaded;
+    for(dirent* de = readdir(dir); de != NULL; de = readdir(dir)) {
+        std::string name = de->d_name;
+        if(name == "." || name == "..") {
+            continue;
+        }
+        const std::string path = dir_ + "/" + name;
+        if(name[0] == '.' && name.size() > 5 && name.compare(name.size()-5, 5, ".part") == 0) {
+            // cut short by a crash or power loss
+            LOG(common::log::info) << "removing stale " << name << common::log::end;
+            unlink(path.c_str());
+            continue;
+        }
+        entry e;
+        struct stat st;
+        if(!parse_name(name, &e) || 0 != stat(path.c_str(), &st)) {
+            LOG(common::log::err) << "found unexpected entry " << name << " ignoring" << common::log::end;
+            continue;
+        }
+        e.size = st.st_size;
+        used_bytes_ += e.size;
+        expected_size_ = std::max<std::uint64_t>(expected_size_, e.size);
+        loaded.push_back(e);
+    }
+    closedir(dir);
+
+    std::sort(loaded.begin(), loaded.end(), &entry_older);
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    index_.assign(loaded.begin(), loaded.end());
+    LOG(common::log::info) << "dvr holds " << index_.size() << " segments, " << used_bytes_ / (1024*1024) << " MB" << common::log::end;
+}
+
+void dvr_recorder::store(const pending& p) {
+    const std::uint64_t size = p.seg->size();
+    if(0 == size) {
+        return;
+    }
+
+    entry e;
+    e.end_ms = p.end_ms;
+    e.start_ms = p.end_ms - p.seg->duration_ms();
+    e.name = std::to_string(e.start_ms) + "-" + std::to_string(e.end_ms) + suffix;
+
+    // the extent is reserved for the largest segment seen so far, so that
+    // the next one rarely has to grow the file
+    expected_size_ = std::max(expected_size_, size);
+    make_room(expected_size_);
+
+    const std::string part = dir_ + "/." + e.name + ".part";
+    common::direct_file file;
+    if(!file.open(part, expected_size_) || !file.write(p.seg->buffer(), size) || !file.close() ||
+       0 != rename(part.c_str(), (dir_ + "/" + e.name).c_str())) {
+        int err = errno;
+        LOG(common::log::err) << "cannot record " << e.name << " errno=" << std::strerror(err) << common::log::end;
+        unlink(part.c_str());
+        return;
+    }
+
+    e.size = file.written();
+    used_bytes_ += e.size;
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    index_.push_back(e);
+    recorded_++;
+}
+
+void dvr_recorder::make_room(std::uint64_t size) {
+    while(!index_.empty() && used_bytes_ + size > quota_bytes_) {
+        const entry& oldest = index_.front();
+        const std::string path = dir_ + "/" + oldest.name;
+        if(0 != unlink(path.c_str()) && errno != ENOENT) {
+            int err = errno;
+            LOG(common::log::err) << "cannot delete " << oldest.name << " errno=" << std::strerror(err) << common::log::end;
+            return;
+        }
+        used_bytes_ -= std::min(used_bytes_, oldest.size);
+        std::lock_guard<std::mutex> lock(index_mutex_);
+        index_.pop_front();
+    }
+}
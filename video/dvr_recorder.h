@@ -0,0 +1,84 @@
+#ifndef DVR_RECORDER_H
+#define DVR_RECORDER_H
+
+#include "common/spsc_queue.h"
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace common {
+    class segment;
+}
+
+namespace video {
+
+// keeps every segment on a local disk, whatever happens to the upload.
+// the capture thread only queues a reference, a writer thread stores the
+// segments with O_DIRECT into files named after their capture time and
+// removes the oldest ones once the directory would grow over its quota.
+class dvr_recorder {
+public:
+    class entry {
+    public:
+        std::int64_t start_ms;  // wall clock of the first and last frame
+        std::int64_t end_ms;
+        std::uint64_t size;
+        std::string name;
+    };
+public:
+    dvr_recorder(const std::string& dir, std::uint64_t quota_bytes, std::size_t queue_length = 16);
+    ~dvr_recorder();
+private:
+    dvr_recorder(const dvr_recorder&) = delete;
+    void operator=(const dvr_recorder&) = delete;
+public:
+    // capture thread, never waits for the disk. while the writer is
+    // @arg3 segments behind new ones are dropped and false is returned.
+    bool record(common::segment* seg);
+    // any thread. recorded segments whose capture overlaps
+    // [@arg1, @arg2) in ms since the epoch, oldest first.
+    void find(std::int64_t from_ms, std::int64_t to_ms, std::vector<entry>* found) const;
+    const std::string& dir() const;
+public:
+    std::uint64_t recorded() const;
+    std::uint64_t dropped() const;
+private:
+    class pending {
+    public:
+        common::segment* seg;
+        std::int64_t end_ms;
+    };
+private:
+    // writer thread
+    void run();
+    void drain();
+    void load_index();
+    void store(const pending& p);
+    void make_room(std::uint64_t size);
+private:
+    std::string dir_;
+    std::uint64_t quota_bytes_;
+    common::spsc_queue<pending> queue_;
+    std::thread* thread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool stop_;
+    std::atomic<std::uint64_t> recorded_;
+    std::atomic<std::uint64_t> dropped_;
+    // written by the writer thread only, oldest first
+    mutable std::mutex index_mutex_;
+    std::deque<entry> index_;
+    std::uint64_t used_bytes_;
+    std::uint64_t expected_size_;
+};
+
+}
+
+#endif // DVR_RECORDER_H
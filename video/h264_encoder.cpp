@@ -4,12 +4,17 @@
 
 #include "segmenter.h"
 
+#include "common/metrics.h"
+#include "common/trace.h"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libswscale/swscale.h>
 #include <libavutil/imgutils.h>
 }
 
+#include <algorithm>
+#include <chrono>
 #include <cassert>
 #include <iostream>
 
@@ -28,35 +33,56 @@ h264_encoder::h264_encoder()
     , initialized_(false)
 	, segmenter_(NULL)
     , end_segment_pending_(false)
-    , previous_segment_end_(0) {
+    , previous_segment_end_(0)
+    , segment_length_sec_(0)
+    , dst_width_(0)
+    , dst_height_(0)
+    , frame_count_(0)
+    , control_(NULL)
+    , frames_skipped_(NULL)
+    , convert_time_(NULL)
+    , encode_time_(NULL)
+    , trace_(NULL) {
 
     codec_ = avcodec_find_encoder(AV_CODEC_ID_H264);
     assert(NULL != codec_);
-    codec_ctx_ = avcodec_alloc_context3(codec_);
-    assert(NULL != codec_ctx_);
     packet_ = av_packet_alloc();
     assert(NULL != packet_);
 }
 
 h264_encoder::~h264_encoder() {
     if(initialized_) {
-        av_free(scaled_frame_buf_);
-        av_frame_free(&scaled_frame_);
-        sws_freeContext(img_convert_ctx_);
-        avcodec_close(codec_ctx_);
+        close_codec();
     }
     av_packet_free(&packet_);
-    avcodec_free_context(&codec_ctx_);
 }
 
 void h264_encoder::on_frame(AVFrame* frame) {
     assert(true == initialized_);
     assert(src_width_ == frame->width && src_height_ == frame->height);
 
+    if(0 != frame_count_++ % target_.fps_divisor) {
+        if(NULL != frames_skipped_) {
+            frames_skipped_->add();
+        }
+        return;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     int ret = sws_scale(img_convert_ctx_, frame->data, frame->linesize, 0, src_height_, 
                         scaled_frame_->data, scaled_frame_->linesize
                         );
     assert(0 < ret);
+    if(NULL != convert_time_ || NULL != trace_) {
+        const std::chrono::steady_clock::time_point converted = std::chrono::steady_clock::now();
+        if(NULL != convert_time_) {
+            convert_time_->record_since(start);
+        }
+        if(NULL != trace_) {
+            trace_->complete("convert", common::trace::micros(start), common::trace::micros(converted), frame->pts);
+        }
+        start = converted;
+    }
     scaled_frame_->pts = frame->pts;
     ret = avcodec_send_frame(codec_ctx_, scaled_frame_);
     assert(0 == ret);
@@ -64,21 +90,18 @@ void h264_encoder::on_frame(AVFrame* frame) {
         ret = avcodec_receive_packet(codec_ctx_, packet_);
         if(0 == ret) {
             if((packet_->flags & AV_PKT_FLAG_KEY) && end_segment_pending_) {
-                LOG(common::log::info) << "key packet encoded and end_segment_pending" << common::log::end;
+                LOG(common::log::debug) << "key packet encoded and end_segment_pending" << common::log::end;
                 if(previous_segment_end_ != 0) {
                     std::time_t current_segment_end = std::time(nullptr);
                     std::time_t diff = std::difftime(current_segment_end, previous_segment_end_);
                     previous_segment_end_ = current_segment_end;
-                    LOG(common::log::info) << "current segment length: " << diff << common::log::end;
+                    LOG(common::log::debug) << "current segment length: " << diff << common::log::end;
                 } else {
                     previous_segment_end_ = std::time(nullptr);
                 }
                 segmenter_->on_segment_end();
                 end_segment_pending_ = false;
-                AVPacket pkt;
-                pkt.data = codec_ctx_->extradata;
-                pkt.size = codec_ctx_->extradata_size;
-                segmenter_->on_packet(&pkt);
+                write_extradata();
             }
             segmenter_->on_packet(packet_);
             av_packet_unref(packet_);
@@ -86,34 +109,42 @@ void h264_encoder::on_frame(AVFrame* frame) {
             break;
         }
     }
+    // with the copies into the segment, which are small next to x264
+    if(NULL != encode_time_) {
+        encode_time_->record_since(start);
+    }
+    if(NULL != trace_) {
+        trace_->complete("encode", common::trace::micros(start), common::trace::now(), frame->pts);
+    }
 }
 
 void h264_encoder::on_segment_end() {
     assert(true == initialized_);
-    end_segment_pending_ = true;
-    // int ret = avcodec_send_frame(codec_ctx_, NULL);
-    // assert(0 <= ret);
-    // while(true) {
-    //     ret = avcodec_receive_packet(codec_ctx_, packet_);
-    //     if(AVERROR_EOF == ret) {
-    //         break;
-    //     }
-    //     else if (ret < 0) { 
-    //         assert(false); // TODO: handle error 
-    //         break;
-    //     }
-    //     segmenter_->on_packet(packet_);
-    //     av_packet_unref(packet_);
-    // }
-    // segmenter_->on_segment_end();
-    // avcodec_flush_buffers(codec_ctx_);
-    // avcodec_close(codec_ctx_);
-    // ret = avcodec_open2(codec_ctx_, codec_, NULL);
-    // assert(0 == ret);
+    if(NULL == control_ || control_->get() == target_) {
+        end_segment_pending_ = true;
+        return;
+    }
+    // a new target needs a new encoder. it starts on a key frame, so the
+    // segment is cut here instead of at the next key frame.
+    flush();
+    segmenter_->on_segment_end();
+    end_segment_pending_ = false;
+    close_codec();
+    target_ = control_->get();
+    open_codec();
+    write_extradata();
+    LOG(common::log::info) << "encoder reconfigured " << dst_width_ << "x" << dst_height_
+                           << " fps/" << static_cast<int>(target_.fps_divisor)
+                           << " bitrate=" << target_.bitrate_kbit << common::log::end;
 }
 
 void h264_encoder::on_eof() {
     assert(true == initialized_);
+    flush();
+    segmenter_->on_eof();
+}
+
+void h264_encoder::flush() {
     int ret = avcodec_send_frame(codec_ctx_, NULL);
     assert(0 <= ret);
     while(true) {
@@ -122,7 +153,6 @@ void h264_encoder::on_eof() {
         segmenter_->on_packet(packet_);
         av_packet_unref(packet_);
     }
-    segmenter_->on_eof();
 }
 
 void h264_encoder::initialize(uint32_t width, 
@@ -140,18 +170,38 @@ void h264_encoder::initialize(uint32_t width,
     assert(NULL != codec_->pix_fmts);
     dst_pixfmt_ = AV_PIX_FMT_YUV420P;
     assert(AV_PIX_FMT_NONE != dst_pixfmt_);
+    src_fps_ = *fps;
+    segment_length_sec_ = segment_length_sec;
+
+    open_codec();
+    initialized_ = true;
+}
+
+void h264_encoder::open_codec() {
+    // yuv420p wants even dimensions
+    dst_width_ = (src_width_/target_.scale_divisor) & ~1u;
+    dst_height_ = (src_height_/target_.scale_divisor) & ~1u;
+    AVRational fps = src_fps_;
+    fps.den *= target_.fps_divisor;
 
-    codec_ctx_->width = src_width_;
-    codec_ctx_->height = src_height_;
-    codec_ctx_->time_base.den = fps->num;
-    codec_ctx_->time_base.num = fps->den;
-    codec_ctx_->framerate = *fps;
+    codec_ctx_ = avcodec_alloc_context3(codec_);
+    assert(NULL != codec_ctx_);
+    codec_ctx_->width = dst_width_;
+    codec_ctx_->height = dst_height_;
+    codec_ctx_->time_base.den = fps.num;
+    codec_ctx_->time_base.num = fps.den;
+    codec_ctx_->framerate = fps;
     codec_ctx_->pix_fmt = dst_pixfmt_;
     codec_ctx_->profile = FF_PROFILE_H264_BASELINE;
     codec_ctx_->qmin = 30;
     codec_ctx_->qmax = 70;
-    codec_ctx_->gop_size = ((fps->num*segment_length_sec)/fps->den)/3;
+    codec_ctx_->gop_size = std::max(((fps.num*segment_length_sec_)/fps.den)/3, 1);
     codec_ctx_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+    if(0 != target_.bitrate_kbit) {
+        codec_ctx_->bit_rate = static_cast<int64_t>(target_.bitrate_kbit)*1000;
+        codec_ctx_->rc_max_rate = codec_ctx_->bit_rate;
+        codec_ctx_->rc_buffer_size = static_cast<int>(codec_ctx_->bit_rate);
+    }
 
     int ret = avcodec_open2(codec_ctx_, codec_, NULL);
     assert(0 == ret);
@@ -159,17 +209,17 @@ void h264_encoder::initialize(uint32_t width,
     // fwrite(codec_ctx_->extradata, 1, codec_ctx_->extradata_size, output_);
 
     img_convert_ctx_ = sws_getContext(src_width_, src_height_, src_pixfmt_, 
-                                      src_width_, src_height_, dst_pixfmt_, 
+                                      dst_width_, dst_height_, dst_pixfmt_, 
                                       0, NULL, NULL, NULL
                                       );
 
-    scaled_frame_buf_ = (uint8_t*)av_malloc(av_image_get_buffer_size(dst_pixfmt_, width, height, 1));
+    scaled_frame_buf_ = (uint8_t*)av_malloc(av_image_get_buffer_size(dst_pixfmt_, dst_width_, dst_height_, 1));
     assert(NULL != scaled_frame_buf_);
     scaled_frame_ = av_frame_alloc();
-    scaled_frame_->width = width;
-    scaled_frame_->height = height;
-    scaled_frame_->format = codec_ctx_->pix_fmt;
     assert(NULL != scaled_frame_);
+    scaled_frame_->width = dst_width_;
+    scaled_frame_->height = dst_height_;
+    scaled_frame_->format = codec_ctx_->pix_fmt;
     ret = av_image_fill_arrays(scaled_frame_->data, 
                                scaled_frame_->linesize, 
                                scaled_frame_buf_, 
@@ -180,7 +230,16 @@ void h264_encoder::initialize(uint32_t width,
                                );
 
     assert(0 < ret);
-    initialized_ = true;
+}
+
+void h264_encoder::close_codec() {
+    av_free(scaled_frame_buf_);
+    scaled_frame_buf_ = NULL;
+    av_frame_free(&scaled_frame_);
+    sws_freeContext(img_convert_ctx_);
+    img_convert_ctx_ = NULL;
+    avcodec_close(codec_ctx_);
+    avcodec_free_context(&codec_ctx_);
 }
 
 void h264_encoder::attach_sink(segmenter* seg) {
@@ -188,6 +247,24 @@ void h264_encoder::attach_sink(segmenter* seg) {
 	assert(NULL != seg);
     assert(true == initialized_);
     segmenter_ = seg;
+    write_extradata();
+}
+
+void h264_encoder::set_control(const common::encoder_control* control) {
+    control_ = control;
+}
+
+void h264_encoder::set_metrics(common::metrics* metrics) {
+    frames_skipped_ = metrics->add_counter("seccam_frames_skipped_total", "Frames left out to meet the target frame rate.");
+    convert_time_ = metrics->add_histogram("seccam_convert_seconds", "Time to scale and convert one frame for the encoder.", 1e-6);
+    encode_time_ = metrics->add_histogram("seccam_encode_seconds", "Time to encode one frame.", 1e-6);
+}
+
+void h264_encoder::set_trace(common::trace* trace) {
+    trace_ = trace;
+}
+
+void h264_encoder::write_extradata() {
     AVPacket pkt;
     pkt.data = codec_ctx_->extradata;
     pkt.size = codec_ctx_->extradata_size;
@@ -3,8 +3,11 @@
 
 extern "C" {
 #include <libavutil/pixfmt.h>
+#include <libavutil/rational.h>
 }
 
+#include "common/encoder_control.h"
+
 #include <cstdint>
 #include <ctime>
 
@@ -15,6 +18,13 @@ struct AVRational;
 struct AVPacket;
 struct SwsContext;
 
+namespace common {
+    class metrics;
+    class counter;
+    class histogram;
+    class trace;
+}
+
 namespace video {
 
 class segmenter;
@@ -41,6 +51,18 @@ public:
                     );
 public:
 	void attach_sink(segmenter* seg);
+    // targets are picked up at the next segment boundary
+    void set_control(const common::encoder_control* control);
+    // frames skipped for the target frame rate, time to convert and
+    // encode one
+    void set_metrics(common::metrics* metrics);
+    // spans for converting and encoding each frame
+    void set_trace(common::trace* trace);
+private:
+    void open_codec();
+    void close_codec();
+    void flush();
+    void write_extradata();
 private:
     AVCodec* codec_;
     AVCodecContext* codec_ctx_;
@@ -56,6 +78,17 @@ private:
 	segmenter* segmenter_;
     bool end_segment_pending_;
     std::time_t previous_segment_end_;
+    AVRational src_fps_;
+    int segment_length_sec_;
+    uint32_t dst_width_;
+    uint32_t dst_height_;
+    uint64_t frame_count_;
+    const common::encoder_control* control_;
+    common::encoder_target target_;
+    common::counter* frames_skipped_;
+    common::histogram* convert_time_;
+    common::histogram* encode_time_;
+    common::trace* trace_;
 };
 
 }
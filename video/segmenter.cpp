@@ -1,6 +1,8 @@
 #include "segmenter.h"
 
 #include "common/segment.h"
+#include "common/metrics.h"
+#include "common/trace.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -10,32 +12,130 @@ extern "C" {
 
 using video::segmenter;
 
+namespace {
+
+std::int64_t wall_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+std::uint32_t elapsed_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count());
+}
+
+}
+
 segmenter::segmenter(on_segment_ready_cb handle_on_segment_ready, on_eof_cb handle_on_eof, void* ctx)
     : cseg_(new common::segment)
+    , cpart_(NULL)
+    , part_ms_(0)
     , handle_on_segment_ready_(handle_on_segment_ready)
+    , handle_on_part_ready_(NULL)
     , handle_on_eof_(handle_on_eof)
-    , ctx_(ctx) {
+    , ctx_(ctx)
+    , segment_bytes_(NULL)
+    , trace_(NULL) {
 
 }
 
 segmenter::~segmenter() {
     delete cseg_;
+    delete cpart_;
+}
+
+void segmenter::enable_parts(std::uint32_t part_ms, on_part_ready_cb handle_on_part_ready) {
+    assert(0 != part_ms);
+    part_ms_ = part_ms;
+    handle_on_part_ready_ = handle_on_part_ready;
+}
+
+void segmenter::set_metrics(common::metrics* metrics) {
+    segment_bytes_ = metrics->add_histogram("seccam_segment_bytes", "Size of the segments cut.");
+}
+
+void segmenter::set_trace(common::trace* trace) {
+    trace_ = trace;
 }
 
 void segmenter::on_packet(AVPacket* packet) {
     assert(NULL != cseg_);
+    clock::time_point now = clock::now();
+    if(0 == cseg_->size()) {
+        segment_start_ = now;
+        // names the segment in the archives, durations stay on the
+        // steady clock
+        cseg_->start_ms(wall_ms());
+        if(NULL != trace_) {
+            trace_->begin("capture", cseg_->start_ms(), common::trace::micros(now));
+        }
+    }
     cseg_->insert(packet->data, packet->size);
+
+    if(0 == part_ms_) {
+        return;
+    }
+    // a part is cut before the packet that would make it too long, so
+    // that a part never splits a frame
+    if(NULL != cpart_ && elapsed_ms(part_start_, now) >= part_ms_) {
+        end_part(false, now);
+    }
+    if(NULL == cpart_) {
+        cpart_ = new common::segment;
+        cpart_->start_ms(wall_ms());
+        part_start_ = now;
+    }
+    cpart_->insert(packet->data, packet->size);
+}
+
+void segmenter::end_part(bool ends_segment, clock::time_point now) {
+    if(NULL == cpart_) {
+        return;
+    }
+    cpart_->duration_ms(elapsed_ms(part_start_, now));
+    cpart_->last_segment(cseg_->last_segment());
+    handle_on_part_ready_(cpart_, ends_segment, ctx_); // transfer ownership
+    cpart_ = NULL;
 }
 
 void segmenter::on_segment_end() {
     assert(NULL != cseg_);
+    clock::time_point now = clock::now();
+    if(0 != cseg_->size()) {
+        cseg_->duration_ms(elapsed_ms(segment_start_, now));
+    }
+    if(0 != part_ms_) {
+        end_part(true, now);
+    }
+    if(NULL != segment_bytes_) {
+        segment_bytes_->record(cseg_->size());
+    }
+    if(NULL != trace_ && 0 != cseg_->size()) {
+        trace_->end("capture", cseg_->start_ms(), common::trace::micros(now));
+        trace_->begin("handoff", cseg_->start_ms(), common::trace::micros(now));
+    }
     handle_on_segment_ready_(cseg_, ctx_); // transfer ownership
     cseg_ = new common::segment;
 }
 
 void segmenter::on_eof() {
+    clock::time_point now = clock::now();
     cseg_->last_segment(true);
+    if(0 != cseg_->size()) {
+        cseg_->duration_ms(elapsed_ms(segment_start_, now));
+    }
+    if(0 != part_ms_) {
+        if(NULL == cpart_) {
+            // the end still has to reach the viewers
+            cpart_ = new common::segment;
+            part_start_ = now;
+        }
+        end_part(true, now);
+    }
+    if(NULL != trace_ && 0 != cseg_->size()) {
+        trace_->end("capture", cseg_->start_ms(), common::trace::micros(now));
+        trace_->begin("handoff", cseg_->start_ms(), common::trace::micros(now));
+    }
     handle_on_segment_ready_(cseg_, ctx_); // transfer ownership
     handle_on_eof_(ctx_);
     cseg_ = 0;
-}
\ No newline at end of file
+}
@@ -2,11 +2,16 @@
 #define SEGMENTER_H
 
 #include <list>
+#include <chrono>
+#include <cstdint>
 
 struct AVPacket;
 
 namespace common {
     class segment;
+    class metrics;
+    class histogram;
+    class trace;
 }
 
 namespace video {
@@ -14,6 +19,7 @@ namespace video {
 class segmenter {
 public:
     typedef void (*on_segment_ready_cb)(common::segment*, void*);
+    typedef void (*on_part_ready_cb)(common::segment*, bool ends_segment, void*);
     typedef void (*on_eof_cb)(void*);
 public:
     segmenter(on_segment_ready_cb handle_on_segment_ready, on_eof_cb handle_on_eof, void* ctx);
@@ -21,17 +27,35 @@ public:
 private:
     segmenter(const segmenter&);
     void operator=(const segmenter&);
+public:
+    // also cuts what is written into parts of about @arg1, each handed
+    // over as soon as it is cut. a segment starts with a new part.
+    void enable_parts(std::uint32_t part_ms, on_part_ready_cb handle_on_part_ready);
+    // sizes of the segments cut
+    void set_metrics(common::metrics* metrics);
+    // opens the trace of each segment, it is named by its start_ms
+    void set_trace(common::trace* trace);
 public:
     void on_packet(AVPacket*);
     void on_segment_end();
     void on_eof();
+private:
+    typedef std::chrono::steady_clock clock;
+    void end_part(bool ends_segment, clock::time_point now);
 private:
     common::segment* cseg_;
+    clock::time_point segment_start_;
+    common::segment* cpart_;
+    clock::time_point part_start_;
+    std::uint32_t part_ms_;
     on_segment_ready_cb handle_on_segment_ready_;
+    on_part_ready_cb handle_on_part_ready_;
     on_eof_cb handle_on_eof_;
     void* ctx_;
+    common::histogram* segment_bytes_;
+    common::trace* trace_;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,170 @@
+#include "snapshot.h"
+
+#include "logging/log.h"
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+}
+
+#include <chrono>
+#include <cassert>
+
+using video::snapshot;
+
+namespace {
+
+// mjpeg qscale, 2 is best and 31 worst
+const int jpeg_qscale = 4;
+
+std::uint64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+snapshot::snapshot()
+    : latest_(NULL)
+    , frame_seq_(0)
+    , frame_ms_(0)
+    , frame_interval_ms_(0)
+    , codec_(NULL)
+    , codec_ctx_(NULL)
+    , img_convert_ctx_(NULL)
+    , scaled_frame_(NULL)
+    , packet_(NULL)
+    , src_pixfmt_(AV_PIX_FMT_NONE)
+    , jpeg_seq_(0)
+    , jpeg_ms_(0)
+    , encodes_(0) {
+
+    codec_ = avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    assert(NULL != codec_);
+    packet_ = av_packet_alloc();
+    assert(NULL != packet_);
+}
+
+snapshot::~snapshot() {
+    AVFrame* frame = latest_.exchange(NULL);
+    av_frame_free(&frame);
+    close_codec();
+    av_packet_free(&packet_);
+}
+
+void snapshot::on_frame(const AVFrame* frame) {
+    AVFrame* ref = av_frame_alloc();
+    if(NULL == ref || 0 != av_frame_ref(ref, frame)) {
+        av_frame_free(&ref);
+        return;
+    }
+    const std::uint64_t now = now_ms();
+    const std::uint64_t prev = frame_ms_.exchange(now);
+    if(0 != prev) {
+        frame_interval_ms_.store(static_cast<std::uint32_t>(now - prev));
+    }
+    // the caller may hold the previous one, then it is NULL here and the
+    // caller drops it when it sees this one
+    AVFrame* old = latest_.exchange(ref);
+    frame_seq_.fetch_add(1, std::memory_order_release);
+    av_frame_free(&old);
+}
+
+bool snapshot::on_request(const std::uint8_t** data, std::size_t* size, void* ctx) {
+    return static_cast<snapshot*>(ctx)->jpeg(data, size);
+}
+
+bool snapshot::jpeg(const std::uint8_t** data, std::size_t* size) {
+    const std::uint64_t seq = frame_seq_.load(std::memory_order_acquire);
+    const std::uint64_t now = now_ms();
+    const bool cached = jpeg_seq_ == seq || (!jpeg_.empty() && now - jpeg_ms_ < frame_interval_ms_.load());
+    if(!cached) {
+        AVFrame* frame = latest_.exchange(NULL);
+        if(NULL != frame) {
+            if(encode(frame)) {
+                jpeg_seq_ = seq;
+                jpeg_ms_ = now;
+            }
+            // give it back unless the capture has moved on meanwhile
+            AVFrame* expected = NULL;
+            if(!latest_.compare_exchange_strong(expected, frame)) {
+                av_frame_free(&frame);
+            }
+        }
+    }
+    if(jpeg_.empty()) {
+        return false;
+    }
+    *data = &jpeg_[0];
+    *size = jpeg_.size();
+    return true;
+}
+
+std::uint64_t snapshot::encodes() const {
+    return encodes_;
+}
+
+bool snapshot::encode(AVFrame* frame) {
+    if(NULL == codec_ctx_ || codec_ctx_->width != frame->width || codec_ctx_->height != frame->height ||
+       src_pixfmt_ != static_cast<AVPixelFormat>(frame->format)) {
+        close_codec();
+        if(!open_codec(frame->width, frame->height, static_cast<AVPixelFormat>(frame->format))) {
+            LOG(common::log::err) << "cannot open jpeg encoder for " << frame->width << "x" << frame->height << common::log::end;
+            return false;
+        }
+    }
+
+    sws_scale(img_convert_ctx_, frame->data, frame->linesize, 0, frame->height,
+              scaled_frame_->data, scaled_frame_->linesize
+              );
+    scaled_frame_->pts = static_cast<std::int64_t>(encodes_);
+    scaled_frame_->quality = codec_ctx_->global_quality;
+
+    if(0 != avcodec_send_frame(codec_ctx_, scaled_frame_) || 0 != avcodec_receive_packet(codec_ctx_, packet_)) {
+        return false;
+    }
+    jpeg_.assign(packet_->data, packet_->data + packet_->size);
+    av_packet_unref(packet_);
+    encodes_++;
+    return true;
+}
+
+bool snapshot::open_codec(int width, int height, AVPixelFormat src_pixfmt) {
+    codec_ctx_ = avcodec_alloc_context3(codec_);
+    assert(NULL != codec_ctx_);
+    codec_ctx_->width = width;
+    codec_ctx_->height = height;
+    codec_ctx_->pix_fmt = AV_PIX_FMT_YUVJ420P;
+    codec_ctx_->time_base.num = 1;
+    codec_ctx_->time_base.den = 25;
+    codec_ctx_->flags |= AV_CODEC_FLAG_QSCALE;
+    codec_ctx_->global_quality = FF_QP2LAMBDA * jpeg_qscale;
+    if(0 != avcodec_open2(codec_ctx_, codec_, NULL)) {
+        avcodec_free_context(&codec_ctx_);
+        return false;
+    }
+
+    img_convert_ctx_ = sws_getContext(width, height, src_pixfmt,
+                                      width, height, codec_ctx_->pix_fmt,
+                                      SWS_BILINEAR, NULL, NULL, NULL
+                                      );
+    scaled_frame_ = av_frame_alloc();
+    assert(NULL != scaled_frame_);
+    scaled_frame_->width = width;
+    scaled_frame_->height = height;
+    scaled_frame_->format = codec_ctx_->pix_fmt;
+    if(NULL == img_convert_ctx_ || 0 != av_frame_get_buffer(scaled_frame_, 32)) {
+        close_codec();
+        return false;
+    }
+    src_pixfmt_ = src_pixfmt;
+    return true;
+}
+
+void snapshot::close_codec() {
+    av_frame_free(&scaled_frame_);
+    sws_freeContext(img_convert_ctx_);
+    img_convert_ctx_ = NULL;
+    avcodec_free_context(&codec_ctx_);
+    src_pixfmt_ = AV_PIX_FMT_NONE;
+}
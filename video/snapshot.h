@@ -0,0 +1,67 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+extern "C" {
+#include <libavutil/pixfmt.h>
+}
+
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+struct AVFrame;
+struct AVCodec;
+struct AVCodecContext;
+struct AVPacket;
+struct SwsContext;
+
+namespace video {
+
+// keeps a reference to the newest captured frame and turns it into a
+// JPEG when someone asks for one. the capture thread only swaps a
+// pointer, encoding happens on the caller's thread, at most once per
+// frame and frame interval, and callers in between get the cached image.
+class snapshot {
+public:
+    snapshot();
+    ~snapshot();
+private:
+    snapshot(const snapshot&) = delete;
+    void operator=(const snapshot&) = delete;
+public:
+    // capture thread, the frame is referenced, not copied
+    void on_frame(const AVFrame* frame);
+public:
+    // one caller thread. @arg1 and @arg2 stay valid until the next call.
+    bool jpeg(const std::uint8_t** data, std::size_t* size);
+    // for net::live_server::set_snapshot_source
+    static bool on_request(const std::uint8_t** data, std::size_t* size, void* ctx);
+public:
+    std::uint64_t encodes() const;
+private:
+    bool encode(AVFrame* frame);
+    bool open_codec(int width, int height, AVPixelFormat src_pixfmt);
+    void close_codec();
+private:
+    // newest frame, NULL while the caller is encoding it
+    std::atomic<AVFrame*> latest_;
+    std::atomic<std::uint64_t> frame_seq_;
+    std::atomic<std::uint64_t> frame_ms_;
+    std::atomic<std::uint32_t> frame_interval_ms_;
+    // caller side
+    AVCodec* codec_;
+    AVCodecContext* codec_ctx_;
+    SwsContext* img_convert_ctx_;
+    AVFrame* scaled_frame_;
+    AVPacket* packet_;
+    AVPixelFormat src_pixfmt_;
+    std::vector<std::uint8_t> jpeg_;
+    std::uint64_t jpeg_seq_;
+    std::uint64_t jpeg_ms_;
+    std::uint64_t encodes_;
+};
+
+}
+
+#endif // SNAPSHOT_H
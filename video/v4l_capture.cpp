@@ -3,6 +3,10 @@
 #include "logging/log.h"
 
 #include "h264_encoder.h"
+#include "snapshot.h"
+
+#include "common/metrics.h"
+#include "common/trace.h"
 
 extern "C" {
 // #include <libavutil/imgutils.h>
@@ -14,30 +18,64 @@ extern "C" {
 
 #include <cassert>
 #include <iostream>
+#include <fstream>
+#include <chrono>
 
 using video::v4l_capture;
 
-v4l_capture::v4l_capture(long segment_length_sec)   
+namespace {
+
+const char* const device = "/dev/video0";
+const char* const probe_magic = "seccam-probe 1";
+
+}
+
+v4l_capture::v4l_capture(long segment_length_sec, const std::string& probe_cache_dir)   
     : format_context_(NULL)
     , codec_(NULL)
     , codec_ctx_(NULL)
     , frame_(NULL)
     , encoder_(0)
+    , snapshot_(NULL)
     , v4l_stream_(NULL)
     , prev_ts_(-1)
+    , prev_pts_(AV_NOPTS_VALUE)
+    , frames_captured_(NULL)
+    , frames_dropped_(NULL)
+    , decode_time_(NULL)
+    , trace_(NULL)
     , segment_length_sec_(segment_length_sec) {
 
+    if(!probe_cache_dir.empty()) {
+        std::string name(device);
+        probe_cache_path_ = probe_cache_dir + "/" + name.substr(name.rfind('/')+1) + ".probe";
+    }
+
     AVInputFormat *input_format = av_find_input_format("v4l2");
     assert(NULL != input_format);
     AVDictionary *options = NULL;
     av_dict_set(&options, "framerate", "2/15", 0);
 
-    avformat_open_input(&format_context_, "/dev/video0", input_format, &options);
+    avformat_open_input(&format_context_, device, input_format, &options);
     assert(NULL != format_context_);
     av_dict_free(&options);
     
-    int ret = avformat_find_stream_info(format_context_, NULL);
-    assert(0 <= ret);
+    int ret = 0;
+    if(1 == format_context_->nb_streams && load_probe(format_context_->streams[0])) {
+        LOG(common::log::info) << "stream parameters from " << probe_cache_path_ << common::log::end;
+    } else {
+        // reads and decodes frames until the parameters are known, at the
+        // low capture frame rate this takes seconds
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        ret = avformat_find_stream_info(format_context_, NULL);
+        assert(0 <= ret);
+        LOG(common::log::info) << "stream probed in "
+                               << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                               << "ms" << common::log::end;
+        if(1 == format_context_->nb_streams) {
+            save_probe(format_context_->streams[0]);
+        }
+    }
     ret = av_find_best_stream(format_context_, AVMEDIA_TYPE_VIDEO, -1, -1, &codec_, 0);
     assert(0 <= ret);
     assert(NULL != codec_);
@@ -84,13 +122,86 @@ void v4l_capture::attach_sink(h264_encoder* enc) {
                          segment_length_sec_);
 }
 
+void v4l_capture::attach_snapshot(snapshot* snap) {
+    assert(NULL == snapshot_);
+    snapshot_ = snap;
+}
+
+void v4l_capture::set_metrics(common::metrics* metrics) {
+    frames_captured_ = metrics->add_counter("seccam_frames_captured_total", "Frames dequeued from the camera and decoded.");
+    frames_dropped_ = metrics->add_counter("seccam_frames_dropped_total", "Frames missing between captured ones, going by their timestamps.");
+    decode_time_ = metrics->add_histogram("seccam_decode_seconds", "Time to dequeue and decode one frame.", 1e-6);
+}
+
+void v4l_capture::set_trace(common::trace* trace) {
+    trace_ = trace;
+}
+
+bool v4l_capture::load_probe(AVStream* stream) {
+    if(probe_cache_path_.empty()) {
+        return false;
+    }
+    std::ifstream in(probe_cache_path_.c_str());
+    std::string magic;
+    int codec_id = 0;
+    int width = 0;
+    int height = 0;
+    int format = 0;
+    AVRational time_base;
+    AVRational frame_rate;
+    if(!std::getline(in, magic) || magic != probe_magic ||
+       !(in >> codec_id >> width >> height >> format >> time_base.num >> time_base.den >> frame_rate.num >> frame_rate.den) ||
+       0 == time_base.den || 0 == frame_rate.den) {
+        return false;
+    }
+    // the device reports its current mode when it is opened, parameters
+    // probed in another mode do not apply
+    AVCodecParameters* par = stream->codecpar;
+    if(par->codec_id != codec_id || par->width != width || par->height != height) {
+        LOG(common::log::info) << "device mode changed since " << probe_cache_path_ << " was written" << common::log::end;
+        return false;
+    }
+    par->format = format;
+    stream->time_base = time_base;
+    stream->avg_frame_rate = frame_rate;
+    stream->r_frame_rate = frame_rate;
+    return true;
+}
+
+void v4l_capture::save_probe(const AVStream* stream) const {
+    if(probe_cache_path_.empty()) {
+        return;
+    }
+    const AVCodecParameters* par = stream->codecpar;
+    std::ofstream out(probe_cache_path_.c_str(), std::ios::trunc);
+    out << probe_magic << '\n'
+        << par->codec_id << ' ' << par->width << ' ' << par->height << ' ' << par->format << ' '
+        << stream->time_base.num << ' ' << stream->time_base.den << ' '
+        << stream->avg_frame_rate.num << ' ' << stream->avg_frame_rate.den << '\n';
+    out.flush();
+    if(!out) {
+        LOG(common::log::err) << "cannot write " << probe_cache_path_ << common::log::end;
+    }
+}
 
 bool v4l_capture::capture() {
 
     assert(0 != encoder_);
 
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
     if(receive_frame(frame_)) {
+        if(NULL != decode_time_) {
+            decode_time_->record_since(start);
+            frames_captured_->add();
+            count_dropped(frame_->pts);
+        }
+        if(NULL != trace_) {
+            trace_->complete("decode", common::trace::micros(start), common::trace::now(), frame_->pts);
+        }
         encoder_->on_frame(frame_);
+        if(NULL != snapshot_) {
+            snapshot_->on_frame(frame_);
+        }
         AVRational timebase = v4l_stream_->time_base;
         long frame_ts = (timebase.num*frame_->pts)/timebase.den;
         if(-1 == prev_ts_) {
@@ -109,6 +220,20 @@ bool v4l_capture::capture() {
     }
 }
 
+void v4l_capture::count_dropped(std::int64_t pts) {
+    // the driver drops frames while nobody dequeues them, which leaves a
+    // gap of more than a frame between the timestamps
+    const AVRational tb = v4l_stream_->time_base;
+    const AVRational fps = v4l_stream_->avg_frame_rate;
+    if(AV_NOPTS_VALUE != prev_pts_ && AV_NOPTS_VALUE != pts && 0 != tb.num && 0 != fps.num) {
+        const std::int64_t step = static_cast<std::int64_t>(tb.den) * fps.den / (static_cast<std::int64_t>(tb.num) * fps.num);
+        if(0 != step && pts - prev_pts_ > step + step/2) {
+            frames_dropped_->add((pts - prev_pts_ + step/2) / step - 1);
+        }
+    }
+    prev_pts_ = pts;
+}
+
 bool v4l_capture::receive_frame(AVFrame* frame) {
     while(true) {
         AVPacket* pkt = av_packet_alloc();
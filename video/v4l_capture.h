@@ -5,6 +5,7 @@ extern "C" {
 #include <libavutil/rational.h>
 }
 
+#include <string>
 #include <cstdint>
 
 struct AVFormatContext;
@@ -14,33 +15,59 @@ struct AVCodecContext;
 struct AVFrame;
 struct AVStream;
 
+namespace common {
+    class metrics;
+    class counter;
+    class histogram;
+    class trace;
+}
+
 namespace video {
 
 class h264_encoder;
+class snapshot;
 
 class v4l_capture {
 public:
-    v4l_capture(long segment_length_sec = 10);
+    // stream parameters probed from a device are kept in @arg2 so that
+    // later starts can skip the probing, an empty path always probes
+    v4l_capture(long segment_length_sec = 10, const std::string& probe_cache_dir = "");
     ~v4l_capture();
 private:
     v4l_capture(const v4l_capture&) = delete;
     void operator=(const v4l_capture&) = delete;
 public:
     void attach_sink(h264_encoder* enc);
+    // sees every captured frame, before the encoder drops any
+    void attach_snapshot(snapshot* snap);
+    // frames captured and lost, time to dequeue and decode one
+    void set_metrics(common::metrics* metrics);
+    // a span per decoded frame
+    void set_trace(common::trace* trace);
 public:
     bool capture();
     void stop_capture();
 private:
     bool receive_frame(AVFrame* frame);
+    void count_dropped(std::int64_t pts);
+    bool load_probe(AVStream* stream);
+    void save_probe(const AVStream* stream) const;
 private:
     AVFormatContext* format_context_;
     AVCodec* codec_;
     AVCodecContext* codec_ctx_;
     AVFrame* frame_;
     h264_encoder* encoder_;
+    snapshot* snapshot_;
     AVStream* v4l_stream_;
     long prev_ts_;
+    std::int64_t prev_pts_;
+    common::counter* frames_captured_;
+    common::counter* frames_dropped_;
+    common::histogram* decode_time_;
+    common::trace* trace_;
     long segment_length_sec_;
+    std::string probe_cache_path_;
 };
 
 }